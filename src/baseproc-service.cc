@@ -1,4 +1,12 @@
 #include <cstring>
+#include <cstdio>
+
+#include <sys/wait.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
 
 #include "dinit.h"
 #include "dinit-log.h"
@@ -33,7 +41,8 @@ bool base_process_service::bring_up() noexcept
         event_loop.get_time(restart_interval_time, clock_type::MONOTONIC);
         restart_interval_count = 0;
         if (start_ps_process(exec_arg_parts, onstart_flags.starts_on_console)) {
-            if (start_timeout != time_val(0,0)) {
+            // (With the vfork launch backend, a process service may already have started)
+            if (start_timeout != time_val(0,0) && get_state() == service_state_t::STARTING) {
                 restart_timer.arm_timer_rel(event_loop, start_timeout);
                 stop_timer_armed = true;
             }
@@ -53,28 +62,83 @@ bool base_process_service::start_ps_process(const std::vector<const char *> &cmd
     // success/failure from the child to the parent. The pipe is set CLOEXEC so a successful
     // exec closes the pipe, and the parent sees EOF. If the exec is unsuccessful, the errno
     // is written to the pipe, and the parent can read it.
+    //
+    // With the vfork launch backend (Linux only), we are suspended until the child has either
+    // exec'd or failed, and the child stores any error directly in our memory. So no pipe is
+    // needed, and we learn the result immediately.
 
     event_loop.get_time(last_start_time, clock_type::MONOTONIC);
 
-    int pipefd[2];
-    if (bp_sys::pipe2(pipefd, O_CLOEXEC)) {
-        log(loglevel_t::ERROR, get_name(), ": can't create status check pipe: ", strerror(errno));
-        return false;
-    }
+    bool use_vfork = false;
+#ifdef __linux__
+    use_vfork = services->get_launch_backend() == launch_backend_t::VFORK;
+#endif
 
     const char * logfile = this->logfile.c_str();
-    if (*logfile == 0) {
+    if (*logfile == 0 || log_type == log_type_id::NONE) {
         logfile = "/dev/null";
     }
 
+    if (! on_console && (log_type == log_type_id::BUFFER || writes_log_file())) {
+        if (! ensure_log_buffer()) {
+            return false;
+        }
+    }
+    else if (! on_console && log_fd == -1) {
+        // Open the log file once, and keep it open for subsequent launches. If this fails (the
+        // filesystem may not yet be writable, for instance) the child tries again by path, and
+        // reports any failure.
+        log_fd = bp_sys::open(logfile, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    }
+
+#ifdef __linux__
+    if (! services->get_cgroup_root().empty() && ! ensure_cgroup()) {
+        return false;
+    }
+#endif
+
+    run_proc_params params(cmd.data(), logfile, on_console);
+    params.log_fd = log_fd;
+    params.cgroup_fd = cgroup_fd;
+    std::vector<const char *> child_env;
+    int exec_errno = 0;
+
+    int pipefd[2] = {-1, -1};
+    if (! use_vfork && bp_sys::pipe2(pipefd, O_CLOEXEC)) {
+        log(loglevel_t::ERROR, get_name(), ": can't create status check pipe: ", strerror(errno));
+        return false;
+    }
+
     bool child_status_registered = false;
     control_conn_t *control_conn = nullptr;
 
     int control_socket[2] = {-1, -1};
+    int notify_pipe[2] = {-1, -1};
+
+    close_notification_fd(); // (left over from a previous process, if still open)
+
+    if (force_notification_fd != -1) {
+        if (bp_sys::pipe2(notify_pipe, O_CLOEXEC)) {
+            log(loglevel_t::ERROR, get_name(), ": can't create notification pipe: ", strerror(errno));
+            goto out_p;
+        }
+        int fdflags = bp_sys::fcntl(notify_pipe[0], F_GETFL);
+        bp_sys::fcntl(notify_pipe[0], F_SETFL, fdflags | O_NONBLOCK);
+        try {
+            readiness_watcher.add_watch(event_loop, notify_pipe[0], dasynq::IN_EVENTS);
+        }
+        catch (std::exception &exc) {
+            log(loglevel_t::ERROR, get_name(), ": can't watch notification pipe: ", exc.what());
+            goto out_np;
+        }
+        params.notify_fd = notify_pipe[1];
+        params.force_notify_fd = force_notification_fd;
+    }
+
     if (onstart_flags.pass_cs_fd) {
         if (dinit_socketpair(AF_UNIX, SOCK_STREAM, /* protocol */ 0, control_socket, SOCK_NONBLOCK)) {
             log(loglevel_t::ERROR, get_name(), ": can't create control socket: ", strerror(errno));
-            goto out_p;
+            goto out_np_w;
         }
 
         // Make the server side socket close-on-exec:
@@ -92,8 +156,73 @@ bool base_process_service::start_ps_process(const std::vector<const char *> &cmd
 
     // Set up complete, now fork and exec:
 
+    params.wpipefd = pipefd[1];
+    params.csfd = control_socket[1];
+
     pid_t forkpid;
 
+#ifdef __linux__
+    if (use_vfork) {
+        try {
+            if (! reserved_child_watch) {
+                child_listener.reserve_watch(event_loop);
+                reserved_child_watch = true;
+            }
+
+            // The child can't modify the environment (which it shares with us), so prepare it
+            // now, leaving space for the variables that the child adds:
+            for (char **env_var = environ; *env_var != nullptr; ++env_var) {
+                bool replaced = (socket_fd != -1 && (strncmp(*env_var, "LISTEN_FDS=", 11) == 0
+                            || strncmp(*env_var, "LISTEN_PID=", 11) == 0))
+                        || (control_socket[1] != -1 && strncmp(*env_var, "DINIT_CS_FD=", 12) == 0);
+                if (! replaced) {
+                    child_env.push_back(*env_var);
+                }
+            }
+            params.env_free = child_env.size();
+            child_env.resize(child_env.size() + 4, nullptr);  // 3 variables, and terminator
+        }
+        catch (std::exception &e) {
+            log(loglevel_t::ERROR, get_name(), ": Could not fork: ", e.what());
+            goto out_cs_h;
+        }
+
+        params.envp = child_env.data();
+        params.exec_errno = &exec_errno;
+        forkpid = vfork_child_proc(params);
+        if (forkpid == -1) {
+            log(loglevel_t::ERROR, get_name(), ": Could not fork: ", strerror(errno));
+            goto out_cs_h;
+        }
+
+        if (control_socket[1] != -1) {
+            bp_sys::close(control_socket[1]);
+        }
+        if (notify_pipe[1] != -1) {
+            bp_sys::close(notify_pipe[1]);
+            notification_fd = notify_pipe[0];
+        }
+
+        if (exec_errno != 0) {
+            // The child has already exited; reap it now. (We hold on to the watch reservation).
+            int status;
+            waitpid(forkpid, &status, 0);
+            log(loglevel_t::ERROR, get_name(), ": execution failed: ", strerror(exec_errno));
+            close_notification_fd();
+            return false;
+        }
+
+        // We specify a high priority for the child watch; see below.
+        child_listener.add_reserved(event_loop, forkpid, dasynq::DEFAULT_PRIORITY - 10);
+        pid = forkpid;
+        services->set_service_session(this, forkpid);
+
+        trace_event(trace_event_t::EXECUTED);
+        exec_succeeded();
+        return true;
+    }
+#endif
+
     try {
         child_status_listener.add_watch(event_loop, pipefd[0], dasynq::IN_EVENTS);
         child_status_registered = true;
@@ -101,7 +230,9 @@ bool base_process_service::start_ps_process(const std::vector<const char *> &cmd
         // We specify a high priority (i.e. low priority value) so that process termination is
         // handled early. This means we have always recorded that the process is terminated by the
         // time that we handle events that might otherwise cause us to signal the process, so we
-        // avoid sending a signal to an invalid (and possibly recycled) process ID.
+        // avoid sending a signal to an invalid (and possibly recycled) process ID. (When the event
+        // loop watches children via pidfds, the child isn't reaped until its watcher is notified,
+        // so this is only needed where pidfds are unavailable).
         forkpid = child_listener.fork(event_loop, reserved_child_watch, dasynq::DEFAULT_PRIORITY - 10);
         reserved_child_watch = true;
     }
@@ -111,7 +242,7 @@ bool base_process_service::start_ps_process(const std::vector<const char *> &cmd
     }
 
     if (forkpid == 0) {
-        run_child_proc(cmd.data(), logfile, on_console, pipefd[1], control_socket[1]);
+        run_child_proc(params);
     }
     else {
         // Parent process
@@ -119,7 +250,12 @@ bool base_process_service::start_ps_process(const std::vector<const char *> &cmd
         if (control_socket[1] != -1) {
             bp_sys::close(control_socket[1]);
         }
+        if (notify_pipe[1] != -1) {
+            bp_sys::close(notify_pipe[1]);
+            notification_fd = notify_pipe[0];
+        }
         pid = forkpid;
+        services->set_service_session(this, forkpid);
 
         waiting_for_execstat = true;
         return true;
@@ -140,13 +276,350 @@ bool base_process_service::start_ps_process(const std::vector<const char *> &cmd
         bp_sys::close(control_socket[1]);
     }
 
+    out_np_w:
+    if (notify_pipe[0] != -1) {
+        readiness_watcher.deregister(event_loop);
+
+        out_np:
+        bp_sys::close(notify_pipe[0]);
+        bp_sys::close(notify_pipe[1]);
+    }
+
     out_p:
-    bp_sys::close(pipefd[0]);
-    bp_sys::close(pipefd[1]);
+    if (pipefd[0] != -1) {
+        bp_sys::close(pipefd[0]);
+        bp_sys::close(pipefd[1]);
+    }
+
+    return false;
+}
+
+void base_process_service::close_notification_fd() noexcept
+{
+    if (notification_fd != -1) {
+        readiness_watcher.deregister(event_loop);
+        bp_sys::close(notification_fd);
+        notification_fd = -1;
+    }
+}
+
+bool base_process_service::ensure_log_buffer() noexcept
+{
+    if (log_output_fd != -1) {
+        return true;
+    }
+
+    try {
+        log_buffer.resize(log_buf_max);
+    }
+    catch (std::bad_alloc &exc) {
+        log(loglevel_t::ERROR, get_name(), ": can't allocate log buffer; out of memory");
+        return false;
+    }
+
+    int pipefds[2];
+    if (bp_sys::pipe2(pipefds, O_CLOEXEC)) {
+        log(loglevel_t::ERROR, get_name(), ": can't create output pipe: ", strerror(errno));
+        return false;
+    }
+    int fdflags = bp_sys::fcntl(pipefds[0], F_GETFL);
+    bp_sys::fcntl(pipefds[0], F_SETFL, fdflags | O_NONBLOCK);
+
+    try {
+        log_output_listener.add_watch(event_loop, pipefds[0], dasynq::IN_EVENTS);
+    }
+    catch (std::exception &exc) {
+        log(loglevel_t::ERROR, get_name(), ": can't watch output pipe: ", exc.what());
+        bp_sys::close(pipefds[0]);
+        bp_sys::close(pipefds[1]);
+        return false;
+    }
+
+    if (writes_log_file()) {
+        try {
+            log_job = new log_write_job(this, logfile, log_file_max_size, log_file_keep, log_buf_max);
+            log_flush_retry_timer.add_timer(event_loop);
+        }
+        catch (std::exception &exc) {
+            log(loglevel_t::ERROR, get_name(), ": can't create log writer: ", exc.what());
+            delete log_job;
+            log_job = nullptr;
+            log_output_listener.deregister(event_loop);
+            bp_sys::close(pipefds[0]);
+            bp_sys::close(pipefds[1]);
+            return false;
+        }
+    }
+
+    log_output_fd = pipefds[0];
+    log_fd = pipefds[1];
+    return true;
+}
+
+void base_process_service::flush_log_output() noexcept
+{
+    if (log_job->in_progress) {
+        return;
+    }
+
+    if (log_job->start == log_job->end) {
+        // Pass as much buffered output as the job holds to the writer (the log buffer may then
+        // accept more output while it is written).
+        int count = std::min(log_buffer.get_length(), log_job->capacity);
+        if (count == 0) {
+            return;
+        }
+        log_buffer.extract(log_job->data.get(), 0, count);
+        log_buffer.consume(count);
+        log_job->start = 0;
+        log_job->end = count;
+
+        if (log_output_paused) {
+            log_output_paused = false;
+            log_output_listener.set_enabled(event_loop, true);
+        }
+    }
+
+    if (log_file_reopen) {
+        log_job->reopen = true;
+        log_file_reopen = false;
+    }
+    queue_log_write(log_job);
+}
+
+void base_process_service::log_write_complete() noexcept
+{
+    if (log_job->rotate_failed) {
+        log(loglevel_t::WARN, get_name(), ": can't rotate log file; out of memory");
+    }
+    if (log_job->would_block) {
+        // The file can't accept output right now; try again later.
+        log_flush_retry_timer.arm_timer_rel(event_loop, time_val(0, 100000000));
+        return;
+    }
+    flush_log_output();
+}
+
+#ifdef __linux__
+
+// Write a value to a file in a cgroup directory. Returns false on failure (with errno set).
+static bool write_cgroup_file(int dirfd, const char *name, const char *value) noexcept
+{
+    int fd = bp_sys::openat(dirfd, name, O_WRONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    ssize_t len = strlen(value);
+    ssize_t r = bp_sys::write(fd, value, len);
+    int write_errno = errno;
+    bp_sys::close(fd);
+    errno = write_errno;
+    return r == len;
+}
+
+bool base_process_service::ensure_cgroup() noexcept
+{
+    if (cgroup_fd != -1) {
+        return true;
+    }
+
+    std::string path;
+    std::string events_path;
+    try {
+        path = services->get_cgroup_root() + "/" + get_name();
+        events_path = path + "/cgroup.events";
+    }
+    catch (std::bad_alloc &exc) {
+        log(loglevel_t::ERROR, get_name(), ": can't create cgroup; out of memory");
+        return false;
+    }
 
+    // The cgroup may remain from a previous instance of dinit (or the service):
+    if (bp_sys::mkdir(path.c_str(), 0755) == -1 && errno != EEXIST) {
+        log(loglevel_t::ERROR, get_name(), ": can't create cgroup ", path, ": ", strerror(errno));
+        return false;
+    }
+
+    int dirfd = bp_sys::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirfd == -1) {
+        log(loglevel_t::ERROR, get_name(), ": can't open cgroup ", path, ": ", strerror(errno));
+        return false;
+    }
+
+    // Apply resource settings. The relevant controllers must be enabled (via
+    // cgroup.subtree_control) in the parent cgroup.
+    char valbuf[32];
+    const char *failed_setting = nullptr;
+    if (cgroup_cpu_weight != 0) {
+        snprintf(valbuf, sizeof(valbuf), "%d", cgroup_cpu_weight);
+        if (! write_cgroup_file(dirfd, "cpu.weight", valbuf)) {
+            failed_setting = "cpu.weight";
+        }
+    }
+    if (failed_setting == nullptr && ! cgroup_memory_max.empty()) {
+        if (! write_cgroup_file(dirfd, "memory.max", cgroup_memory_max.c_str())) {
+            failed_setting = "memory.max";
+        }
+    }
+    if (failed_setting == nullptr && cgroup_io_weight != 0) {
+        snprintf(valbuf, sizeof(valbuf), "default %d", cgroup_io_weight);
+        if (! write_cgroup_file(dirfd, "io.weight", valbuf)) {
+            failed_setting = "io.weight";
+        }
+    }
+    if (failed_setting != nullptr) {
+        log(loglevel_t::ERROR, get_name(), ": can't set cgroup ", failed_setting, ": ", strerror(errno));
+        bp_sys::close(dirfd);
+        return false;
+    }
+
+    // Watch cgroup.events, which is modified when the cgroup becomes (un)populated:
+    int ifd = bp_sys::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (ifd == -1 || bp_sys::inotify_add_watch(ifd, events_path.c_str(), IN_MODIFY) == -1) {
+        log(loglevel_t::ERROR, get_name(), ": can't watch cgroup events: ", strerror(errno));
+        if (ifd != -1) bp_sys::close(ifd);
+        bp_sys::close(dirfd);
+        return false;
+    }
+
+    try {
+        cgroup_watcher.add_watch(event_loop, ifd, dasynq::IN_EVENTS);
+    }
+    catch (std::exception &exc) {
+        log(loglevel_t::ERROR, get_name(), ": can't watch cgroup events: ", exc.what());
+        bp_sys::close(ifd);
+        bp_sys::close(dirfd);
+        return false;
+    }
+
+    cgroup_fd = dirfd;
+    cgroup_events_fd = ifd;
+    return true;
+}
+
+bool base_process_service::cgroup_populated() noexcept
+{
+    // cgroup.events contains "populated 0" or "populated 1" (amongst other keys). If it can't be
+    // read, we assume the cgroup is empty (so that stopping the service isn't held up).
+    int fd = bp_sys::openat(cgroup_fd, "cgroup.events", O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    char buf[64];
+    ssize_t r = bp_sys::read(fd, buf, sizeof(buf) - 1);
+    bp_sys::close(fd);
+    if (r <= 0) {
+        return false;
+    }
+    buf[r] = 0;
+    return strstr(buf, "populated 1") != nullptr;
+}
+
+bool base_process_service::cgroup_kill() noexcept
+{
+    if (write_cgroup_file(cgroup_fd, "cgroup.kill", "1")) {
+        return true;
+    }
+
+    // cgroup.kill requires Linux 5.14; otherwise, signal each process listed in cgroup.procs.
+    // (A process forked meanwhile may survive, in which case the cgroup remains populated, and we
+    // try again when the stop timer expires).
+    int fd = bp_sys::openat(cgroup_fd, "cgroup.procs", O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    char buf[1024];
+    pid_t kill_pid = 0;
+    ssize_t r;
+    while ((r = bp_sys::read(fd, buf, sizeof(buf))) > 0) {
+        for (ssize_t i = 0; i < r; i++) {
+            if (buf[i] >= '0' && buf[i] <= '9') {
+                kill_pid = kill_pid * 10 + (buf[i] - '0');
+            }
+            else {
+                if (kill_pid > 0) bp_sys::kill(kill_pid, SIGKILL);
+                kill_pid = 0;
+            }
+        }
+    }
+    int read_errno = errno;
+    bp_sys::close(fd);
+    errno = read_errno;
+    return r == 0;
+}
+
+void base_process_service::cgroup_event() noexcept
+{
+    if (waiting_cgroup_empty && ! cgroup_populated()) {
+        waiting_cgroup_empty = false;
+        if (stop_timer_armed) {
+            restart_timer.stop_timer(event_loop);
+            stop_timer_armed = false;
+        }
+        // (an untracked bgprocess must also have terminated)
+        if (pid != -1) {
+            services->unwatch_orphan_pid(pid);
+            pid = -1;
+        }
+        stopped();
+        services->process_queues();
+    }
+}
+
+#else
+
+bool base_process_service::cgroup_populated() noexcept
+{
     return false;
 }
 
+bool base_process_service::cgroup_kill() noexcept
+{
+    return false;
+}
+
+void base_process_service::cgroup_event() noexcept
+{
+}
+
+#endif
+
+void base_process_service::complete_stop() noexcept
+{
+    if (cgroup_fd != -1 && cgroup_populated()) {
+        // Other processes (which may have left the process group) remain; kill them all, and
+        // finish stopping when the cgroup is empty. The kill is repeated if the stop timer
+        // expires before then.
+        waiting_cgroup_empty = true;
+        if (! cgroup_kill()) {
+            log(loglevel_t::WARN, get_name(), ": can't kill processes in cgroup: ", strerror(errno));
+        }
+        if (stop_timeout != time_val(0,0)) {
+            restart_timer.arm_timer_rel(event_loop, stop_timeout);
+            stop_timer_armed = true;
+        }
+        return;
+    }
+
+    waiting_cgroup_empty = false;
+    if (stop_timer_armed) {
+        restart_timer.stop_timer(event_loop);
+        stop_timer_armed = false;
+    }
+    stopped();
+}
+
+void base_process_service::reopen_log() noexcept
+{
+    if (writes_log_file()) {
+        // The file is re-opened (by the writer) on next write.
+        log_file_reopen = true;
+    }
+    else {
+        service_record::reopen_log();
+    }
+}
+
 void base_process_service::bring_down() noexcept
 {
     waiting_for_deps = false;
@@ -165,7 +638,19 @@ void base_process_service::bring_down() noexcept
         // If we are a BGPROCESS and the process is not our immediate child, however, that
         // won't work - check for this now:
         if (get_type() == service_type_t::BGPROCESS && ! tracking_child) {
-            stopped();
+            // If the process runs in a cgroup of its own, we can instead wait for the cgroup to
+            // become empty:
+            if (cgroup_fd != -1 && cgroup_populated()) {
+                waiting_cgroup_empty = true;
+                if (stop_timeout != time_val(0,0)) {
+                    restart_timer.arm_timer_rel(event_loop, stop_timeout);
+                    stop_timer_armed = true;
+                }
+            }
+            else {
+                services->unwatch_orphan_pid(pid);
+                stopped();
+            }
         }
         else if (stop_timeout != time_val(0,0)) {
             restart_timer.arm_timer_rel(event_loop, stop_timeout);
@@ -174,7 +659,7 @@ void base_process_service::bring_down() noexcept
     }
     else {
         // The process is already dead.
-        stopped();
+        complete_stop();
     }
 }
 
@@ -183,7 +668,8 @@ base_process_service::base_process_service(service_set *sset, string name,
         std::list<std::pair<unsigned,unsigned>> &command_offsets,
         const std::list<prelim_dep> &deplist_p)
      : service_record(sset, name, service_type_p, deplist_p), child_listener(this),
-       child_status_listener(this), restart_timer(this)
+       child_status_listener(this), restart_timer(this), readiness_watcher(this),
+       log_output_listener(this), log_flush_retry_timer(this), cgroup_watcher(this)
 {
     program_name = std::move(command);
     exec_arg_parts = separate_args(program_name, command_offsets);
@@ -203,12 +689,49 @@ base_process_service::base_process_service(service_set *sset, string name,
     tracking_child = false;
     stop_timer_armed = false;
     start_is_interruptible = false;
+    log_output_paused = false;
+    log_file_reopen = false;
+    waiting_cgroup_empty = false;
+}
+
+base_process_service::~base_process_service() noexcept
+{
+    if (pid != -1) {
+        services->unwatch_orphan_pid(pid);
+    }
+    services->clear_service_session(this);
+    if (log_output_fd != -1) {
+        log_output_listener.deregister(event_loop);
+        bp_sys::close(log_output_fd);
+        if (writes_log_file()) {
+            log_flush_retry_timer.deregister(event_loop);
+        }
+    }
+    if (log_job != nullptr) {
+        release_log_write_job(log_job);
+    }
+#ifdef __linux__
+    if (cgroup_fd != -1) {
+        cgroup_watcher.deregister(event_loop);
+        bp_sys::close(cgroup_events_fd);
+        bp_sys::close(cgroup_fd);
+        // Remove the cgroup (this fails harmlessly if any process remains in it):
+        try {
+            std::string path = services->get_cgroup_root() + "/" + get_name();
+            bp_sys::rmdir(path.c_str());
+        }
+        catch (std::bad_alloc &exc) {
+            // leave it
+        }
+    }
+#endif
 }
 
 void base_process_service::do_restart() noexcept
 {
     waiting_restart_timer = false;
     restart_interval_count++;
+    total_restarts++;
     auto service_state = get_state();
 
     // We may be STARTING (regular restart) or STARTED ("smooth recovery"). This affects whether
@@ -304,10 +827,24 @@ void base_process_service::kill_with_fire() noexcept
         log(loglevel_t::WARN, "Service ", get_name(), " with pid ", pid, " exceeded allowed stop time; killing.");
         kill_pg(SIGKILL);
     }
+    else if (waiting_cgroup_empty) {
+        log(loglevel_t::WARN, "Service ", get_name(), " processes remaining in cgroup after stop time; killing.");
+        cgroup_kill();
+    }
+
+    if (waiting_cgroup_empty && stop_timeout != time_val(0,0)) {
+        restart_timer.arm_timer_rel(event_loop, stop_timeout);
+        stop_timer_armed = true;
+    }
 }
 
 void base_process_service::kill_pg(int signo) noexcept
 {
+    if (signo == SIGKILL && cgroup_fd != -1 && cgroup_kill()) {
+        // Killed the whole cgroup, including any processes which have left the process group.
+        return;
+    }
+
     pid_t pgid = getpgid(pid);
     if (pgid == -1) {
         // only should happen if pid is invalid, which should never happen...
@@ -1,11 +1,68 @@
 #include "control.h"
 #include "service.h"
+#include "ring-buffer.h"
 
 namespace {
     constexpr auto OUT_EVENTS = dasynq::OUT_EVENTS;
     constexpr auto IN_EVENTS = dasynq::IN_EVENTS;
 }
 
+// The service event bus: delivers events for all services to subscribed control connections.
+// Each event is serialised once, into an event_packet shared by all subscribers. The bus only
+// listens for events while there are subscribers.
+class service_event_bus : private service_listener
+{
+    dlist<control_conn_t, control_conn_t::extract_subscriber_node> subscribers;
+    service_set *services = nullptr;
+
+    void service_event(service_record *service, service_event_t event) noexcept override
+    {
+        event_packet *ep = new (std::nothrow) event_packet();
+        if (ep != nullptr) {
+            const std::string &name = service->get_name();
+            int name_len = std::min((size_t)250, name.length());
+            ep->refcount = 1;
+            ep->service = service;
+            ep->len = 5 + name_len;
+            ep->data[0] = DINIT_IP_SUBSCRIBEDEVENT;
+            ep->data[1] = ep->len;
+            ep->data[2] = static_cast<char>(event);
+            ep->data[3] = static_cast<char>(service->get_state());
+            ep->data[4] = static_cast<char>(service->get_target_state());
+            std::memcpy(ep->data + 5, name.data(), name_len);
+        }
+
+        for (control_conn_t *conn = subscribers.head(); conn != nullptr; conn = subscribers.next(conn)) {
+            conn->subscribed_event(service, ep);
+        }
+
+        if (ep != nullptr) {
+            ep->release();
+        }
+    }
+
+    public:
+    // Add a subscriber (not already subscribed). May throw std::bad_alloc.
+    void subscribe(control_conn_t *conn, service_set *services_p)
+    {
+        if (subscribers.is_empty()) {
+            services_p->add_event_listener(this);
+            services = services_p;
+        }
+        subscribers.append(conn);
+    }
+
+    void unsubscribe(control_conn_t *conn) noexcept
+    {
+        subscribers.unlink(conn);
+        if (subscribers.is_empty()) {
+            services->remove_event_listener(this);
+        }
+    }
+};
+
+static service_event_bus event_bus;
+
 bool control_conn_t::process_packet()
 {
     using std::string;
@@ -54,6 +111,43 @@ bool control_conn_t::process_packet()
     if (pktType == DINIT_CP_LISTSERVICES) {
         return list_services();
     }
+    if (pktType == DINIT_CP_QUERYTRACE) {
+        return list_trace();
+    }
+    if (pktType == DINIT_CP_CRITICALCHAIN) {
+        return process_critical_chain();
+    }
+    if (pktType == DINIT_CP_REOPENLOGS) {
+        services->reopen_logs();
+        char ackBuf[] = { DINIT_RP_ACK };
+        if (! queue_packet(ackBuf, 1)) return false;
+        rbuf.consume(1);
+        return true;
+    }
+    if (pktType == DINIT_CP_CATLOG) {
+        return process_catlog();
+    }
+    if (pktType == DINIT_CP_CLOSEHANDLE) {
+        return process_close_handle();
+    }
+    if (pktType == DINIT_CP_BATCH) {
+        return process_batch();
+    }
+    if (pktType == DINIT_CP_SERVICESTATUS) {
+        return process_service_status();
+    }
+    if (pktType == DINIT_CP_LISTSTATUS) {
+        return list_service_status();
+    }
+    if (pktType == DINIT_CP_BUFFERSTATS) {
+        return process_buffer_stats();
+    }
+    if (pktType == DINIT_CP_SUBSCRIBE) {
+        return process_subscribe();
+    }
+    if (pktType == DINIT_CP_UNSUBSCRIBE) {
+        return process_unsubscribe();
+    }
     else {
         // Unrecognized: give error response
         char outbuf[] = { DINIT_RP_BADREQ };
@@ -163,43 +257,18 @@ bool control_conn_t::process_start_stop(int pktType)
         return true;
     }
     else {
-        bool already_there = false;
-        
-        switch (pktType) {
-        case DINIT_CP_STARTSERVICE:
-            // start service, mark as required
-            if (do_pin) service->pin_start();
-            service->start();
-            services->process_queues();
-            already_there = service->get_state() == service_state_t::STARTED;
-            break;
-        case DINIT_CP_STOPSERVICE:
-            // force service to stop
-            if (do_pin) service->pin_stop();
-            service->stop(true);
-            service->forced_stop();
-            services->process_queues();
-            already_there = service->get_state() == service_state_t::STOPPED;
-            break;
-        case DINIT_CP_WAKESERVICE:
-            // re-start a stopped service (do not mark as required)
-            if (do_pin) service->pin_start();
-            service->start(false);
-            services->process_queues();
-            already_there = service->get_state() == service_state_t::STARTED;
-            break;
-        case DINIT_CP_RELEASESERVICE:
-            // remove required mark, stop if not required by dependents
-            if (do_pin) service->pin_stop();
-            service->stop(false);
-            services->process_queues();
-            already_there = service->get_state() == service_state_t::STOPPED;
-            break;
-        }
+        // Reply before acting on the request, so that the reply precedes any service events
+        // that result (a service may start, or fail to start, immediately).
+        bool do_start = (pktType == DINIT_CP_STARTSERVICE || pktType == DINIT_CP_WAKESERVICE);
+        service_state_t wanted_state = do_start ? service_state_t::STARTED : service_state_t::STOPPED;
+        bool already_there = service->get_state() == wanted_state;
         
         char ack_buf[] = { (char)(already_there ? DINIT_RP_ALREADYSS : DINIT_RP_ACK) };
         
         if (! queue_packet(ack_buf, 1)) return false;
+        
+        issue_start_stop(service, pktType, do_pin);
+        services->process_queues();
     }
     
     // Clear the packet from the buffer
@@ -208,6 +277,194 @@ bool control_conn_t::process_start_stop(int pktType)
     return true;
 }
 
+void control_conn_t::issue_start_stop(service_record *service, int op, bool do_pin)
+{
+    switch (op) {
+    case DINIT_CP_STARTSERVICE:
+        // start service, mark as required
+        if (do_pin) service->pin_start();
+        service->start();
+        break;
+    case DINIT_CP_STOPSERVICE:
+        // force service to stop
+        if (do_pin) service->pin_stop();
+        service->stop(true);
+        service->forced_stop();
+        break;
+    case DINIT_CP_WAKESERVICE:
+        // re-start a stopped service (do not mark as required)
+        if (do_pin) service->pin_start();
+        service->start(false);
+        break;
+    case DINIT_CP_RELEASESERVICE:
+        // remove required mark, stop if not required by dependents
+        if (do_pin) service->pin_stop();
+        service->stop(false);
+        break;
+    }
+}
+
+bool control_conn_t::process_batch()
+{
+    using std::string;
+
+    constexpr int hdr_size = 3;
+
+    if (rbuf.get_length() < hdr_size) {
+        chklen = hdr_size;
+        return true;
+    }
+
+    // 1 byte: packet type
+    // 2 bytes: packet length (including type and length)
+    // Entries, each:
+    //   1 byte: operation (DINIT_CP_STARTSERVICE etc, or DINIT_CP_LOADSERVICE)
+    //   1 byte: flags (DINIT_BATCH_PIN, DINIT_BATCH_BYNAME)
+    //   4 bytes: service handle, or (with DINIT_BATCH_BYNAME) 2 bytes name length and name
+
+    uint16_t pkt_len;
+    rbuf.extract((char *) &pkt_len, 1, 2);
+    chklen = pkt_len;
+    if (pkt_len <= hdr_size || pkt_len > 1024) {
+        char badreqRep[] = { DINIT_RP_BADREQ };
+        if (! queue_packet(badreqRep, 1)) return false;
+        bad_conn_close = true;
+        iob.set_watches(OUT_EVENTS);
+        return true;
+    }
+
+    if (rbuf.get_length() < chklen) {
+        // packet not complete yet; read more
+        return true;
+    }
+
+    struct batch_entry {
+        int op;
+        bool do_pin;
+        service_record *service;
+        handle_t handle;
+        char result;
+    };
+    std::vector<batch_entry> entries;
+
+    // First, check that the request is well-formed, and find or load each service. The reply
+    // is queued before any operation is issued, so that it precedes any resulting service events.
+    int pos = hdr_size;
+    bool bad_req = false;
+    while (pos < pkt_len) {
+        if (pkt_len - pos < 2) {
+            bad_req = true;
+            break;
+        }
+        batch_entry entry;
+        entry.op = rbuf[pos];
+        int flags = rbuf[pos + 1];
+        entry.do_pin = (flags & DINIT_BATCH_PIN) != 0;
+        entry.service = nullptr;
+        entry.handle = 0;
+        entry.result = DINIT_RP_ACK;
+        pos += 2;
+
+        if (entry.op != DINIT_CP_STARTSERVICE && entry.op != DINIT_CP_STOPSERVICE
+                && entry.op != DINIT_CP_WAKESERVICE && entry.op != DINIT_CP_RELEASESERVICE
+                && entry.op != DINIT_CP_LOADSERVICE) {
+            bad_req = true;
+            break;
+        }
+
+        if (flags & DINIT_BATCH_BYNAME) {
+            uint16_t name_len;
+            if (pkt_len - pos < 2) {
+                bad_req = true;
+                break;
+            }
+            rbuf.extract((char *) &name_len, pos, 2);
+            pos += 2;
+            if (name_len == 0 || pkt_len - pos < name_len) {
+                bad_req = true;
+                break;
+            }
+            string service_name = rbuf.extract_string(pos, name_len);
+            pos += name_len;
+            try {
+                entry.service = services->load_service(service_name.c_str());
+            }
+            catch (service_load_exc &slexc) {
+                log(loglevel_t::ERROR, "Could not load service ", slexc.serviceName, ": ", slexc.excDescription);
+            }
+            if (entry.service != nullptr) {
+                entry.handle = allocate_service_handle(entry.service);
+            }
+        }
+        else {
+            if (pkt_len - pos < (int) sizeof(handle_t)) {
+                bad_req = true;
+                break;
+            }
+            rbuf.extract((char *) &entry.handle, pos, sizeof(handle_t));
+            pos += sizeof(handle_t);
+            entry.service = find_service_for_key(entry.handle);
+            if (entry.service == nullptr) {
+                bad_req = true;
+                break;
+            }
+        }
+
+        if (entry.service == nullptr) {
+            entry.result = DINIT_RP_NOSERVICE;
+        }
+        else if (entry.op != DINIT_CP_LOADSERVICE) {
+            bool do_start = (entry.op == DINIT_CP_STARTSERVICE || entry.op == DINIT_CP_WAKESERVICE);
+            service_state_t wanted_state = do_start ? service_state_t::STARTED : service_state_t::STOPPED;
+            if (entry.service->get_state() == wanted_state) {
+                entry.result = DINIT_RP_ALREADYSS;
+            }
+        }
+
+        entries.push_back(entry);
+    }
+
+    if (bad_req) {
+        char badreqRep[] = { DINIT_RP_BADREQ };
+        if (! queue_packet(badreqRep, 1)) return false;
+        bad_conn_close = true;
+        iob.set_watches(OUT_EVENTS);
+        return true;
+    }
+
+    // Reply:
+    // 1 byte: DINIT_RP_BATCHREPLY
+    // 2 bytes: number of entries
+    // Per entry: 1 byte result, 4 bytes service handle, 1 byte service state
+    constexpr int entry_size = 2 + sizeof(handle_t);
+    uint16_t num_entries = entries.size();
+    std::vector<char> reply(3 + entry_size * num_entries);
+    reply[0] = DINIT_RP_BATCHREPLY;
+    std::memcpy(reply.data() + 1, &num_entries, 2);
+    char *rp = reply.data() + 3;
+    for (auto &entry : entries) {
+        rp[0] = entry.result;
+        std::memcpy(rp + 1, &entry.handle, sizeof(handle_t));
+        rp[1 + sizeof(handle_t)] = static_cast<char>(entry.service != nullptr
+                ? entry.service->get_state() : service_state_t::STOPPED);
+        rp += entry_size;
+    }
+    if (! queue_packet(std::move(reply))) return false;
+
+    // Issue all the operations, then process the resulting queued actions together:
+    for (auto &entry : entries) {
+        if (entry.service != nullptr) {
+            issue_start_stop(entry.service, entry.op, entry.do_pin);
+        }
+    }
+    services->process_queues();
+
+    // Clear the packet from the buffer
+    rbuf.consume(chklen);
+    chklen = 0;
+    return true;
+}
+
 bool control_conn_t::process_unpin_service()
 {
     using std::string;
@@ -247,6 +504,380 @@ bool control_conn_t::process_unpin_service()
     return true;
 }
 
+bool control_conn_t::process_close_handle()
+{
+    constexpr int pkt_size = 1 + sizeof(handle_t);
+
+    if (rbuf.get_length() < pkt_size) {
+        chklen = pkt_size;
+        return true;
+    }
+
+    // 1 byte: packet type
+    // 4 bytes: service handle
+
+    handle_t handle;
+    rbuf.extract((char *) &handle, 1, sizeof(handle));
+
+    if (find_service_for_key(handle) == nullptr) {
+        // Service handle is bad
+        char badreqRep[] = { DINIT_RP_BADREQ };
+        if (! queue_packet(badreqRep, 1)) return false;
+        bad_conn_close = true;
+        iob.set_watches(OUT_EVENTS);
+        return true;
+    }
+
+    release_service_handle(handle);
+    char ack_buf[] = { (char) DINIT_RP_ACK };
+    if (! queue_packet(ack_buf, 1)) return false;
+
+    // Clear the packet from the buffer
+    rbuf.consume(pkt_size);
+    chklen = 0;
+    return true;
+}
+
+bool control_conn_t::process_buffer_stats()
+{
+    rbuf.consume(1); // clear request packet
+    chklen = 0;
+
+    const chunk_buffer_stats &stats = chunk_buffer::get_stats();
+    uint32_t chunk_size = chunk_buffer::chunk_data_size;
+    uint64_t counts[4] = { stats.allocated, stats.free, stats.new_chunks, stats.reused };
+
+    const service_arena_stats &astats = services->get_arena().get_stats();
+    uint32_t slab_size = service_arena::slab_size;
+    uint64_t arena_counts[4] = { astats.slabs, astats.in_use, astats.free, astats.large };
+
+    char pkt[1 + sizeof(chunk_size) + sizeof(counts) + sizeof(slab_size) + sizeof(arena_counts)];
+    char *pktp = pkt;
+    *pktp++ = DINIT_RP_BUFFERSTATS;
+    std::memcpy(pktp, &chunk_size, sizeof(chunk_size));
+    pktp += sizeof(chunk_size);
+    std::memcpy(pktp, counts, sizeof(counts));
+    pktp += sizeof(counts);
+    std::memcpy(pktp, &slab_size, sizeof(slab_size));
+    pktp += sizeof(slab_size);
+    std::memcpy(pktp, arena_counts, sizeof(arena_counts));
+    return queue_packet(pkt, sizeof(pkt));
+}
+
+bool control_conn_t::queue_service_status(service_record *service) noexcept
+{
+    constexpr int hdr_size = 5 + 6 * sizeof(int32_t) + 2 * sizeof(int64_t);
+
+    const std::string &name = service->get_name();
+    int name_len = std::min((size_t)255, name.length());
+
+    int exit_status;
+    bool have_exit_status = service->get_exit_status(exit_status);
+
+    int32_t pid = service->get_pid();
+    uint32_t restart_interval_count = service->get_restart_interval_count();
+    uint32_t total_restarts = service->get_total_restarts();
+    uint32_t orphan_count = service->get_orphan_count();
+    uint32_t console_position = services->get_console_queue_position(service);
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t launch_time = service->get_last_launch_time();
+    int64_t since_launch = (launch_time != 0) ? (timespec_to_ns(now) - launch_time) : 0;
+
+    int64_t start_latency = 0;
+    if (service->get_start_end_time() != 0) {
+        start_latency = service->get_start_end_time() - service->get_start_begin_time();
+    }
+
+    char pkt[hdr_size + 255];
+    pkt[0] = DINIT_RP_SERVICESTATUS;
+    pkt[1] = static_cast<char>(service->get_state());
+    pkt[2] = static_cast<char>(service->get_target_state());
+    pkt[3] = have_exit_status ? DINIT_SSTATUS_HAS_EXIT_STATUS : 0;
+    pkt[4] = name_len;
+
+    char *p = pkt + 5;
+    auto put = [&p](const void *val, size_t size) {
+        std::memcpy(p, val, size);
+        p += size;
+    };
+    int32_t exit_status32 = have_exit_status ? exit_status : 0;
+    put(&pid, sizeof(pid));
+    put(&exit_status32, sizeof(exit_status32));
+    put(&restart_interval_count, sizeof(restart_interval_count));
+    put(&total_restarts, sizeof(total_restarts));
+    put(&orphan_count, sizeof(orphan_count));
+    put(&console_position, sizeof(console_position));
+    put(&since_launch, sizeof(since_launch));
+    put(&start_latency, sizeof(start_latency));
+    put(name.data(), name_len);
+
+    return queue_packet(pkt, hdr_size + name_len);
+}
+
+bool control_conn_t::process_service_status()
+{
+    constexpr int pkt_size = 1 + sizeof(handle_t);
+
+    if (rbuf.get_length() < pkt_size) {
+        chklen = pkt_size;
+        return true;
+    }
+
+    // 1 byte: packet type
+    // 4 bytes: service handle
+
+    handle_t handle;
+    rbuf.extract((char *) &handle, 1, sizeof(handle));
+
+    service_record *service = find_service_for_key(handle);
+    if (service == nullptr) {
+        // Service handle is bad
+        char badreqRep[] = { DINIT_RP_BADREQ };
+        if (! queue_packet(badreqRep, 1)) return false;
+        bad_conn_close = true;
+        iob.set_watches(OUT_EVENTS);
+        return true;
+    }
+
+    if (! queue_service_status(service)) return false;
+
+    // Clear the packet from the buffer
+    rbuf.consume(pkt_size);
+    chklen = 0;
+    return true;
+}
+
+bool control_conn_t::list_service_status()
+{
+    rbuf.consume(1); // clear request packet
+    chklen = 0;
+
+    try {
+        auto slist = services->list_services();
+        for (auto sptr : slist) {
+            if (! queue_service_status(sptr)) return false;
+        }
+
+        char ack_buf[] = { (char) DINIT_RP_LISTDONE };
+        return queue_packet(ack_buf, 1);
+    }
+    catch (std::bad_alloc &exc)
+    {
+        do_oom_close();
+        return true;
+    }
+}
+
+bool control_conn_t::process_subscribe()
+{
+    constexpr int hdr_size = 5;
+
+    if (rbuf.get_length() < hdr_size) {
+        chklen = hdr_size;
+        return true;
+    }
+
+    // 1 byte: packet type
+    // 1 byte: flags
+    // 1 byte: service type
+    // 2 bytes: name prefix length
+    // N bytes: name prefix
+
+    uint16_t prefix_len;
+    rbuf.extract((char *) &prefix_len, 3, 2);
+    chklen = hdr_size + prefix_len;
+    if (chklen > 1024) {
+        char badreqRep[] = { DINIT_RP_BADREQ };
+        if (! queue_packet(badreqRep, 1)) return false;
+        bad_conn_close = true;
+        iob.set_watches(OUT_EVENTS);
+        return true;
+    }
+
+    if (rbuf.get_length() < chklen) {
+        // packet not complete yet; read more
+        return true;
+    }
+
+    if (! subscribed) {
+        event_bus.subscribe(this, services);
+        subscribed = true;
+    }
+    subscribe_flags = rbuf[1];
+    subscribe_type = static_cast<service_type_t>(rbuf[2]);
+    subscribe_prefix = rbuf.extract_string(hdr_size, prefix_len);
+
+    char ack_buf[] = { (char) DINIT_RP_ACK };
+    if (! queue_packet(ack_buf, 1)) return false;
+
+    // Clear the packet from the buffer
+    rbuf.consume(chklen);
+    chklen = 0;
+    return true;
+}
+
+bool control_conn_t::process_unsubscribe()
+{
+    end_subscription();
+
+    char ack_buf[] = { (char) DINIT_RP_ACK };
+    if (! queue_packet(ack_buf, 1)) return false;
+
+    rbuf.consume(1);
+    return true;
+}
+
+bool control_conn_t::subscription_matches(service_record *service) noexcept
+{
+    if ((subscribe_flags & DINIT_SUBSCRIBE_TYPE) && service->get_type() != subscribe_type) {
+        return false;
+    }
+    if ((subscribe_flags & DINIT_SUBSCRIBE_PREFIX)
+            && service->get_name().compare(0, subscribe_prefix.length(), subscribe_prefix) != 0) {
+        return false;
+    }
+    return true;
+}
+
+void control_conn_t::subscribed_event(service_record *service, event_packet *ep) noexcept
+{
+    if (! subscription_matches(service)) return;
+
+    if (! coalescing_events && ep != nullptr) {
+        if (pending_events.empty() && outbuf.get_length() < max_event_outbuf) {
+            queue_packet(ep->data, ep->len);
+            return;
+        }
+        if (pending_events.size() < max_pending_events) {
+            try {
+                pending_events.push_back(ep);
+                ep->refcount++;
+                return;
+            }
+            catch (std::bad_alloc &exc) {
+                // coalesce, below
+            }
+        }
+    }
+
+    // The subscriber is not keeping up (or we are out of memory): coalesce held events.
+    try {
+        for (event_packet *pep : pending_events) {
+            changed_services.insert(pep->service);
+        }
+        changed_services.insert(service);
+    }
+    catch (std::bad_alloc &exc) {
+        do_oom_close();
+    }
+    for (event_packet *pep : pending_events) {
+        pep->release();
+    }
+    pending_events.clear();
+    coalescing_events = true;
+    iob.set_watches((bad_conn_close ? 0 : IN_EVENTS) | OUT_EVENTS);
+}
+
+void control_conn_t::drain_events() noexcept
+{
+    bool was_deferred = defer_flush;
+    defer_flush = true;
+
+    while (! pending_events.empty() && outbuf.get_length() < max_event_outbuf) {
+        event_packet *ep = pending_events.front();
+        pending_events.pop_front();
+        queue_packet(ep->data, ep->len);
+        ep->release();
+    }
+
+    if (coalescing_events && pending_events.empty() && outbuf.get_length() < max_event_outbuf) {
+        for (service_record *service : changed_services) {
+            const std::string &name = service->get_name();
+            int name_len = std::min((size_t)250, name.length());
+            char pkt[4 + 250];
+            pkt[0] = DINIT_IP_SERVICECHANGED;
+            pkt[1] = 4 + name_len;
+            pkt[2] = static_cast<char>(service->get_state());
+            pkt[3] = static_cast<char>(service->get_target_state());
+            std::memcpy(pkt + 4, name.data(), name_len);
+            queue_packet(pkt, 4 + name_len);
+        }
+        changed_services.clear();
+        coalescing_events = false;
+    }
+
+    defer_flush = was_deferred;
+}
+
+void control_conn_t::end_subscription() noexcept
+{
+    if (subscribed) {
+        event_bus.unsubscribe(this);
+        subscribed = false;
+    }
+    for (event_packet *ep : pending_events) {
+        ep->release();
+    }
+    pending_events.clear();
+    changed_services.clear();
+    coalescing_events = false;
+}
+
+bool control_conn_t::process_catlog()
+{
+    constexpr int pkt_size = 2 + sizeof(handle_t);
+
+    if (rbuf.get_length() < pkt_size) {
+        chklen = pkt_size;
+        return true;
+    }
+
+    // 1 byte: packet type
+    // 1 byte: flags
+    // 4 bytes: service handle
+
+    int flags = rbuf[1];
+    handle_t handle;
+    rbuf.extract((char *) &handle, 2, sizeof(handle));
+
+    service_record *service = find_service_for_key(handle);
+    if (service == nullptr) {
+        // Service handle is bad
+        char badreqRep[] = { DINIT_RP_BADREQ };
+        if (! queue_packet(badreqRep, 1)) return false;
+        bad_conn_close = true;
+        iob.set_watches(OUT_EVENTS);
+        return true;
+    }
+
+    ring_buffer *log_buf = service->get_log_buffer();
+    if (log_buf == nullptr) {
+        // Service output is not captured
+        char nakRep[] = { DINIT_RP_NAK };
+        if (! queue_packet(nakRep, 1)) return false;
+    }
+    else {
+        // Reply: DINIT_RP_SERVICE_LOG, (1 byte) flags, (4 byte) length, output
+        uint32_t length = log_buf->get_length();
+        std::vector<char> pkt(6 + length);
+        pkt[0] = DINIT_RP_SERVICE_LOG;
+        pkt[1] = 0;
+        memcpy(pkt.data() + 2, &length, sizeof(length));
+        log_buf->extract(pkt.data() + 6, 0, length);
+        if (flags & DINIT_CATLOG_CLEAR) {
+            log_buf->clear();
+        }
+        if (! queue_packet(std::move(pkt))) return false;
+    }
+
+    // Clear the packet from the buffer
+    rbuf.consume(pkt_size);
+    chklen = 0;
+    return true;
+}
+
 bool control_conn_t::list_services()
 {
     rbuf.consume(1); // clear request packet
@@ -255,11 +886,10 @@ bool control_conn_t::list_services()
     try {
         auto slist = services->list_services();
         for (auto sptr : slist) {
-            std::vector<char> pkt_buf;
+            char pkt_buf[8 + 255];
             
             const std::string &name = sptr->get_name();
-            int nameLen = std::min((size_t)256, name.length());
-            pkt_buf.resize(8 + nameLen);
+            int nameLen = std::min((size_t)255, name.length());
             
             pkt_buf[0] = DINIT_RP_SVCINFO;
             pkt_buf[1] = nameLen;
@@ -275,7 +905,7 @@ bool control_conn_t::list_services()
                 pkt_buf[8+i] = name[i];
             }
             
-            if (! queue_packet(std::move(pkt_buf))) return false;
+            if (! queue_packet(pkt_buf, 8 + nameLen)) return false;
         }
         
         char ack_buf[] = { (char) DINIT_RP_LISTDONE };
@@ -290,134 +920,212 @@ bool control_conn_t::list_services()
     }
 }
 
-control_conn_t::handle_t control_conn_t::allocate_service_handle(service_record *record)
+bool control_conn_t::list_trace()
 {
-    bool is_unique = true;
-    handle_t largest_seen = 0;
-    handle_t candidate = 0;
-    for (auto p : keyServiceMap) {
-        if (p.first > largest_seen) largest_seen = p.first;
-        if (p.first == candidate) {
-            if (largest_seen == std::numeric_limits<handle_t>::max()) throw std::bad_alloc();
-            candidate = largest_seen + 1;
+    rbuf.consume(1); // clear request packet
+    chklen = 0;
+
+    try {
+        service_trace &trace = services->get_trace();
+        unsigned count = trace.size();
+        for (unsigned i = 0; i < count; i++) {
+            const trace_entry &entry = trace[i];
+            const std::string &name = entry.service->get_name();
+            uint16_t name_len = std::min((size_t)256, name.length());
+            uint16_t dep_name_len = 0;
+            if (entry.dependency != nullptr) {
+                dep_name_len = std::min((size_t)256, entry.dependency->get_name().length());
+            }
+            int64_t secs = entry.time.tv_sec;
+            uint32_t nsecs = entry.time.tv_nsec;
+
+            constexpr int hdr_size = 18;
+            std::vector<char> pkt_buf(hdr_size + name_len + dep_name_len);
+            pkt_buf[0] = DINIT_RP_TRACEREC;
+            pkt_buf[1] = static_cast<char>(entry.event);
+            std::memcpy(pkt_buf.data() + 2, &name_len, sizeof(name_len));
+            std::memcpy(pkt_buf.data() + 4, &dep_name_len, sizeof(dep_name_len));
+            std::memcpy(pkt_buf.data() + 6, &secs, sizeof(secs));
+            std::memcpy(pkt_buf.data() + 14, &nsecs, sizeof(nsecs));
+            std::memcpy(pkt_buf.data() + hdr_size, name.data(), name_len);
+            if (dep_name_len != 0) {
+                std::memcpy(pkt_buf.data() + hdr_size + name_len, entry.dependency->get_name().data(),
+                        dep_name_len);
+            }
+
+            if (! queue_packet(std::move(pkt_buf))) return false;
         }
-        is_unique &= (p.second != record);
+
+        char ack_buf[] = { (char) DINIT_RP_TRACEDONE };
+        if (! queue_packet(ack_buf, 1)) return false;
+
+        return true;
     }
-    
-    keyServiceMap[candidate] = record;
-    serviceKeyMap.insert(std::make_pair(record, candidate));
-    
-    if (is_unique) {
-        record->addListener(this);
+    catch (std::bad_alloc &exc)
+    {
+        do_oom_close();
+        return true;
     }
-    
-    return candidate;
 }
 
-bool control_conn_t::queue_packet(const char *pkt, unsigned size) noexcept
+bool control_conn_t::process_critical_chain()
 {
-    int in_flag = bad_conn_close ? 0 : IN_EVENTS;
-    bool was_empty = outbuf.empty();
-
-    // If the queue is empty, we can try to write the packet out now rather than queueing it.
-    // If the write is unsuccessful or partial, we queue the remainder.
-    if (was_empty) {
-        int wr = write(iob.get_watched_fd(), pkt, size);
-        if (wr == -1) {
-            if (errno == EPIPE) {
-                return false;
-            }
-            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
-                log(loglevel_t::WARN, "Error writing to control connection: ", strerror(errno));
-                return false;
-            }
-            // EAGAIN etc: fall through to below
-        }
-        else {
-            if ((unsigned)wr == size) {
-                // Ok, all written.
-                iob.set_watches(in_flag);
-                return true;
-            }
-            pkt += wr;
-            size -= wr;
-        }
-    }
-    
-    // Create a vector out of the (remaining part of the) packet:
-    try {
-        outbuf.emplace_back(pkt, pkt + size);
-        iob.set_watches(in_flag | OUT_EVENTS);
+    using std::string;
+
+    constexpr int pkt_size = 3;
+
+    if (rbuf.get_length() < pkt_size) {
+        chklen = pkt_size;
         return true;
     }
-    catch (std::bad_alloc &baexc) {
-        // Mark the connection bad, and stop reading further requests
+
+    uint16_t svcSize;
+    rbuf.extract((char *)&svcSize, 1, 2);
+    chklen = svcSize + 3; // packet type + (2 byte) length + service name
+    if (svcSize <= 0 || chklen > 1024) {
+        // Queue error response / mark connection bad
+        char badreqRep[] = { DINIT_RP_BADREQ };
+        if (! queue_packet(badreqRep, 1)) return false;
         bad_conn_close = true;
-        oom_close = true;
-        if (was_empty) {
-            // We can't send out-of-memory response as we already wrote as much as we
-            // could above. Neither can we later send the response since we have currently
-            // sent an incomplete packet. All we can do is close the connection.
-            return false;
-        }
-        else {
-            iob.set_watches(OUT_EVENTS);
-            return true;
+        iob.set_watches(OUT_EVENTS);
+        return true;
+    }
+
+    if (rbuf.get_length() < chklen) {
+        // packet not complete yet; read more
+        return true;
+    }
+
+    string serviceName = rbuf.extract_string(3, svcSize);
+    rbuf.consume(chklen);
+    chklen = 0;
+
+    service_record *record = services->find_service(serviceName);
+    if (record == nullptr) {
+        char nosvcRep[] = { DINIT_RP_NOSERVICE };
+        return queue_packet(nosvcRep, 1);
+    }
+
+    // Send the chain, from the requested service down through the dependencies that gated the
+    // start of each. (The dependency graph is acyclic, so the chain must end).
+    constexpr int hdr_size = 28;
+    while (record != nullptr) {
+        const string &name = record->get_name();
+        uint16_t name_len = std::min((size_t)256, name.length());
+        int64_t times[3] = { record->get_start_begin_time(), record->get_start_deps_time(),
+                record->get_start_end_time() };
+
+        std::vector<char> pkt_buf(hdr_size + name_len);
+        pkt_buf[0] = DINIT_RP_CHAINLINK;
+        pkt_buf[1] = static_cast<char>(record->get_type());
+        std::memcpy(pkt_buf.data() + 2, &name_len, sizeof(name_len));
+        std::memcpy(pkt_buf.data() + 4, times, sizeof(times));
+        std::memcpy(pkt_buf.data() + hdr_size, name.data(), name_len);
+        if (! queue_packet(std::move(pkt_buf))) return false;
+
+        record = record->get_critical_dependency();
+    }
+
+    // Total start time by service type:
+    constexpr int num_types = static_cast<int>(service_type_t::INTERNAL) + 1;
+    uint32_t counts[num_types] = { 0 };
+    int64_t totals[num_types] = { 0 };
+    for (auto sptr : services->list_services()) {
+        if (sptr->get_start_deps_time() != 0 && sptr->get_start_end_time() != 0) {
+            int type = static_cast<int>(sptr->get_type());
+            counts[type]++;
+            totals[type] += sptr->get_start_end_time() - sptr->get_start_deps_time();
         }
     }
+
+    for (int type = 0; type < num_types; type++) {
+        if (counts[type] == 0) continue;
+        char blame_buf[2 + sizeof(uint32_t) + sizeof(int64_t)];
+        blame_buf[0] = DINIT_RP_BLAME;
+        blame_buf[1] = static_cast<char>(type);
+        std::memcpy(blame_buf + 2, &counts[type], sizeof(uint32_t));
+        std::memcpy(blame_buf + 2 + sizeof(uint32_t), &totals[type], sizeof(int64_t));
+        if (! queue_packet(blame_buf, sizeof(blame_buf))) return false;
+    }
+
+    char done_buf[] = { (char) DINIT_RP_LISTDONE };
+    return queue_packet(done_buf, 1);
 }
 
-// This queue_packet method is frustratingly similar to the one above, but the subtle differences
-// make them extraordinary difficult to combine into a single method.
-bool control_conn_t::queue_packet(std::vector<char> &&pkt) noexcept
+control_conn_t::handle_t control_conn_t::allocate_service_handle(service_record *record)
 {
-    int in_flag = bad_conn_close ? 0 : IN_EVENTS;
-    bool was_empty = outbuf.empty();
-    
-    if (was_empty) {
-        outpkt_index = 0;
-        // We can try sending the packet immediately:
-        int wr = write(iob.get_watched_fd(), pkt.data(), pkt.size());
-        if (wr == -1) {
-            if (errno == EPIPE) {
-                return false;
-            }
-            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
-                log(loglevel_t::WARN, "Error writing to control connection: ", strerror(errno));
-                return false;
-            }
-            // EAGAIN etc: fall through to below
+    handle_t handle;
+    if (first_free_handle != no_handle) {
+        handle = first_free_handle;
+        first_free_handle = handles[handle].id;
+    }
+    else {
+        if (handles.size() >= no_handle) throw std::bad_alloc();
+        handle = handles.size();
+        handles.emplace_back();
+        handles.back().listener = this;
+    }
+
+    service_handle &slot = handles[handle];
+    slot.service = record;
+    slot.id = handle;
+    record->add_handle(&slot);
+    return handle;
+}
+
+void control_conn_t::release_service_handle(handle_t handle) noexcept
+{
+    service_handle &slot = handles[handle];
+    slot.service->remove_handle(&slot);
+    slot.service = nullptr;
+    slot.id = first_free_handle;
+    first_free_handle = handle;
+}
+
+bool control_conn_t::flush_outbuf() noexcept
+{
+    if (outbuf.write_to(iob.get_watched_fd()) == -1) {
+        if (errno == EPIPE) {
+            return false;
         }
-        else {
-            if ((unsigned)wr == pkt.size()) {
-                // Ok, all written.
-                iob.set_watches(in_flag);
-                return true;
-            }
-            outpkt_index = wr;
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            log(loglevel_t::WARN, "Error writing to control connection: ", strerror(errno));
+            return false;
         }
     }
-    
+
+    int in_flag = bad_conn_close ? 0 : IN_EVENTS;
+    int out_flag = (outbuf.empty() && ! bad_conn_close) ? 0 : OUT_EVENTS;
+    iob.set_watches(in_flag | out_flag);
+    return true;
+}
+
+bool control_conn_t::queue_packet(const char *pkt, unsigned size) noexcept
+{
     try {
-        outbuf.emplace_back(pkt);
-        iob.set_watches(in_flag | OUT_EVENTS);
-        return true;
+        outbuf.append(pkt, size);
     }
     catch (std::bad_alloc &baexc) {
-        // Mark the connection bad, and stop reading further requests
+        // Mark the connection bad, and stop reading further requests. Since the packet was not
+        // queued at all, we can send the out-of-memory response once the queued packets have
+        // been sent.
         bad_conn_close = true;
         oom_close = true;
-        if (was_empty) {
-            // We can't send out-of-memory response as we already wrote as much as we
-            // could above. Neither can we later send the response since we have currently
-            // sent an incomplete packet. All we can do is close the connection.
-            return false;
-        }
-        else {
-            iob.set_watches(OUT_EVENTS);
-            return true;
-        }
+        iob.set_watches(OUT_EVENTS);
+        return true;
+    }
+
+    // If we are processing a request, the packet will be written once processing is complete;
+    // otherwise, try to write it out now (queued output is written in as few writes as possible).
+    if (defer_flush) {
+        return true;
     }
+    return flush_outbuf();
+}
+
+bool control_conn_t::queue_packet(std::vector<char> &&pkt) noexcept
+{
+    return queue_packet(pkt.data(), pkt.size());
 }
 
 bool control_conn_t::rollback_complete() noexcept
@@ -447,13 +1155,28 @@ bool control_conn_t::data_ready() noexcept
     
     // complete packet?
     if (rbuf.get_length() >= chklen) {
+        bool close_conn = false;
+        defer_flush = true;
         try {
-            return !process_packet();
+            // Process each complete packet in the buffer (the client may send several requests
+            // without waiting for replies):
+            do {
+                close_conn = !process_packet();
+            } while (! close_conn && ! bad_conn_close && rbuf.get_length() > 0
+                    && rbuf.get_length() >= chklen);
         }
         catch (std::bad_alloc &baexc) {
             do_oom_close();
-            return false;
+            close_conn = false;
+        }
+        defer_flush = false;
+
+        // Write out replies, and re-enable watches (including when the last packet was
+        // incomplete and nothing was queued):
+        if (! close_conn) {
+            close_conn = !flush_outbuf();
         }
+        return close_conn;
     }
     else if (rbuf.get_length() == 1024) {
         // Too big packet
@@ -480,40 +1203,21 @@ bool control_conn_t::send_data() noexcept
         return true;
     }
     
-    vector<char> & pkt = outbuf.front();
-    char *data = pkt.data();
-    int written = write(iob.get_watched_fd(), data + outpkt_index, pkt.size() - outpkt_index);
-    if (written == -1) {
-        if (errno == EPIPE) {
-            // read end closed
-            return true;
-        }
-        else if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
-            // spurious readiness notification?
-        }
-        else {
-            log(loglevel_t::ERROR, "Error writing to control connection: ", strerror(errno));
-            return true;
-        }
-        return false;
+    if (! flush_outbuf()) {
+        return true;
     }
 
-    outpkt_index += written;
-    if (outpkt_index == pkt.size()) {
-        // We've finished this packet, move on to the next:
-        outbuf.pop_front();
-        outpkt_index = 0;
-        if (outbuf.empty() && ! oom_close) {
-            if (! bad_conn_close) {
-                iob.set_watches(IN_EVENTS);
-            }
-            else {
-                return true;
-            }
+    // Queue any subscribed events held back while the output buffer was full:
+    if ((! pending_events.empty() || coalescing_events) && outbuf.get_length() < max_event_outbuf) {
+        drain_events();
+        if (! flush_outbuf()) {
+            return true;
         }
     }
-    
-    return false;
+
+    // If all output has been sent, close now if the connection is bad (unless we still need
+    // to send the out-of-memory response):
+    return outbuf.empty() && bad_conn_close && ! oom_close;
 }
 
 control_conn_t::~control_conn_t() noexcept
@@ -521,9 +1225,13 @@ control_conn_t::~control_conn_t() noexcept
     close(iob.get_watched_fd());
     iob.deregister(loop);
     
-    // Clear service listeners
-    for (auto p : serviceKeyMap) {
-        p.first->removeListener(this);
+    end_subscription();
+
+    // Unlink service handles
+    for (auto &slot : handles) {
+        if (slot.service != nullptr) {
+            slot.service->remove_handle(&slot);
+        }
     }
     
     active_control_conns--;
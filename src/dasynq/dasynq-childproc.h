@@ -1,10 +1,39 @@
 #include <signal.h>
+#include <sys/wait.h>
+
+#if DASYNQ_HAVE_PIDFD
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 #include "dasynq-btree_set.h"
 
 namespace dasynq {
 
+#if DASYNQ_HAVE_PIDFD
+template <class Base> class pidfd_child_events;
+#endif
+
+// Handler for terminated child processes which are not watched (such as orphaned descendants,
+// if the process is a "subreaper"); see event_loop::set_unwatched_child_handler().
+using unwatched_child_handler_t = void (*)(pid_t child, int status, void *arg);
+
 namespace dprivate {
 
+// Convert the termination information from waitid() to a status value as returned by waitpid().
+inline int wait_status_from_siginfo(const siginfo_t &info) noexcept
+{
+    switch (info.si_code) {
+    case CLD_EXITED:
+        return (info.si_status & 0xff) << 8;
+    case CLD_DUMPED:
+        return (info.si_status & 0x7f) | 0x80;
+    default: // CLD_KILLED
+        return info.si_status & 0x7f;
+    }
+}
+
 // Map of pid_t to void *, with possibility of reserving entries so that mappings can
 // be later added with no danger of allocator exhaustion (bad_alloc).
 class pid_map
@@ -78,12 +107,35 @@ inline void sigchld_handler(int signum)
     // hurt in any case).
 }
 
+#if DASYNQ_HAVE_PIDFD
+
+// Child watch handle for the pidfd-based backend. The pid_map entry maps the child's pid to the
+// handle itself (rather than to the watcher).
+class pidfd_watch_handle
+{
+    template <typename> friend class dasynq::pidfd_child_events;
+
+    pid_map::pid_handle_t map_handle;
+    void *userdata;
+    pid_t pid;
+    int pidfd = -1;
+    bool exited = false; // child has terminated (pidfd readable), but not yet reaped
+};
+
+#endif
+
 } // dprivate namespace
 
+#if DASYNQ_HAVE_PIDFD
+using pid_watch_handle_t = dprivate::pidfd_watch_handle;
+#else
 using pid_watch_handle_t = dprivate::pid_map::pid_handle_t;
+#endif
 
 template <class Base> class child_proc_events : public Base
 {
+    using pid_watch_handle_t = dprivate::pid_map::pid_handle_t;
+
     public:
     using reaper_mutex_t = typename Base::mutex_t;
 
@@ -96,6 +148,34 @@ template <class Base> class child_proc_events : public Base
     private:
     dprivate::pid_map child_waiters;
     reaper_mutex_t reaper_lock; // used to prevent reaping while trying to signal a process
+    unwatched_child_handler_t unwatched_handler = nullptr;
+    void *unwatched_handler_arg = nullptr;
+
+    // Reap terminated children, peeking at each first (with WNOWAIT) so that an unwatched child
+    // can be reported to the unwatched-child handler before it is reaped.
+    void reap_children_peek() noexcept
+    {
+        while (true) {
+            siginfo_t info;
+            info.si_pid = 0;
+            if (waitid(P_ALL, 0, &info, WEXITED | WNOHANG | WNOWAIT) == -1 || info.si_pid == 0) {
+                break;
+            }
+
+            pid_t child = info.si_pid;
+            auto ent = child_waiters.get(child);
+            if (! ent.first) {
+                unwatched_handler(child, dprivate::wait_status_from_siginfo(info), unwatched_handler_arg);
+            }
+
+            int status;
+            if (waitpid(child, &status, WNOHANG) <= 0) break;
+            if (ent.first) {
+                child_waiters.remove(child);
+                Base::receive_child_stat(child, status, ent.second);
+            }
+        }
+    }
     
     protected:
     using sigdata_t = typename traits_t::sigdata_t;
@@ -107,10 +187,15 @@ template <class Base> class child_proc_events : public Base
             int status;
             pid_t child;
             reaper_lock.lock();
-            while ((child = waitpid(-1, &status, WNOHANG)) > 0) {
-                auto ent = child_waiters.remove(child);
-                if (ent.first) {
-                    Base::receive_child_stat(child, status, ent.second);
+            if (unwatched_handler != nullptr) {
+                reap_children_peek();
+            }
+            else {
+                while ((child = waitpid(-1, &status, WNOHANG)) > 0) {
+                    auto ent = child_waiters.remove(child);
+                    if (ent.first) {
+                        Base::receive_child_stat(child, status, ent.second);
+                    }
                 }
             }
             reaper_lock.unlock();
@@ -172,6 +257,12 @@ template <class Base> class child_proc_events : public Base
         child_waiters.remove(handle);
         child_waiters.unreserve(handle);
     }
+
+    // Reap a child which has been reported as terminated; called (with the main lock held) just
+    // before the watcher is notified. Here, the child was already reaped when SIGCHLD was received.
+    void reap_child_watch_nolock(pid_watch_handle_t &handle, int &status) noexcept
+    {
+    }
     
     // Get the reaper lock, which can be used to ensure that a process is not reaped while attempting to
     // signal it.
@@ -180,6 +271,273 @@ template <class Base> class child_proc_events : public Base
         return reaper_lock;
     }
 
+    void set_unwatched_child_handler(unwatched_child_handler_t handler, void *arg) noexcept
+    {
+        std::lock_guard<decltype(Base::lock)> guard(Base::lock);
+        unwatched_handler = handler;
+        unwatched_handler_arg = arg;
+    }
+
+    template <typename T> void init(T *loop_mech)
+    {
+        // Mask SIGCHLD:
+        sigset_t sigmask;
+        this->sigmaskf(SIG_UNBLOCK, nullptr, &sigmask);
+        sigaddset(&sigmask, SIGCHLD);
+        this->sigmaskf(SIG_SETMASK, &sigmask, nullptr);
+
+        // On some systems a SIGCHLD handler must be established, or SIGCHLD will not be
+        // generated:
+        struct sigaction chld_action;
+        chld_action.sa_handler = dprivate::sigchld_handler;
+        sigemptyset(&chld_action.sa_mask);
+        chld_action.sa_flags = 0;
+        sigaction(SIGCHLD, &chld_action, nullptr);
+        loop_mech->add_signal_watch(SIGCHLD, nullptr);
+        Base::init(loop_mech);
+    }
+};
+
+#if DASYNQ_HAVE_PIDFD
+
+// Child process watching using Linux process file descriptors ("pidfd"s). A pidfd is opened for each
+// watched child and placed in an epoll set of our own, which is itself watched by the main loop. When
+// a child terminates, its pidfd becomes readable and the watcher is queued directly, with no need to
+// look up the pid. The child is not reaped until just before the watcher is notified, so that until
+// that point the process ID can't be recycled; it is safe to signal the process (or its process group)
+// at any time before the watcher has handled termination, regardless of event priorities.
+//
+// A SIGCHLD watch remains, to reap any children which are not watched (such as orphaned processes,
+// if we are a subreaper), and to handle watched children for which a pidfd could not be opened. If the
+// kernel does not support pidfds at all, this behaves exactly as child_proc_events.
+template <class Base> class pidfd_child_events : public Base
+{
+    public:
+    using reaper_mutex_t = typename Base::mutex_t;
+
+    class traits_t : public Base::traits_t
+    {
+        public:
+        constexpr static bool supports_childwatch_reservation = true;
+    };
+
+    private:
+    dprivate::pid_map child_waiters; // pid -> pidfd_watch_handle *
+    reaper_mutex_t reaper_lock; // used to prevent reaping while trying to signal a process
+    int pidfd_epfd = -1; // epoll set containing the pidfds of watched children; -1 if pidfds unsupported
+    bool reap_blocked = false; // the SIGCHLD reap loop stopped at a child which has a pidfd
+    unwatched_child_handler_t unwatched_handler = nullptr;
+    void *unwatched_handler_arg = nullptr;
+
+    // Open a pidfd for the child, and add it to our epoll set. On failure the child is still
+    // watched, via SIGCHLD.
+    void attach_pidfd(pid_watch_handle_t &handle) noexcept
+    {
+        if (pidfd_epfd == -1) return;
+
+        int fd = syscall(SYS_pidfd_open, handle.pid, 0);
+        if (fd == -1) return;
+
+        struct epoll_event epevent;
+        epevent.data.ptr = &handle;
+        epevent.events = EPOLLIN;
+        if (epoll_ctl(pidfd_epfd, EPOLL_CTL_ADD, fd, &epevent) == -1) {
+            close(fd);
+            return;
+        }
+        handle.pidfd = fd;
+    }
+
+    void detach_pidfd(pid_watch_handle_t &handle) noexcept
+    {
+        if (handle.pidfd != -1) {
+            // The descriptor may be shared with a child which has not yet exec'd, so we must remove
+            // it from the epoll set explicitly:
+            epoll_ctl(pidfd_epfd, EPOLL_CTL_DEL, handle.pidfd, nullptr);
+            close(handle.pidfd);
+            handle.pidfd = -1;
+        }
+    }
+
+    // Reap terminated children which have no pidfd (for watched children, queueing the watcher).
+    // Stops at the first terminated child which has a pidfd, since it can't be skipped; we retry
+    // once that child has been reaped.
+    void reap_children() noexcept
+    {
+        reap_blocked = false;
+        while (true) {
+            siginfo_t info;
+            info.si_pid = 0;
+            if (waitid(P_ALL, 0, &info, WEXITED | WNOHANG | WNOWAIT) == -1 || info.si_pid == 0) {
+                break;
+            }
+
+            pid_t child = info.si_pid;
+            auto ent = child_waiters.get(child);
+            pid_watch_handle_t *handle = static_cast<pid_watch_handle_t *>(ent.second);
+            if (ent.first && handle->pidfd != -1) {
+                reap_blocked = true;
+                break;
+            }
+            if (! ent.first && unwatched_handler != nullptr) {
+                unwatched_handler(child, dprivate::wait_status_from_siginfo(info), unwatched_handler_arg);
+            }
+
+            int status;
+            if (waitpid(child, &status, WNOHANG) <= 0) break;
+            if (ent.first) {
+                child_waiters.remove(handle->map_handle);
+                Base::receive_child_stat(child, status, handle->userdata);
+            }
+        }
+    }
+
+    protected:
+    using sigdata_t = typename traits_t::sigdata_t;
+    using fd_r = typename traits_t::fd_r;
+
+    template <typename T>
+    bool receive_signal(T & loop_mech, sigdata_t &siginfo, void *userdata)
+    {
+        if (siginfo.get_signo() == SIGCHLD) {
+            reaper_lock.lock();
+            reap_children();
+            reaper_lock.unlock();
+            return false; // leave signal watch enabled
+        }
+        else {
+            return Base::receive_signal(loop_mech, siginfo, userdata);
+        }
+    }
+
+    template <typename T>
+    void receive_fd_event(T &loop_mech, fd_r fd_r_a, void * userdata, int flags)
+    {
+        if (userdata == &pidfd_epfd) {
+            epoll_event events[16];
+            int r;
+            do {
+                r = epoll_wait(pidfd_epfd, events, 16, 0);
+                for (int i = 0; i < r; i++) {
+                    pid_watch_handle_t &handle = *static_cast<pid_watch_handle_t *>(events[i].data.ptr);
+                    // The child has terminated. Leave the pidfd open (and the child unreaped) but
+                    // stop watching it:
+                    epoll_ctl(pidfd_epfd, EPOLL_CTL_DEL, handle.pidfd, nullptr);
+                    handle.exited = true;
+                    Base::receive_child_stat(handle.pid, 0, handle.userdata);
+                }
+            } while (r == 16);
+        }
+        else {
+            Base::receive_fd_event(loop_mech, fd_r_a, userdata, flags);
+        }
+    }
+
+    public:
+    void reserve_child_watch_nolock(pid_watch_handle_t &handle)
+    {
+        child_waiters.reserve(handle.map_handle);
+    }
+
+    void unreserve_child_watch(pid_watch_handle_t &handle) noexcept
+    {
+        std::lock_guard<decltype(Base::lock)> guard(Base::lock);
+        unreserve_child_watch_nolock(handle);
+    }
+
+    void unreserve_child_watch_nolock(pid_watch_handle_t &handle) noexcept
+    {
+        child_waiters.unreserve(handle.map_handle);
+    }
+
+    void add_child_watch_nolock(pid_watch_handle_t &handle, pid_t child, void *val)
+    {
+        child_waiters.add(handle.map_handle, child, &handle);
+        handle.userdata = val;
+        handle.pid = child;
+        handle.exited = false;
+        attach_pidfd(handle);
+    }
+
+    void add_reserved_child_watch(pid_watch_handle_t &handle, pid_t child, void *val) noexcept
+    {
+        std::lock_guard<decltype(Base::lock)> guard(Base::lock);
+        add_reserved_child_watch_nolock(handle, child, val);
+    }
+
+    void add_reserved_child_watch_nolock(pid_watch_handle_t &handle, pid_t child, void *val) noexcept
+    {
+        child_waiters.add_from_reserve(handle.map_handle, child, &handle);
+        handle.userdata = val;
+        handle.pid = child;
+        handle.exited = false;
+        attach_pidfd(handle);
+    }
+
+    // Stop watching a child, but retain watch reservation
+    void stop_child_watch(pid_watch_handle_t &handle) noexcept
+    {
+        std::lock_guard<decltype(Base::lock)> guard(Base::lock);
+        stop_child_watch_nolock(handle);
+    }
+
+    void stop_child_watch_nolock(pid_watch_handle_t &handle) noexcept
+    {
+        child_waiters.remove(handle.map_handle);
+        if (handle.pidfd != -1) {
+            detach_pidfd(handle);
+            // If the child has already terminated, nobody else will reap it:
+            reaper_lock.lock();
+            reap_children();
+            reaper_lock.unlock();
+        }
+    }
+
+    void remove_child_watch(pid_watch_handle_t &handle) noexcept
+    {
+        std::lock_guard<decltype(Base::lock)> guard(Base::lock);
+        remove_child_watch_nolock(handle);
+    }
+
+    void remove_child_watch_nolock(pid_watch_handle_t &handle) noexcept
+    {
+        stop_child_watch_nolock(handle);
+        child_waiters.unreserve(handle.map_handle);
+    }
+
+    // Reap a child which has been reported as terminated; called (with the main lock held) just
+    // before the watcher is notified. If the child has a pidfd, it has not yet been reaped, and we
+    // do so now, storing its status.
+    void reap_child_watch_nolock(pid_watch_handle_t &handle, int &status) noexcept
+    {
+        if (! handle.exited) return;
+
+        reaper_lock.lock();
+        waitpid(handle.pid, &status, WNOHANG);
+        handle.exited = false;
+        child_waiters.remove(handle.map_handle);
+        close(handle.pidfd);
+        handle.pidfd = -1;
+        if (reap_blocked) {
+            reap_children();
+        }
+        reaper_lock.unlock();
+    }
+
+    // Get the reaper lock, which can be used to ensure that a process is not reaped while attempting to
+    // signal it.
+    reaper_mutex_t &get_reaper_lock() noexcept
+    {
+        return reaper_lock;
+    }
+
+    void set_unwatched_child_handler(unwatched_child_handler_t handler, void *arg) noexcept
+    {
+        std::lock_guard<decltype(Base::lock)> guard(Base::lock);
+        unwatched_handler = handler;
+        unwatched_handler_arg = arg;
+    }
+
     template <typename T> void init(T *loop_mech)
     {
         // Mask SIGCHLD:
@@ -196,9 +554,34 @@ template <class Base> class child_proc_events : public Base
         chld_action.sa_flags = 0;
         sigaction(SIGCHLD, &chld_action, nullptr);
         loop_mech->add_signal_watch(SIGCHLD, nullptr);
+
+        // Check that pidfds are supported (Linux 5.3+); if not, we rely on SIGCHLD alone:
+        int test_fd = syscall(SYS_pidfd_open, getpid(), 0);
+        if (test_fd != -1) {
+            close(test_fd);
+            pidfd_epfd = epoll_create1(EPOLL_CLOEXEC);
+            if (pidfd_epfd != -1) {
+                try {
+                    loop_mech->add_fd_watch(pidfd_epfd, &pidfd_epfd, IN_EVENTS);
+                }
+                catch (...) {
+                    close(pidfd_epfd);
+                    pidfd_epfd = -1;
+                }
+            }
+        }
+
         Base::init(loop_mech);
     }
+
+    ~pidfd_child_events()
+    {
+        if (pidfd_epfd != -1) {
+            close(pidfd_epfd);
+        }
+    }
 };
 
+#endif
 
 } // end namespace
@@ -22,6 +22,10 @@
 // If the epoll family of system calls are available:
 //     #define DASYNQ_HAVE_KQUEUE 1
 //
+// If Linux process file descriptors (pidfd_open, Linux 5.3+) should be used to watch child
+// processes (requires epoll; define to 0 to watch children via SIGCHLD only):
+//     #define DASYNQ_HAVE_PIDFD 1
+//
 // If the pipe2 system call is available:
 //     #define HAVE_PIPE2 1
 //
@@ -55,6 +59,13 @@
 
 // General feature availability
 
+#if defined(__linux__) && ! defined(DASYNQ_HAVE_PIDFD)
+#include <sys/syscall.h>
+#if defined(SYS_pidfd_open)
+#define DASYNQ_HAVE_PIDFD 1
+#endif
+#endif
+
 #if (defined(__OpenBSD__) || defined(__linux__)) && ! defined(HAVE_PIPE2)
 #define DASYNQ_HAVE_PIPE2 1
 #endif
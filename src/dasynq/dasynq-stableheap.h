@@ -9,6 +9,7 @@
 // The generation counter is a 64-bit integer and can not realistically overflow.
 
 #include <functional>
+#include <cstdint>
 
 namespace dasynq {
 
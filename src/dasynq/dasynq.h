@@ -60,7 +60,12 @@ namespace dasynq {
 #include "dasynq-timerfd.h"
 #include "dasynq-childproc.h"
 namespace dasynq {
-    template <typename T> using loop_t = epoll_loop<interrupt_channel<timer_fd_events<child_proc_events<T>>>>;
+#if DASYNQ_HAVE_PIDFD
+    template <typename T> using child_events = pidfd_child_events<T>;
+#else
+    template <typename T> using child_events = child_proc_events<T>;
+#endif
+    template <typename T> using loop_t = epoll_loop<interrupt_channel<timer_fd_events<child_events<T>>>>;
     using loop_traits_t = epoll_traits;
 }
 #else
@@ -787,6 +792,13 @@ class event_loop
         loop_mech.stop_child_watch(callback->watch_handle);
     }
 
+    // Reap a terminated child (if not already reaped) before its watcher is notified.
+    // Call with lock held.
+    void reap_child_nolock(base_child_watcher *callback) noexcept
+    {
+        loop_mech.reap_child_watch_nolock(callback->watch_handle, callback->child_status);
+    }
+
     void register_timer(base_timer_watcher *callback, clock_type clock)
     {
         auto & ed = (event_dispatch<T_Mutex, backend_traits_t> &) loop_mech;
@@ -1267,6 +1279,16 @@ class event_loop
         loop_mech.get_time(tv, clock, force_update);
     }
 
+    // Set a handler to be called when a child process which is not watched terminates (for instance
+    // an orphaned descendant re-parented to this process, if it is a "subreaper"), or nullptr for
+    // none. The handler is called before the child is reaped, so that information about the process
+    // (in /proc, for example) remains available. It is called with internal locks held, and must not
+    // use the event loop.
+    void set_unwatched_child_handler(unwatched_child_handler_t handler, void *arg) noexcept
+    {
+        loop_mech.set_unwatched_child_handler(handler, arg);
+    }
+
     event_loop() { }
     event_loop(const event_loop &other) = delete;
 };
@@ -1923,6 +1945,7 @@ class child_proc_watcher_impl : public child_proc_watcher<EventLoop>
     void dispatch(void *loop_ptr) noexcept override
     {
         EventLoop &loop = *static_cast<EventLoop *>(loop_ptr);
+        loop.reap_child_nolock(this);
         loop.get_base_lock().unlock();
 
         auto rearm_type = static_cast<Derived *>(this)->status_change(loop, this->watch_pid, this->child_status);
@@ -4,6 +4,7 @@
 #include <csignal>
 #include <cstddef>
 #include <cstdlib>
+#include <climits>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -45,6 +46,7 @@ eventloop_t event_loop;
 static void sigint_reboot_cb(eventloop_t &eloop) noexcept;
 static void sigquit_cb(eventloop_t &eloop) noexcept;
 static void sigterm_cb(eventloop_t &eloop) noexcept;
+static void sighup_cb(eventloop_t &eloop) noexcept;
 static void close_control_socket() noexcept;
 static void wait_for_user_input() noexcept;
 
@@ -128,6 +130,33 @@ namespace {
     };
 
     control_socket_watcher control_socket_io;
+
+    // Reaped child processes which had no watcher (normally orphaned descendants of service
+    // processes) are recorded by the unwatched-child handler, which can't use the event loop; it
+    // writes to this pipe so that services are notified once the event loop is free.
+    class reaped_dispatch_watcher : public eventloop_t::fd_watcher_impl<reaped_dispatch_watcher>
+    {
+        using rearm = dasynq::rearm;
+
+        public:
+        rearm fd_event(eventloop_t &loop, int fd, int flags) noexcept
+        {
+            char buf[64];
+            while (read(fd, buf, sizeof(buf)) > 0) { }
+            services->dispatch_reaped_exits();
+            return rearm::REARM;
+        }
+    };
+
+    reaped_dispatch_watcher reaped_dispatch_io;
+    int reaped_dispatch_pipe[2] = {-1, -1};
+
+    void unwatched_child_cb(pid_t child, int status, void *arg) noexcept
+    {
+        services->child_reaped(child, status);
+        char c = 0;
+        write(reaped_dispatch_pipe[1], &c, 1); // (if the pipe is full, a dispatch is pending anyway)
+    }
 }
 
 int dinit_main(int argc, char **argv)
@@ -138,6 +167,11 @@ int dinit_main(int argc, char **argv)
     const char * service_dir = nullptr;
     string service_dir_str; // to hold storage for above if necessary
     bool control_socket_path_set = false;
+    const char * cache_path = nullptr;  // service description cache to use
+    const char * compile_cache_path = nullptr;  // service description cache to write
+    int max_concurrent_starts = 0;  // limit on concurrently starting services (0 = none)
+    const char * launch_backend = nullptr;  // service process launch mechanism
+    const char * cgroup_root = nullptr;  // cgroup (v2) in which to create service cgroups
 
     // list of services to start
     list<const char *> services_to_start;
@@ -177,6 +211,56 @@ int dinit_main(int argc, char **argv)
                     return 1;
                 }
             }
+            else if (strcmp(argv[i], "--service-cache") == 0) {
+                if (++i < argc) {
+                    cache_path = argv[i];
+                }
+                else {
+                    cerr << "dinit: '--service-cache' requires an argument" << endl;
+                    return 1;
+                }
+            }
+            else if (strcmp(argv[i], "--compile-cache") == 0) {
+                if (++i < argc) {
+                    compile_cache_path = argv[i];
+                }
+                else {
+                    cerr << "dinit: '--compile-cache' requires an argument" << endl;
+                    return 1;
+                }
+            }
+            else if (strcmp(argv[i], "--max-concurrent-starts") == 0) {
+                char *endp = nullptr;
+                long maxval = -1;
+                if (++i < argc && *argv[i] != 0) {
+                    maxval = strtol(argv[i], &endp, 10);
+                }
+                if (endp == nullptr || *endp != 0 || maxval < 0 || maxval > INT_MAX) {
+                    cerr << "dinit: '--max-concurrent-starts' requires a numeric argument" << endl;
+                    return 1;
+                }
+                max_concurrent_starts = maxval;
+            }
+            else if (strcmp(argv[i], "--launch-backend") == 0) {
+                if (++i < argc && (strcmp(argv[i], "fork") == 0 || strcmp(argv[i], "vfork") == 0)) {
+                    launch_backend = argv[i];
+                }
+                else {
+                    cerr << "dinit: '--launch-backend' requires an argument: fork or vfork" << endl;
+                    return 1;
+                }
+            }
+#ifdef __linux__
+            else if (strcmp(argv[i], "--cgroup-root") == 0) {
+                if (++i < argc && *argv[i] != 0) {
+                    cgroup_root = argv[i];
+                }
+                else {
+                    cerr << "dinit: '--cgroup-root' requires an argument" << endl;
+                    return 1;
+                }
+            }
+#endif
             else if (strcmp(argv[i], "--help") == 0) {
                 cout << "dinit, an init with dependency management" << endl;
                 cout << " --help                       display help" << endl;
@@ -186,6 +270,13 @@ int dinit_main(int argc, char **argv)
                 cout << " --system, -s                 run as the system init process" << endl;
                 cout << " --socket-path <path>, -p <path>" << endl;
                 cout << "                              path to control socket" << endl;
+                cout << " --service-cache <file>       use compiled service description cache" << endl;
+                cout << " --compile-cache <file>       write service description cache and exit" << endl;
+                cout << " --max-concurrent-starts <n>  limit number of services starting at once" << endl;
+                cout << " --launch-backend fork|vfork  mechanism for launching service processes" << endl;
+#ifdef __linux__
+                cout << " --cgroup-root <dir>          run each service in its own cgroup under <dir>" << endl;
+#endif
                 cout << " <service-name>               start service with name <service-name>" << endl;
                 return 0;
             }
@@ -227,7 +318,10 @@ int dinit_main(int argc, char **argv)
     sigaddset(&sigwait_set, SIGCHLD);
     sigaddset(&sigwait_set, SIGINT);
     sigaddset(&sigwait_set, SIGTERM);
-    if (am_system_init) sigaddset(&sigwait_set, SIGQUIT);
+    if (am_system_init) {
+        sigaddset(&sigwait_set, SIGQUIT);
+        sigaddset(&sigwait_set, SIGHUP);
+    }
     sigprocmask(SIG_BLOCK, &sigwait_set, NULL);
 
     // Terminal access control signals - we block these so that dinit can't be
@@ -261,6 +355,24 @@ int dinit_main(int argc, char **argv)
     if (service_dir == nullptr) {
         service_dir = "/etc/dinit.d";
     }
+
+    if (compile_cache_path != nullptr) {
+        dirload_service_set cache_services(service_dir);
+        int count;
+        try {
+            count = cache_services.write_cache(compile_cache_path);
+        }
+        catch (std::bad_alloc &exc) {
+            cerr << "dinit: out of memory writing service cache" << endl;
+            return 1;
+        }
+        if (count == -1) {
+            cerr << "dinit: writing service cache: " << strerror(errno) << endl;
+            return 1;
+        }
+        cout << "dinit: wrote " << count << " service descriptions to cache" << endl;
+        return 0;
+    }
     
     if (services_to_start.empty()) {
         services_to_start.push_back("boot");
@@ -270,6 +382,7 @@ int dinit_main(int argc, char **argv)
     callback_signal_handler sigterm_watcher {sigterm_cb};
     callback_signal_handler sigint_watcher;
     callback_signal_handler sigquit_watcher;
+    callback_signal_handler sighup_watcher {sighup_cb};
 
     if (am_system_init) {
         sigint_watcher.setCbFunc(sigint_reboot_cb);
@@ -286,6 +399,8 @@ int dinit_main(int argc, char **argv)
         // PID 1: SIGQUIT exec's shutdown
         sigquit_watcher.add_watch(event_loop, SIGQUIT);
         // As a user process, we instead just let SIGQUIT perform the default action.
+        // SIGHUP re-opens service log files (as a user process, it terminates as usual).
+        sighup_watcher.add_watch(event_loop, SIGHUP);
     }
 
     // Try to open control socket (may fail due to readonly filesystem)
@@ -308,6 +423,44 @@ int dinit_main(int argc, char **argv)
     services = new dirload_service_set(service_dir);
     
     init_log(services);
+    services->set_max_concurrent_starts(max_concurrent_starts);
+    if (launch_backend != nullptr) {
+        if (strcmp(launch_backend, "fork") == 0) {
+            services->set_launch_backend(launch_backend_t::FORK);
+        }
+#ifdef __linux__
+        else {
+            services->set_launch_backend(launch_backend_t::VFORK);
+        }
+#else
+        else {
+            log(loglevel_t::WARN, "vfork launch backend is not supported on this system; using fork");
+        }
+#endif
+    }
+
+    if (cgroup_root != nullptr) {
+        services->set_cgroup_root(cgroup_root);
+    }
+
+    if (pipe2(reaped_dispatch_pipe, O_CLOEXEC | O_NONBLOCK) == 0) {
+        try {
+            reaped_dispatch_io.add_watch(event_loop, reaped_dispatch_pipe[0], dasynq::IN_EVENTS);
+            event_loop.set_unwatched_child_handler(unwatched_child_cb, nullptr);
+        }
+        catch (std::exception &e) {
+            log(loglevel_t::WARN, "Can't watch for orphaned processes: ", e.what());
+            close(reaped_dispatch_pipe[0]);
+            close(reaped_dispatch_pipe[1]);
+        }
+    }
+    else {
+        log(loglevel_t::WARN, "Can't watch for orphaned processes: ", strerror(errno));
+    }
+
+    if (cache_path != nullptr && ! services->use_cache(cache_path)) {
+        log(loglevel_t::WARN, "Could not use service description cache: ", cache_path);
+    }
     
     for (auto svc : services_to_start) {
         try {
@@ -587,3 +740,9 @@ static void sigterm_cb(eventloop_t &eloop) noexcept
 {
     services->stop_all_services();
 }
+
+// Re-open service log files, after they have been rotated
+static void sighup_cb(eventloop_t &eloop) noexcept
+{
+    services->reopen_logs();
+}
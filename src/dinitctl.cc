@@ -5,10 +5,14 @@
 #include <iostream>
 #include <system_error>
 #include <memory>
+#include <fstream>
+#include <vector>
+#include <unordered_map>
 
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/wait.h>
 #include <unistd.h>
 #include <signal.h>
 #include <pwd.h>
@@ -33,11 +37,19 @@ class ReadCPException
 
 enum class Command;
 
-static int issueLoadService(int socknum, const char *service_name);
+static int issueLoadService(int socknum, const char *service_name, bool find_only = false);
 static int checkLoadReply(int socknum, cpbuffer<1024> &rbuffer, handle_t *handle_p, service_state_t *state_p);
 static int startStopService(int socknum, const char *service_name, Command command, bool do_pin, bool wait_for_service, bool verbose);
+static int startStopServices(int socknum, const std::vector<const char *> &service_names, Command command, bool do_pin, bool wait_for_service, bool verbose);
 static int unpinService(int socknum, const char *service_name, bool verbose);
-static int listServices(int socknum);
+static int listServices(int socknum, bool long_format);
+static int showTrace(int socknum, const char *chrome_file);
+static int criticalChain(int socknum, const char *service_name);
+static int reopenLogs(int socknum, bool verbose);
+static int catLog(int socknum, const char *service_name, bool do_clear);
+static int monitorServices(int socknum, const char *name_prefix);
+static int serviceStatus(int socknum, const char *service_name);
+static int bufferStats(int socknum);
 
 
 // Fill a circular buffer from a file descriptor, reading at least _rlength_ bytes.
@@ -119,7 +131,14 @@ enum class Command {
     STOP_SERVICE,
     RELEASE_SERVICE,
     UNPIN_SERVICE,
-    LIST_SERVICES
+    LIST_SERVICES,
+    TRACE,
+    ANALYZE_CHAIN,
+    REOPEN_LOGS,
+    CAT_LOG,
+    MONITOR,
+    SERVICE_STATUS,
+    BUFFER_STATS
 };
 
 // Entry point.
@@ -129,6 +148,7 @@ int main(int argc, char **argv)
     
     bool show_help = argc < 2;
     char *service_name = nullptr;
+    std::vector<const char *> service_names;
     
     std::string control_socket_str;
     const char * control_socket_path = nullptr;
@@ -137,6 +157,9 @@ int main(int argc, char **argv)
     bool sys_dinit = false;  // communicate with system daemon
     bool wait_for_service = true;
     bool do_pin = false;
+    bool do_clear = false;
+    bool long_format = false;
+    const char *chrome_file = nullptr;  // file to write trace in Chrome trace format
     
     Command command = Command::NONE;
         
@@ -158,6 +181,19 @@ int main(int argc, char **argv)
             else if (strcmp(argv[i], "--pin") == 0) {
                 do_pin = true;
             }
+            else if (strcmp(argv[i], "--clear") == 0) {
+                do_clear = true;
+            }
+            else if (strcmp(argv[i], "--long") == 0) {
+                long_format = true;
+            }
+            else if (strcmp(argv[i], "--chrome") == 0) {
+                if (++i == argc) {
+                    show_help = true;
+                    break;
+                }
+                chrome_file = argv[i];
+            }
             else {
                 return 1;
             }
@@ -181,6 +217,32 @@ int main(int argc, char **argv)
             else if (strcmp(argv[i], "list") == 0) {
                 command = Command::LIST_SERVICES;
             }
+            else if (strcmp(argv[i], "trace") == 0) {
+                command = Command::TRACE;
+            }
+            else if (strcmp(argv[i], "analyze") == 0) {
+                // followed by analysis type (only "critical-chain" is supported)
+                if (++i == argc || strcmp(argv[i], "critical-chain") != 0) {
+                    show_help = true;
+                    break;
+                }
+                command = Command::ANALYZE_CHAIN;
+            }
+            else if (strcmp(argv[i], "reopen-logs") == 0) {
+                command = Command::REOPEN_LOGS;
+            }
+            else if (strcmp(argv[i], "catlog") == 0) {
+                command = Command::CAT_LOG;
+            }
+            else if (strcmp(argv[i], "monitor") == 0) {
+                command = Command::MONITOR;
+            }
+            else if (strcmp(argv[i], "status") == 0) {
+                command = Command::SERVICE_STATUS;
+            }
+            else if (strcmp(argv[i], "buffer-stats") == 0) {
+                command = Command::BUFFER_STATS;
+            }
             else {
                 show_help = true;
                 break;
@@ -188,20 +250,43 @@ int main(int argc, char **argv)
         }
         else {
             // service name
-            if (service_name != nullptr) {
-                show_help = true;
-                break;
+            if (service_name == nullptr) {
+                service_name = argv[i];
             }
-            service_name = argv[i];
-            // TODO support multiple services
+            service_names.push_back(argv[i]);
         }
     }
+
+    // Several services may be given for start/stop/wake/release:
+    bool multi_service_cmd = (command == Command::START_SERVICE || command == Command::STOP_SERVICE
+            || command == Command::WAKE_SERVICE || command == Command::RELEASE_SERVICE);
+
+    if (service_names.size() > 1 && ! multi_service_cmd) {
+        show_help = true;
+    }
     
-    if (service_name != nullptr && command == Command::LIST_SERVICES) {
+    bool no_service_cmd = (command == Command::LIST_SERVICES || command == Command::TRACE
+            || command == Command::REOPEN_LOGS || command == Command::BUFFER_STATS);
+
+    if (service_name != nullptr && no_service_cmd) {
         show_help = true;
     }
     
-    if ((service_name == nullptr && command != Command::LIST_SERVICES) || command == Command::NONE) {
+    // (for monitor, the service name is an optional prefix)
+    if ((service_name == nullptr && ! no_service_cmd && command != Command::MONITOR)
+            || command == Command::NONE) {
+        show_help = true;
+    }
+
+    if (chrome_file != nullptr && command != Command::TRACE) {
+        show_help = true;
+    }
+
+    if (do_clear && command != Command::CAT_LOG) {
+        show_help = true;
+    }
+
+    if (long_format && command != Command::LIST_SERVICES) {
         show_help = true;
     }
 
@@ -209,12 +294,19 @@ int main(int argc, char **argv)
         cout << "dinitctl:   control Dinit services" << endl;
         
         cout << "\nUsage:" << endl;
-        cout << "    dinitctl [options] start [options] <service-name> : start and activate service" << endl;
-        cout << "    dinitctl [options] stop [options] <service-name>  : stop service and cancel explicit activation" << endl;
-        cout << "    dinitctl [options] wake [options] <service-name>  : start but do not mark activated" << endl;
-        cout << "    dinitctl [options] release [options] <service-name> : release activation, stop if no dependents" << endl;
+        cout << "    dinitctl [options] start [options] <service-name>... : start and activate service(s)" << endl;
+        cout << "    dinitctl [options] stop [options] <service-name>...  : stop service(s) and cancel explicit activation" << endl;
+        cout << "    dinitctl [options] wake [options] <service-name>...  : start but do not mark activated" << endl;
+        cout << "    dinitctl [options] release [options] <service-name>... : release activation, stop if no dependents" << endl;
         cout << "    dinitctl [options] unpin <service-name>           : un-pin the service (after a previous pin)" << endl;
-        cout << "    dinitctl list                                     : list loaded services" << endl;
+        cout << "    dinitctl list [--long]                            : list loaded services" << endl;
+        cout << "    dinitctl status <service-name>                    : show service status and statistics" << endl;
+        cout << "    dinitctl trace [--chrome <file>]                  : show service timeline trace" << endl;
+        cout << "    dinitctl analyze critical-chain <service-name>    : show dependencies which delayed service start" << endl;
+        cout << "    dinitctl reopen-logs                              : re-open service log files (on next launch)" << endl;
+        cout << "    dinitctl catlog [--clear] <service-name>          : show captured output of service" << endl;
+        cout << "    dinitctl monitor [<name-prefix>]                  : report service events as they occur" << endl;
+        cout << "    dinitctl buffer-stats                             : show buffer and service arena statistics" << endl;
         
         cout << "\nNote: An activated service continues running when its dependents stop." << endl;
         
@@ -226,6 +318,9 @@ int main(int argc, char **argv)
         cout << "  --help           : show this help" << endl;
         cout << "  --no-wait        : don't wait for service startup/shutdown to complete" << endl;
         cout << "  --pin            : pin the service in the requested (started/stopped) state" << endl;
+        cout << "  --chrome <file>  : write trace to file in Chrome trace (JSON) format" << endl;
+        cout << "  --clear          : clear the captured output after showing it" << endl;
+        cout << "  --long           : also show process and restart details of each service" << endl;
         return 1;
     }
     
@@ -283,12 +378,54 @@ int main(int argc, char **argv)
         return unpinService(socknum, service_name, verbose);
     }
     else if (command == Command::LIST_SERVICES) {
-        return listServices(socknum);
+        return listServices(socknum, long_format);
+    }
+    else if (command == Command::TRACE) {
+        return showTrace(socknum, chrome_file);
+    }
+    else if (command == Command::ANALYZE_CHAIN) {
+        return criticalChain(socknum, service_name);
+    }
+    else if (command == Command::REOPEN_LOGS) {
+        return reopenLogs(socknum, verbose);
+    }
+    else if (command == Command::CAT_LOG) {
+        return catLog(socknum, service_name, do_clear);
+    }
+    else if (command == Command::MONITOR) {
+        return monitorServices(socknum, service_name);
+    }
+    else if (command == Command::SERVICE_STATUS) {
+        return serviceStatus(socknum, service_name);
+    }
+    else if (command == Command::BUFFER_STATS) {
+        return bufferStats(socknum);
+    }
+
+    if (service_names.size() > 1) {
+        return startStopServices(socknum, service_names, command, do_pin, wait_for_service, verbose);
     }
 
     return startStopService(socknum, service_name, command, do_pin, wait_for_service, verbose);
 }
 
+// Get the control protocol request type for a start/stop command
+static int startStopPacketType(Command command)
+{
+    switch (command) {
+    case Command::STOP_SERVICE:
+        return DINIT_CP_STOPSERVICE;
+    case Command::RELEASE_SERVICE:
+        return DINIT_CP_RELEASESERVICE;
+    case Command::START_SERVICE:
+        return DINIT_CP_STARTSERVICE;
+    case Command::WAKE_SERVICE:
+        return DINIT_CP_WAKESERVICE;
+    default:
+        return 0;
+    }
+}
+
 // Start/stop a service
 static int startStopService(int socknum, const char *service_name, Command command, bool do_pin, bool wait_for_service, bool verbose)
 {
@@ -315,22 +452,7 @@ static int startStopService(int socknum, const char *service_name, Command comma
         }
                 
         service_state_t wanted_state = do_stop ? service_state_t::STOPPED : service_state_t::STARTED;
-        int pcommand = 0;
-        switch (command) {
-        case Command::STOP_SERVICE:
-            pcommand = DINIT_CP_STOPSERVICE;
-            break;
-        case Command::RELEASE_SERVICE:
-            pcommand = DINIT_CP_RELEASESERVICE;
-            break;
-        case Command::START_SERVICE:
-            pcommand = DINIT_CP_STARTSERVICE;
-            break;
-        case Command::WAKE_SERVICE:
-            pcommand = DINIT_CP_WAKESERVICE;
-            break;
-        default: ;
-        }
+        int pcommand = startStopPacketType(command);
         
         // Need to issue STOPSERVICE/STARTSERVICE
         // We'll do this regardless of the current service state / target state, since issuing
@@ -450,9 +572,181 @@ static int startStopService(int socknum, const char *service_name, Command comma
     return 0;
 }
 
+// Start/stop several services. The services are loaded and the command issued for all of them
+// using BATCH requests (as few as possible; usually just one), so that dinit acts on them together.
+static int startStopServices(int socknum, const std::vector<const char *> &service_names, Command command, bool do_pin, bool wait_for_service, bool verbose)
+{
+    using namespace std;
+
+    bool do_stop = (command == Command::STOP_SERVICE || command == Command::RELEASE_SERVICE);
+    service_state_t wanted_state = do_stop ? service_state_t::STOPPED : service_state_t::STARTED;
+    int pcommand = startStopPacketType(command);
+
+    service_event_t completionEvent = do_stop ? service_event_t::STOPPED : service_event_t::STARTED;
+    service_event_t cancelledEvent = do_stop ? service_event_t::STOPCANCELLED : service_event_t::STARTCANCELLED;
+
+    size_t count = service_names.size();
+    unordered_map<handle_t, size_t> waiting;  // handle -> index of service, for services being waited on
+    int rval = 0;
+    bool issued = false;
+
+    try {
+        cpbuffer<1024> rbuffer;
+
+        // Process a service event packet (at the front of the buffer), if it is for a service
+        // that we are waiting on:
+        auto process_event = [&](void) {
+            if (rbuffer[0] != DINIT_IP_SERVICEEVENT) return;
+            handle_t ev_handle;
+            rbuffer.extract((char *) &ev_handle, 2, sizeof(ev_handle));
+            service_event_t event = static_cast<service_event_t>(rbuffer[2 + sizeof(ev_handle)]);
+            auto i = waiting.find(ev_handle);
+            if (i == waiting.end()) return;
+            const char *name = service_names[i->second];
+            if (event == completionEvent) {
+                if (verbose) {
+                    cout << "Service '" << name << "' " << describeState(do_stop) << "." << endl;
+                }
+            }
+            else if (event == cancelledEvent) {
+                if (verbose) {
+                    cout << "Service '" << name << "' " << describeVerb(do_stop) << " cancelled." << endl;
+                }
+                rval = 1;
+            }
+            else if (! do_stop && event == service_event_t::FAILEDSTART) {
+                if (verbose) {
+                    cout << "Service '" << name << "' failed to start." << endl;
+                }
+                rval = 1;
+            }
+            else {
+                return;
+            }
+            waiting.erase(i);
+        };
+
+        // Read the next packet into the buffer (at least the first two bytes). If it is an
+        // information packet, read it entirely and process it. Returns the packet type.
+        auto next_packet = [&](void) {
+            fillBufferTo(&rbuffer, socknum, 2);
+            int pkt_type = rbuffer[0];
+            if (pkt_type >= 100) {
+                int pktlen = (unsigned char) rbuffer[1];
+                fillBufferTo(&rbuffer, socknum, pktlen);
+                process_event();
+                rbuffer.consume(pktlen);
+            }
+            return pkt_type;
+        };
+
+        size_t next = 0;
+        while (next < count) {
+            // Build a batch request with as many entries as will fit:
+            vector<char> pkt = { (char) DINIT_CP_BATCH, 0, 0 };
+            size_t first = next;
+            while (next < count) {
+                uint16_t name_len = strlen(service_names[next]);
+                if (pkt.size() + 4 + name_len > 1024) break;
+                pkt.push_back(pcommand);
+                pkt.push_back(DINIT_BATCH_BYNAME | (do_pin ? DINIT_BATCH_PIN : 0));
+                pkt.insert(pkt.end(), (char *) &name_len, (char *) &name_len + 2);
+                pkt.insert(pkt.end(), service_names[next], service_names[next] + name_len);
+                next++;
+            }
+            if (next == first) {
+                cerr << "dinitctl: Service name too long: " << service_names[next] << endl;
+                return 1;
+            }
+            uint16_t pkt_len = pkt.size();
+            memcpy(pkt.data() + 1, &pkt_len, 2);
+
+            if (write_all(socknum, pkt.data(), pkt.size()) == -1) {
+                perror("dinitctl: write");
+                return 1;
+            }
+
+            // Wait for the reply (processing any service events in the meantime):
+            while (next_packet() >= 100) { }
+            if (rbuffer[0] != DINIT_RP_BATCHREPLY) {
+                cerr << "dinitctl: Protocol error." << endl;
+                return 1;
+            }
+            fillBufferTo(&rbuffer, socknum, 3);
+            uint16_t num_entries;
+            rbuffer.extract((char *) &num_entries, 1, 2);
+            rbuffer.consume(3);
+            if (num_entries != next - first) {
+                cerr << "dinitctl: Protocol error." << endl;
+                return 1;
+            }
+
+            constexpr int entry_size = 2 + sizeof(handle_t);
+            for (size_t i = first; i < next; i++) {
+                fillBufferTo(&rbuffer, socknum, entry_size);
+                int result = rbuffer[0];
+                handle_t handle;
+                rbuffer.extract((char *) &handle, 1, sizeof(handle));
+                auto state = static_cast<service_state_t>(rbuffer[1 + sizeof(handle)]);
+                rbuffer.consume(entry_size);
+
+                if (result == DINIT_RP_NOSERVICE) {
+                    cerr << "dinitctl: Failed to find/load service '" << service_names[i] << "'." << endl;
+                    rval = 1;
+                }
+                else if (result == DINIT_RP_ALREADYSS) {
+                    if (verbose) {
+                        bool already = (state == wanted_state);
+                        cout << "Service '" << service_names[i] << "' " << (already ? "(already) " : "")
+                                << describeState(do_stop) << "." << endl;
+                    }
+                }
+                else if (result == DINIT_RP_ACK) {
+                    issued = true;
+                    if (wait_for_service) {
+                        waiting[handle] = i;
+                    }
+                }
+                else {
+                    cerr << "dinitctl: Protocol error." << endl;
+                    return 1;
+                }
+            }
+        }
+
+        if (! wait_for_service) {
+            if (verbose && issued) {
+                cout << "Issued " << describeVerb(do_stop) << " command successfully." << endl;
+            }
+            return rval;
+        }
+
+        // Wait until all services have started/stopped (or failed to):
+        while (! waiting.empty()) {
+            if (next_packet() < 100) {
+                // Not an information packet?
+                cerr << "dinitctl: protocol error" << endl;
+                return 1;
+            }
+        }
+    }
+    catch (ReadCPException &exc) {
+        cerr << "dinitctl: control socket read failure or protocol error" << endl;
+        return 1;
+    }
+    catch (std::bad_alloc &exc) {
+        cerr << "dinitctl: out of memory" << endl;
+        return 1;
+    }
+
+    return rval;
+}
+
 // Issue a "load service" command (DINIT_CP_LOADSERVICE), without waiting for
 // a response. Returns 1 on failure (with error logged), 0 on success.
-static int issueLoadService(int socknum, const char *service_name)
+// Issue a "load service" request (or, if find_only is set, a "find service" request which will not
+// load the service if it is not already loaded).
+static int issueLoadService(int socknum, const char *service_name, bool find_only)
 {
     // Build buffer;
     uint16_t sname_len = strlen(service_name);
@@ -463,7 +757,7 @@ static int issueLoadService(int socknum, const char *service_name)
         std::unique_ptr<char[]> ubuf(new char[bufsize]);
         auto buf = ubuf.get();
         
-        buf[0] = DINIT_CP_LOADSERVICE;
+        buf[0] = find_only ? DINIT_CP_FINDSERVICE : DINIT_CP_LOADSERVICE;
         memcpy(buf + 1, &sname_len, 2);
         memcpy(buf + 3, service_name, sname_len);
         
@@ -566,12 +860,118 @@ static int unpinService(int socknum, const char *service_name, bool verbose)
     return 0;
 }
 
-static int listServices(int socknum)
+// Print the state indicator for a service, as shown by "dinitctl list".
+static void printStateIndicator(service_state_t current, service_state_t target)
+{
+    using namespace std;
+
+    cout << "[";
+
+    cout << (target  == service_state_t::STARTED ? "{" : " ");
+    cout << (current == service_state_t::STARTED ? "+" : " ");
+    cout << (target  == service_state_t::STARTED ? "}" : " ");
+
+    if (current == service_state_t::STARTING) {
+        cout << "<<";
+    }
+    else if (current == service_state_t::STOPPING) {
+        cout << ">>";
+    }
+    else {
+        cout << "  ";
+    }
+
+    cout << (target  == service_state_t::STOPPED ? "{" : " ");
+    cout << (current == service_state_t::STOPPED ? "-" : " ");
+    cout << (target  == service_state_t::STOPPED ? "}" : " ");
+
+    cout << "]";
+}
+
+namespace {
+    // Service status, as reported in a SERVICESTATUS reply
+    class service_status_rec
+    {
+        public:
+        std::string name;
+        service_state_t state;
+        service_state_t target;
+        bool have_exit_status;
+        int32_t pid;
+        int32_t exit_status;
+        uint32_t restart_interval_count;
+        uint32_t total_restarts;
+        uint32_t orphan_count;
+        uint32_t console_position;
+        int64_t since_launch;   // nanoseconds (0 = never launched)
+        int64_t start_latency;  // nanoseconds (0 = not started)
+    };
+}
+
+// Read a SERVICESTATUS reply (the packet type byte must already be in the buffer).
+static void readServiceStatus(int socknum, cpbuffer<1024> &rbuffer, service_status_rec &rec)
+{
+    constexpr int hdr_size = 5 + 6 * sizeof(int32_t) + 2 * sizeof(int64_t);
+
+    fillBufferTo(&rbuffer, socknum, hdr_size);
+    rec.state = static_cast<service_state_t>(rbuffer[1]);
+    rec.target = static_cast<service_state_t>(rbuffer[2]);
+    rec.have_exit_status = (rbuffer[3] & DINIT_SSTATUS_HAS_EXIT_STATUS) != 0;
+    int name_len = (unsigned char) rbuffer[4];
+
+    int pos = 5;
+    auto get = [&rbuffer, &pos](void *val, int size) {
+        rbuffer.extract((char *) val, pos, size);
+        pos += size;
+    };
+    get(&rec.pid, sizeof(rec.pid));
+    get(&rec.exit_status, sizeof(rec.exit_status));
+    get(&rec.restart_interval_count, sizeof(rec.restart_interval_count));
+    get(&rec.total_restarts, sizeof(rec.total_restarts));
+    get(&rec.orphan_count, sizeof(rec.orphan_count));
+    get(&rec.console_position, sizeof(rec.console_position));
+    get(&rec.since_launch, sizeof(rec.since_launch));
+    get(&rec.start_latency, sizeof(rec.start_latency));
+
+    fillBufferTo(&rbuffer, socknum, hdr_size + name_len);
+
+    char *name_ptr = rbuffer.get_ptr(hdr_size);
+    int clength = std::min(rbuffer.get_contiguous_length(name_ptr), name_len);
+
+    rec.name = std::string(name_ptr, clength);
+    rec.name.append(rbuffer.get_buf_base(), name_len - clength);
+
+    rbuffer.consume(hdr_size + name_len);
+}
+
+// Describe how the most recent process of a service terminated.
+static std::string describeExitStatus(const service_status_rec &rec)
+{
+    if (! rec.have_exit_status) {
+        return "none";
+    }
+    if (WIFEXITED(rec.exit_status)) {
+        return "exited " + std::to_string(WEXITSTATUS(rec.exit_status));
+    }
+    if (WIFSIGNALED(rec.exit_status)) {
+        return "signalled " + std::to_string(WTERMSIG(rec.exit_status));
+    }
+    return "unknown";
+}
+
+static std::string describeDuration(int64_t nsecs)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.3fs", nsecs / 1000000000.0);
+    return buf;
+}
+
+static int listServices(int socknum, bool long_format)
 {
     using namespace std;
     
     try {
-        char cmdbuf[] = { (char)DINIT_CP_LISTSERVICES };
+        char cmdbuf[] = { (char)(long_format ? DINIT_CP_LISTSTATUS : DINIT_CP_LISTSERVICES) };
         int r = write_all(socknum, cmdbuf, 1);
         
         if (r == -1) {
@@ -581,46 +981,438 @@ static int listServices(int socknum)
         
         cpbuffer<1024> rbuffer;
         wait_for_reply(rbuffer, socknum);
-        while (rbuffer[0] == DINIT_RP_SVCINFO) {
-            fillBufferTo(&rbuffer, socknum, 8);
-            int nameLen = rbuffer[1];
-            service_state_t current = static_cast<service_state_t>(rbuffer[2]);
-            service_state_t target = static_cast<service_state_t>(rbuffer[3]);
-            
-            fillBufferTo(&rbuffer, socknum, nameLen + 8);
+        if (long_format) {
+            while (rbuffer[0] == DINIT_RP_SERVICESTATUS) {
+                service_status_rec rec;
+                readServiceStatus(socknum, rbuffer, rec);
+
+                std::string details;
+                auto add_detail = [&details](const std::string &detail) {
+                    if (! details.empty()) details += "; ";
+                    details += detail;
+                };
+                if (rec.pid != -1) {
+                    add_detail("pid " + std::to_string(rec.pid));
+                }
+                if (rec.have_exit_status) {
+                    add_detail("last exit: " + describeExitStatus(rec));
+                }
+                if (rec.total_restarts != 0) {
+                    add_detail("restarts: " + std::to_string(rec.restart_interval_count) + " ("
+                            + std::to_string(rec.total_restarts) + " total)");
+                }
+                if (rec.since_launch != 0) {
+                    add_detail("launched " + describeDuration(rec.since_launch) + " ago");
+                }
+                if (rec.start_latency != 0) {
+                    add_detail("start took " + describeDuration(rec.start_latency));
+                }
+                if (rec.console_position != 0) {
+                    add_detail("waiting for console (position " + std::to_string(rec.console_position) + ")");
+                }
+
+                printStateIndicator(rec.state, rec.target);
+                cout << " " << rec.name;
+                if (! details.empty()) {
+                    cout << " (" << details << ")";
+                }
+                cout << endl;
+
+                wait_for_reply(rbuffer, socknum);
+            }
+        }
+        else {
+            while (rbuffer[0] == DINIT_RP_SVCINFO) {
+                fillBufferTo(&rbuffer, socknum, 8);
+                int nameLen = rbuffer[1];
+                service_state_t current = static_cast<service_state_t>(rbuffer[2]);
+                service_state_t target = static_cast<service_state_t>(rbuffer[3]);
             
-            char *name_ptr = rbuffer.get_ptr(8);
-            int clength = std::min(rbuffer.get_contiguous_length(name_ptr), nameLen);
+                fillBufferTo(&rbuffer, socknum, nameLen + 8);
             
-            string name = string(name_ptr, clength);
-            name.append(rbuffer.get_buf_base(), nameLen - clength);
+                char *name_ptr = rbuffer.get_ptr(8);
+                int clength = std::min(rbuffer.get_contiguous_length(name_ptr), nameLen);
             
-            cout << "[";
+                string name = string(name_ptr, clength);
+                name.append(rbuffer.get_buf_base(), nameLen - clength);
             
-            cout << (target  == service_state_t::STARTED ? "{" : " ");
-            cout << (current == service_state_t::STARTED ? "+" : " ");
-            cout << (target  == service_state_t::STARTED ? "}" : " ");
+                printStateIndicator(current, target);
+                cout << " " << name << endl;
             
-            if (current == service_state_t::STARTING) {
-                cout << "<<";
+                rbuffer.consume(8 + nameLen);
+                wait_for_reply(rbuffer, socknum);
             }
-            else if (current == service_state_t::STOPPING) {
-                cout << ">>";
+        }
+        
+        if (rbuffer[0] != DINIT_RP_LISTDONE) {
+            cerr << "dinitctl: Control socket protocol error" << endl;
+            return 1;
+        }
+    }
+    catch (ReadCPException &exc) {
+        cerr << "dinitctl: Control socket read failure or protocol error" << endl;
+        return 1;
+    }
+    catch (std::bad_alloc &exc) {
+        cerr << "dinitctl: Out of memory" << endl;
+        return 1;
+    }
+    
+    return 0;
+}
+
+namespace {
+    // An entry from the service timeline trace
+    class trace_rec
+    {
+        public:
+        trace_event_t event;
+        std::string service;
+        std::string dependency;
+        double time;  // microseconds, relative to the first entry
+    };
+}
+
+static const char * describe_trace_event(trace_event_t event)
+{
+    switch (event) {
+    case trace_event_t::STARTING: return "starting";
+    case trace_event_t::DEPREADY: return "dependency ready:";
+    case trace_event_t::DEPSSTARTED: return "dependencies started";
+    case trace_event_t::EXECUTED: return "process executed";
+    case trace_event_t::STARTED: return "started";
+    case trace_event_t::FAILEDSTART: return "failed to start";
+    case trace_event_t::STOPPING: return "stopping";
+    case trace_event_t::STOPPED: return "stopped";
+    }
+    return "(unknown event)";
+}
+
+// Escape a string for inclusion in JSON output
+static std::string json_escape(const std::string &s)
+{
+    std::string r;
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            r += '\\';
+            r += c;
+        }
+        else if ((unsigned char)c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", (unsigned)c);
+            r += buf;
+        }
+        else {
+            r += c;
+        }
+    }
+    return r;
+}
+
+// Write a trace in the Chrome trace event format (as accepted by chrome://tracing and Perfetto).
+// Each service is shown as a separate thread; the time spent waiting for dependencies, starting
+// and stopping are shown as slices, and other events as instants.
+static bool write_chrome_trace(const std::vector<trace_rec> &recs, const char *filename)
+{
+    using namespace std;
+
+    class svc_times
+    {
+        public:
+        int tid;
+        double start = -1;  // time STARTING
+        double deps = -1;   // time DEPSSTARTED
+        double stop = -1;   // time STOPPING
+    };
+
+    ofstream out(filename);
+    if (! out) {
+        return false;
+    }
+
+    unordered_map<string, svc_times> services;
+    bool first = true;
+
+    auto begin_event = [&](const char *name, const char *ph, int tid, double ts) {
+        out << (first ? "\n" : ",\n");
+        first = false;
+        out << "{\"name\":\"" << name << "\",\"ph\":\"" << ph << "\",\"pid\":1,\"tid\":" << tid
+                << ",\"ts\":" << ts;
+    };
+
+    auto slice = [&](const char *name, int tid, double from, double to) {
+        begin_event(name, "X", tid, from);
+        out << ",\"dur\":" << (to - from) << "}";
+    };
+
+    out << fixed;
+    out.precision(3);
+    out << "{\"traceEvents\":[";
+
+    for (auto &rec : recs) {
+        auto it = services.find(rec.service);
+        if (it == services.end()) {
+            svc_times times;
+            times.tid = services.size() + 1;
+            it = services.emplace(rec.service, times).first;
+            begin_event("thread_name", "M", times.tid, 0);
+            out << ",\"args\":{\"name\":\"" << json_escape(rec.service) << "\"}}";
+        }
+        svc_times &times = it->second;
+
+        switch (rec.event) {
+        case trace_event_t::STARTING:
+            times.start = rec.time;
+            times.deps = -1;
+            break;
+        case trace_event_t::DEPREADY:
+            begin_event("dependency ready", "i", times.tid, rec.time);
+            out << ",\"s\":\"t\",\"args\":{\"dependency\":\"" << json_escape(rec.dependency) << "\"";
+            if (times.start >= 0) {
+                out << ",\"waited_us\":" << (rec.time - times.start);
             }
-            else {
-                cout << "  ";
+            out << "}}";
+            break;
+        case trace_event_t::DEPSSTARTED:
+            if (times.start >= 0) {
+                slice("waiting for dependencies", times.tid, times.start, rec.time);
             }
-            
-            cout << (target  == service_state_t::STOPPED ? "{" : " ");
-            cout << (current == service_state_t::STOPPED ? "-" : " ");
-            cout << (target  == service_state_t::STOPPED ? "}" : " ");
-            
-            cout << "] " << name << endl;
-            
-            rbuffer.consume(8 + nameLen);
+            times.deps = rec.time;
+            break;
+        case trace_event_t::EXECUTED:
+            begin_event("process executed", "i", times.tid, rec.time);
+            out << ",\"s\":\"t\"}";
+            break;
+        case trace_event_t::STARTED:
+        case trace_event_t::FAILEDSTART:
+        {
+            const char *name = (rec.event == trace_event_t::STARTED) ? "starting" : "starting (failed)";
+            if (times.deps >= 0) {
+                slice(name, times.tid, times.deps, rec.time);
+            }
+            else if (times.start >= 0) {
+                slice((rec.event == trace_event_t::STARTED) ? "waiting for dependencies"
+                        : "waiting for dependencies (failed)", times.tid, times.start, rec.time);
+            }
+            times.start = times.deps = -1;
+            break;
+        }
+        case trace_event_t::STOPPING:
+            times.stop = rec.time;
+            break;
+        case trace_event_t::STOPPED:
+            if (times.stop >= 0) {
+                slice("stopping", times.tid, times.stop, rec.time);
+            }
+            times.stop = -1;
+            break;
+        }
+    }
+
+    out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    out.close();
+    return ! out.fail();
+}
+
+static int showTrace(int socknum, const char *chrome_file)
+{
+    using namespace std;
+
+    vector<trace_rec> recs;
+
+    try {
+        char cmdbuf[] = { (char)DINIT_CP_QUERYTRACE };
+        int r = write_all(socknum, cmdbuf, 1);
+
+        if (r == -1) {
+            perror("dinitctl: write");
+            return 1;
+        }
+
+        constexpr int hdr_size = 18;
+        bool have_base = false;
+        int64_t base_secs = 0;
+        uint32_t base_nsecs = 0;
+
+        cpbuffer<1024> rbuffer;
+        wait_for_reply(rbuffer, socknum);
+        while (rbuffer[0] == DINIT_RP_TRACEREC) {
+            fillBufferTo(&rbuffer, socknum, hdr_size);
+            uint16_t name_len, dep_name_len;
+            int64_t secs;
+            uint32_t nsecs;
+            trace_rec rec;
+            rec.event = static_cast<trace_event_t>(rbuffer[1]);
+            rbuffer.extract((char *)&name_len, 2, sizeof(name_len));
+            rbuffer.extract((char *)&dep_name_len, 4, sizeof(dep_name_len));
+            rbuffer.extract((char *)&secs, 6, sizeof(secs));
+            rbuffer.extract((char *)&nsecs, 14, sizeof(nsecs));
+
+            fillBufferTo(&rbuffer, socknum, hdr_size + name_len + dep_name_len);
+            rec.service = rbuffer.extract_string(hdr_size, name_len);
+            rec.dependency = rbuffer.extract_string(hdr_size + name_len, dep_name_len);
+
+            if (! have_base) {
+                base_secs = secs;
+                base_nsecs = nsecs;
+                have_base = true;
+            }
+            rec.time = (secs - base_secs) * 1000000.0 + ((double)nsecs - base_nsecs) / 1000.0;
+            recs.push_back(std::move(rec));
+
+            rbuffer.consume(hdr_size + name_len + dep_name_len);
             wait_for_reply(rbuffer, socknum);
         }
-        
+
+        if (rbuffer[0] != DINIT_RP_TRACEDONE) {
+            cerr << "dinitctl: Control socket protocol error" << endl;
+            return 1;
+        }
+    }
+    catch (ReadCPException &exc) {
+        cerr << "dinitctl: Control socket read failure or protocol error" << endl;
+        return 1;
+    }
+    catch (std::bad_alloc &exc) {
+        cerr << "dinitctl: Out of memory" << endl;
+        return 1;
+    }
+
+    if (chrome_file != nullptr) {
+        if (! write_chrome_trace(recs, chrome_file)) {
+            cerr << "dinitctl: Could not write trace to " << chrome_file << endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    // Show the trace as text: time (seconds, relative to the first entry), service, event.
+    char timebuf[32];
+    for (auto &rec : recs) {
+        snprintf(timebuf, sizeof(timebuf), "%12.6f", rec.time / 1000000.0);
+        cout << timebuf << "  " << rec.service << ": " << describe_trace_event(rec.event);
+        if (rec.event == trace_event_t::DEPREADY) {
+            cout << " " << rec.dependency;
+        }
+        cout << endl;
+    }
+
+    return 0;
+}
+
+static const char * describe_service_type(service_type_t type)
+{
+    switch (type) {
+    case service_type_t::PROCESS: return "process";
+    case service_type_t::BGPROCESS: return "bgprocess";
+    case service_type_t::SCRIPTED: return "scripted";
+    case service_type_t::INTERNAL: return "internal";
+    default: return "(unknown)";
+    }
+}
+
+// Show the critical chain for a service (the chain of dependencies which determined when it
+// started) and the total start time for each service type.
+static int criticalChain(int socknum, const char *service_name)
+{
+    using namespace std;
+
+    class chain_link
+    {
+        public:
+        string name;
+        service_type_t type;
+        int64_t begin_time;
+        int64_t deps_time;
+        int64_t end_time;
+    };
+
+    vector<chain_link> chain;
+
+    try {
+        uint16_t name_len = strlen(service_name);
+        if (name_len + 3 > 1024) {
+            cerr << "dinitctl: Service name too long" << endl;
+            return 1;
+        }
+        vector<char> cmdbuf(3 + name_len);
+        cmdbuf[0] = DINIT_CP_CRITICALCHAIN;
+        memcpy(cmdbuf.data() + 1, &name_len, sizeof(name_len));
+        memcpy(cmdbuf.data() + 3, service_name, name_len);
+
+        int r = write_all(socknum, cmdbuf.data(), cmdbuf.size());
+        if (r == -1) {
+            perror("dinitctl: write");
+            return 1;
+        }
+
+        cpbuffer<1024> rbuffer;
+        wait_for_reply(rbuffer, socknum);
+
+        if (rbuffer[0] == DINIT_RP_NOSERVICE) {
+            cerr << "dinitctl: Service not loaded: " << service_name << endl;
+            return 1;
+        }
+
+        constexpr int hdr_size = 28;
+        while (rbuffer[0] == DINIT_RP_CHAINLINK) {
+            fillBufferTo(&rbuffer, socknum, hdr_size);
+            chain_link link;
+            link.type = static_cast<service_type_t>(rbuffer[1]);
+            uint16_t lname_len;
+            rbuffer.extract((char *)&lname_len, 2, sizeof(lname_len));
+            rbuffer.extract((char *)&link.begin_time, 4, sizeof(int64_t));
+            rbuffer.extract((char *)&link.deps_time, 12, sizeof(int64_t));
+            rbuffer.extract((char *)&link.end_time, 20, sizeof(int64_t));
+            fillBufferTo(&rbuffer, socknum, hdr_size + lname_len);
+            link.name = rbuffer.extract_string(hdr_size, lname_len);
+            chain.push_back(std::move(link));
+
+            rbuffer.consume(hdr_size + lname_len);
+            wait_for_reply(rbuffer, socknum);
+        }
+
+        if (chain.empty() || chain[0].end_time == 0) {
+            cout << "Service " << service_name << " has not started." << endl;
+        }
+        else {
+            // Times are shown relative to the start of the first service in the chain.
+            int64_t base_time = chain.back().begin_time;
+            char buf[128];
+            cout << "Critical chain for " << service_name << " (time started, start duration):" << endl;
+            for (unsigned i = 0; i < chain.size(); i++) {
+                auto &link = chain[i];
+                snprintf(buf, sizeof(buf), "%*s%s%s (%s) @%.3fs +%.3fs", (int)(i * 2), "",
+                        (i == 0) ? "" : "`-", link.name.c_str(), describe_service_type(link.type),
+                        (link.end_time - base_time) / 1e9,
+                        (link.deps_time != 0) ? (link.end_time - link.deps_time) / 1e9 : 0.0);
+                cout << buf << endl;
+            }
+        }
+
+        bool first_blame = true;
+        constexpr int blame_size = 2 + sizeof(uint32_t) + sizeof(int64_t);
+        while (rbuffer[0] == DINIT_RP_BLAME) {
+            fillBufferTo(&rbuffer, socknum, blame_size);
+            service_type_t type = static_cast<service_type_t>(rbuffer[1]);
+            uint32_t count;
+            int64_t total;
+            rbuffer.extract((char *)&count, 2, sizeof(count));
+            rbuffer.extract((char *)&total, 2 + sizeof(count), sizeof(total));
+            rbuffer.consume(blame_size);
+
+            if (first_blame) {
+                cout << "\nTotal start time by service type:" << endl;
+                first_blame = false;
+            }
+            char buf[128];
+            snprintf(buf, sizeof(buf), "  %-10s %8.3fs  (%u services)", describe_service_type(type),
+                    total / 1e9, (unsigned)count);
+            cout << buf << endl;
+
+            wait_for_reply(rbuffer, socknum);
+        }
+
         if (rbuffer[0] != DINIT_RP_LISTDONE) {
             cerr << "dinitctl: Control socket protocol error" << endl;
             return 1;
@@ -634,6 +1426,312 @@ static int listServices(int socknum)
         cerr << "dinitctl: Out of memory" << endl;
         return 1;
     }
-    
+
+    return 0;
+}
+
+// Ask dinit to re-open service log files
+static int reopenLogs(int socknum, bool verbose)
+{
+    using namespace std;
+
+    try {
+        char cmdbuf[] = { (char)DINIT_CP_REOPENLOGS };
+        int r = write_all(socknum, cmdbuf, 1);
+
+        if (r == -1) {
+            perror("dinitctl: write");
+            return 1;
+        }
+
+        cpbuffer<1024> rbuffer;
+        wait_for_reply(rbuffer, socknum);
+        if (rbuffer[0] != DINIT_RP_ACK) {
+            cerr << "dinitctl: Protocol error." << endl;
+            return 1;
+        }
+    }
+    catch (ReadCPException &exc) {
+        cerr << "dinitctl: Control socket read failure or protocol error" << endl;
+        return 1;
+    }
+
+    if (verbose) {
+        cout << "Service logs will be re-opened." << endl;
+    }
+    return 0;
+}
+
+// Show statistics for the control connection output buffers and the service arena (for debugging)
+static int bufferStats(int socknum)
+{
+    using namespace std;
+
+    uint32_t chunk_size;
+    uint64_t counts[4];  // allocated, free, newly allocated, re-used
+    uint32_t slab_size;
+    uint64_t arena_counts[4];  // slabs, objects in use, objects free, large objects
+
+    try {
+        char cmdbuf[] = { (char)DINIT_CP_BUFFERSTATS };
+        if (write_all(socknum, cmdbuf, 1) == -1) {
+            perror("dinitctl: write");
+            return 1;
+        }
+
+        cpbuffer<1024> rbuffer;
+        wait_for_reply(rbuffer, socknum);
+        if (rbuffer[0] != DINIT_RP_BUFFERSTATS) {
+            cerr << "dinitctl: Protocol error." << endl;
+            return 1;
+        }
+
+        constexpr int arena_pos = 1 + sizeof(chunk_size) + sizeof(counts);
+        fillBufferTo(&rbuffer, socknum, arena_pos + sizeof(slab_size) + sizeof(arena_counts));
+        rbuffer.extract((char *) &chunk_size, 1, sizeof(chunk_size));
+        rbuffer.extract((char *) counts, 1 + sizeof(chunk_size), sizeof(counts));
+        rbuffer.extract((char *) &slab_size, arena_pos, sizeof(slab_size));
+        rbuffer.extract((char *) arena_counts, arena_pos + sizeof(slab_size), sizeof(arena_counts));
+    }
+    catch (ReadCPException &exc) {
+        cerr << "dinitctl: Control socket read failure or protocol error" << endl;
+        return 1;
+    }
+
+    cout << "Control connection output buffers:" << endl;
+    cout << "    Chunk size:         " << chunk_size << " bytes" << endl;
+    cout << "    Chunks allocated:   " << counts[0] << " (" << counts[1] << " kept free)" << endl;
+    cout << "    Chunks obtained:    " << (counts[2] + counts[3]) << " (" << counts[3] << " re-used)" << endl;
+    cout << "Service arena:" << endl;
+    cout << "    Slab size:          " << slab_size << " bytes" << endl;
+    cout << "    Slabs allocated:    " << arena_counts[0] << endl;
+    cout << "    Objects in use:     " << arena_counts[1] << " (" << arena_counts[2] << " kept free)" << endl;
+    cout << "    Large objects:      " << arena_counts[3] << endl;
+    return 0;
+}
+
+// Show the captured output of a service (log-type = buffer)
+static int catLog(int socknum, const char *service_name, bool do_clear)
+{
+    using namespace std;
+
+    if (issueLoadService(socknum, service_name) == 1) {
+        return 1;
+    }
+
+    try {
+        cpbuffer<1024> rbuffer;
+        wait_for_reply(rbuffer, socknum);
+
+        handle_t handle;
+        if (checkLoadReply(socknum, rbuffer, &handle, nullptr) != 0) {
+            return 1;
+        }
+
+        char buf[2 + sizeof(handle)];
+        buf[0] = DINIT_CP_CATLOG;
+        buf[1] = do_clear ? DINIT_CATLOG_CLEAR : 0;
+        memcpy(buf + 2, &handle, sizeof(handle));
+        if (write_all(socknum, buf, sizeof(buf)) == -1) {
+            perror("dinitctl: write");
+            return 1;
+        }
+
+        wait_for_reply(rbuffer, socknum);
+        if (rbuffer[0] == DINIT_RP_NAK) {
+            cerr << "dinitctl: Service output is not captured (log-type is not \"buffer\")." << endl;
+            return 1;
+        }
+        if (rbuffer[0] != DINIT_RP_SERVICE_LOG) {
+            cerr << "dinitctl: Protocol error." << endl;
+            return 1;
+        }
+
+        fillBufferTo(&rbuffer, socknum, 6);
+        uint32_t length;
+        rbuffer.extract((char *) &length, 2, sizeof(length));
+        rbuffer.consume(6);
+
+        // Copy the output through to stdout, as it arrives:
+        while (length > 0) {
+            if (rbuffer.get_length() == 0) {
+                fillBufferTo(&rbuffer, socknum, 1);
+            }
+            char *ptr = rbuffer.get_ptr(0);
+            uint32_t chunk = std::min(rbuffer.get_contiguous_length(ptr), rbuffer.get_length());
+            chunk = std::min(chunk, length);
+            if (write_all(STDOUT_FILENO, ptr, chunk) == -1) {
+                perror("dinitctl: write");
+                return 1;
+            }
+            rbuffer.consume(chunk);
+            length -= chunk;
+        }
+    }
+    catch (ReadCPException &exc) {
+        cerr << "dinitctl: Control socket read failure or protocol error" << endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+static const char * describe_service_event(service_event_t event)
+{
+    switch (event) {
+    case service_event_t::STARTED: return "started";
+    case service_event_t::STOPPED: return "stopped";
+    case service_event_t::FAILEDSTART: return "failed to start";
+    case service_event_t::STARTCANCELLED: return "start cancelled";
+    case service_event_t::STOPCANCELLED: return "stop cancelled";
+    }
+    return "unknown event";
+}
+
+static const char * describe_service_state(service_state_t state)
+{
+    switch (state) {
+    case service_state_t::STOPPED: return "stopped";
+    case service_state_t::STARTING: return "starting";
+    case service_state_t::STARTED: return "started";
+    case service_state_t::STOPPING: return "stopping";
+    }
+    return "unknown state";
+}
+
+// Subscribe to service events (optionally, only for services whose name has the given prefix),
+// and report them until the connection is closed.
+static int monitorServices(int socknum, const char *name_prefix)
+{
+    using namespace std;
+
+    try {
+        uint16_t prefix_len = (name_prefix != nullptr) ? strlen(name_prefix) : 0;
+        vector<char> cmdbuf(5 + prefix_len);
+        cmdbuf[0] = DINIT_CP_SUBSCRIBE;
+        cmdbuf[1] = (name_prefix != nullptr) ? DINIT_SUBSCRIBE_PREFIX : 0;
+        cmdbuf[2] = 0;
+        memcpy(cmdbuf.data() + 3, &prefix_len, 2);
+        if (prefix_len != 0) {
+            memcpy(cmdbuf.data() + 5, name_prefix, prefix_len);
+        }
+
+        if (write_all(socknum, cmdbuf.data(), cmdbuf.size()) == -1) {
+            perror("dinitctl: write");
+            return 1;
+        }
+
+        cpbuffer<1024> rbuffer;
+        wait_for_reply(rbuffer, socknum);
+        if (rbuffer[0] != DINIT_RP_ACK) {
+            cerr << "dinitctl: Protocol error." << endl;
+            return 1;
+        }
+        rbuffer.consume(1);
+
+        while (true) {
+            fillBufferTo(&rbuffer, socknum, 2);
+            int pkt_type = (unsigned char) rbuffer[0];
+            int pktlen = (unsigned char) rbuffer[1];
+            if (pkt_type < 100 || pktlen < 2) {
+                cerr << "dinitctl: Protocol error." << endl;
+                return 1;
+            }
+            fillBufferTo(&rbuffer, socknum, pktlen);
+
+            if (pkt_type == DINIT_IP_SUBSCRIBEDEVENT && pktlen >= 5) {
+                auto event = static_cast<service_event_t>(rbuffer[2]);
+                string name = rbuffer.extract_string(5, pktlen - 5);
+                cout << name << ": " << describe_service_event(event) << endl;
+            }
+            else if (pkt_type == DINIT_IP_SERVICECHANGED && pktlen >= 4) {
+                auto state = static_cast<service_state_t>(rbuffer[2]);
+                string name = rbuffer.extract_string(4, pktlen - 4);
+                cout << name << ": now " << describe_service_state(state) << endl;
+            }
+            rbuffer.consume(pktlen);
+        }
+    }
+    catch (ReadCPException &exc) {
+        if (exc.errcode == 0) {
+            // connection closed (dinit terminated)
+            return 0;
+        }
+        cerr << "dinitctl: Control socket read failure or protocol error" << endl;
+        return 1;
+    }
+    catch (std::bad_alloc &exc) {
+        cerr << "dinitctl: Out of memory" << endl;
+        return 1;
+    }
+}
+
+// Show the status (with process details and statistics) of a loaded service
+static int serviceStatus(int socknum, const char *service_name)
+{
+    using namespace std;
+
+    if (issueLoadService(socknum, service_name, true) == 1) {
+        return 1;
+    }
+
+    try {
+        cpbuffer<1024> rbuffer;
+        wait_for_reply(rbuffer, socknum);
+
+        handle_t handle;
+        if (rbuffer[0] == DINIT_RP_NOSERVICE) {
+            cerr << "dinitctl: Service is not loaded: " << service_name << endl;
+            return 1;
+        }
+        if (checkLoadReply(socknum, rbuffer, &handle, nullptr) != 0) {
+            return 1;
+        }
+
+        char buf[1 + sizeof(handle)];
+        buf[0] = DINIT_CP_SERVICESTATUS;
+        memcpy(buf + 1, &handle, sizeof(handle));
+        if (write_all(socknum, buf, sizeof(buf)) == -1) {
+            perror("dinitctl: write");
+            return 1;
+        }
+
+        wait_for_reply(rbuffer, socknum);
+        if (rbuffer[0] != DINIT_RP_SERVICESTATUS) {
+            cerr << "dinitctl: Protocol error." << endl;
+            return 1;
+        }
+
+        service_status_rec rec;
+        readServiceStatus(socknum, rbuffer, rec);
+
+        cout << "Service: " << rec.name << endl;
+        cout << "    State:            " << describe_service_state(rec.state);
+        if (rec.target != rec.state) {
+            cout << " (target: " << describe_service_state(rec.target) << ")";
+        }
+        cout << endl;
+        if (rec.pid != -1) {
+            cout << "    Process ID:       " << rec.pid << endl;
+        }
+        cout << "    Last exit status: " << describeExitStatus(rec) << endl;
+        cout << "    Restarts:         " << rec.restart_interval_count << " in current interval, "
+                << rec.total_restarts << " total" << endl;
+        cout << "    Orphans reaped:   " << rec.orphan_count << endl;
+        if (rec.since_launch != 0) {
+            cout << "    Last launched:    " << describeDuration(rec.since_launch) << " ago" << endl;
+        }
+        if (rec.start_latency != 0) {
+            cout << "    Start duration:   " << describeDuration(rec.start_latency) << endl;
+        }
+        if (rec.console_position != 0) {
+            cout << "    Console queue:    position " << rec.console_position << endl;
+        }
+    }
+    catch (ReadCPException &exc) {
+        cerr << "dinitctl: Control socket read failure or protocol error" << endl;
+        return 1;
+    }
+
     return 0;
 }
@@ -1,9 +1,32 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
 namespace bp_sys {
 
 using dasynq::pipe2;
 
 using ::fcntl;
+using ::open;
+using ::openat;
 using ::close;
+using ::read;
+using ::write;
 using ::kill;
+using ::writev;
+using ::fstat;
+using ::rename;
+using ::unlink;
+using ::mkdir;
+using ::rmdir;
+
+#ifdef __linux__
+using ::inotify_init1;
+using ::inotify_add_watch;
+#endif
 
 }
@@ -0,0 +1,224 @@
+#ifndef CHUNK_BUFFER_H
+#define CHUNK_BUFFER_H
+
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
+#include <new>
+
+#include <sys/uio.h>
+
+// Statistics for chunk buffers (across all buffers), for debugging purposes.
+struct chunk_buffer_stats
+{
+    unsigned long allocated = 0;  // chunks currently allocated (in use, or kept free)
+    unsigned long free = 0;       // chunks currently kept free for re-use
+    unsigned long new_chunks = 0; // chunks obtained by allocation (in total)
+    unsigned long reused = 0;     // chunks obtained from those kept free (in total)
+};
+
+// A queue of bytes held in a chain of fixed-size chunks. Used to hold outgoing data for a control
+// connection: data is appended at the end of the last chunk (so packets are packed together, and
+// may span chunks), and written out with writev() from as many chunks as possible. Chunks which
+// have been emptied are kept, up to a limit, for re-use.
+class chunk_buffer
+{
+    public:
+    static constexpr unsigned chunk_data_size = 4064;
+
+    private:
+    static constexpr unsigned max_free_chunks = 4;
+    static constexpr int max_iov = 64;
+
+    struct chunk
+    {
+        chunk *next = nullptr;
+        unsigned start = 0;  // index of first unconsumed byte
+        unsigned end = 0;    // index following last byte
+        char data[chunk_data_size];
+    };
+
+    chunk *head = nullptr;
+    chunk *tail = nullptr;
+    chunk *free_chunks = nullptr;
+    unsigned num_free = 0;
+    size_t length = 0;
+
+    void release_chunk(chunk *c) noexcept
+    {
+        if (num_free < max_free_chunks) {
+            c->next = free_chunks;
+            free_chunks = c;
+            num_free++;
+            get_stats().free++;
+        }
+        else {
+            delete c;
+            get_stats().allocated--;
+        }
+    }
+
+    // Get an empty chunk (from the free chunks, if possible). May throw std::bad_alloc.
+    chunk *obtain_chunk()
+    {
+        chunk *c = free_chunks;
+        if (c != nullptr) {
+            free_chunks = c->next;
+            num_free--;
+            get_stats().free--;
+            get_stats().reused++;
+            c->next = nullptr;
+            c->start = 0;
+            c->end = 0;
+            return c;
+        }
+        c = new chunk;
+        get_stats().allocated++;
+        get_stats().new_chunks++;
+        return c;
+    }
+
+    public:
+    chunk_buffer() noexcept { }
+
+    chunk_buffer(const chunk_buffer &) = delete;
+    chunk_buffer &operator=(const chunk_buffer &) = delete;
+
+    ~chunk_buffer()
+    {
+        while (head != nullptr) {
+            chunk *c = head;
+            head = c->next;
+            delete c;
+            get_stats().allocated--;
+        }
+        while (free_chunks != nullptr) {
+            chunk *c = free_chunks;
+            free_chunks = c->next;
+            delete c;
+            get_stats().allocated--;
+            get_stats().free--;
+        }
+    }
+
+    // Get the statistics for all chunk buffers.
+    static chunk_buffer_stats &get_stats() noexcept
+    {
+        static chunk_buffer_stats stats;
+        return stats;
+    }
+
+    bool empty() noexcept
+    {
+        return length == 0;
+    }
+
+    size_t get_length() noexcept
+    {
+        return length;
+    }
+
+    // Append data to the buffer. Either all the data is appended, or (if std::bad_alloc is
+    // thrown) none of it is.
+    void append(const char *data, size_t len)
+    {
+        size_t space = (tail != nullptr) ? (chunk_data_size - tail->end) : 0;
+
+        if (len > space) {
+            // Obtain all the chunks needed before copying anything:
+            chunk *first_new = nullptr;
+            chunk *last_new = nullptr;
+            try {
+                for (size_t needed = len - space; ; needed -= chunk_data_size) {
+                    chunk *c = obtain_chunk();
+                    if (last_new == nullptr) {
+                        first_new = c;
+                    }
+                    else {
+                        last_new->next = c;
+                    }
+                    last_new = c;
+                    if (needed <= chunk_data_size) break;
+                }
+            }
+            catch (std::bad_alloc &) {
+                while (first_new != nullptr) {
+                    chunk *c = first_new;
+                    first_new = c->next;
+                    release_chunk(c);
+                }
+                throw;
+            }
+
+            if (tail == nullptr) {
+                head = first_new;
+            }
+            else {
+                tail->next = first_new;
+            }
+        }
+
+        chunk *c = (tail != nullptr) ? tail : head;
+        length += len;
+        while (len > 0) {
+            if (c->end == chunk_data_size) {
+                c = c->next;
+            }
+            unsigned count = std::min(len, (size_t)(chunk_data_size - c->end));
+            std::memcpy(c->data + c->end, data, count);
+            c->end += count;
+            data += count;
+            len -= count;
+        }
+        tail = c;
+    }
+
+    // Remove the given number of bytes (no more than the current length) from the start of the
+    // buffer.
+    void consume(size_t amount) noexcept
+    {
+        length -= amount;
+        while (amount > 0) {
+            unsigned avail = head->end - head->start;
+            if (amount < avail) {
+                head->start += amount;
+                break;
+            }
+            amount -= avail;
+            chunk *c = head;
+            head = c->next;
+            if (head == nullptr) tail = nullptr;
+            release_chunk(c);
+        }
+    }
+
+    // Write out as much of the buffer contents as possible to the given file descriptor, and
+    // remove whatever was written from the buffer. Returns the number of bytes written, or -1 if
+    // an error occurred (with errno set, and possibly with some data having been written).
+    ssize_t write_to(int fd) noexcept
+    {
+        ssize_t total = 0;
+        while (length > 0) {
+            struct iovec iov[max_iov];
+            int iovcnt = 0;
+            size_t iov_length = 0;
+            for (chunk *c = head; c != nullptr && iovcnt < max_iov; c = c->next) {
+                iov[iovcnt].iov_base = c->data + c->start;
+                iov[iovcnt].iov_len = c->end - c->start;
+                iov_length += iov[iovcnt].iov_len;
+                iovcnt++;
+            }
+
+            ssize_t r = writev(fd, iov, iovcnt);
+            if (r == -1) {
+                return -1;
+            }
+            consume(r);
+            total += r;
+            if ((size_t)r < iov_length) break;
+        }
+        return total;
+    }
+};
+
+#endif
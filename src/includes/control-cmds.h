@@ -26,6 +26,62 @@ constexpr static int DINIT_CP_LISTSERVICES = 8;
 constexpr static int DINIT_CP_SHUTDOWN = 10;
  // followed by 1-byte shutdown type
 
+// Retrieve the service timeline trace:
+constexpr static int DINIT_CP_QUERYTRACE = 11;
+
+// Analyse the critical chain of a service:
+constexpr static int DINIT_CP_CRITICALCHAIN = 12;
+ // followed by 2-byte service name length, service name
+
+// Re-open service log files (on next launch of each service process):
+constexpr static int DINIT_CP_REOPENLOGS = 13;
+
+// Retrieve the captured output of a service (log-type = buffer):
+constexpr static int DINIT_CP_CATLOG = 14;
+ // followed by 1-byte flags, 4-byte service handle
+
+// CATLOG flags:
+constexpr static int DINIT_CATLOG_CLEAR = 1;  // clear the buffer after retrieving contents
+
+// Release a service handle (no further events will be reported for it; the handle may be
+// re-used by a later FIND/LOAD):
+constexpr static int DINIT_CP_CLOSEHANDLE = 15;
+ // followed by 4-byte service handle
+
+// Apply several operations, each to a service given by handle or by name, in one request:
+constexpr static int DINIT_CP_BATCH = 16;
+ // followed by 2-byte packet length (including type and length, at most 1024), then entries:
+ //   1-byte operation (DINIT_CP_STARTSERVICE/STOPSERVICE/WAKESERVICE/RELEASESERVICE, or
+ //   DINIT_CP_LOADSERVICE to only load the service), 1-byte flags, then 4-byte service handle,
+ //   or (with DINIT_BATCH_BYNAME) 2-byte service name length and service name. A service given
+ //   by name is loaded and a new handle allocated for it.
+
+// BATCH entry flags:
+constexpr static int DINIT_BATCH_PIN = 1;     // pin the service in the requested state
+constexpr static int DINIT_BATCH_BYNAME = 2;  // service is given by name rather than handle
+
+// Subscribe to events for all services (or those matching a filter), which are then reported via
+// DINIT_IP_SUBSCRIBEDEVENT / DINIT_IP_SERVICECHANGED. Subscribing again replaces the filter.
+constexpr static int DINIT_CP_SUBSCRIBE = 17;
+ // followed by 1-byte flags, 1-byte service type, 2-byte name prefix length, name prefix
+
+// SUBSCRIBE flags:
+constexpr static int DINIT_SUBSCRIBE_TYPE = 1;    // only services of the given type
+constexpr static int DINIT_SUBSCRIBE_PREFIX = 2;  // only services whose name has the given prefix
+
+// Cancel a subscription:
+constexpr static int DINIT_CP_UNSUBSCRIBE = 18;
+
+// Query the status (with runtime statistics) of a service:
+constexpr static int DINIT_CP_SERVICESTATUS = 19;
+ // followed by 4-byte service handle
+
+// List the status of all loaded services (replies SERVICESTATUS for each, then LISTDONE):
+constexpr static int DINIT_CP_LISTSTATUS = 20;
+
+// Query control connection output buffer and service arena statistics (for debugging):
+constexpr static int DINIT_CP_BUFFERSTATS = 21;
+
 
 
 // Replies:
@@ -64,6 +120,56 @@ constexpr static int DINIT_RP_ALREADYSS = 61;
 constexpr static int DINIT_RP_SVCINFO = 62;
 constexpr static int DINIT_RP_LISTDONE = 63;
 
+// Service timeline trace entry / trace complete:
+constexpr static int DINIT_RP_TRACEREC = 64;
+//     followed by 1-byte event, 2-byte service name length, 2-byte dependency name length,
+//     8-byte seconds, 4-byte nanoseconds (CLOCK_MONOTONIC), service name, dependency name
+constexpr static int DINIT_RP_TRACEDONE = 65;
+
+// Critical chain link (one per service in the chain, starting with the requested service):
+constexpr static int DINIT_RP_CHAINLINK = 66;
+//     followed by 1-byte service type, 2-byte service name length, 8-byte time start
+//     commenced, 8-byte time dependencies started, 8-byte time started (CLOCK_MONOTONIC
+//     nanoseconds, or 0), service name
+
+// Start time "blame" by service type (following the chain links; ends with LISTDONE):
+constexpr static int DINIT_RP_BLAME = 67;
+//     followed by 1-byte service type, 4-byte count of started services, 8-byte total
+//     start time (nanoseconds, from dependencies started until service started)
+
+// Captured service output:
+constexpr static int DINIT_RP_SERVICE_LOG = 68;
+//     followed by 1-byte flags (reserved), 4-byte length, output
+
+// Reply to BATCH:
+constexpr static int DINIT_RP_BATCHREPLY = 69;
+//     followed by 2-byte number of entries, then for each entry in the request: 1-byte result
+//     (DINIT_RP_ACK if issued, DINIT_RP_ALREADYSS if already started/stopped, or
+//     DINIT_RP_NOSERVICE if the service could not be loaded), 4-byte service handle, 1-byte
+//     service state
+
+// Service status:
+constexpr static int DINIT_RP_SERVICESTATUS = 70;
+//     followed by 1-byte service state, 1-byte target state, 1-byte flags (SSTATUS_*), 1-byte
+//     service name length, 4-byte process ID (-1 if none), 4-byte exit status of the most recent
+//     process to terminate (as from waitpid), 4-byte restart count in the current restart
+//     interval, 4-byte total restart count, 4-byte count of orphaned descendants reaped, 4-byte
+//     console queue position (1 = next; 0 if not waiting for the console), 8-byte time since the
+//     most recent process was launched (nanoseconds; 0 if never), 8-byte duration of the most
+//     recent start (nanoseconds, from start commenced until started; 0 if not started), name
+
+// SERVICESTATUS flags:
+constexpr static int DINIT_SSTATUS_HAS_EXIT_STATUS = 1;  // a process has terminated (exit status is valid)
+
+// Control connection output buffer statistics (across all connections), and service arena
+// statistics:
+constexpr static int DINIT_RP_BUFFERSTATS = 71;
+//     followed by 4-byte chunk size, 8-byte count of chunks allocated (in use or kept free), 8-byte
+//     count of chunks kept free for re-use, 8-byte total of chunks newly allocated, 8-byte total of
+//     chunks re-used;
+//     then 4-byte arena slab size, 8-byte count of slabs, 8-byte count of objects in use (in
+//     slabs), 8-byte count of objects kept free for re-use, 8-byte count of large objects
+
 // Information:
 
 // Service event occurred (4-byte service handle, 1 byte event code)
@@ -71,3 +177,13 @@ constexpr static int DINIT_IP_SERVICEEVENT = 100;
 
 // rollback completed
 constexpr static int DINIT_ROLLBACK_COMPLETED = 101;
+
+// Service event occurred, for a subscriber (see DINIT_CP_SUBSCRIBE):
+constexpr static int DINIT_IP_SUBSCRIBEDEVENT = 102;
+//     followed by 1-byte event code, 1-byte service state, 1-byte target state, service name
+//     (truncated to 250 bytes)
+
+// Service status changed, for a subscriber which did not receive events quickly enough (the
+// individual events were coalesced):
+constexpr static int DINIT_IP_SERVICECHANGED = 103;
+//     followed by 1-byte service state, 1-byte target state, service name (truncated)
@@ -3,9 +3,12 @@
 
 #include <list>
 #include <vector>
-#include <unordered_map>
+#include <deque>
+#include <unordered_set>
+#include <string>
 #include <limits>
 #include <cstddef>
+#include <cstring>
 
 #include <unistd.h>
 
@@ -16,6 +19,7 @@
 #include "control-cmds.h"
 #include "service-listener.h"
 #include "cpbuffer.h"
+#include "chunk-buffer.h"
 
 // Control connection for dinit
 
@@ -45,6 +49,22 @@ extern int active_control_conns;
 class service_set;
 class service_record;
 
+// A service event, serialised once (as a DINIT_IP_SUBSCRIBEDEVENT packet) for delivery to all
+// subscribers. Reference counted, since it may be held (queued) for slow subscribers.
+class event_packet
+{
+    public:
+    unsigned refcount = 0;
+    service_record *service = nullptr;
+    unsigned char len = 0;
+    char data[255];
+
+    void release() noexcept
+    {
+        if (--refcount == 0) delete this;
+    }
+};
+
 class control_conn_watcher : public eventloop_t::bidi_fd_watcher_impl<control_conn_watcher>
 {
     inline rearm receive_event(eventloop_t &loop, int fd, int flags) noexcept;
@@ -79,9 +99,11 @@ inline dasynq::rearm control_conn_watcher::receive_event(eventloop_t &loop, int
 }
 
 
-class control_conn_t : private service_listener
+class control_conn_t : private service_handle_listener
 {
     friend rearm control_conn_cb(eventloop_t *loop, control_conn_watcher *watcher, int revents);
+    friend class service_event_bus;
+    friend class control_conn_t_test;
     
     control_conn_watcher iob;
     eventloop_t &loop;
@@ -100,20 +122,50 @@ class control_conn_t : private service_listener
     template <typename T> using list = std::list<T>;
     template <typename T> using vector = std::vector<T>;
     
-    // A mapping between service records and their associated numerical identifier used
-    // in communction
+    // Service handles: the numerical identifier used in communication for a service is an index
+    // into this table. A free slot has a null service and is linked (via its id) into the free
+    // list. Each slot in use is also linked into the service record's list of handles. (A deque
+    // is used since slots must not move when the table grows).
     using handle_t = uint32_t;
-    std::unordered_multimap<service_record *, handle_t> serviceKeyMap;
-    std::unordered_map<handle_t, service_record *> keyServiceMap;
+    std::deque<service_handle> handles;
+    static constexpr handle_t no_handle = std::numeric_limits<handle_t>::max();
+    handle_t first_free_handle = no_handle;
     
-    // Buffer for outgoing packets. Each outgoing back is represented as a vector<char>.
-    list<vector<char>> outbuf;
-    // Current index within the first outgoing packet (all previous bytes have been sent).
-    unsigned outpkt_index = 0;
+    // Buffer for outgoing packets (which are packed together).
+    chunk_buffer outbuf;
+
+    // Whether writing of queued packets is deferred until the current request has been processed
+    // (so that all the packets in a reply are written together).
+    bool defer_flush = false;
+
+    // Subscription to events for all services (via the service event bus), with filter
+    bool subscribed = false;
+    int subscribe_flags = 0;
+    service_type_t subscribe_type = service_type_t::INTERNAL;
+    std::string subscribe_prefix;
+    lld_node<control_conn_t> subscriber_node;
+
+    static lld_node<control_conn_t> &extract_subscriber_node(control_conn_t *conn) noexcept
+    {
+        return conn->subscriber_node;
+    }
+
+    // Subscribed events are held (rather than queued as output) while the output buffer is over
+    // max_event_outbuf, up to max_pending_events. Beyond that, events are coalesced: the affected
+    // services are recorded, and their current status is sent once the output buffer drains.
+    static constexpr size_t max_event_outbuf = 16384;
+    static constexpr unsigned max_pending_events = 64;
+    std::deque<event_packet *> pending_events;
+    std::unordered_set<service_record *> changed_services;
+    bool coalescing_events = false;
+
+    // Write out as much queued output as possible, and set the in/out watch enabled state
+    // accordingly. Returns false if an error occurred (the connection should be closed).
+    bool flush_outbuf() noexcept;
     
-    // Queue a packet to be sent
-    //  Returns:  false if the packet could not be queued and a suitable error packet
-    //              could not be sent/queued (the connection should be closed);
+    // Queue a packet to be sent (it is written immediately, unless a request is being processed)
+    //  Returns:  false if an error occurred writing queued packets (the connection should be
+    //              closed);
     //            true (with bad_conn_close == false) if the packet was successfully
     //              queued;
     //            true (with bad_conn_close == true) if the packet was not successfully
@@ -137,11 +189,57 @@ class control_conn_t : private service_listener
     // Process a FINDSERVICE/LOADSERVICE packet. May throw std::bad_alloc.
     bool process_find_load(int pktType);
 
+    // Issue a start/stop/wake/release order (DINIT_CP_STARTSERVICE etc) for a service, without
+    // processing the resulting queued actions. Other operations are ignored.
+    void issue_start_stop(service_record *service, int op, bool do_pin);
+
+    // Process a BATCH packet. May throw std::bad_alloc.
+    bool process_batch();
+
     // Process an UNPINSERVICE packet. May throw std::bad_alloc.
     bool process_unpin_service();
     
     bool list_services();
 
+    // Process a QUERYTRACE packet.
+    bool list_trace();
+
+    // Process a CRITICALCHAIN packet. May throw std::bad_alloc.
+    bool process_critical_chain();
+
+    // Process a CATLOG packet. May throw std::bad_alloc.
+    bool process_catlog();
+
+    // Process a BUFFERSTATS packet.
+    bool process_buffer_stats();
+
+    // Process a SERVICESTATUS packet, or a LISTSTATUS packet.
+    bool process_service_status();
+    bool list_service_status();
+
+    // Queue a SERVICESTATUS reply for a service.
+    bool queue_service_status(service_record *service) noexcept;
+
+    // Process a CLOSEHANDLE packet. May throw std::bad_alloc.
+    bool process_close_handle();
+
+    // Process a SUBSCRIBE/UNSUBSCRIBE packet. May throw std::bad_alloc.
+    bool process_subscribe();
+    bool process_unsubscribe();
+
+    // Check whether a service matches the subscription filter.
+    bool subscription_matches(service_record *service) noexcept;
+
+    // Deliver an event (from the service event bus) to this subscriber. The event packet may be
+    // null (if it could not be allocated), in which case the event is coalesced.
+    void subscribed_event(service_record *service, event_packet *ep) noexcept;
+
+    // Queue held (and coalesced) subscribed events as output, while there is room.
+    void drain_events() noexcept;
+
+    // Cancel the subscription (if any), discarding held events.
+    void end_subscription() noexcept;
+
     // Notify that data is ready to be read from the socket. Returns true if the connection should
     // be closed.
     bool data_ready() noexcept;
@@ -150,15 +248,14 @@ class control_conn_t : private service_listener
     
     // Allocate a new handle for a service; may throw std::bad_alloc
     handle_t allocate_service_handle(service_record *record);
+
+    // Release a handle (which must be in use).
+    void release_service_handle(handle_t handle) noexcept;
     
-    service_record *find_service_for_key(uint32_t key)
+    service_record *find_service_for_key(uint32_t key) noexcept
     {
-        try {
-            return keyServiceMap.at(key);
-        }
-        catch (std::out_of_range &exc) {
-            return nullptr;
-        }
+        if (key >= handles.size()) return nullptr;
+        return handles[key].service;
     }
     
     // Close connection due to out-of-memory condition.
@@ -172,32 +269,17 @@ class control_conn_t : private service_listener
     // Process service event broadcast.
     // Note that this can potentially be called during packet processing (upon issuing
     // service start/stop orders etc).
-    void service_event(service_record * service, service_event_t event) noexcept final override
+    void service_event(service_handle &handle, service_event_t event) noexcept final override
     {
-        // For each service handle corresponding to the event, send an information packet.
-        auto range = serviceKeyMap.equal_range(service);
-        auto & i = range.first;
-        auto & end = range.second;
-        try {
-            while (i != end) {
-                uint32_t key = i->second;
-                std::vector<char> pkt;
-                constexpr int pktsize = 3 + sizeof(key);
-                pkt.reserve(pktsize);
-                pkt.push_back(DINIT_IP_SERVICEEVENT);
-                pkt.push_back(pktsize);
-                char * p = (char *) &key;
-                for (int j = 0; j < (int)sizeof(key); j++) {
-                    pkt.push_back(*p++);
-                }
-                pkt.push_back(static_cast<char>(event));
-                queue_packet(std::move(pkt));
-                ++i;
-            }
-        }
-        catch (std::bad_alloc &exc) {
-            do_oom_close();
-        }
+        // Send an information packet for the handle.
+        uint32_t key = handle.id;
+        constexpr int pktsize = 3 + sizeof(key);
+        char pkt[pktsize];
+        pkt[0] = DINIT_IP_SERVICEEVENT;
+        pkt[1] = pktsize;
+        std::memcpy(pkt + 2, &key, sizeof(key));
+        pkt[2 + sizeof(key)] = static_cast<char>(event);
+        queue_packet(pkt, pktsize);
     }
     
     public:
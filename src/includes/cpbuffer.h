@@ -80,7 +80,7 @@ template <int SIZE> class cpbuffer
     char operator[](int idx) noexcept
     {
         int dest_idx = cur_idx + idx;
-        if (dest_idx > SIZE) dest_idx -= SIZE;
+        if (dest_idx >= SIZE) dest_idx -= SIZE;
         return buf[dest_idx];
     }
     
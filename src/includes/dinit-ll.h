@@ -68,6 +68,18 @@ class dlist
         }
     }
 
+    T * head() noexcept
+    {
+        return first;
+    }
+
+    // Get the element following the given element in the list, or nullptr if it is the tail.
+    T * next(T *e) noexcept
+    {
+        T * n = E(e).next;
+        return (n == first) ? nullptr : n;
+    }
+
     bool is_empty() noexcept
     {
         return first == nullptr;
@@ -3,10 +3,17 @@
 
 #include <cstddef>
 #include <cerrno>
+#include <algorithm>
 
 #include <sys/types.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#include <cstring>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#endif
+
 // Signal-safe read. Read and re-try if interrupted by signal (EINTR).
 // *May* affect errno even on a successful read (when the return is less than n).
 inline ssize_t ss_read(int fd, void * buf, size_t n)
@@ -36,4 +43,88 @@ inline ssize_t ss_read(int fd, void * buf, size_t n)
     return n;
 }
 
+#ifdef __linux__
+
+// Close the file descriptors in the range [first, last], using close_range() (Linux 5.9+).
+// Returns false if close_range() isn't available.
+inline bool close_fd_range(unsigned first, unsigned last) noexcept
+{
+#ifdef SYS_close_range
+    return syscall(SYS_close_range, first, last, 0) == 0;
+#else
+    return false;
+#endif
+}
+
+// Close all file descriptors other than those in keep[0..nkeep) (which must be sorted), by
+// scanning /proc/self/fd. Does not allocate memory.
+inline void close_fds_by_scan(const int *keep, int nkeep) noexcept
+{
+    int dir_fd = open("/proc/self/fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd == -1) {
+        return;
+    }
+
+    // Read directory entries (struct linux_dirent64: 8-byte inode, 8-byte offset, 2-byte record
+    // length, 1-byte type, name). Closing descriptors while reading may cause entries to be
+    // missed, so re-scan until a pass closes nothing.
+    alignas(8) char buf[1024];
+    bool closed_any;
+    do {
+        closed_any = false;
+        lseek(dir_fd, 0, SEEK_SET);
+        long n;
+        while ((n = syscall(SYS_getdents64, dir_fd, buf, sizeof(buf))) > 0) {
+            for (long pos = 0; pos < n; ) {
+                unsigned short reclen;
+                std::memcpy(&reclen, buf + pos + 16, sizeof(reclen));
+                const char *name = buf + pos + 19;
+                pos += reclen;
+
+                if (*name < '0' || *name > '9') continue;  // "." or ".."
+                int fd = 0;
+                for ( ; *name != 0; ++name) {
+                    fd = fd * 10 + (*name - '0');
+                }
+                if (fd == dir_fd || std::binary_search(keep, keep + nkeep, fd)) continue;
+                close(fd);
+                closed_any = true;
+            }
+        }
+    } while (closed_any);
+
+    close(dir_fd);
+}
+
+// Close all file descriptors other than those in keep[0..nkeep) (which is sorted in place). For
+// use in a child process before exec: does not allocate memory. If close_range() isn't available,
+// falls back to scanning /proc/self/fd (so only open descriptors are visited).
+inline void close_fds_except(int *keep, int nkeep) noexcept
+{
+    for (int i = 1; i < nkeep; i++) {
+        int fd = keep[i];
+        int j = i;
+        for ( ; j > 0 && keep[j - 1] > fd; j--) {
+            keep[j] = keep[j - 1];
+        }
+        keep[j] = fd;
+    }
+
+    unsigned next = 0;
+    bool done = true;
+    for (int i = 0; i < nkeep && done; i++) {
+        if ((unsigned)keep[i] > next) {
+            done = close_fd_range(next, keep[i] - 1);
+        }
+        next = std::max(next, (unsigned)keep[i] + 1);
+    }
+    if (done && close_fd_range(next, ~0U)) {
+        return;
+    }
+
+    close_fds_by_scan(keep, nkeep);
+}
+
+#endif
+
 #endif
@@ -0,0 +1,299 @@
+#ifndef LOAD_SERVICE_H_INCLUDED
+#define LOAD_SERVICE_H_INCLUDED 1
+
+#include <string>
+#include <list>
+#include <utility>
+#include <cstring>
+#include <cstdint>
+
+#include "service.h"
+
+// Service description parsing. The tokenizer works directly over a buffer holding the whole
+// description file, splitting lines with memchr and appending unescaped runs of characters to
+// values in bulk. Setting names and values are only copied once, into the strings passed to the
+// setting handler.
+
+namespace dinit_load {
+
+class setting_exception
+{
+    std::string info;
+
+    public:
+    setting_exception(const std::string &&exc_info) : info(std::move(exc_info))
+    {
+    }
+
+    std::string &get_info()
+    {
+        return info;
+    }
+};
+
+// Check for white space, as per isspace() in the "classic" locale. This is locale-independent
+// (and much cheaper than std::isspace with a locale argument).
+inline bool is_ws(char c) noexcept
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// Check for an alphabetic character (in the "classic" locale).
+inline bool is_alpha(char c) noexcept
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+// Utility function to skip white space. Returns a pointer to the first non-white-space
+// position (or end).
+inline const char *skipws(const char *i, const char *end) noexcept
+{
+    while (i != end && is_ws(*i)) {
+        ++i;
+    }
+    return i;
+}
+
+// Read a setting name.
+inline std::string read_setting_name(const char *&i, const char *end)
+{
+    const char *start = i;
+    // Allow alphabetical characters, and dash (-) in setting name
+    while (i != end && (*i == '-' || is_alpha(*i))) {
+        ++i;
+    }
+    return std::string(start, i);
+}
+
+// Read a setting value
+//
+// In general a setting value is a single-line string. It may contain multiple parts
+// separated by white space (which is normally collapsed). A hash mark - # - denotes
+// the end of the value and the beginning of a comment (it should be preceded by
+// whitespace).
+//
+// Part of a value may be quoted using double quote marks, which prevents collapse
+// of whitespace and interpretation of most special characters (the quote marks will
+// not be considered part of the value). A backslash can precede a character (such
+// as '#' or '"' or another backslash) to remove its special meaning. Newline
+// characters are not allowed in values and cannot be quoted.
+//
+// This function expects the string to be in an ASCII-compatible, single byte
+// encoding (the "classic" locale).
+//
+// Params:
+//    i  -  reference to pointer through the line
+//    end -   pointer to end of line
+//    part_positions -  list of <int,int> to which the position of each setting value
+//                      part will be added as [start,end). May be null.
+inline std::string read_setting_value(const char *&i, const char *end,
+        std::list<std::pair<unsigned,unsigned>> * part_positions = nullptr)
+{
+    i = skipws(i, end);
+
+    std::string rval;
+    bool new_part = true;
+    unsigned part_start = 0;
+
+    while (i != end) {
+        char c = *i;
+        if (c == '\"') {
+            if (new_part) {
+                part_start = rval.length();
+                new_part = false;
+            }
+            // quoted string
+            ++i;
+            while (true) {
+                const char *run_start = i;
+                while (i != end && *i != '\"' && *i != '\\' && *i != '\n') {
+                    ++i;
+                }
+                rval.append(run_start, i);
+                if (i == end) {
+                    // String wasn't terminated
+                    throw setting_exception("Unterminated quoted string");
+                }
+                c = *i;
+                if (c == '\"') break;
+                if (c == '\n') {
+                    throw setting_exception("Line end inside quoted string");
+                }
+                // A backslash escapes the following character.
+                ++i;
+                if (i == end) {
+                    throw setting_exception("Unterminated quoted string");
+                }
+                if (*i == '\n') {
+                    throw setting_exception("Line end follows backslash escape character (`\\')");
+                }
+                rval += *i;
+                ++i;
+            }
+            ++i; // skip closing quote
+        }
+        else if (c == '\\') {
+            if (new_part) {
+                part_start = rval.length();
+                new_part = false;
+            }
+            // A backslash escapes the next character
+            ++i;
+            if (i != end) {
+                rval += *i;
+                ++i;
+            }
+            else {
+                throw setting_exception("Backslash escape (`\\') not followed by character");
+            }
+        }
+        else if (is_ws(c)) {
+            if (! new_part && part_positions != nullptr) {
+                part_positions->emplace_back(part_start, rval.length());
+                new_part = true;
+            }
+            i = skipws(i, end);
+            if (i == end) break;
+            if (*i == '#') break; // comment
+            rval += ' ';  // collapse ws to a single space
+        }
+        else if (c == '#') {
+            // Possibly intended a comment; we require leading whitespace to reduce occurrence of accidental
+            // comments in setting values.
+            throw setting_exception("hashmark (`#') comment must be separated from setting value by whitespace");
+        }
+        else {
+            if (new_part) {
+                part_start = rval.length();
+                new_part = false;
+            }
+            // Append the run of ordinary characters in one go
+            const char *run_start = i;
+            do {
+                ++i;
+            } while (i != end && (c = *i) != '\"' && c != '\\' && c != '#' && ! is_ws(c));
+            rval.append(run_start, i);
+        }
+    }
+
+    // Got to end:
+    if (! new_part && part_positions != nullptr) {
+        part_positions->emplace_back(part_start, rval.length());
+    }
+
+    return rval;
+}
+
+// Process a service description held in the buffer [buf, buf_end), calling
+// func(setting, value, parts) for each setting found. The parts are the [start,end)
+// positions of each part of the value.
+//
+// Throws setting_exception or service_description_exc if the description is badly formed.
+template <typename T>
+void process_service_file(const std::string &name, const char *buf, const char *buf_end, T func)
+{
+    const char *line = buf;
+    while (line != buf_end) {
+        const char *eol = static_cast<const char *>(std::memchr(line, '\n', buf_end - line));
+        if (eol == nullptr) {
+            eol = buf_end;
+        }
+
+        const char *i = skipws(line, eol);
+        line = (eol == buf_end) ? eol : eol + 1;
+
+        if (i == eol || *i == '#') {
+            continue;  // blank or comment line
+        }
+
+        std::string setting = read_setting_name(i, eol);
+        i = skipws(i, eol);
+        if (i == eol || (*i != '=' && *i != ':')) {
+            throw service_description_exc(name, "Badly formed line.");
+        }
+        i = skipws(++i, eol);
+
+        std::list<std::pair<unsigned,unsigned>> parts;
+        std::string value = read_setting_value(i, eol, &parts);
+        func(setting, value, parts);
+    }
+}
+
+
+// Bounds-checked reader for the service description cache (see load_service.cc for the format)
+class cache_reader
+{
+    const char *pos;
+    const char *end;
+
+    public:
+    cache_reader(const char *pos_p, const char *end_p) noexcept : pos(pos_p), end(end_p) { }
+
+    template <typename T> bool get(T &val) noexcept
+    {
+        if ((size_t)(end - pos) < sizeof(T)) return false;
+        std::memcpy(&val, pos, sizeof(T));
+        pos += sizeof(T);
+        return true;
+    }
+
+    // Get a pointer to (and skip over) a sequence of bytes
+    bool get_bytes(const char *&p, size_t len) noexcept
+    {
+        if ((size_t)(end - pos) < len) return false;
+        p = pos;
+        pos += len;
+        return true;
+    }
+
+    const char *get_pos() noexcept
+    {
+        return pos;
+    }
+};
+
+} // namespace dinit_load
+
+template <typename T>
+void service_desc_cache::replay(const char *entry, T func)
+{
+    // The entry has already been validated (in open()), so we need not check bounds here.
+    dinit_load::cache_reader reader(entry, base + length);
+    uint16_t name_len;
+    const char *p;
+    int64_t mtime_sec;
+    uint32_t mtime_nsec;
+    uint64_t size;
+    uint32_t num_settings;
+    reader.get(name_len);
+    reader.get_bytes(p, name_len);
+    reader.get(mtime_sec);
+    reader.get(mtime_nsec);
+    reader.get(size);
+    reader.get(num_settings);
+
+    for (uint32_t j = 0; j < num_settings; j++) {
+        uint16_t setting_len;
+        uint32_t value_len;
+        uint16_t num_parts;
+        reader.get(setting_len);
+        reader.get_bytes(p, setting_len);
+        std::string setting(p, setting_len);
+        reader.get(value_len);
+        reader.get_bytes(p, value_len);
+        std::string value(p, value_len);
+        reader.get(num_parts);
+
+        std::list<std::pair<unsigned,unsigned>> parts;
+        for (uint16_t k = 0; k < num_parts; k++) {
+            uint32_t part_start, part_end;
+            reader.get(part_start);
+            reader.get(part_end);
+            parts.emplace_back(part_start, part_end);
+        }
+
+        func(setting, value, parts);
+    }
+}
+
+#endif
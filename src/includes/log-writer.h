@@ -0,0 +1,63 @@
+#ifndef LOG_WRITER_H_INCLUDED
+#define LOG_WRITER_H_INCLUDED 1
+
+#include <memory>
+#include <string>
+#include <cstdint>
+
+class base_process_service;
+
+// Log files which dinit writes itself (logfile-max-size) are written, and rotated, by a separate
+// writer thread, so that a slow or stalled disk does not block the event loop. A service hands
+// a block of its buffered output to the writer as a job; while the job is in progress, further
+// output accumulates in the service's log buffer (and, once that is full, in the output pipe).
+
+// A log write job: a block of output to be written to a log file, together with the state of
+// the file. While the job is in progress it belongs to the writer thread, and must not be
+// touched by the service.
+class log_write_job
+{
+    public:
+    base_process_service *service;  // owning service (nullptr if the service has been deleted)
+    log_write_job *next = nullptr;  // next job in writer queue
+    bool in_progress = false;       // queued for, or being performed by, the writer
+
+    // Log file settings:
+    std::string path;
+    uint64_t max_size;  // size at which the file is rotated
+    int keep;           // number of rotated files kept
+
+    // Log file state:
+    int fd = -1;        // log file, or -1 if not (yet) open
+    uint64_t size = 0;  // current size of log file
+    bool reopen = false;  // close the file, and open it again by path, before writing
+
+    // Output to write: data[start, end) remains unwritten.
+    std::unique_ptr<char[]> data;
+    int capacity;
+    int start = 0;
+    int end = 0;
+
+    // Result of the job:
+    bool would_block = false;    // the file couldn't accept all output; retry later
+    bool rotate_failed = false;  // the file couldn't be rotated (out of memory)
+
+    // Throws: std::bad_alloc
+    log_write_job(base_process_service *service_p, const std::string &path_p, uint64_t max_size_p,
+            int keep_p, int capacity_p)
+        : service(service_p), path(path_p), max_size(max_size_p), keep(keep_p),
+          data(new char[capacity_p]), capacity(capacity_p)
+    {
+    }
+};
+
+// Queue a job to be performed by the writer thread. When the job is complete (or fails),
+// base_process_service::log_write_complete() is called for the service from the event loop.
+// If the writer thread can't be started, the job is performed (and completed) immediately.
+void queue_log_write(log_write_job *job) noexcept;
+
+// Release the job of a service which is being deleted. The job (and its log file) is closed once
+// any write in progress has finished.
+void release_log_write_job(log_write_job *job) noexcept;
+
+#endif
@@ -1,4 +1,6 @@
 #include "service.h"
+#include "ring-buffer.h"
+#include "log-writer.h"
 
 // Given a string and a list of pairs of (start,end) indices for each argument in that string,
 // store a null terminator for the argument. Return a `char *` vector containing the beginning
@@ -22,10 +24,58 @@ class process_restart_timer : public eventloop_t::timer_impl<process_restart_tim
     dasynq::rearm timer_expiry(eventloop_t &, int expiry_count);
 };
 
+// Watcher for the pipe over which a process signals readiness (ready-notification = pipefd:N).
+class ready_notify_watcher : public eventloop_t::fd_watcher_impl<ready_notify_watcher>
+{
+    public:
+    base_process_service * service;
+    dasynq::rearm fd_event(eventloop_t &eloop, int fd, int flags) noexcept;
+
+    ready_notify_watcher(base_process_service * sr) noexcept : service(sr) { }
+};
+
+// Watcher for the pipe from which service process output is read into the log buffer
+// (log-type = buffer).
+class log_output_watcher : public eventloop_t::fd_watcher_impl<log_output_watcher>
+{
+    public:
+    base_process_service * service;
+    dasynq::rearm fd_event(eventloop_t &eloop, int fd, int flags) noexcept;
+
+    log_output_watcher(base_process_service * sr) noexcept : service(sr) { }
+};
+
+// Timer for retrying writes of output to the log file (logfile-max-size), when the file did
+// not accept them immediately.
+class log_flush_timer : public eventloop_t::timer_impl<log_flush_timer>
+{
+    public:
+    base_process_service * service;
+
+    log_flush_timer(base_process_service *service_p) noexcept : service(service_p) { }
+
+    dasynq::rearm timer_expiry(eventloop_t &, int expiry_count);
+};
+
+// Watcher (via inotify) for changes to the cgroup.events file of a service's cgroup, used to
+// determine when all processes in the cgroup have terminated.
+class cgroup_events_watcher : public eventloop_t::fd_watcher_impl<cgroup_events_watcher>
+{
+    public:
+    base_process_service * service;
+    dasynq::rearm fd_event(eventloop_t &eloop, int fd, int flags) noexcept;
+
+    cgroup_events_watcher(base_process_service * sr) noexcept : service(sr) { }
+};
+
 class base_process_service : public service_record
 {
     friend class service_child_watcher;
     friend class exec_status_pipe_watcher;
+    friend class ready_notify_watcher;
+    friend class log_output_watcher;
+    friend class log_flush_timer;
+    friend class cgroup_events_watcher;
     friend class base_process_service_test;
 
     private:
@@ -42,12 +92,45 @@ class base_process_service : public service_record
     service_child_watcher child_listener;
     exec_status_pipe_watcher child_status_listener;
     process_restart_timer restart_timer;
-    time_val last_start_time;
+    ready_notify_watcher readiness_watcher;
+    log_output_watcher log_output_listener;
+    log_flush_timer log_flush_retry_timer;
+    cgroup_events_watcher cgroup_watcher;
+    time_val last_start_time {0, 0};  // time the most recent process was launched
+
+    // Captured output (log-type = buffer, or a log file written by dinit): the buffer is
+    // allocated, and the output pipe created, when the process is first launched. The pipe is
+    // kept open across restarts.
+    ring_buffer log_buffer;
+    int log_buf_max = 4096;    // capacity of the log buffer
+    int log_output_fd = -1;    // read end of the output pipe, or -1
+
+    // With logfile-max-size, dinit writes output from the buffer to the log file itself (via the
+    // log writer thread), and rotates the file when it reaches the maximum size (keeping
+    // log_file_keep old files). The job holds the log file, and the output being written.
+    log_write_job *log_job = nullptr;  // created with the output pipe
+    uint64_t log_file_max_size = 0;  // 0 if dinit does not write the log file
+    int log_file_keep = 3;
+
+    // With a cgroup root (--cgroup-root), the service processes run in a cgroup (v2) of their
+    // own, created (and the resource settings applied) when the process is first launched.
+    int cgroup_fd = -1;          // cgroup directory, or -1 if not (yet) open
+    int cgroup_events_fd = -1;   // inotify instance watching cgroup.events, or -1
+    int cgroup_cpu_weight = 0;   // cpu.weight (1-10000), or 0 to leave the default
+    int cgroup_io_weight = 0;    // io.weight (1-10000), or 0 to leave the default
+    string cgroup_memory_max;    // memory.max, or empty to leave the default
+
+    // Readiness notification: the fd number at which the process receives the write end of the
+    // notification pipe (-1 if the process doesn't notify readiness), and our read end (-1 if not
+    // open).
+    int force_notification_fd = -1;
+    int notification_fd = -1;
 
     // Restart interval time and restart count are used to track the number of automatic restarts
     // over an interval. Too many restarts over an interval will inhibit further restarts.
     time_val restart_interval_time;  // current restart interval
     int restart_interval_count;      // count of restarts within current interval
+    unsigned total_restarts = 0;     // count of all automatic restarts
 
     time_val restart_interval;       // maximum restart interval
     int max_restart_interval_count;  // number of restarts allowed over maximum interval
@@ -65,6 +148,9 @@ class base_process_service : public service_record
     bool reserved_child_watch : 1;
     bool tracking_child : 1;  // whether we expect to see child process status
     bool start_is_interruptible : 1;  // whether we can interrupt start
+    bool log_output_paused : 1;  // output pipe watch disabled, as the log file isn't keeping up
+    bool log_file_reopen : 1;    // re-open the log file (by path) with the next write
+    bool waiting_cgroup_empty : 1;  // stopping; waiting for remaining processes in the cgroup to exit
 
     // Launch the process with the given arguments, return true on success
     bool start_ps_process(const std::vector<const char *> &args, bool on_console) noexcept;
@@ -91,6 +177,45 @@ class base_process_service : public service_record
     // Called if exec succeeds.
     virtual void exec_succeeded() noexcept { };
 
+    // Called when the process signals readiness via the notification pipe.
+    virtual void ready_notified() noexcept { };
+
+    // Stop watching, and close, the notification pipe.
+    void close_notification_fd() noexcept;
+
+    // Create the output pipe and allocate the log buffer (log-type = buffer, or a log file
+    // written by dinit), if not already done. Returns false on failure (with an error logged).
+    bool ensure_log_buffer() noexcept;
+
+    // Whether dinit writes process output to the log file itself (logfile-max-size)
+    bool writes_log_file() noexcept
+    {
+        return log_type == log_type_id::LOGFILE && log_file_max_size != 0 && ! logfile.empty();
+    }
+
+    // Pass buffered output to the log writer, unless a write is already in progress (in which
+    // case this is called again once it completes).
+    void flush_log_output() noexcept;
+
+    // Create the service cgroup, apply resource settings, and begin watching cgroup.events, if not
+    // already done. Returns false on failure (with an error logged).
+    bool ensure_cgroup() noexcept;
+
+    // Check whether any processes remain in the service cgroup.
+    bool cgroup_populated() noexcept;
+
+    // Kill all processes in the service cgroup (via cgroup.kill, or by signalling each process
+    // listed in cgroup.procs if that is not supported). Returns false on failure.
+    bool cgroup_kill() noexcept;
+
+    // The service process has terminated (or, for a bgprocess, is no longer tracked) while
+    // stopping. If other processes remain in the service cgroup, kill them and wait for the
+    // cgroup to become empty; otherwise, the service has stopped.
+    void complete_stop() noexcept;
+
+    // Called when cgroup.events has changed.
+    void cgroup_event() noexcept;
+
     virtual bool can_interrupt_start() noexcept override
     {
         return waiting_restart_timer || start_is_interruptible || service_record::can_interrupt_start();
@@ -114,9 +239,7 @@ class base_process_service : public service_record
             std::list<std::pair<unsigned,unsigned>> &command_offsets,
             const std::list<prelim_dep> &deplist_p);
 
-    ~base_process_service() noexcept
-    {
-    }
+    ~base_process_service() noexcept;
 
     // Set the stop command and arguments (may throw std::bad_alloc)
     void set_stop_command(std::string command, std::list<std::pair<unsigned,unsigned>> &stop_command_offsets)
@@ -151,6 +274,59 @@ class base_process_service : public service_record
         start_is_interruptible = value;
     }
 
+    // Set the fd number at which the process receives the readiness notification pipe, or -1.
+    void set_notification_fd(int fd) noexcept
+    {
+        force_notification_fd = fd;
+    }
+
+    // Set the capacity of the buffer for captured output (log-type = buffer)
+    void set_log_buf_max(int max) noexcept
+    {
+        log_buf_max = max;
+    }
+
+    // Set the size at which the log file is rotated (0 to not rotate), and number of rotated
+    // files to keep
+    void set_log_file_rotation(uint64_t max_size, int keep) noexcept
+    {
+        log_file_max_size = max_size;
+        log_file_keep = keep;
+    }
+
+    // Set the cgroup resource settings (0 or empty to leave the default)
+    void set_cgroup_settings(int cpu_weight, int io_weight, string &&memory_max) noexcept
+    {
+        cgroup_cpu_weight = cpu_weight;
+        cgroup_io_weight = io_weight;
+        cgroup_memory_max = std::move(memory_max);
+    }
+
+    virtual ring_buffer *get_log_buffer() noexcept override
+    {
+        return (log_type == log_type_id::BUFFER) ? &log_buffer : nullptr;
+    }
+
+    virtual unsigned get_restart_interval_count() noexcept override
+    {
+        return restart_interval_count;
+    }
+
+    virtual unsigned get_total_restarts() noexcept override
+    {
+        return total_restarts;
+    }
+
+    virtual int64_t get_last_launch_time() noexcept override
+    {
+        return int64_t(last_start_time.seconds()) * 1000000000 + last_start_time.nseconds();
+    }
+
+    virtual void reopen_log() noexcept override;
+
+    // A log write job (passed to the log writer by flush_log_output()) has completed.
+    void log_write_complete() noexcept;
+
     // The restart/stop timer expired.
     void timer_expired() noexcept;
 };
@@ -160,8 +336,12 @@ class process_service : public base_process_service
     virtual void handle_exit_status(int exit_status) noexcept override;
     virtual void exec_failed(int errcode) noexcept override;
     virtual void exec_succeeded() noexcept override;
+    virtual void ready_notified() noexcept override;
     virtual void bring_down() noexcept override;
 
+    // The process has started (and signalled readiness, if required).
+    void process_started() noexcept;
+
     public:
     process_service(service_set *sset, string name, string &&command,
             std::list<std::pair<unsigned,unsigned>> &command_offsets,
@@ -190,6 +370,8 @@ class bgproc_service : public base_process_service
     // Read the pid-file, return false on failure
     pid_result_t read_pid_file(int *exit_status) noexcept;
 
+    virtual void orphan_pid_exited(pid_t exited_pid, int status) noexcept override;
+
     public:
     bgproc_service(service_set *sset, string name, string &&command,
             std::list<std::pair<unsigned,unsigned>> &command_offsets,
@@ -0,0 +1,83 @@
+#ifndef REAPED_EXITS_H_INCLUDED
+#define REAPED_EXITS_H_INCLUDED 1
+
+#include <ctime>
+#include <sys/types.h>
+
+// History of recently reaped child processes which had no watcher: mainly orphaned descendants of
+// service processes (re-parented to dinit, which is a "subreaper" on Linux), but also, for
+// instance, a bgprocess daemon which terminated before its pid was read from the pid file. Held in
+// a fixed-size ring buffer (so that the most recent exits are kept).
+
+class reaped_exit
+{
+    public:
+    struct timespec time;  // time of reaping (CLOCK_MONOTONIC)
+    pid_t pid;
+    int status;            // exit status, as from waitpid()
+    pid_t pgid;            // process group and session of the process, if known (or -1); for a
+    pid_t sid;             //   process in a service cgroup, the session of the service process
+};
+
+class reaped_exit_history
+{
+    public:
+    static constexpr unsigned capacity = 64;
+
+    private:
+    reaped_exit entries[capacity];
+    unsigned first = 0;  // index of oldest entry
+    unsigned count = 0;  // number of entries
+
+    public:
+    void record(pid_t pid, int status, pid_t pgid, pid_t sid) noexcept
+    {
+        unsigned index = first + count;
+        if (index >= capacity) index -= capacity;
+        if (count == capacity) {
+            if (++first == capacity) first = 0;
+        }
+        else {
+            count++;
+        }
+
+        reaped_exit &entry = entries[index];
+        clock_gettime(CLOCK_MONOTONIC, &entry.time);
+        entry.pid = pid;
+        entry.status = status;
+        entry.pgid = pgid;
+        entry.sid = sid;
+    }
+
+    unsigned size() noexcept
+    {
+        return count;
+    }
+
+    // Get an entry, by index from the oldest (0) to the newest (size() - 1).
+    const reaped_exit &operator[](unsigned i) noexcept
+    {
+        unsigned index = first + i;
+        if (index >= capacity) index -= capacity;
+        return entries[index];
+    }
+
+    // Find the most recent exit of the given process, reaped no earlier than the given time.
+    // Returns nullptr if there is none.
+    const reaped_exit *find(pid_t pid, const struct timespec &since) noexcept
+    {
+        for (unsigned i = count; i > 0; i--) {
+            const reaped_exit &entry = (*this)[i - 1];
+            if (entry.time.tv_sec < since.tv_sec
+                    || (entry.time.tv_sec == since.tv_sec && entry.time.tv_nsec < since.tv_nsec)) {
+                break;
+            }
+            if (entry.pid == pid) {
+                return &entry;
+            }
+        }
+        return nullptr;
+    }
+};
+
+#endif
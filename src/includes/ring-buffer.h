@@ -0,0 +1,131 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <algorithm>
+#include <memory>
+#include <cstring>
+
+#include <unistd.h>
+
+// A circular buffer, like cpbuffer, but with capacity set (and changeable) at run time. Used to
+// hold captured service output (log-type = buffer).
+class ring_buffer
+{
+    std::unique_ptr<char[]> buf;
+    int size = 0;
+    int cur_idx = 0;
+    int length = 0;  // number of elements in the buffer
+
+    public:
+    int get_size() noexcept
+    {
+        return size;
+    }
+
+    int get_length() noexcept
+    {
+        return length;
+    }
+
+    int get_free() noexcept
+    {
+        return size - length;
+    }
+
+    // Change the capacity of the buffer. If the new capacity is smaller than the current
+    // length, the oldest contents are discarded.
+    // Throws: std::bad_alloc on allocation failure (the buffer is unchanged).
+    void resize(int new_size)
+    {
+        std::unique_ptr<char[]> new_buf(new char[new_size]);
+        int keep = std::min(length, new_size);
+        extract(new_buf.get(), length - keep, keep);
+        buf = std::move(new_buf);
+        size = new_size;
+        cur_idx = 0;
+        length = keep;
+    }
+
+    char * get_ptr(int index) noexcept
+    {
+        int pos = cur_idx + index;
+        if (pos >= size) pos -= size;
+        return &buf[pos];
+    }
+
+    // Get the length of the contiguous run of contents starting at the given index.
+    int get_contiguous_length(int index) noexcept
+    {
+        int pos = cur_idx + index;
+        if (pos >= size) pos -= size;
+        return std::min(length - index, size - pos);
+    }
+
+    // fill by reading from the given fd, return positive if some was read, 0 at end-of-file
+    // or if the buffer is full, or -1 on error.
+    int fill(int fd) noexcept
+    {
+        int pos = cur_idx + length;
+        if (pos >= size) pos -= size;
+        int max_count = std::min(size - pos, size - length);
+        if (max_count == 0) return 0;
+        ssize_t r = read(fd, &buf[pos], max_count);
+        if (r > 0) {
+            length += r;
+        }
+        return r;
+    }
+
+    // fill by reading from the given fd, discarding the oldest contents to make room if
+    // necessary. Return positive if some was read, 0 at end-of-file, or -1 on error.
+    int fill_overwrite(int fd) noexcept
+    {
+        if (size == 0) return 0;
+        int pos = cur_idx + length;
+        if (pos >= size) pos -= size;
+        ssize_t r = read(fd, &buf[pos], size - pos);
+        if (r > 0) {
+            length += r;
+            if (length > size) {
+                // overwrote the oldest contents
+                cur_idx += length - size;
+                if (cur_idx >= size) cur_idx -= size;
+                length = size;
+            }
+        }
+        return r;
+    }
+
+    // Remove the given number of bytes from the start of the buffer.
+    void consume(int amount) noexcept
+    {
+        cur_idx += amount;
+        if (cur_idx >= size) cur_idx -= size;
+        length -= amount;
+    }
+
+    void clear() noexcept
+    {
+        cur_idx = 0;
+        length = 0;
+    }
+
+    // Extract bytes from the buffer. The bytes remain in the buffer.
+    void extract(char *dest, int index, int length) noexcept
+    {
+        if (length == 0) return;
+        index += cur_idx;
+        if (index >= size) index -= size;
+        if (index + length > size) {
+            // wrap-around copy
+            int half = size - index;
+            std::memcpy(dest, &buf[index], half);
+            std::memcpy(dest + half, &buf[0], length - half);
+        }
+        else {
+            std::memcpy(dest, &buf[index], length);
+        }
+    }
+};
+
+#endif
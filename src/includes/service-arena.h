@@ -0,0 +1,182 @@
+#ifndef SERVICE_ARENA_H
+#define SERVICE_ARENA_H
+
+#include <cstddef>
+#include <new>
+
+// Statistics for a service arena, for debugging purposes.
+struct service_arena_stats
+{
+    unsigned long slabs = 0;   // slabs allocated
+    unsigned long in_use = 0;  // objects currently allocated from slabs
+    unsigned long free = 0;    // freed objects kept for re-use
+    unsigned long large = 0;   // objects currently allocated from the heap (too large for a slab)
+};
+
+// An arena from which a service set allocates its service records and the storage for their
+// dependency lists. Objects are carved from large slabs, which are kept until the arena is
+// destroyed. Freed objects are kept in per-size-class free lists, and re-used for later
+// allocations of the same size class. For a long-running process this keeps the records together
+// rather than scattered through (and fragmenting) the heap.
+class service_arena
+{
+    public:
+    static constexpr std::size_t slab_size = 64 * 1024;
+    static constexpr std::size_t granule = 16;  // allocation unit (and alignment)
+    static constexpr std::size_t max_object_size = 2048;  // larger objects come from the heap
+
+    private:
+    static constexpr unsigned num_classes = max_object_size / granule;
+
+    struct slab
+    {
+        slab *next;
+    };
+
+    struct free_object
+    {
+        free_object *next;
+    };
+
+    static constexpr std::size_t slab_header_size = (sizeof(slab) + granule - 1) / granule * granule;
+
+    slab *slabs = nullptr;
+    char *avail = nullptr;      // unallocated space in the current slab
+    char *avail_end = nullptr;
+    free_object *free_lists[num_classes] = {};
+    service_arena_stats stats;
+
+    // The size class (index into free_lists) for an object of the given size (> 0)
+    static unsigned size_class(std::size_t size) noexcept
+    {
+        return (size + granule - 1) / granule - 1;
+    }
+
+    void push_free(void *p, unsigned sc) noexcept
+    {
+        free_object *fo = static_cast<free_object *>(p);
+        fo->next = free_lists[sc];
+        free_lists[sc] = fo;
+        stats.free++;
+    }
+
+    // Start a new slab. The space remaining in the current slab (if any) is kept as a free
+    // object. Throws std::bad_alloc.
+    void new_slab()
+    {
+        char *mem = static_cast<char *>(::operator new(slab_size));
+        if (avail != avail_end) {
+            push_free(avail, size_class(avail_end - avail));
+        }
+        slab *s = reinterpret_cast<slab *>(mem);
+        s->next = slabs;
+        slabs = s;
+        avail = mem + slab_header_size;
+        avail_end = mem + slab_size;
+        stats.slabs++;
+    }
+
+    public:
+    service_arena() noexcept
+    {
+    }
+
+    service_arena(const service_arena &) = delete;
+    service_arena &operator=(const service_arena &) = delete;
+
+    ~service_arena()
+    {
+        while (slabs != nullptr) {
+            slab *next = slabs->next;
+            ::operator delete(slabs);
+            slabs = next;
+        }
+    }
+
+    // Allocate storage for an object of the given size. Throws std::bad_alloc.
+    void *allocate(std::size_t size)
+    {
+        if (size > max_object_size) {
+            void *p = ::operator new(size);
+            stats.large++;
+            return p;
+        }
+
+        unsigned sc = size_class(size == 0 ? 1 : size);
+        free_object *fo = free_lists[sc];
+        if (fo != nullptr) {
+            free_lists[sc] = fo->next;
+            stats.free--;
+            stats.in_use++;
+            return fo;
+        }
+
+        std::size_t alloc_size = (sc + 1) * granule;
+        if ((std::size_t)(avail_end - avail) < alloc_size) {
+            new_slab();
+        }
+        void *p = avail;
+        avail += alloc_size;
+        stats.in_use++;
+        return p;
+    }
+
+    // Release storage allocated (with the same size) by allocate().
+    void deallocate(void *p, std::size_t size) noexcept
+    {
+        if (size > max_object_size) {
+            ::operator delete(p);
+            stats.large--;
+            return;
+        }
+        push_free(p, size_class(size == 0 ? 1 : size));
+        stats.in_use--;
+    }
+
+    const service_arena_stats &get_stats() noexcept
+    {
+        return stats;
+    }
+};
+
+// Allocator for standard containers, allocating from a service arena.
+template <typename T> class arena_allocator
+{
+    template <typename U> friend class arena_allocator;
+
+    service_arena *arena;
+
+    public:
+    using value_type = T;
+
+    arena_allocator(service_arena *arena_p) noexcept : arena(arena_p)
+    {
+    }
+
+    template <typename U> arena_allocator(const arena_allocator<U> &other) noexcept
+        : arena(other.arena)
+    {
+    }
+
+    T *allocate(std::size_t n)
+    {
+        return static_cast<T *>(arena->allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, std::size_t n) noexcept
+    {
+        arena->deallocate(p, n * sizeof(T));
+    }
+
+    template <typename U> bool operator==(const arena_allocator<U> &other) const noexcept
+    {
+        return arena == other.arena;
+    }
+
+    template <typename U> bool operator!=(const arena_allocator<U> &other) const noexcept
+    {
+        return arena != other.arena;
+    }
+};
+
+#endif
@@ -30,6 +30,18 @@ enum class service_event_t {
     STOPCANCELLED      // Service was set to be stopped but a start was requested
 };
 
+/* Service trace events (recorded in the service timeline trace) */
+enum class trace_event_t {
+    STARTING,          // Service start commenced (propagation of start to dependencies)
+    DEPREADY,          // A dependency that the service was waiting on has started (or failed)
+    DEPSSTARTED,       // All dependencies started; service start proper commences
+    EXECUTED,          // Service process was successfully executed
+    STARTED,           // Service reached STARTED state
+    FAILEDSTART,       // Service failed to start
+    STOPPING,          // Service stop commenced
+    STOPPED            // Service reached STOPPED state
+};
+
 /* Shutdown types */
 enum class shutdown_type_t {
     CONTINUE,          // Continue normal boot sequence (used after single-user shell)
@@ -38,4 +50,17 @@ enum class shutdown_type_t {
     REBOOT             // Reboot system
 };
 
+/* Mechanism used to launch service processes */
+enum class launch_backend_t {
+    FORK,              // fork(), and report exec() status via a pipe
+    VFORK              // clone(CLONE_VM | CLONE_VFORK), exec() status known on return (Linux only)
+};
+
+/* Destination of service process output */
+enum class log_type_id {
+    NONE,              // discard output (/dev/null)
+    LOGFILE,           // append to the log file
+    BUFFER             // capture in an in-memory buffer (retrieved with "dinitctl catlog")
+};
+
 #endif
@@ -1,9 +1,39 @@
 #ifndef SERVICE_LISTENER_H
 #define SERVICE_LISTENER_H
 
+#include <cstdint>
+
 #include "service-constants.h"
+#include "dinit-ll.h"
 
 class service_record;
+class service_handle_listener;
+
+// A handle referring to a service, held by a client (a control connection), which may hold
+// several handles for the same service. Each service keeps an intrusive list of the handles
+// referring to it, so that events are delivered to each handle without any lookup.
+class service_handle
+{
+    public:
+    service_handle_listener *listener = nullptr;
+    service_record *service = nullptr;  // the service, or nullptr if the handle is not in use
+    uint32_t id = 0;                    // identifier of the handle, as known to the client
+    lld_node<service_handle> handle_node;  // node in the service's list of handles
+};
+
+inline lld_node<service_handle> &extract_handle_node(service_handle *h) noexcept
+{
+    return h->handle_node;
+}
+
+// Interface for holders of service handles
+class service_handle_listener
+{
+    public:
+
+    // An event occurred on the service referred to by the handle.
+    virtual void service_event(service_handle &handle, service_event_t event) noexcept = 0;
+};
 
 // Interface for listening to services
 class service_listener
@@ -0,0 +1,77 @@
+#ifndef SERVICE_TRACE_H_INCLUDED
+#define SERVICE_TRACE_H_INCLUDED 1
+
+#include <ctime>
+#include <cstdint>
+
+#include "service-constants.h"
+
+// Service timeline trace: a record of service state transitions, with timestamps, held in a
+// fixed-size ring buffer (so that the most recent transitions are kept). It can be retrieved
+// via the control socket ("dinitctl trace") to see where time is spent, eg during boot.
+
+class service_record;
+
+class trace_entry
+{
+    public:
+    struct timespec time;          // time of event (CLOCK_MONOTONIC)
+    service_record *service;
+    service_record *dependency;    // for DEPREADY, the dependency; otherwise nullptr
+    trace_event_t event;
+};
+
+// Convert a timestamp to nanoseconds
+inline int64_t timespec_to_ns(const struct timespec &ts) noexcept
+{
+    return int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+class service_trace
+{
+    public:
+    static constexpr unsigned capacity = 4096;
+
+    private:
+    trace_entry entries[capacity];
+    unsigned first = 0;  // index of oldest entry
+    unsigned count = 0;  // number of entries
+
+    public:
+    // Record an event; if the buffer is full, the oldest entry is discarded. Returns the
+    // recorded time of the event.
+    const struct timespec &record(service_record *service, trace_event_t event,
+            service_record *dependency = nullptr) noexcept
+    {
+        unsigned index = first + count;
+        if (index >= capacity) index -= capacity;
+        if (count == capacity) {
+            if (++first == capacity) first = 0;
+        }
+        else {
+            count++;
+        }
+
+        trace_entry &entry = entries[index];
+        clock_gettime(CLOCK_MONOTONIC, &entry.time);
+        entry.service = service;
+        entry.dependency = dependency;
+        entry.event = event;
+        return entry.time;
+    }
+
+    unsigned size() noexcept
+    {
+        return count;
+    }
+
+    // Get an entry, by index from the oldest (0) to the newest (size() - 1).
+    const trace_entry &operator[](unsigned i) noexcept
+    {
+        unsigned index = first + i;
+        if (index >= capacity) index -= capacity;
+        return entries[index];
+    }
+};
+
+#endif
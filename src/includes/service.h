@@ -5,17 +5,27 @@
 #include <list>
 #include <vector>
 #include <csignal>
+#include <climits>
 #include <unordered_set>
+#include <unordered_map>
 #include <algorithm>
 
+#include <sys/resource.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
 #include "dasynq.h"
 
 #include "dinit.h"
 #include "control.h"
 #include "service-listener.h"
 #include "service-constants.h"
+#include "service-trace.h"
+#include "reaped-exits.h"
 #include "dinit-ll.h"
 #include "dinit-log.h"
+#include "service-arena.h"
 
 /*
  * This header defines service_record, a data record maintaining information about a service,
@@ -164,6 +174,92 @@ class service_description_exc : public service_load_exc
 class service_record;
 class service_set;
 class base_process_service;
+class ring_buffer;
+
+// Priority of a service waiting for a start slot. Services with a higher start-priority setting,
+// and then those with a longer path (via dependents) to a top-level service - i.e. those which
+// gate the most dependent services - are given a start slot first.
+class start_slot_prio
+{
+    public:
+    int priority;
+    int path_len;
+
+    start_slot_prio() noexcept : priority(0), path_len(0) { }
+    start_slot_prio(int priority_p, int path_len_p) noexcept : priority(priority_p), path_len(path_len_p) { }
+};
+
+class compare_start_slot_prio
+{
+    public:
+    bool operator()(const start_slot_prio &a, const start_slot_prio &b) noexcept
+    {
+        if (a.priority != b.priority) {
+            return a.priority > b.priority;
+        }
+        return a.path_len > b.path_len;
+    }
+};
+
+// A resource limit setting (rlimit-*): the soft and/or hard limit to apply for a resource.
+class service_rlimits
+{
+    public:
+    int resource_id;  // RLIMIT_xxx
+    bool soft_set : 1;
+    bool hard_set : 1;
+    struct rlimit limits;
+
+    service_rlimits(int id) noexcept : resource_id(id), soft_set(false), hard_set(false), limits({0, 0})
+    {
+    }
+};
+
+// Attributes of a service process, applied by the child before exec (see run_child_proc).
+class process_attrs
+{
+    public:
+    std::vector<service_rlimits> rlimits;
+    int nice = INT_MIN;           // nice value, or INT_MIN to leave unchanged
+#ifdef __linux__
+    int ioprio = -1;              // I/O priority (class and data, as for ioprio_set()), or -1
+    int oom_score_adj = INT_MIN;  // OOM score adjustment, or INT_MIN to leave unchanged
+    bool has_cpu_affinity = false;
+    cpu_set_t cpu_affinity;
+#endif
+};
+
+// Parameters for running a service process in the child after fork()/clone(); see
+// service_record::run_child_proc.
+class run_proc_params
+{
+    public:
+    const char * const *args;   // program arguments
+    const char *logfile;        // log file or nullptr (stdout/stderr to console)
+    int log_fd = -1;            // log file, already opened by the parent; -1 to open logfile
+    bool on_console;            // whether to run on the console
+    int wpipefd = -1;           // pipe to which the exec() error status is written, or -1
+    int csfd = -1;              // control socket fd for the process, or -1
+    int notify_fd = -1;         // write end of the readiness notification pipe, or -1
+    int force_notify_fd = -1;   // fd number at which the process receives notify_fd
+    int cgroup_fd = -1;         // directory of the cgroup the process is to join, or -1
+
+    // For the vfork launch backend, the child shares memory with the parent and so must not
+    // modify the environment or report the exec() status via a pipe. Instead:
+    int *exec_errno = nullptr;  // location to store exec() error status (0 on success)
+    const char **envp = nullptr; // environment, with unused (nullptr) slots for added variables
+    int env_free = 0;           // index of first unused slot in envp
+    const sigset_t *sigmask = nullptr; // signal mask to restore (if null, the current mask)
+
+    run_proc_params(const char * const *args_p, const char *logfile_p, bool on_console_p) noexcept
+        : args(args_p), logfile(logfile_p), on_console(on_console_p)
+    {
+    }
+};
+
+template <typename A, typename B, typename C> using start_slot_heap_def = dasynq::dary_heap<A,B,C>;
+using start_slot_queue_t = dasynq::stable_heap<start_slot_heap_def, service_record *, start_slot_prio,
+        compare_start_slot_prio>;
 
 enum class dependency_type
 {
@@ -249,7 +345,7 @@ class service_record
     
     private:
     string service_name;
-    service_type_t record_type;  /* ServiceType::DUMMY, PROCESS, SCRIPTED, INTERNAL */
+    service_type_t record_type;  /* ServiceType::PROCESS, SCRIPTED, INTERNAL */
     service_state_t service_state = service_state_t::STOPPED; /* service_state_t::STOPPED, STARTING, STARTED, STOPPING */
     service_state_t desired_state = service_state_t::STOPPED; /* service_state_t::STOPPED / STARTED */
 
@@ -259,6 +355,9 @@ class service_record
     onstart_flags_t onstart_flags;
 
     string logfile;           // log file name, empty string specifies /dev/null
+    log_type_id log_type = log_type_id::LOGFILE;  // where process output goes
+    int log_fd = -1;          // log file (or, for log-type = buffer, the write end of the output
+                              // pipe), opened on first launch and kept for later launches; or -1
     
     bool auto_restart : 1;    // whether to restart this (process) if it dies unexpectedly
     bool smooth_recovery : 1; // whether the service process can restart without bringing down service
@@ -268,6 +367,7 @@ class service_record
     bool waiting_for_deps : 1;  // if STARTING, whether we are waiting for dependencies (inc console) to start
                                 // if STOPPING, whether we are waiting for dependents to stop
     bool waiting_for_execstat : 1;  // if we are waiting for exec status after fork()
+    bool has_start_slot : 1;    // if we hold a start slot (see service_set::get_start_slot)
     bool start_explicit : 1;    // whether we are are explicitly required to be started
 
     bool prop_require : 1;      // require must be propagated
@@ -280,18 +380,20 @@ class service_record
     
     int required_by = 0;        // number of dependents wanting this service to be started
 
-    // list of dependencies
-    typedef std::list<service_dep> dep_list;
+    // list of dependencies. This is sized when the service is constructed and never grows
+    // thereafter, so pointers to its elements (held in dependents lists) remain valid.
+    // (The storage for both lists is allocated from the service set's arena).
+    typedef std::vector<service_dep, arena_allocator<service_dep>> dep_list;
     
     // list of dependents
-    typedef std::list<service_dep *> dpt_list;
+    typedef std::vector<service_dep *, arena_allocator<service_dep *>> dpt_list;
     
     dep_list depends_on;  // services this one depends on
     dpt_list dependents;  // services depending on this one
     
     service_set *services; // the set this service belongs to
     
-    std::unordered_set<service_listener *> listeners;
+    dlist<service_handle, extract_handle_node> handles;  // handles referring to this service
     
     // Process services:
     bool force_stop; // true if the service must actually stop. This is the
@@ -311,14 +413,31 @@ class service_record
                      //   this is PID of the service script; otherwise it is the
                      //   PID of the process itself (process service).
     int exit_status; // Exit status, if the process has exited (pid == -1).
+    bool have_exit_status = false;  // whether any process has exited (exit_status is valid)
     int socket_fd = -1;  // For socket-activation services, this is the file
                          // descriptor for the socket.
+    unsigned orphan_count = 0;  // number of orphaned descendant processes reaped
+    pid_t session_id = -1;      // session/process group of the last launched process, or -1
+                                //   (see service_set::set_service_session())
+
+    // Timing of the most recent start (CLOCK_MONOTONIC, in nanoseconds; 0 if not reached):
+    int64_t start_begin_time = 0;    // start commenced (STARTING)
+    int64_t start_deps_time = 0;     // all dependencies had started
+    int64_t start_end_time = 0;      // service STARTED
+
+    int start_priority = 0;     // priority for start slot assignment (start-priority setting)
+    process_attrs proc_attrs;   // resource limits, scheduling priority etc for the process
+    int start_path_len = 0;     // longest path via dependents to a service with no dependents
     
     // Data for use by service_set
     public:
     
     // Console queue.
     lld_node<service_record> console_queue_node;
+
+    // Start slot queue.
+    start_slot_queue_t::handle_t start_slot_handle;
+    bool start_slot_queued = false;
     
     // Propagation and start/stop queues
     lls_node<service_record> prop_queue_node;
@@ -340,8 +459,14 @@ class service_record
     //   dep_failed: whether failure is recorded due to a dependency failing
     void failed_to_start(bool dep_failed = false) noexcept;
 
-    void run_child_proc(const char * const *args, const char *logfile, bool on_console, int wpipefd,
-            int csfd) noexcept;
+    // Set up and exec() the service process; called in the child process. Does not return.
+    void run_child_proc(run_proc_params &params) noexcept;
+
+    // Launch the service process (via run_child_proc) using clone(CLONE_VM | CLONE_VFORK). On
+    // return the child has either exec'd or failed to, with the error (or 0) stored in
+    // *params.exec_errno, which must be set. Returns the child pid, or -1 (with errno set) if the
+    // child could not be created. Linux only.
+    pid_t vfork_child_proc(run_proc_params &params) noexcept;
     
     // A dependency has reached STARTED state
     void dependency_started() noexcept;
@@ -383,12 +508,12 @@ class service_record
             || (service_state == service_state_t::STARTING && waiting_for_deps);
     }
     
-    void notify_listeners(service_event_t event) noexcept
-    {
-        for (auto l : listeners) {
-            l->service_event(this, event);
-        }
-    }
+    // Record an event in the service timeline trace.
+    void trace_event(trace_event_t event) noexcept;
+
+    // Notify handle holders of this service, and listeners for all services (see
+    // service_set::add_event_listener()), of an event.
+    void notify_listeners(service_event_t event) noexcept;
     
     // Queue to run on the console. 'acquired_console()' will be called when the console is available.
     // Has no effect if the service has already queued for console.
@@ -396,6 +521,15 @@ class service_record
     
     // Release console (console must be currently held by this service)
     void release_console() noexcept;
+
+    // Whether this service requires a start slot to start (i.e. if it starts a process).
+    bool needs_start_slot() noexcept
+    {
+        return record_type != service_type_t::INTERNAL;
+    }
+
+    // Release the start slot, if held, or leave the start slot queue, if queued.
+    void release_start_slot() noexcept;
     
     bool do_auto_restart() noexcept;
 
@@ -440,39 +574,62 @@ class service_record
     // issued but service has not yet responded (state will be set to STOPPING).
     virtual bool interrupt_start() noexcept;
 
+    // Each record is preceded in its allocation by a header, recording where the allocation came
+    // from (so that it can be released).
+    struct alloc_header
+    {
+        service_arena *arena;
+        std::size_t size;
+    };
+    static_assert(sizeof(alloc_header) <= service_arena::granule, "alloc_header too large");
+
+    static service_arena *arena_of(service_set *set) noexcept;
+
     public:
 
-    service_record(service_set *set, string name)
+    service_record(service_set *set, string name, service_type_t record_type_p,
+            const std::list<prelim_dep> &deplist_p)
         : service_state(service_state_t::STOPPED), desired_state(service_state_t::STOPPED),
             auto_restart(false), smooth_recovery(false),
             pinned_stopped(false), pinned_started(false), waiting_for_deps(false),
-            waiting_for_execstat(false), start_explicit(false),
+            waiting_for_execstat(false), has_start_slot(false), start_explicit(false),
             prop_require(false), prop_release(false), prop_failure(false),
-            prop_start(false), prop_stop(false), restarting(false), force_stop(false)
+            prop_start(false), prop_stop(false), restarting(false),
+            depends_on(arena_of(set)), dependents(arena_of(set)), force_stop(false)
     {
         services = set;
         service_name = name;
-        record_type = service_type_t::DUMMY;
+        this->record_type = record_type_p;
         socket_perms = 0;
         exit_status = 0;
-    }
-
-    service_record(service_set *set, string name, service_type_t record_type_p,
-            const std::list<prelim_dep> &deplist_p)
-        : service_record(set, name)
-    {
-        services = set;
-        service_name = name;
-        this->record_type = record_type_p;
 
+        depends_on.reserve(deplist_p.size());
         for (auto & pdep : deplist_p) {
-            auto b = depends_on.emplace(depends_on.end(), this, pdep.to, pdep.dep_type);
-            pdep.to->dependents.push_back(&(*b));
+            depends_on.emplace_back(this, pdep.to, pdep.dep_type);
+            pdep.to->dependents.push_back(&depends_on.back());
         }
     }
 
     virtual ~service_record() noexcept
     {
+        close_log_fd();
+    }
+
+    // Service records are allocated from the arena of the service set they belong to, via:
+    //     new (set) service_record(set, ...)
+    // Throws std::bad_alloc.
+    static void *operator new(std::size_t size, service_set *set);
+    static void operator delete(void *p, service_set *set) noexcept;
+    static void operator delete(void *p) noexcept;
+
+    // Remove this service from the dependents lists of its dependencies; used to discard a record
+    // which could not be added to the service set.
+    void unlink_dependencies() noexcept
+    {
+        for (auto &dep : depends_on) {
+            dpt_list &dpts = dep.get_to()->dependents;
+            dpts.erase(std::find(dpts.begin(), dpts.end(), &dep));
+        }
     }
     
     // Get the type of this service record
@@ -488,6 +645,9 @@ class service_record
 
     // Console is available.
     void acquired_console() noexcept;
+
+    // A start slot has been assigned to this service.
+    void acquired_start_slot() noexcept;
     
     // Get the target (aka desired) state.
     service_state_t get_target_state() noexcept
@@ -500,6 +660,93 @@ class service_record
     {
         this->logfile = logfile;
     }
+
+    // Set where service process output goes (log file, buffer, or nowhere)
+    void set_log_type(log_type_id log_type) noexcept
+    {
+        this->log_type = log_type;
+    }
+
+    log_type_id get_log_type() noexcept
+    {
+        return log_type;
+    }
+
+    // Get the buffer holding captured output (log-type = buffer), or nullptr if there is none.
+    virtual ring_buffer *get_log_buffer() noexcept
+    {
+        return nullptr;
+    }
+
+    // Get the exit status of the most recent service process (or script) to terminate. Returns
+    // false if none has terminated.
+    bool get_exit_status(int &status) noexcept
+    {
+        status = exit_status;
+        return have_exit_status;
+    }
+
+    // Restart statistics, for services which run a process (others report none): the number of
+    // automatic restarts within the current restart interval, and in total.
+    virtual unsigned get_restart_interval_count() noexcept
+    {
+        return 0;
+    }
+
+    virtual unsigned get_total_restarts() noexcept
+    {
+        return 0;
+    }
+
+    // Get the time at which the most recent service process was launched (CLOCK_MONOTONIC, in
+    // nanoseconds), or 0 if none has been.
+    virtual int64_t get_last_launch_time() noexcept
+    {
+        return 0;
+    }
+
+    // Close the log file, if open, so that it is re-opened (by path) when the process is next
+    // launched. Processes already running continue writing to the old file.
+    void close_log_fd() noexcept;
+
+    // Arrange for the log file to be re-opened (e.g. after it has been rotated externally).
+    virtual void reopen_log() noexcept;
+
+    // A process watched via service_set::watch_orphan_pid() has terminated, and been reaped.
+    virtual void orphan_pid_exited(pid_t exited_pid, int status) noexcept
+    {
+    }
+
+    // An orphaned descendant of the service process has terminated, and been reaped.
+    void orphan_reaped() noexcept
+    {
+        orphan_count++;
+    }
+
+    // Get the number of orphaned descendants of the service process which have been reaped
+    // (a daemon which leaks double-forked children will show a growing count).
+    unsigned get_orphan_count() noexcept
+    {
+        return orphan_count;
+    }
+
+    // Get the process ID of the service process, or -1 if none.
+    pid_t get_pid() noexcept
+    {
+        return pid;
+    }
+
+    // Get the session (and process group) in which the most recently launched service process was
+    // started, or -1 if none.
+    pid_t get_session_id() noexcept
+    {
+        return session_id;
+    }
+
+    void set_session_id(pid_t sid) noexcept
+    {
+        session_id = sid;
+    }
     
     // Set whether this service should automatically restart when it dies
     void set_auto_restart(bool auto_restart) noexcept
@@ -539,6 +786,52 @@ class service_record
 
     const std::string &get_name() const noexcept { return service_name; }
     service_state_t get_state() const noexcept { return service_state; }
+
+    // Get the times (CLOCK_MONOTONIC, in nanoseconds) at which the most recent start of the service
+    // commenced, its dependencies had all started, and it reached STARTED state (0 for any of these
+    // which have not happened).
+    int64_t get_start_begin_time() const noexcept { return start_begin_time; }
+    int64_t get_start_deps_time() const noexcept { return start_deps_time; }
+    int64_t get_start_end_time() const noexcept { return start_end_time; }
+
+    // Set/get the attributes (resource limits, priorities, CPU affinity) of the service process
+    void set_process_attrs(process_attrs &&attrs) noexcept
+    {
+        proc_attrs = std::move(attrs);
+    }
+
+    const process_attrs &get_process_attrs() const noexcept
+    {
+        return proc_attrs;
+    }
+
+    // Set/get the priority of this service when waiting for a start slot (higher values are given
+    // a slot first).
+    void set_start_priority(int priority) noexcept
+    {
+        start_priority = priority;
+    }
+
+    int get_start_priority() const noexcept
+    {
+        return start_priority;
+    }
+
+    // Get the length of the longest path from this service, via its dependents, to a service
+    // which has no dependents.
+    int get_start_path_len() const noexcept
+    {
+        return start_path_len;
+    }
+
+    // Update the start path length of this (newly added) service from its dependents, and
+    // propagate it to its dependencies.
+    void update_start_paths() noexcept;
+
+    // Find the dependency which (by starting last) determined when this service could begin
+    // its own start, i.e. the next link in the service's "critical chain". Returns nullptr if
+    // the service did not wait for any dependency.
+    service_record *get_critical_dependency() noexcept;
     
     void start(bool activate = true) noexcept;  // start the service
     void stop(bool bring_down = true) noexcept;   // stop the service
@@ -562,21 +855,16 @@ class service_record
     // commence starting/stopping.
     void unpin() noexcept;
     
-    bool isDummy() noexcept
-    {
-        return record_type == service_type_t::DUMMY;
-    }
-    
-    // Add a listener. A listener must only be added once. May throw std::bad_alloc.
-    void addListener(service_listener * listener)
+    // Add a handle referring to this service (its listener receives events for the service).
+    // Handles must not be added or removed during event notification.
+    void add_handle(service_handle *handle) noexcept
     {
-        listeners.insert(listener);
+        handles.append(handle);
     }
-    
-    // Remove a listener.    
-    void removeListener(service_listener * listener) noexcept
+
+    void remove_handle(service_handle *handle) noexcept
     {
-        listeners.erase(listener);
+        handles.unlink(handle);
     }
 };
 
@@ -599,8 +887,10 @@ inline auto extract_console_queue(service_record *sr) -> decltype(sr->console_qu
  * A service_set, as the name suggests, manages a set of services.
  *
  * Other than the ability to find services by name, the service set manages various queues.
- * One is the queue for processes wishing to acquire the console. There is also a set of
- * processes that want to start, and another set of those that want to stop. These latter
+ * One is the queue for processes wishing to acquire the console. Another is the queue of
+ * services waiting for a start slot, used if the number of services which may concurrently
+ * start (i.e. launch their process after their dependencies have started) is limited. There is
+ * also a set of processes that want to start, and another set of those that want to stop. These latter
  * two "queues" (not really queues since their order is not important) are used to prevent too
  * much recursion and to prevent service states from "bouncing" too rapidly.
  * 
@@ -616,8 +906,13 @@ inline auto extract_console_queue(service_record *sr) -> decltype(sr->console_qu
 class service_set
 {
     protected:
+    // Arena for service records and their dependency lists. (Declared first, so it is destroyed
+    // last).
+    service_arena arena;
+
     int active_services;
     std::list<service_record *> records;
+    std::unordered_map<std::string, service_record *> records_by_name; // index of records, by name
     bool restart_enabled; // whether automatic restart is enabled (allowed)
     
     shutdown_type_t shutdown_type = shutdown_type_t::CONTINUE;  // Shutdown type, if stopping
@@ -625,9 +920,48 @@ class service_set
     // Services waiting for exclusive access to the console
     dlist<service_record, extract_console_queue> console_queue;
 
+    // Start slots: the maximum number of services which may concurrently start (0 = no limit),
+    // the number of slots in use, and services waiting for a slot
+    int max_starts = 0;
+    int active_starts = 0;
+
+    // Mechanism for launching service processes
+#ifdef __linux__
+    launch_backend_t launch_backend = launch_backend_t::VFORK;
+#else
+    launch_backend_t launch_backend = launch_backend_t::FORK;
+#endif
+    start_slot_queue_t start_slot_queue;
+
+    // Parent cgroup (v2) directory for per-service cgroups; empty if not using cgroups
+    std::string cgroup_root;
+
     // Propagation and start/stop "queues" - list of services waiting for processing
     slist<service_record, extract_prop_queue> prop_queue;
     slist<service_record, extract_stop_queue> stop_queue;
+
+    // Timeline of service state transitions
+    service_trace trace;
+
+    // Recently reaped child processes which had no watcher (normally, orphaned descendants of
+    // service processes), and the number of those which are yet to be dispatched (see
+    // dispatch_reaped_exits()); services watching processes which are not (yet) children of dinit
+    // (see watch_orphan_pid()).
+    reaped_exit_history reaped_exits;
+    unsigned reaped_undispatched = 0;
+    std::unordered_map<pid_t, service_record *> orphan_pid_watches;
+
+    // Services by the session/process group id of their most recently launched process (see
+    // set_service_session()), to which orphaned descendants are attributed.
+    std::unordered_map<pid_t, service_record *> service_sessions;
+
+#ifdef __linux__
+    // Find the service in whose cgroup a (not yet reaped) process ran, or return nullptr.
+    service_record *find_cgroup_service(pid_t pid) noexcept;
+#endif
+
+    // Listeners for events on all services
+    std::vector<service_listener *> event_listeners;
     
     public:
     service_set()
@@ -660,6 +994,99 @@ class service_set
     // Locate an existing service record.
     service_record *find_service(const std::string &name) noexcept;
 
+    // Get the service timeline trace.
+    service_trace &get_trace() noexcept
+    {
+        return trace;
+    }
+
+    // Record that a child process with no watcher (normally an orphaned descendant of a service
+    // process) has terminated. This is called from within the event loop, before the process is
+    // reaped, and must not use the event loop; services are notified later, by
+    // dispatch_reaped_exits().
+    void child_reaped(pid_t pid, int status) noexcept;
+
+    // Notify services of processes reaped (since the last call) via child_reaped(): services
+    // watching the process (see watch_orphan_pid()), or to which the process was an orphaned
+    // descendant.
+    void dispatch_reaped_exits() noexcept;
+
+    // Find the exit status of a process reaped via child_reaped() no earlier than the given time.
+    // Returns nullptr if the process has not been reaped (or the record has been discarded).
+    const reaped_exit *find_reaped_exit(pid_t pid, const struct timespec &since) noexcept
+    {
+        return reaped_exits.find(pid, since);
+    }
+
+    // Watch for termination of a process which is not a child of dinit (so can't otherwise be
+    // watched), in case it is re-parented to dinit (the service is notified via
+    // orphan_pid_exited()). May throw std::bad_alloc.
+    void watch_orphan_pid(pid_t pid, service_record *sr)
+    {
+        orphan_pid_watches[pid] = sr;
+    }
+
+    void unwatch_orphan_pid(pid_t pid) noexcept
+    {
+        orphan_pid_watches.erase(pid);
+    }
+
+    // Record that a process of the given service was launched in a new session/process group
+    // (whose id is the process id), replacing the previous session of the service. Orphaned
+    // descendants which remain in the session are attributed to the service, even once the
+    // process itself has terminated. (If out of memory, they are not attributed).
+    void set_service_session(service_record *sr, pid_t sid) noexcept
+    {
+        try {
+            service_sessions[sid] = sr;
+        }
+        catch (std::bad_alloc &exc) {
+            sid = -1;
+        }
+        pid_t old_sid = sr->get_session_id();
+        if (old_sid != -1 && old_sid != sid) {
+            auto i = service_sessions.find(old_sid);
+            if (i != service_sessions.end() && i->second == sr) {
+                service_sessions.erase(i);
+            }
+        }
+        sr->set_session_id(sid);
+    }
+
+    void clear_service_session(service_record *sr) noexcept
+    {
+        pid_t sid = sr->get_session_id();
+        if (sid != -1) {
+            auto i = service_sessions.find(sid);
+            if (i != service_sessions.end() && i->second == sr) {
+                service_sessions.erase(i);
+            }
+            sr->set_session_id(-1);
+        }
+    }
+
+    // Add a listener for events on all services. May throw std::bad_alloc.
+    void add_event_listener(service_listener *listener)
+    {
+        event_listeners.push_back(listener);
+    }
+
+    void remove_event_listener(service_listener *listener) noexcept
+    {
+        auto i = std::find(event_listeners.begin(), event_listeners.end(), listener);
+        if (i != event_listeners.end()) {
+            event_listeners.erase(i);
+        }
+    }
+
+    // Notify listeners for all services of an event on a service.
+    void notify_event_listeners(service_record *service, service_event_t event) noexcept
+    {
+        for (auto l : event_listeners) {
+            l->service_event(service, event);
+        }
+    }
+
     // Load a service description, and dependencies, if there is no existing
     // record for the given name.
     // Throws:
@@ -687,14 +1114,28 @@ class service_set
         service_set::start_service(record);
     }
     
+    // Add a service record to the set. May throw std::bad_alloc.
     void add_service(service_record *svc)
     {
         records.push_back(svc);
+        try {
+            records_by_name[svc->get_name()] = svc;
+        }
+        catch (...) {
+            records.pop_back();
+            throw;
+        }
+        svc->update_start_paths();
     }
     
-    void remove_service(service_record *svc)
+    // Remove a service record from the set (the record is not deleted).
+    void remove_service(service_record *svc) noexcept
     {
-        std::remove(records.begin(), records.end(), svc);
+        records.remove(svc);
+        auto i = records_by_name.find(svc->get_name());
+        if (i != records_by_name.end() && i->second == svc) {
+            records_by_name.erase(i);
+        }
     }
 
     // Get the list of all loaded services.
@@ -769,6 +1210,117 @@ class service_set
         }
     }
 
+    // Get the position of a service in the console queue (1 if it is next to acquire the
+    // console), or 0 if it is not waiting for the console.
+    unsigned get_console_queue_position(service_record *service) noexcept
+    {
+        if (! console_queue.is_queued(service)) return 0;
+        unsigned position = 1;
+        for (service_record *sr = console_queue.head(); sr != service; sr = console_queue.next(sr)) {
+            position++;
+        }
+        return position;
+    }
+
+    // Set the maximum number of services which may concurrently start (0 for no limit).
+    void set_max_concurrent_starts(int max) noexcept
+    {
+        max_starts = max;
+        pull_start_slot_queue();
+    }
+
+    // Set the mechanism used to launch service processes.
+    void set_launch_backend(launch_backend_t backend) noexcept
+    {
+        launch_backend = backend;
+    }
+
+    launch_backend_t get_launch_backend() noexcept
+    {
+        return launch_backend;
+    }
+
+    // Set/get the cgroup (v2) directory in which a cgroup is created for each service process
+    // (empty for none; Linux only).
+    void set_cgroup_root(std::string &&root) noexcept
+    {
+        cgroup_root = std::move(root);
+    }
+
+    const std::string &get_cgroup_root() noexcept
+    {
+        return cgroup_root;
+    }
+
+    service_arena &get_arena() noexcept
+    {
+        return arena;
+    }
+
+    // Get the number of start slots in use.
+    int count_active_starts() noexcept
+    {
+        return active_starts;
+    }
+
+    // Acquire a start slot for a service. Returns true if a slot was assigned; otherwise, the
+    // service is queued, and its acquired_start_slot() will be called when a slot is available.
+    // Queued services are given slots in priority order (see start_slot_prio).
+    bool get_start_slot(service_record *service) noexcept
+    {
+        if (service->start_slot_queued) {
+            return false;
+        }
+        if (max_starts == 0 || active_starts < max_starts) {
+            active_starts++;
+            return true;
+        }
+        try {
+            start_slot_queue.allocate(service->start_slot_handle, service);
+        }
+        catch (std::bad_alloc &exc) {
+            // Can't queue; just let the service start.
+            active_starts++;
+            return true;
+        }
+        start_slot_queue.insert(service->start_slot_handle,
+                start_slot_prio(service->get_start_priority(), service->get_start_path_len()));
+        service->start_slot_queued = true;
+        return false;
+    }
+
+    // Release a start slot, and assign it to a waiting service (if any).
+    void release_start_slot() noexcept
+    {
+        active_starts--;
+        pull_start_slot_queue();
+    }
+
+    // Assign available start slots to waiting services.
+    void pull_start_slot_queue() noexcept
+    {
+        while (! start_slot_queue.empty() && (max_starts == 0 || active_starts < max_starts)) {
+            auto &front_handle = start_slot_queue.get_root();
+            service_record * front = start_slot_queue.node_data(front_handle);
+            unqueue_start_slot(front);
+            if (front->get_state() != service_state_t::STARTING) {
+                // no longer starting, doesn't need the slot
+                continue;
+            }
+            active_starts++;
+            front->acquired_start_slot();
+        }
+    }
+
+    void unqueue_start_slot(service_record * service) noexcept
+    {
+        if (service->start_slot_queued) {
+            start_slot_queue.remove(service->start_slot_handle);
+            start_slot_queue.deallocate(service->start_slot_handle);
+            service->start_slot_queued = false;
+        }
+    }
+
     // Notification from service that it is active (state != STOPPED)
     // Only to be called on the transition from inactive to active.
     void service_active(service_record *) noexcept;
@@ -784,6 +1336,15 @@ class service_set
         return active_services;
     }
     
+    // Close the log files held open for service processes, so that they are re-opened (on next
+    // launch, or next write if dinit writes the file) e.g. after log rotation.
+    void reopen_logs() noexcept
+    {
+        for (auto *s : records) {
+            s->reopen_log();
+        }
+    }
+
     void stop_all_services(shutdown_type_t type = shutdown_type_t::HALT) noexcept
     {
         restart_enabled = false;
@@ -811,9 +1372,64 @@ class service_set
     }
 };
 
+inline service_arena *service_record::arena_of(service_set *set) noexcept
+{
+    return &set->get_arena();
+}
+
+inline void *service_record::operator new(std::size_t size, service_set *set)
+{
+    service_arena *arena = arena_of(set);
+    char *mem = static_cast<char *>(arena->allocate(size + service_arena::granule));
+    alloc_header *hdr = reinterpret_cast<alloc_header *>(mem);
+    hdr->arena = arena;
+    hdr->size = size + service_arena::granule;
+    return mem + service_arena::granule;
+}
+
+inline void service_record::operator delete(void *p, service_set *set) noexcept
+{
+    operator delete(p);
+}
+
+inline void service_record::operator delete(void *p) noexcept
+{
+    if (p == nullptr) return;
+    char *mem = static_cast<char *>(p) - service_arena::granule;
+    alloc_header *hdr = reinterpret_cast<alloc_header *>(mem);
+    hdr->arena->deallocate(mem, hdr->size);
+}
+
+// A compiled cache of service descriptions (see load_service.cc for details). The cache file is
+// memory-mapped, and holds the already-tokenised settings from each description file.
+class service_desc_cache
+{
+    const char *base = nullptr;  // base of mapped cache file (nullptr if no cache)
+    size_t length = 0;
+    std::unordered_map<std::string, const char *> entries;  // service name -> entry in cache
+
+    void close_mapping() noexcept;
+
+    public:
+    ~service_desc_cache() noexcept;
+
+    // Map the specified cache file, and check that it is valid. Returns false on failure.
+    bool open(const char *path) noexcept;
+
+    // Find the cache entry for the named service, if present and the description file
+    // (at the given path) has not been modified since the cache was written. Returns nullptr
+    // if there is no (up-to-date) entry.
+    const char *find(const std::string &name, const std::string &path) noexcept;
+
+    // Process each setting in an entry via func(setting, value, parts). (Defined in
+    // load-service.h).
+    template <typename T> void replay(const char *entry, T func);
+};
+
 class dirload_service_set : public service_set
 {
     const char *service_dir;  // directory containing service descriptions
+    service_desc_cache cache;
 
     public:
     dirload_service_set(const char *service_dir_p) : service_set(), service_dir(service_dir_p)
@@ -821,6 +1437,16 @@ class dirload_service_set : public service_set
     }
 
     service_record *load_service(const char *name) override;
+
+    // Use the specified service description cache. Returns false if the cache could not be read.
+    bool use_cache(const char *cache_path) noexcept
+    {
+        return cache.open(cache_path);
+    }
+
+    // Write a service description cache for all descriptions in the service directory.
+    // Returns the number of descriptions written, or -1 on failure (with errno set).
+    int write_cache(const char *cache_path);
 };
 
 #endif
@@ -1,193 +1,29 @@
 #include <algorithm>
 #include <string>
-#include <fstream>
-#include <locale>
 #include <iostream>
 #include <limits>
+#include <memory>
+#include <vector>
+#include <unordered_set>
 
 #include <cstring>
 
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
 #include <pwd.h>
 #include <grp.h>
 
 #include "proc-service.h"
+#include "load-service.h"
 
 using string = std::string;
-using string_iterator = std::string::iterator;
+using namespace dinit_load;
 
-// Utility function to skip white space. Returns an iterator at the
-// first non-white-space position (or at end).
-static string_iterator skipws(string_iterator i, string_iterator end)
-{
-    using std::locale;
-    using std::isspace;
-    
-    while (i != end) {
-      if (! isspace(*i, locale::classic())) {
-        break;
-      }
-      ++i;
-    }
-    return i;
-}
-
-// Read a setting name.
-static string read_setting_name(string_iterator & i, string_iterator end)
-{
-    using std::locale;
-    using std::ctype;
-    using std::use_facet;
-    
-    const ctype<char> & facet = use_facet<ctype<char> >(locale::classic());
-
-    string rval;
-    // Allow alphabetical characters, and dash (-) in setting name
-    while (i != end && (*i == '-' || facet.is(ctype<char>::alpha, *i))) {
-        rval += *i;
-        ++i;
-    }
-    return rval;
-}
-
-namespace {
-    class setting_exception
-    {
-        std::string info;
-        
-        public:
-        setting_exception(const std::string &&exc_info) : info(std::move(exc_info))
-        {
-        }
-        
-        std::string &get_info()
-        {
-            return info;
-        }
-    };
-}
-
-
-// Read a setting value
-//
-// In general a setting value is a single-line string. It may contain multiple parts
-// separated by white space (which is normally collapsed). A hash mark - # - denotes
-// the end of the value and the beginning of a comment (it should be preceded by
-// whitespace).
-//
-// Part of a value may be quoted using double quote marks, which prevents collapse
-// of whitespace and interpretation of most special characters (the quote marks will
-// not be considered part of the value). A backslash can precede a character (such
-// as '#' or '"' or another backslash) to remove its special meaning. Newline
-// characters are not allowed in values and cannot be quoted.
-//
-// This function expects the string to be in an ASCII-compatible, single byte
-// encoding (the "classic" locale).
-//
-// Params:
-//    service_name - the name of the service to which the setting applies
-//    i  -  reference to string iterator through the line
-//    end -   iterator at end of line
-//    part_positions -  list of <int,int> to which the position of each setting value
-//                      part will be added as [start,end). May be null.
-static string read_setting_value(string_iterator & i, string_iterator end,
-        std::list<std::pair<unsigned,unsigned>> * part_positions = nullptr)
-{
-    using std::locale;
-    using std::isspace;
-
-    i = skipws(i, end);
-    
-    string rval;
-    bool new_part = true;
-    int part_start;
-    
-    while (i != end) {
-        char c = *i;
-        if (c == '\"') {
-            if (new_part) {
-                part_start = rval.length();
-                new_part = false;
-            }
-            // quoted string
-            ++i;
-            while (i != end) {
-                c = *i;
-                if (c == '\"') break;
-                if (c == '\n') {
-                    throw setting_exception("Line end inside quoted string");
-                }
-                else if (c == '\\') {
-                    // A backslash escapes the following character.
-                    ++i;
-                    if (i != end) {
-                        c = *i;
-                        if (c == '\n') {
-                            throw setting_exception("Line end follows backslash escape character (`\\')");
-                        }
-                        rval += c;
-                    }
-                }
-                else {
-                    rval += c;
-                }
-                ++i;
-            }
-            if (i == end) {
-                // String wasn't terminated
-                throw setting_exception("Unterminated quoted string");
-            }
-        }
-        else if (c == '\\') {
-            if (new_part) {
-                part_start = rval.length();
-                new_part = false;
-            }
-            // A backslash escapes the next character
-            ++i;
-            if (i != end) {
-                rval += *i;
-            }
-            else {
-                throw setting_exception("Backslash escape (`\\') not followed by character");
-            }
-        }
-        else if (isspace(c, locale::classic())) {
-            if (! new_part && part_positions != nullptr) {
-                part_positions->emplace_back(part_start, rval.length());
-                new_part = true;
-            }
-            i = skipws(i, end);
-            if (i == end) break;
-            if (*i == '#') break; // comment
-            rval += ' ';  // collapse ws to a single space
-            continue;
-        }
-        else if (c == '#') {
-            // Possibly intended a comment; we require leading whitespace to reduce occurrence of accidental
-            // comments in setting values.
-            throw setting_exception("hashmark (`#') comment must be separated from setting value by whitespace");
-        }
-        else {
-            if (new_part) {
-                part_start = rval.length();
-                new_part = false;
-            }
-            rval += c;
-        }
-        ++i;
-    }
-
-    // Got to end:
-    if (part_positions != nullptr) {
-        part_positions->emplace_back(part_start, rval.length());
-    }
-
-    return rval;
-}
-
-static int signal_name_to_number(std::string &signame)
+static int signal_name_to_number(const std::string &signame)
 {
     if (signame == "HUP") return SIGHUP;
     if (signame == "INT") return SIGINT;
@@ -268,6 +104,100 @@ static unsigned long long parse_unum_param(const std::string &param, const std::
     }
 }
 
+// Parse a signed numeric parameter value, which must be within [min, max]
+static int parse_snum_param(const std::string &param, const std::string &service_name, int min, int max)
+{
+    std::size_t ind = 0;
+    try {
+        int v = std::stoi(param, &ind, 10);
+        if (v < min || v > max || ind != param.length()) {
+            throw service_description_exc(service_name, num_err_msg);
+        }
+        return v;
+    }
+    catch (std::logic_error &exc) {
+        throw service_description_exc(service_name, num_err_msg);
+    }
+}
+
+// Parse a resource limit setting: "soft:hard", where either part may be empty (leaving that limit
+// unchanged) or "unlimited"; or a single value, which sets both limits.
+static void parse_rlimit(const std::string &param, const std::string &service_name, const char *setting_name,
+        service_rlimits &rlimit)
+{
+    auto parse_limit = [&](const std::string &value) -> rlim_t {
+        if (value == "unlimited" || value == "-") {
+            return RLIM_INFINITY;
+        }
+        unsigned long long v = parse_unum_param(value, service_name);
+        if ((rlim_t)v == RLIM_INFINITY || (unsigned long long)(rlim_t)v != v) {
+            throw service_description_exc(service_name, std::string(setting_name) + ": value out of range");
+        }
+        return v;
+    };
+
+    auto colon_pos = param.find(':');
+    if (colon_pos == std::string::npos) {
+        rlimit.limits.rlim_cur = rlimit.limits.rlim_max = parse_limit(param);
+        rlimit.soft_set = rlimit.hard_set = true;
+        return;
+    }
+
+    std::string soft = param.substr(0, colon_pos);
+    std::string hard = param.substr(colon_pos + 1);
+    if (soft.length() != 0) {
+        rlimit.limits.rlim_cur = parse_limit(soft);
+        rlimit.soft_set = true;
+    }
+    if (hard.length() != 0) {
+        rlimit.limits.rlim_max = parse_limit(hard);
+        rlimit.hard_set = true;
+    }
+}
+
+#ifdef __linux__
+// Parse a CPU affinity setting: a list of CPU numbers and ranges (a-b), separated by white space
+// or commas.
+static void parse_cpu_affinity(const std::string &param, const std::string &service_name, cpu_set_t &cpus)
+{
+    CPU_ZERO(&cpus);
+    const char *i = param.c_str();
+    while (*i != 0) {
+        if (*i == ' ' || *i == ',') {
+            ++i;
+            continue;
+        }
+        char *end;
+        errno = 0;
+        unsigned long first = strtoul(i, &end, 10);
+        unsigned long last = first;
+        if (end == i || errno != 0) {
+            throw service_description_exc(service_name, "cpu-affinity: badly formed CPU list");
+        }
+        if (*end == '-') {
+            i = end + 1;
+            last = strtoul(i, &end, 10);
+            if (end == i || errno != 0 || last < first) {
+                throw service_description_exc(service_name, "cpu-affinity: badly formed CPU list");
+            }
+        }
+        if (last >= CPU_SETSIZE) {
+            throw service_description_exc(service_name, "cpu-affinity: CPU number too large");
+        }
+        for (unsigned long cpu = first; cpu <= last; cpu++) {
+            CPU_SET(cpu, &cpus);
+        }
+        i = end;
+        if (*i != 0 && *i != ' ' && *i != ',') {
+            throw service_description_exc(service_name, "cpu-affinity: badly formed CPU list");
+        }
+    }
+    if (CPU_COUNT(&cpus) == 0) {
+        throw service_description_exc(service_name, "cpu-affinity: no CPUs specified");
+    }
+}
+#endif
+
 static const char * gid_err_msg = "Specified group id contains invalid numeric characters or is outside allowed range.";
 
 static gid_t parse_gid_param(const std::string &param, const std::string &service_name)
@@ -349,6 +279,405 @@ static void parse_timespec(const std::string &paramval, const std::string &servi
     ts.tv_nsec = insec;
 }
 
+// Read the entire contents of a service description file into buf, replacing any previous
+// contents. Throws service_not_found if the file cannot be opened, or service_description_exc
+// if it cannot be read. May throw std::bad_alloc.
+static void read_service_file(const string &name, const char *path, std::vector<char> &buf)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        throw service_not_found(name);
+    }
+
+    try {
+        // Size the buffer from the file size, so that it can normally be read in one call
+        struct stat statbuf;
+        size_t size_hint = 256;
+        if (fstat(fd, &statbuf) == 0 && statbuf.st_size > 0) {
+            size_hint = statbuf.st_size + 1;
+        }
+        buf.resize(size_hint);
+
+        size_t len = 0;
+        while (true) {
+            if (len == buf.size()) {
+                buf.resize(len * 2);
+            }
+            ssize_t r = read(fd, buf.data() + len, buf.size() - len);
+            if (r == 0) break;
+            if (r == -1) {
+                if (errno == EINTR) continue;
+                throw service_description_exc(name, string("Error reading service description: ")
+                        + strerror(errno));
+            }
+            len += r;
+        }
+        buf.resize(len);
+    }
+    catch (...) {
+        close(fd);
+        throw;
+    }
+
+    close(fd);
+}
+
+// Service description cache
+// -------------------------
+//
+// The cache holds the settings from a number of service description files, already tokenised.
+// It is written by "dinit --compile-cache" and memory-mapped at startup. For each description,
+// the file modification time and size are recorded; if they no longer match the file, the
+// cache entry is ignored and the description file is parsed instead.
+//
+// Format (all integers in host byte order, no alignment):
+//   header:  8-byte magic ("DINITSC" + nul), 4-byte format version, 4-byte entry count
+//   entry:   2-byte name length, name,
+//            8-byte modification time (seconds), 4-byte modification time (nanoseconds),
+//            8-byte file size, 4-byte setting count, settings...
+//   setting: 2-byte setting name length, setting name, 4-byte value length, value,
+//            2-byte part count, then 4-byte start and 4-byte end position of each part.
+
+static const char cache_magic[8] = { 'D', 'I', 'N', 'I', 'T', 'S', 'C', 0 };
+constexpr static uint32_t cache_version = 1;
+
+namespace {
+    // Writer for the cache
+    class cache_writer
+    {
+        std::vector<char> &buf;
+
+        public:
+        cache_writer(std::vector<char> &buf_p) noexcept : buf(buf_p) { }
+
+        template <typename T> void put(T val)
+        {
+            const char *p = reinterpret_cast<const char *>(&val);
+            buf.insert(buf.end(), p, p + sizeof(T));
+        }
+
+        void put_bytes(const char *p, size_t len)
+        {
+            buf.insert(buf.end(), p, p + len);
+        }
+    };
+}
+
+service_desc_cache::~service_desc_cache() noexcept
+{
+    if (base != nullptr) {
+        munmap(const_cast<char *>(base), length);
+    }
+}
+
+bool service_desc_cache::open(const char *path) noexcept
+{
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+
+    struct stat statbuf;
+    if (fstat(fd, &statbuf) == -1 || statbuf.st_size < (off_t)(sizeof(cache_magic) + 8)) {
+        close(fd);
+        return false;
+    }
+
+    void *mapping = mmap(nullptr, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+
+    base = static_cast<const char *>(mapping);
+    length = statbuf.st_size;
+
+    // Check the header and validate all entries, so that we need not worry about a damaged
+    // cache file later:
+    cache_reader reader(base, base + length);
+    const char *magic;
+    uint32_t version;
+    uint32_t num_entries;
+    reader.get_bytes(magic, sizeof(cache_magic));
+    reader.get(version);
+    reader.get(num_entries);
+
+    if (std::memcmp(magic, cache_magic, sizeof(cache_magic)) != 0 || version != cache_version) {
+        close_mapping();
+        return false;
+    }
+
+    try {
+        for (uint32_t i = 0; i < num_entries; i++) {
+            const char *entry = reader.get_pos();
+            uint16_t name_len;
+            const char *name;
+            int64_t mtime_sec;
+            uint32_t mtime_nsec;
+            uint64_t size;
+            uint32_t num_settings;
+            if (! reader.get(name_len) || ! reader.get_bytes(name, name_len) || ! reader.get(mtime_sec)
+                    || ! reader.get(mtime_nsec) || ! reader.get(size) || ! reader.get(num_settings)) {
+                throw std::length_error("");
+            }
+
+            for (uint32_t j = 0; j < num_settings; j++) {
+                uint16_t setting_len;
+                uint32_t value_len;
+                uint16_t num_parts;
+                const char *p;
+                if (! reader.get(setting_len) || ! reader.get_bytes(p, setting_len)
+                        || ! reader.get(value_len) || ! reader.get_bytes(p, value_len)
+                        || ! reader.get(num_parts)) {
+                    throw std::length_error("");
+                }
+                for (uint16_t k = 0; k < num_parts; k++) {
+                    uint32_t part_start, part_end;
+                    if (! reader.get(part_start) || ! reader.get(part_end) || part_start > part_end
+                            || part_end > value_len) {
+                        throw std::length_error("");
+                    }
+                }
+            }
+
+            entries[std::string(name, name_len)] = entry;
+        }
+    }
+    catch (std::exception &exc) {
+        // bad_alloc, or invalid cache
+        entries.clear();
+        close_mapping();
+        return false;
+    }
+
+    return true;
+}
+
+void service_desc_cache::close_mapping() noexcept
+{
+    munmap(const_cast<char *>(base), length);
+    base = nullptr;
+    length = 0;
+}
+
+const char * service_desc_cache::find(const std::string &name, const std::string &path) noexcept
+{
+    if (base == nullptr) return nullptr;
+
+    auto i = entries.find(name);
+    if (i == entries.end()) return nullptr;
+
+    struct stat statbuf;
+    if (stat(path.c_str(), &statbuf) == -1) {
+        return nullptr;
+    }
+
+    cache_reader reader(i->second, base + length);
+    uint16_t name_len;
+    const char *name_p;
+    int64_t mtime_sec;
+    uint32_t mtime_nsec;
+    uint64_t size;
+    reader.get(name_len);
+    reader.get_bytes(name_p, name_len);
+    reader.get(mtime_sec);
+    reader.get(mtime_nsec);
+    reader.get(size);
+
+    if (mtime_sec != statbuf.st_mtim.tv_sec || mtime_nsec != (uint32_t)statbuf.st_mtim.tv_nsec
+            || size != (uint64_t)statbuf.st_size) {
+        return nullptr;
+    }
+
+    return i->second;
+}
+
+// Write a cache containing all service descriptions in the service directory. Descriptions
+// which cannot be parsed are omitted (they will be parsed, and the error reported, when loaded).
+// Returns the number of descriptions written to the cache, or -1 on error (with errno set).
+// May throw std::bad_alloc.
+int dirload_service_set::write_cache(const char *cache_path)
+{
+
+    DIR *dir = opendir(service_dir);
+    if (dir == nullptr) {
+        return -1;
+    }
+
+    std::vector<char> buf;
+    cache_writer writer(buf);
+    writer.put_bytes(cache_magic, sizeof(cache_magic));
+    writer.put(cache_version);
+    writer.put(uint32_t(0)); // entry count, filled in below
+
+    uint32_t num_entries = 0;
+    std::vector<char> entry_buf;
+    std::vector<char> file_buf;
+
+    while (true) {
+        // (errno may be set by a failure below, so reset it before each readdir() call)
+        errno = 0;
+        struct dirent *dent = readdir(dir);
+        if (dent == nullptr) break;
+
+        const char *name = dent->d_name;
+        size_t name_len = strlen(name);
+        if (name[0] == '.' || name_len > std::numeric_limits<uint16_t>::max()) {
+            continue;
+        }
+
+        string service_filename = service_dir;
+        if (*(service_filename.rbegin()) != '/') {
+            service_filename += '/';
+        }
+        service_filename += name;
+
+        struct stat statbuf;
+        if (stat(service_filename.c_str(), &statbuf) == -1 || ! S_ISREG(statbuf.st_mode)) {
+            continue;
+        }
+
+        entry_buf.clear();
+        cache_writer entry_writer(entry_buf);
+        entry_writer.put(uint16_t(name_len));
+        entry_writer.put_bytes(name, name_len);
+        entry_writer.put(int64_t(statbuf.st_mtim.tv_sec));
+        entry_writer.put(uint32_t(statbuf.st_mtim.tv_nsec));
+        entry_writer.put(uint64_t(statbuf.st_size));
+        size_t num_settings_pos = entry_buf.size();
+        entry_writer.put(uint32_t(0)); // setting count, filled in below
+        uint32_t num_settings = 0;
+
+        auto write_setting = [&](const string &setting, string &value, std::list<std::pair<unsigned,unsigned>> &parts) {
+            if (setting.length() > std::numeric_limits<uint16_t>::max()
+                    || value.length() > std::numeric_limits<uint32_t>::max()
+                    || parts.size() > std::numeric_limits<uint16_t>::max()) {
+                throw setting_exception("Setting too large");
+            }
+            entry_writer.put(uint16_t(setting.length()));
+            entry_writer.put_bytes(setting.data(), setting.length());
+            entry_writer.put(uint32_t(value.length()));
+            entry_writer.put_bytes(value.data(), value.length());
+            entry_writer.put(uint16_t(parts.size()));
+            for (auto &part : parts) {
+                entry_writer.put(uint32_t(part.first));
+                entry_writer.put(uint32_t(part.second));
+            }
+            num_settings++;
+        };
+
+        try {
+            read_service_file(name, service_filename.c_str(), file_buf);
+            process_service_file(name, file_buf.data(), file_buf.data() + file_buf.size(), write_setting);
+        }
+        catch (setting_exception &exc) {
+            continue;
+        }
+        catch (service_load_exc &exc) {
+            continue;
+        }
+
+        std::memcpy(entry_buf.data() + num_settings_pos, &num_settings, sizeof(num_settings));
+        buf.insert(buf.end(), entry_buf.begin(), entry_buf.end());
+        num_entries++;
+    }
+
+    int readdir_errno = errno;
+    closedir(dir);
+    if (readdir_errno != 0) {
+        errno = readdir_errno;
+        return -1;
+    }
+
+    std::memcpy(buf.data() + sizeof(cache_magic) + sizeof(cache_version), &num_entries, sizeof(num_entries));
+
+    // Write to a temporary file and then rename it, so that the cache is replaced atomically:
+    string tmp_path = string(cache_path) + ".tmp";
+    int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd == -1) {
+        return -1;
+    }
+
+    size_t written = 0;
+    while (written < buf.size()) {
+        ssize_t r = write(fd, buf.data() + written, buf.size() - written);
+        if (r == -1) {
+            if (errno == EINTR) continue;
+            int write_errno = errno;
+            close(fd);
+            unlink(tmp_path.c_str());
+            errno = write_errno;
+            return -1;
+        }
+        written += r;
+    }
+
+    if (close(fd) == -1 || rename(tmp_path.c_str(), cache_path) == -1) {
+        int close_errno = errno;
+        unlink(tmp_path.c_str());
+        errno = close_errno;
+        return -1;
+    }
+
+    return num_entries;
+}
+
+namespace {
+    // The settings read from a service description, held until the service's dependencies
+    // have been loaded and the service record can be created.
+    class pending_service
+    {
+        public:
+        string name;
+
+        string command;
+        std::list<std::pair<unsigned,unsigned>> command_offsets;
+        string stop_command;
+        std::list<std::pair<unsigned,unsigned>> stop_command_offsets;
+        string pid_file;
+
+        service_type_t service_type = service_type_t::PROCESS;
+        string logfile;
+        log_type_id log_type = log_type_id::LOGFILE;
+        int log_buf_max = 4096;  // capacity of the output buffer (log-type = buffer)
+        uint64_t logfile_max_size = 0;  // size at which dinit rotates the log file; 0 for no rotation
+        int logfile_keep = 3;  // number of rotated log files to keep
+        process_attrs proc_attrs;  // resource limits, priorities etc
+        int cgroup_cpu_weight = 0;  // cgroup settings (0 or empty to leave the default)
+        int cgroup_io_weight = 0;
+        string cgroup_memory_max;
+        onstart_flags_t onstart_flags;
+        int term_signal = -1;  // additional termination signal
+        bool auto_restart = false;
+        bool smooth_recovery = false;
+        bool start_is_interruptible = false;
+        string socket_path;
+        int socket_perms = 0666;
+        // Note: Posix allows that uid_t and gid_t may be unsigned types, but eg chown uses -1 as an
+        // invalid value, so it's safe to assume that we can do the same:
+        uid_t socket_uid = -1;
+        gid_t socket_gid = -1;
+        // Restart limit interval / count; default is 10 seconds, 3 restarts:
+        timespec restart_interval = { .tv_sec = 10, .tv_nsec = 0 };
+        int max_restarts = 3;
+        timespec restart_delay = { .tv_sec = 0, .tv_nsec = 200000000 };
+        timespec stop_timeout = { .tv_sec = 10, .tv_nsec = 0 };
+        timespec start_timeout = { .tv_sec = 60, .tv_nsec = 0 };
+        int start_priority = 0;
+        int notification_fd = -1;  // fd number for readiness notification pipe, or -1
+
+        // Dependencies, by name, as given in the description; next_dep is the first which has
+        // not yet been resolved to a loaded record (in depends).
+        std::list<std::pair<string, dependency_type>> dep_names;
+        std::list<std::pair<string, dependency_type>>::iterator next_dep;
+        std::list<prelim_dep> depends;
+
+        pending_service(const string &name_p) : name(name_p)
+        {
+        }
+    };
+}
+
 // Find a service record, or load it from file. If the service has
 // dependencies, load those also.
 //
@@ -356,312 +685,453 @@ static void parse_timespec(const std::string &paramval, const std::string &servi
 // problem occurs (I/O error, service description not found etc). Throws std::bad_alloc
 // if a memory allocation failure occurs.
 //
+// Loading does not recurse: descriptions are read onto an explicit stack (a depth-first
+// traversal of the dependency graph), and each service record is created, and added to the
+// set, only once all its dependencies have been loaded. A dependency on a service which is
+// still on the stack is a cycle.
+//
 service_record * dirload_service_set::load_service(const char * name)
 {
     using std::string;
-    using std::ifstream;
-    using std::ios;
-    using std::ios_base;
-    using std::locale;
-    using std::isspace;
-    
     using std::list;
     using std::pair;
     
     // First try and find an existing record...
     service_record * rval = find_service(string(name));
     if (rval != 0) {
-        if (rval->isDummy()) {
-            throw service_cyclic_dependency(name);
-        }
         return rval;
     }
 
-    // Couldn't find one. Have to load it.    
-    string service_filename = service_dir;
-    if (*(service_filename.rbegin()) != '/') {
-        service_filename += '/';
-    }
-    service_filename += name;
-    
-    string command;
-    list<pair<unsigned,unsigned>> command_offsets;
-    string stop_command;
-    list<pair<unsigned,unsigned>> stop_command_offsets;
-    string pid_file;
-
-    service_type_t service_type = service_type_t::PROCESS;
-    std::list<prelim_dep> depends;
-    string logfile;
-    onstart_flags_t onstart_flags;
-    int term_signal = -1;  // additional termination signal
-    bool auto_restart = false;
-    bool smooth_recovery = false;
-    bool start_is_interruptible = false;
-    string socket_path;
-    int socket_perms = 0666;
-    // Note: Posix allows that uid_t and gid_t may be unsigned types, but eg chown uses -1 as an
-    // invalid value, so it's safe to assume that we can do the same:
-    uid_t socket_uid = -1;
-    gid_t socket_gid = -1;
-    // Restart limit interval / count; default is 10 seconds, 3 restarts:
-    timespec restart_interval = { .tv_sec = 10, .tv_nsec = 0 };
-    int max_restarts = 3;
-    timespec restart_delay = { .tv_sec = 0, .tv_nsec = 200000000 };
-    timespec stop_timeout = { .tv_sec = 10, .tv_nsec = 0 };
-    timespec start_timeout = { .tv_sec = 60, .tv_nsec = 0 };
-    
-    string line;
-    ifstream service_file;
-    service_file.exceptions(ios::badbit | ios::failbit);
-    
-    try {
-        service_file.open(service_filename.c_str(), ios::in);
-    }
-    catch (std::ios_base::failure &exc) {
-        throw service_not_found(name);
-    }
-    
-    // Add a dummy service record now to prevent infinite recursion in case of cyclic dependency.
-    // We replace this with the real service later (or remove it if we find a configuration error).
-    rval = new service_record(this, string(name));
-    add_service(rval);
-    
-    try {
-        // getline can set failbit if it reaches end-of-file, we don't want an exception in that case:
-        service_file.exceptions(ios::badbit);
-        
-        while (! (service_file.rdstate() & ios::eofbit)) {
-            getline(service_file, line);
-            string::iterator i = line.begin();
-            string::iterator end = line.end();
-          
-            i = skipws(i, end);
-            if (i != end) {
-                if (*i == '#') {
-                    continue;  // comment line
-                }
-                string setting = read_setting_name(i, end);
-                i = skipws(i, end);
-                if (i == end || (*i != '=' && *i != ':')) {
-                    throw service_description_exc(name, "Badly formed line.");
-                }
-                i = skipws(++i, end);
-                
-                if (setting == "command") {
-                    command = read_setting_value(i, end, &command_offsets);
-                }
-                else if (setting == "socket-listen") {
-                    socket_path = read_setting_value(i, end, nullptr);
-                }
-                else if (setting == "socket-permissions") {
-                    string sock_perm_str = read_setting_value(i, end, nullptr);
-                    std::size_t ind = 0;
-                    try {
-                        socket_perms = std::stoi(sock_perm_str, &ind, 8);
-                        if (ind != sock_perm_str.length()) {
-                            throw std::logic_error("");
-                        }
-                    }
-                    catch (std::logic_error &exc) {
-                        throw service_description_exc(name, "socket-permissions: Badly-formed or out-of-range numeric value");
+    // Couldn't find one. Have to load it (and any dependencies not yet loaded).
+    std::vector<std::unique_ptr<pending_service>> load_stack;
+    std::unordered_set<string> in_progress;
+
+    // Read the description of a service, and push it onto the load stack
+    auto read_description = [&](const string &svc_name) {
+        std::unique_ptr<pending_service> svcp { new pending_service(svc_name) };
+        pending_service &svc = *svcp;
+        const string &name = svc.name;
+
+        string service_filename = service_dir;
+        if (*(service_filename.rbegin()) != '/') {
+            service_filename += '/';
+        }
+        service_filename += name;
+
+        // Process a single setting (with value parts, if applicable)
+        auto process_setting = [&](const string &setting, string &value, list<pair<unsigned,unsigned>> &parts) {
+            if (setting == "command") {
+                svc.command = std::move(value);
+                svc.command_offsets = std::move(parts);
+            }
+            else if (setting == "socket-listen") {
+                svc.socket_path = std::move(value);
+            }
+            else if (setting == "socket-permissions") {
+                std::size_t ind = 0;
+                try {
+                    svc.socket_perms = std::stoi(value, &ind, 8);
+                    if (ind != value.length()) {
+                        throw std::logic_error("");
                     }
                 }
-                else if (setting == "socket-uid") {
-                    string sock_uid_s = read_setting_value(i, end, nullptr);
-                    socket_uid = parse_uid_param(sock_uid_s, name, &socket_gid);
+                catch (std::logic_error &exc) {
+                    throw service_description_exc(name, "socket-permissions: Badly-formed or out-of-range numeric value");
+                }
+            }
+            else if (setting == "socket-uid") {
+                svc.socket_uid = parse_uid_param(value, name, &svc.socket_gid);
+            }
+            else if (setting == "socket-gid") {
+                svc.socket_gid = parse_gid_param(value, name);
+            }
+            else if (setting == "stop-command") {
+                svc.stop_command = std::move(value);
+                svc.stop_command_offsets = std::move(parts);
+            }
+            else if (setting == "pid-file") {
+                svc.pid_file = std::move(value);
+            }
+            else if (setting == "depends-on") {
+                svc.dep_names.emplace_back(std::move(value), dependency_type::REGULAR);
+            }
+            else if (setting == "depends-ms") {
+                svc.dep_names.emplace_back(std::move(value), dependency_type::MILESTONE);
+            }
+            else if (setting == "waits-for") {
+                svc.dep_names.emplace_back(std::move(value), dependency_type::WAITS_FOR);
+            }
+            else if (setting == "logfile") {
+                svc.logfile = std::move(value);
+            }
+            else if (setting == "log-type") {
+                if (value == "file") {
+                    svc.log_type = log_type_id::LOGFILE;
                 }
-                else if (setting == "socket-gid") {
-                    string sock_gid_s = read_setting_value(i, end, nullptr);
-                    socket_gid = parse_gid_param(sock_gid_s, name);
+                else if (value == "buffer") {
+                    svc.log_type = log_type_id::BUFFER;
                 }
-                else if (setting == "stop-command") {
-                    stop_command = read_setting_value(i, end, &stop_command_offsets);
+                else if (value == "none") {
+                    svc.log_type = log_type_id::NONE;
                 }
-                else if (setting == "pid-file") {
-                    pid_file = read_setting_value(i, end);
+                else {
+                    throw service_description_exc(name, "log-type must be one of: \"file\", \"buffer\" or \"none\"");
                 }
-                else if (setting == "depends-on") {
-                    string dependency_name = read_setting_value(i, end);
-                    depends.emplace_back(load_service(dependency_name.c_str()), dependency_type::REGULAR);
+            }
+            else if (setting == "logfile-max-size") {
+                svc.logfile_max_size = parse_unum_param(value, name);
+            }
+            else if (setting == "logfile-keep") {
+                svc.logfile_keep = parse_unum_param(value, name, 1000);
+            }
+            else if (setting == "log-buffer-size") {
+                svc.log_buf_max = parse_unum_param(value, name, std::numeric_limits<int>::max() / 2);
+                if (svc.log_buf_max == 0) {
+                    throw service_description_exc(name, "log-buffer-size must be greater than zero");
                 }
-                else if (setting == "depends-ms") {
-                    string dependency_name = read_setting_value(i, end);
-                    depends.emplace_back(load_service(dependency_name.c_str()), dependency_type::MILESTONE);
+            }
+            else if (setting == "restart") {
+                svc.auto_restart = (value == "yes" || value == "true");
+            }
+            else if (setting == "smooth-recovery") {
+                svc.smooth_recovery = (value == "yes" || value == "true");
+            }
+            else if (setting == "type") {
+                if (value == "scripted") {
+                    svc.service_type = service_type_t::SCRIPTED;
                 }
-                else if (setting == "waits-for") {
-                    string dependency_name = read_setting_value(i, end);
-                    depends.emplace_back(load_service(dependency_name.c_str()), dependency_type::WAITS_FOR);
+                else if (value == "process") {
+                    svc.service_type = service_type_t::PROCESS;
                 }
-                else if (setting == "logfile") {
-                    logfile = read_setting_value(i, end);
+                else if (value == "bgprocess") {
+                    svc.service_type = service_type_t::BGPROCESS;
                 }
-                else if (setting == "restart") {
-                    string restart = read_setting_value(i, end);
-                    auto_restart = (restart == "yes" || restart == "true");
+                else if (value == "internal") {
+                    svc.service_type = service_type_t::INTERNAL;
                 }
-                else if (setting == "smooth-recovery") {
-                    string recovery = read_setting_value(i, end);
-                    smooth_recovery = (recovery == "yes" || recovery == "true");
+                else {
+                    throw service_description_exc(name, "Service type must be one of: \"scripted\","
+                        " \"process\", \"bgprocess\" or \"internal\"");
                 }
-                else if (setting == "type") {
-                    string type_str = read_setting_value(i, end);
-                    if (type_str == "scripted") {
-                        service_type = service_type_t::SCRIPTED;
+            }
+            else if (setting == "options") {
+                for (auto indexpair : parts) {
+                    string option_txt = value.substr(indexpair.first, indexpair.second - indexpair.first);
+                    if (option_txt == "starts-rwfs") {
+                        svc.onstart_flags.rw_ready = true;
                     }
-                    else if (type_str == "process") {
-                        service_type = service_type_t::PROCESS;
+                    else if (option_txt == "starts-log") {
+                        svc.onstart_flags.log_ready = true;
                     }
-                    else if (type_str == "bgprocess") {
-                        service_type = service_type_t::BGPROCESS;
+                    else if (option_txt == "no-sigterm") {
+                        svc.onstart_flags.no_sigterm = true;
                     }
-                    else if (type_str == "internal") {
-                        service_type = service_type_t::INTERNAL;
+                    else if (option_txt == "runs-on-console") {
+                        svc.onstart_flags.runs_on_console = true;
+                        // A service that runs on the console necessarily starts on console:
+                        svc.onstart_flags.starts_on_console = true;
                     }
-                    else {
-                        throw service_description_exc(name, "Service type must be one of: \"scripted\","
-                            " \"process\", \"bgprocess\" or \"internal\"");
+                    else if (option_txt == "starts-on-console") {
+                        svc.onstart_flags.starts_on_console = true;
                     }
-                }
-                else if (setting == "options") {
-                    std::list<std::pair<unsigned,unsigned>> indices;
-                    string onstart_cmds = read_setting_value(i, end, &indices);
-                    for (auto indexpair : indices) {
-                        string option_txt = onstart_cmds.substr(indexpair.first, indexpair.second - indexpair.first);
-                        if (option_txt == "starts-rwfs") {
-                            onstart_flags.rw_ready = true;
-                        }
-                        else if (option_txt == "starts-log") {
-                            onstart_flags.log_ready = true;
-                        }
-                        else if (option_txt == "no-sigterm") {
-                            onstart_flags.no_sigterm = true;
-                        }
-                        else if (option_txt == "runs-on-console") {
-                            onstart_flags.runs_on_console = true;
-                            // A service that runs on the console necessarily starts on console:
-                            onstart_flags.starts_on_console = true;
-                        }
-                        else if (option_txt == "starts-on-console") {
-                            onstart_flags.starts_on_console = true;
-                        }
-                        else if (option_txt == "pass-cs-fd") {
-                            onstart_flags.pass_cs_fd = true;
-                        }
-                        else if (option_txt == "start-interruptible") {
-                            start_is_interruptible = true;
-                        }
-                        else {
-                            throw service_description_exc(name, "Unknown option: " + option_txt);
-                        }
+                    else if (option_txt == "pass-cs-fd") {
+                        svc.onstart_flags.pass_cs_fd = true;
                     }
-                }
-                else if (setting == "termsignal") {
-                    string signame = read_setting_value(i, end, nullptr);
-                    int signo = signal_name_to_number(signame);
-                    if (signo == -1) {
-                        throw service_description_exc(name, "Unknown/unsupported termination signal: " + signame);
+                    else if (option_txt == "start-interruptible") {
+                        svc.start_is_interruptible = true;
                     }
                     else {
-                        term_signal = signo;
+                        throw service_description_exc(name, "Unknown option: " + option_txt);
                     }
                 }
-                else if (setting == "restart-limit-interval") {
-                    string interval_str = read_setting_value(i, end, nullptr);
-                    parse_timespec(interval_str, name, "restart-limit-interval", restart_interval);
+            }
+            else if (setting == "termsignal") {
+                int signo = signal_name_to_number(value);
+                if (signo == -1) {
+                    throw service_description_exc(name, "Unknown/unsupported termination signal: " + value);
                 }
-                else if (setting == "restart-delay") {
-                    string rsdelay_str = read_setting_value(i, end, nullptr);
-                    parse_timespec(rsdelay_str, name, "restart-delay", restart_delay);
+                else {
+                    svc.term_signal = signo;
                 }
-                else if (setting == "restart-limit-count") {
-                    string limit_str = read_setting_value(i, end, nullptr);
-                    max_restarts = parse_unum_param(limit_str, name, std::numeric_limits<int>::max());
+            }
+            else if (setting == "restart-limit-interval") {
+                parse_timespec(value, name, "restart-limit-interval", svc.restart_interval);
+            }
+            else if (setting == "restart-delay") {
+                parse_timespec(value, name, "restart-delay", svc.restart_delay);
+            }
+            else if (setting == "restart-limit-count") {
+                svc.max_restarts = parse_unum_param(value, name, std::numeric_limits<int>::max());
+            }
+            else if (setting == "stop-timeout") {
+                parse_timespec(value, name, "stop-timeout", svc.stop_timeout);
+            }
+            else if (setting == "start-timeout") {
+                parse_timespec(value, name, "start-timeout", svc.start_timeout);
+            }
+            else if (setting == "start-priority") {
+                std::size_t ind = 0;
+                try {
+                    svc.start_priority = std::stoi(value, &ind, 10);
+                    if (ind != value.length()) {
+                        throw std::logic_error("");
+                    }
                 }
-                else if (setting == "stop-timeout") {
-                    string stoptimeout_str = read_setting_value(i, end, nullptr);
-                    parse_timespec(stoptimeout_str, name, "stop-timeout", stop_timeout);
+                catch (std::logic_error &exc) {
+                    throw service_description_exc(name, "start-priority: Badly-formed or out-of-range numeric value");
                 }
-                else if (setting == "start-timeout") {
-                    string starttimeout_str = read_setting_value(i, end, nullptr);
-                    parse_timespec(starttimeout_str, name, "start-timeout", start_timeout);
+            }
+            else if (setting == "nice") {
+                svc.proc_attrs.nice = parse_snum_param(value, name, -20, 19);
+            }
+            else if (setting.compare(0, 7, "rlimit-") == 0) {
+                static const std::pair<const char *, int> rlimit_names[] = {
+                    { "rlimit-nofile", RLIMIT_NOFILE },
+                    { "rlimit-core", RLIMIT_CORE },
+                    { "rlimit-data", RLIMIT_DATA },
+                    { "rlimit-addrspace", RLIMIT_AS },
+                };
+                auto rl_i = std::find_if(std::begin(rlimit_names), std::end(rlimit_names),
+                        [&](const std::pair<const char *, int> &rl) { return setting == rl.first; });
+                if (rl_i == std::end(rlimit_names)) {
+                    throw service_description_exc(name, "Unknown setting: " + setting);
                 }
+                auto &rlimits = svc.proc_attrs.rlimits;
+                auto existing = std::find_if(rlimits.begin(), rlimits.end(),
+                        [&](const service_rlimits &rl) { return rl.resource_id == rl_i->second; });
+                if (existing == rlimits.end()) {
+                    rlimits.emplace_back(rl_i->second);
+                    existing = rlimits.end() - 1;
+                }
+                parse_rlimit(value, name, rl_i->first, *existing);
+            }
+#ifdef __linux__
+            else if (setting == "ioprio") {
+                // realtime:N, best-effort:N (N from 0, highest priority, to 7) or idle.
+                // (I/O priority classes: RT = 1, BE = 2, IDLE = 3)
+                auto colon_pos = value.find(':');
+                string io_class = value.substr(0, colon_pos);
+                int class_id;
+                if (io_class == "realtime") class_id = 1;
+                else if (io_class == "best-effort") class_id = 2;
+                else if (io_class == "idle") class_id = 3;
                 else {
-                    throw service_description_exc(name, "Unknown setting: " + setting);
+                    throw service_description_exc(name, "ioprio must be one of: \"realtime:N\", "
+                            "\"best-effort:N\" or \"idle\"");
+                }
+                int level = 0;
+                if (class_id != 3) {
+                    if (colon_pos == string::npos) {
+                        throw service_description_exc(name, "ioprio: priority level (0-7) not specified");
+                    }
+                    level = parse_snum_param(value.substr(colon_pos + 1), name, 0, 7);
+                }
+                else if (colon_pos != string::npos) {
+                    throw service_description_exc(name, "ioprio: idle class does not take a priority level");
                 }
+                svc.proc_attrs.ioprio = (class_id << 13) | level;
             }
-        }
-        
-        service_file.close();
-        
-        if (service_type == service_type_t::PROCESS || service_type == service_type_t::BGPROCESS || service_type == service_type_t::SCRIPTED) {
-            if (command.length() == 0) {
-                throw service_description_exc(name, "Service command not specified");
+            else if (setting == "oom-score-adj") {
+                svc.proc_attrs.oom_score_adj = parse_snum_param(value, name, -1000, 1000);
             }
-        }
-        
-        // Now replace the dummy service record with a real record:
-        for (auto iter = records.begin(); iter != records.end(); iter++) {
-            if (*iter == rval) {
-                // We've found the dummy record
-                delete rval;
-                if (service_type == service_type_t::PROCESS) {
-                    auto rvalps = new process_service(this, string(name), std::move(command),
-                            command_offsets, depends);
-                    rvalps->set_restart_interval(restart_interval, max_restarts);
-                    rvalps->set_restart_delay(restart_delay);
-                    rvalps->set_stop_timeout(stop_timeout);
-                    rvalps->set_start_timeout(start_timeout);
-                    rvalps->set_start_interruptible(start_is_interruptible);
-                    rval = rvalps;
+            else if (setting == "cpu-affinity") {
+                parse_cpu_affinity(value, name, svc.proc_attrs.cpu_affinity);
+                svc.proc_attrs.has_cpu_affinity = true;
+            }
+            else if (setting == "cgroup-cpu-weight") {
+                svc.cgroup_cpu_weight = parse_snum_param(value, name, 1, 10000);
+            }
+            else if (setting == "io-weight") {
+                svc.cgroup_io_weight = parse_snum_param(value, name, 1, 10000);
+            }
+            else if (setting == "memory-max") {
+                // "max", or a size in bytes, optionally with a K, M or G suffix
+                if (value == "max") {
+                    svc.cgroup_memory_max = value;
                 }
-                else if (service_type == service_type_t::BGPROCESS) {
-                    auto rvalps = new bgproc_service(this, string(name), std::move(command),
-                            command_offsets, depends);
-                    rvalps->set_pid_file(std::move(pid_file));
-                    rvalps->set_restart_interval(restart_interval, max_restarts);
-                    rvalps->set_restart_delay(restart_delay);
-                    rvalps->set_stop_timeout(stop_timeout);
-                    rvalps->set_start_timeout(start_timeout);
-                    rvalps->set_start_interruptible(start_is_interruptible);
-                    rval = rvalps;
+                else {
+                    unsigned shift = 0;
+                    string num = value;
+                    if (! num.empty()) {
+                        switch (num.back()) {
+                        case 'K': shift = 10; break;
+                        case 'M': shift = 20; break;
+                        case 'G': shift = 30; break;
+                        }
+                        if (shift != 0) num.pop_back();
+                    }
+                    unsigned long long bytes = parse_unum_param(num, name,
+                            std::numeric_limits<unsigned long long>::max() >> shift);
+                    svc.cgroup_memory_max = std::to_string(bytes << shift);
                 }
-                else if (service_type == service_type_t::SCRIPTED) {
-                    auto rvalps = new scripted_service(this, string(name), std::move(command),
-                            command_offsets, depends);
-                    rvalps->set_stop_command(stop_command, stop_command_offsets);
-                    rvalps->set_stop_timeout(stop_timeout);
-                    rvalps->set_start_timeout(start_timeout);
-                    rvalps->set_start_interruptible(start_is_interruptible);
-                    rval = rvalps;
+            }
+#else
+            else if (setting == "cgroup-cpu-weight" || setting == "io-weight" || setting == "memory-max") {
+                throw service_description_exc(name, setting + " is not supported on this platform");
+            }
+            else if (setting == "ioprio" || setting == "oom-score-adj" || setting == "cpu-affinity") {
+                throw service_description_exc(name, setting + " is not supported on this platform");
+            }
+#endif
+            else if (setting == "ready-notification") {
+                if (value.compare(0, 7, "pipefd:") == 0) {
+                    svc.notification_fd = parse_unum_param(value.substr(7), name, std::numeric_limits<int>::max());
+                    if (svc.notification_fd < 3) {
+                        throw service_description_exc(name, "ready-notification: pipefd must be 3 or greater");
+                    }
                 }
                 else {
-                    rval = new service_record(this, string(name), service_type, depends);
+                    throw service_description_exc(name, "Unknown ready-notification setting: " + value);
                 }
-                rval->set_log_file(logfile);
-                rval->set_auto_restart(auto_restart);
-                rval->set_smooth_recovery(smooth_recovery);
-                rval->set_flags(onstart_flags);
-                rval->set_extra_termination_signal(term_signal);
-                rval->set_socket_details(std::move(socket_path), socket_perms, socket_uid, socket_gid);
-                *iter = rval;
+            }
+            else {
+                throw service_description_exc(name, "Unknown setting: " + setting);
+            }
+        };
+
+        // Use the compiled description from the cache if it is present and up-to-date; otherwise,
+        // parse the description file.
+        const char *cache_entry = cache.find(name, service_filename);
+
+        try {
+            if (cache_entry != nullptr) {
+                cache.replay(cache_entry, process_setting);
+            }
+            else {
+                std::vector<char> file_buf;
+                read_service_file(name, service_filename.c_str(), file_buf);
+                process_service_file(name, file_buf.data(), file_buf.data() + file_buf.size(), process_setting);
+            }
+        }
+        catch (setting_exception &setting_exc) {
+            throw service_description_exc(name, std::move(setting_exc.get_info()));
+        }
+
+        if (svc.service_type == service_type_t::PROCESS || svc.service_type == service_type_t::BGPROCESS
+                || svc.service_type == service_type_t::SCRIPTED) {
+            if (svc.command.length() == 0) {
+                throw service_description_exc(name, "Service command not specified");
+            }
+        }
+
+        if (svc.logfile_max_size != 0) {
+            if (svc.log_type != log_type_id::LOGFILE || svc.logfile.length() == 0) {
+                throw service_description_exc(name, "logfile-max-size requires logfile (and log-type = file)");
+            }
+        }
+
+        if (svc.notification_fd != -1) {
+            if (svc.service_type != service_type_t::PROCESS) {
+                throw service_description_exc(name, "ready-notification is only supported for process services");
+            }
+            if (svc.notification_fd == 3 && svc.socket_path.length() != 0) {
+                throw service_description_exc(name, "ready-notification: pipefd:3 conflicts with socket-listen (fd 3)");
+            }
+        }
+
+        svc.next_dep = svc.dep_names.begin();
+        load_stack.push_back(std::move(svcp));
+        in_progress.insert(svc_name);
+    };
+
+    read_description(name);
+
+    while (true) {
+        pending_service &svc = *load_stack.back();
+
+        // Resolve dependencies to records; if one is not yet loaded, read its description and
+        // process it first.
+        bool deps_loaded = true;
+        while (svc.next_dep != svc.dep_names.end()) {
+            const string &dep_name = svc.next_dep->first;
+            service_record *dep = find_service(dep_name);
+            if (dep == nullptr) {
+                if (in_progress.count(dep_name) != 0) {
+                    throw service_cyclic_dependency(dep_name);
+                }
+                read_description(dep_name);
+                deps_loaded = false;
                 break;
             }
+            svc.depends.emplace_back(dep, svc.next_dep->second);
+            ++svc.next_dep;
+        }
+
+        if (! deps_loaded) {
+            continue;
+        }
+
+        // All dependencies are loaded; create the service record:
+        if (svc.service_type == service_type_t::PROCESS) {
+            auto rvalps = new (this) process_service(this, svc.name, std::move(svc.command),
+                    svc.command_offsets, svc.depends);
+            rvalps->set_restart_interval(svc.restart_interval, svc.max_restarts);
+            rvalps->set_restart_delay(svc.restart_delay);
+            rvalps->set_stop_timeout(svc.stop_timeout);
+            rvalps->set_start_timeout(svc.start_timeout);
+            rvalps->set_start_interruptible(svc.start_is_interruptible);
+            rvalps->set_log_buf_max(svc.log_buf_max);
+            rvalps->set_log_file_rotation(svc.logfile_max_size, svc.logfile_keep);
+            rvalps->set_cgroup_settings(svc.cgroup_cpu_weight, svc.cgroup_io_weight,
+                    std::move(svc.cgroup_memory_max));
+            rvalps->set_notification_fd(svc.notification_fd);
+            rval = rvalps;
+        }
+        else if (svc.service_type == service_type_t::BGPROCESS) {
+            auto rvalps = new (this) bgproc_service(this, svc.name, std::move(svc.command),
+                    svc.command_offsets, svc.depends);
+            rvalps->set_pid_file(std::move(svc.pid_file));
+            rvalps->set_restart_interval(svc.restart_interval, svc.max_restarts);
+            rvalps->set_restart_delay(svc.restart_delay);
+            rvalps->set_stop_timeout(svc.stop_timeout);
+            rvalps->set_start_timeout(svc.start_timeout);
+            rvalps->set_start_interruptible(svc.start_is_interruptible);
+            rvalps->set_log_buf_max(svc.log_buf_max);
+            rvalps->set_log_file_rotation(svc.logfile_max_size, svc.logfile_keep);
+            rvalps->set_cgroup_settings(svc.cgroup_cpu_weight, svc.cgroup_io_weight,
+                    std::move(svc.cgroup_memory_max));
+            rval = rvalps;
+        }
+        else if (svc.service_type == service_type_t::SCRIPTED) {
+            auto rvalps = new (this) scripted_service(this, svc.name, std::move(svc.command),
+                    svc.command_offsets, svc.depends);
+            rvalps->set_stop_command(svc.stop_command, svc.stop_command_offsets);
+            rvalps->set_stop_timeout(svc.stop_timeout);
+            rvalps->set_start_timeout(svc.start_timeout);
+            rvalps->set_start_interruptible(svc.start_is_interruptible);
+            rvalps->set_log_buf_max(svc.log_buf_max);
+            rvalps->set_log_file_rotation(svc.logfile_max_size, svc.logfile_keep);
+            rvalps->set_cgroup_settings(svc.cgroup_cpu_weight, svc.cgroup_io_weight,
+                    std::move(svc.cgroup_memory_max));
+            rval = rvalps;
+        }
+        else {
+            rval = new (this) service_record(this, svc.name, svc.service_type, svc.depends);
+        }
+
+        try {
+            rval->set_log_file(svc.logfile);
+            rval->set_log_type(svc.log_type);
+            rval->set_auto_restart(svc.auto_restart);
+            rval->set_smooth_recovery(svc.smooth_recovery);
+            rval->set_flags(svc.onstart_flags);
+            rval->set_extra_termination_signal(svc.term_signal);
+            rval->set_start_priority(svc.start_priority);
+            rval->set_process_attrs(std::move(svc.proc_attrs));
+            rval->set_socket_details(std::move(svc.socket_path), svc.socket_perms, svc.socket_uid, svc.socket_gid);
+            add_service(rval);
+        }
+        catch (...) {
+            // The dependencies already refer to the new record; unlink it before deleting it.
+            rval->unlink_dependencies();
+            delete rval;
+            throw;
+        }
+
+        in_progress.erase(svc.name);
+        load_stack.pop_back();
+        if (load_stack.empty()) {
+            return rval;
         }
-        
-        return rval;
-    }
-    catch (setting_exception &setting_exc)
-    {
-        // Must remove the dummy service record.
-        std::remove(records.begin(), records.end(), rval);
-        delete rval;
-        throw service_description_exc(name, std::move(setting_exc.get_info()));
-    }
-    catch (...) {
-        // Must remove the dummy service record.
-        std::remove(records.begin(), records.end(), rval);
-        delete rval;
-        throw;
     }
 }
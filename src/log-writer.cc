@@ -0,0 +1,295 @@
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <new>
+#include <system_error>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "dinit.h"
+#include "log-writer.h"
+#include "proc-service.h"
+#include "baseproc-sys.h"
+
+// The log writer thread. Jobs are queued (under queue_mutex) for the writer, which performs each
+// in turn and moves it to the completed list; the event loop is then woken via the notification
+// pipe, and dispatches the completions. Only the writer thread touches a job (or its file) while
+// the job is in progress.
+
+static std::mutex queue_mutex;
+static std::condition_variable queue_cond;
+static log_write_job *pending_head = nullptr;  // jobs waiting to be performed
+static log_write_job *pending_tail = nullptr;
+static log_write_job *done_head = nullptr;     // completed jobs, waiting for dispatch
+static log_write_job *done_tail = nullptr;
+
+static int notify_fds[2] = { -1, -1 };  // notification pipe (writer -> event loop)
+
+enum class writer_state_t { NOT_STARTED, RUNNING, FAILED };
+static writer_state_t writer_state = writer_state_t::NOT_STARTED;
+
+static void append_job(log_write_job *&head, log_write_job *&tail, log_write_job *job) noexcept
+{
+    job->next = nullptr;
+    if (tail == nullptr) {
+        head = job;
+    }
+    else {
+        tail->next = job;
+    }
+    tail = job;
+}
+
+// Rotate the log file (if open) and open a new one. Returns false on failure.
+static bool open_log_file(log_write_job *job) noexcept
+{
+    if (job->fd != -1) {
+        // Rotate: logfile.(keep-1) -> logfile.(keep), ... logfile -> logfile.1. Each step is a
+        // rename (or, if no old files are kept, an unlink), so this doesn't copy any data.
+        bp_sys::close(job->fd);
+        job->fd = -1;
+        const std::string &logfile = job->path;
+        try {
+            if (job->keep == 0) {
+                bp_sys::unlink(logfile.c_str());
+            }
+            else {
+                std::string old_name = logfile + "." + std::to_string(job->keep);
+                for (int i = job->keep - 1; i > 0; i--) {
+                    std::string new_name = std::move(old_name);
+                    old_name = logfile + "." + std::to_string(i);
+                    bp_sys::rename(old_name.c_str(), new_name.c_str());
+                }
+                bp_sys::rename(logfile.c_str(), old_name.c_str());
+            }
+        }
+        catch (std::bad_alloc &exc) {
+            job->rotate_failed = true;
+        }
+    }
+
+    // With O_NONBLOCK, writes to a FIFO or terminal will not block (and so hold up the writes
+    // for other services).
+    job->fd = bp_sys::open(job->path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_NONBLOCK | O_CLOEXEC,
+            S_IRUSR | S_IWUSR);
+    if (job->fd == -1) {
+        return false;
+    }
+
+    struct stat statbuf;
+    job->size = (bp_sys::fstat(job->fd, &statbuf) == 0) ? statbuf.st_size : 0;
+    return true;
+}
+
+// Write the job's output to the log file, rotating the file as necessary.
+static void perform_job(log_write_job *job) noexcept
+{
+    job->would_block = false;
+    job->rotate_failed = false;
+
+    if (job->reopen) {
+        if (job->fd != -1) {
+            bp_sys::close(job->fd);
+            job->fd = -1;
+        }
+        job->reopen = false;
+    }
+
+    while (job->start != job->end) {
+        if ((job->fd == -1 || job->size >= job->max_size) && ! open_log_file(job)) {
+            // Can't open the log file; discard the output (as for a process which can't open
+            // its log file). We try again with the next output.
+            job->start = job->end;
+            break;
+        }
+
+        // Write as much as fits in the current file. If the file couldn't be rotated, it just
+        // grows.
+        uint64_t count = job->end - job->start;
+        if (job->size < job->max_size && count > job->max_size - job->size) {
+            count = job->max_size - job->size;
+        }
+
+        struct iovec iov;
+        iov.iov_base = job->data.get() + job->start;
+        iov.iov_len = count;
+
+        ssize_t r = bp_sys::writev(job->fd, &iov, 1);
+        if (r == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // The file can't accept output right now.
+                job->would_block = true;
+                return;
+            }
+            // Write error (disk full, perhaps): discard the output, and re-open the file with
+            // the next output.
+            job->start = job->end;
+            bp_sys::close(job->fd);
+            job->fd = -1;
+            break;
+        }
+
+        job->start += r;
+        job->size += r;
+        if ((uint64_t)r < count) {
+            // A partial write: rather than keep retrying, wait before writing more.
+            job->would_block = true;
+            return;
+        }
+    }
+}
+
+// Dispatch a completed job (from the event loop).
+static void complete_job(log_write_job *job) noexcept
+{
+    job->in_progress = false;
+    if (job->service == nullptr) {
+        // The service has gone away
+        if (job->fd != -1) {
+            bp_sys::close(job->fd);
+        }
+        delete job;
+        return;
+    }
+    job->service->log_write_complete();
+}
+
+static void writer_main() noexcept
+{
+    while (true) {
+        log_write_job *job;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            while (pending_head == nullptr) {
+                queue_cond.wait(lock);
+            }
+            job = pending_head;
+            pending_head = job->next;
+            if (pending_head == nullptr) pending_tail = nullptr;
+        }
+
+        perform_job(job);
+
+        bool was_empty;
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            was_empty = (done_head == nullptr);
+            append_job(done_head, done_tail, job);
+        }
+        if (was_empty) {
+            char c = 0;
+            while (write(notify_fds[1], &c, 1) == -1 && errno == EINTR) { }
+        }
+    }
+}
+
+namespace {
+// Watcher for the notification pipe, through which the writer signals job completion.
+class log_writer_watcher : public eventloop_t::fd_watcher_impl<log_writer_watcher>
+{
+    public:
+    rearm fd_event(eventloop_t &loop, int fd, int flags) noexcept
+    {
+        // Drain the pipe before taking the completed jobs, so that no notification is missed.
+        char buf[64];
+        while (read(fd, buf, sizeof(buf)) > 0) { }
+
+        log_write_job *job;
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            job = done_head;
+            done_head = done_tail = nullptr;
+        }
+
+        while (job != nullptr) {
+            log_write_job *next = job->next;
+            complete_job(job);
+            job = next;
+        }
+        return rearm::REARM;
+    }
+};
+}
+
+static log_writer_watcher writer_watcher;
+
+// Start the writer thread. Returns false on failure.
+static bool start_writer() noexcept
+{
+    if (dasynq::pipe2(notify_fds, O_CLOEXEC | O_NONBLOCK) == -1) {
+        return false;
+    }
+
+    try {
+        writer_watcher.add_watch(event_loop, notify_fds[0], dasynq::IN_EVENTS);
+    }
+    catch (std::exception &exc) {
+        close(notify_fds[0]);
+        close(notify_fds[1]);
+        return false;
+    }
+
+    // Signals are handled by the event loop (in this thread); the writer must not receive any.
+    sigset_t sigall_set;
+    sigset_t orig_set;
+    sigfillset(&sigall_set);
+    pthread_sigmask(SIG_SETMASK, &sigall_set, &orig_set);
+
+    bool started = true;
+    try {
+        std::thread(writer_main).detach();
+    }
+    catch (std::system_error &exc) {
+        started = false;
+    }
+
+    pthread_sigmask(SIG_SETMASK, &orig_set, nullptr);
+
+    if (! started) {
+        writer_watcher.deregister(event_loop);
+        close(notify_fds[0]);
+        close(notify_fds[1]);
+    }
+    return started;
+}
+
+void queue_log_write(log_write_job *job) noexcept
+{
+    if (writer_state == writer_state_t::NOT_STARTED) {
+        writer_state = start_writer() ? writer_state_t::RUNNING : writer_state_t::FAILED;
+    }
+
+    job->in_progress = true;
+
+    if (writer_state == writer_state_t::FAILED) {
+        // No writer thread; write directly (which may block).
+        perform_job(job);
+        complete_job(job);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        append_job(pending_head, pending_tail, job);
+    }
+    queue_cond.notify_one();
+}
+
+void release_log_write_job(log_write_job *job) noexcept
+{
+    if (job->in_progress) {
+        // Deleted on completion
+        job->service = nullptr;
+        return;
+    }
+    if (job->fd != -1) {
+        bp_sys::close(job->fd);
+    }
+    delete job;
+}
@@ -1,3 +1,5 @@
+#include <cstring>
+
 #include <sys/un.h>
 #include <sys/socket.h>
 
@@ -7,6 +9,8 @@
 #include "dinit-log.h"
 #include "proc-service.h"
 
+#include "baseproc-sys.h"
+
 /*
  * Most of the implementation for process-based services (process, scripted, bgprocess) is here.
  *
@@ -43,7 +47,10 @@ void process_service::exec_succeeded() noexcept
     // might be stopped (and killed via a signal) during smooth recovery.  We don't to
     // process startup again in either case, so we check for state STARTING:
     if (get_state() == service_state_t::STARTING) {
-        started();
+        // If the process signals readiness, we remain STARTING until it does so:
+        if (force_notification_fd == -1) {
+            process_started();
+        }
     }
     else if (get_state() == service_state_t::STOPPING) {
         // stopping, but smooth recovery was in process. That's now over so we can
@@ -55,6 +62,23 @@ void process_service::exec_succeeded() noexcept
     }
 }
 
+void process_service::ready_notified() noexcept
+{
+    if (get_state() == service_state_t::STARTING) {
+        process_started();
+    }
+}
+
+void process_service::process_started() noexcept
+{
+    // Cancel the start timeout:
+    if (stop_timer_armed) {
+        restart_timer.stop_timer(event_loop);
+        stop_timer_armed = false;
+    }
+    started();
+}
+
 rearm exec_status_pipe_watcher::fd_event(eventloop_t &loop, int fd, int flags) noexcept
 {
     base_process_service *sr = service;
@@ -79,6 +103,7 @@ rearm exec_status_pipe_watcher::fd_event(eventloop_t &loop, int fd, int flags) n
         sr->exec_failed(exec_status);
     }
     else {
+        sr->trace_event(trace_event_t::EXECUTED);
         sr->exec_succeeded();
 
         if (sr->pid == -1) {
@@ -92,12 +117,90 @@ rearm exec_status_pipe_watcher::fd_event(eventloop_t &loop, int fd, int flags) n
     return rearm::REMOVED;
 }
 
+rearm ready_notify_watcher::fd_event(eventloop_t &loop, int fd, int flags) noexcept
+{
+    base_process_service *sr = service;
+
+    char buf[128];
+    int r = read(fd, buf, sizeof(buf));
+    if (r > 0) {
+        // The process signals readiness by writing a line; anything else written is discarded.
+        if (memchr(buf, '\n', r) != nullptr) {
+            sr->ready_notified();
+            sr->services->process_queues();
+        }
+        return rearm::REARM;
+    }
+    else if (r == -1 && (errno == EAGAIN || errno == EINTR)) {
+        return rearm::REARM;
+    }
+
+    // The process closed the pipe (or terminated). If it did so without signalling readiness, the
+    // start has failed; we terminate the process, and the start fails when it exits.
+    deregister(loop);
+    close(fd);
+    sr->notification_fd = -1;
+
+    if (sr->get_state() == service_state_t::STARTING && sr->pid != -1) {
+        log(loglevel_t::ERROR, sr->get_name(), ": process closed notification pipe without signalling readiness");
+        sr->kill_pg(SIGTERM);
+    }
+
+    return rearm::REMOVED;
+}
+
+rearm log_output_watcher::fd_event(eventloop_t &loop, int fd, int flags) noexcept
+{
+    base_process_service *sr = service;
+
+    if (sr->log_type == log_type_id::BUFFER) {
+        // Read whatever output is available. When the buffer is full, the oldest output is
+        // discarded to make room.
+        int r = sr->log_buffer.fill_overwrite(fd);
+        if (r == 0) {
+            // End-of-file: can't normally happen, since we hold the write end of the pipe open.
+            return rearm::DISARM;
+        }
+        return rearm::REARM;
+    }
+
+    // Output is written to the log file by dinit:
+    int r = sr->log_buffer.fill(fd);
+    if (r == 0 && sr->log_buffer.get_free() != 0) {
+        return rearm::DISARM; // end-of-file (as above)
+    }
+    sr->flush_log_output();
+    if (sr->log_buffer.get_free() == 0) {
+        // The log file isn't keeping up; stop reading output until the buffer is flushed. (The
+        // process will block when the pipe is full).
+        sr->log_output_paused = true;
+        return rearm::DISARM;
+    }
+    return rearm::REARM;
+}
+
+dasynq::rearm cgroup_events_watcher::fd_event(eventloop_t &loop, int fd, int flags) noexcept
+{
+    // Drain the inotify events; we only need to know that cgroup.events was modified.
+    char buf[256];
+    while (bp_sys::read(fd, buf, sizeof(buf)) > 0) { }
+    service->cgroup_event();
+    return rearm::REARM;
+}
+
+dasynq::rearm log_flush_timer::timer_expiry(eventloop_t &, int expiry_count)
+{
+    service->flush_log_output();
+    return dasynq::rearm::NOOP;
+}
+
 dasynq::rearm service_child_watcher::status_change(eventloop_t &loop, pid_t child, int status) noexcept
 {
     base_process_service *sr = service;
 
     sr->pid = -1;
     sr->exit_status = status;
+    sr->have_exit_status = true;
 
     // Ok, for a process service, any process death which we didn't rig
     // ourselves is a bit... unexpected. Probably, the child died because
@@ -130,6 +233,8 @@ void process_service::handle_exit_status(int exit_status) noexcept
     restarting = false;
     auto service_state = get_state();
 
+    close_notification_fd();
+
     if (exit_status != 0 && service_state != service_state_t::STOPPING) {
         if (did_exit) {
             log(loglevel_t::ERROR, "Service ", get_name(), " process terminated with exit code ",
@@ -142,7 +247,14 @@ void process_service::handle_exit_status(int exit_status) noexcept
     }
 
     if (service_state == service_state_t::STARTING) {
-        if (did_exit && WEXITSTATUS(exit_status) == 0) {
+        if (force_notification_fd != -1) {
+            // The process should have signalled readiness before terminating:
+            if (exit_status == 0) {
+                log(loglevel_t::ERROR, "Service ", get_name(), " process terminated before signalling readiness");
+            }
+            failed_to_start();
+        }
+        else if (did_exit && WEXITSTATUS(exit_status) == 0) {
             started();
         }
         else {
@@ -152,7 +264,7 @@ void process_service::handle_exit_status(int exit_status) noexcept
     else if (service_state == service_state_t::STOPPING) {
         // We won't log a non-zero exit status or termination due to signal here -
         // we assume that the process died because we signalled it.
-        stopped();
+        complete_stop();
     }
     else if (smooth_recovery && service_state == service_state_t::STARTED
             && get_target_state() == service_state_t::STARTED) {
@@ -168,6 +280,7 @@ void process_service::handle_exit_status(int exit_status) noexcept
 void process_service::exec_failed(int errcode) noexcept
 {
     log(loglevel_t::ERROR, get_name(), ": execution failed: ", strerror(errcode));
+    close_notification_fd();
     if (get_state() == service_state_t::STARTING) {
         failed_to_start();
     }
@@ -256,7 +369,7 @@ void bgproc_service::handle_exit_status(int exit_status) noexcept
     else if (service_state == service_state_t::STOPPING) {
         // We won't log a non-zero exit status or termination due to signal here -
         // we assume that the process died because we signalled it.
-        stopped();
+        complete_stop();
     }
     else {
         // we must be STARTED
@@ -275,6 +388,23 @@ void bgproc_service::handle_exit_status(int exit_status) noexcept
     services->process_queues();
 }
 
+void bgproc_service::orphan_pid_exited(pid_t exited_pid, int status) noexcept
+{
+    if (exited_pid != pid || tracking_child) {
+        return;
+    }
+
+    // The untracked process has terminated after all; handle it as for a tracked process:
+    pid = -1;
+    exit_status = status;
+    have_exit_status = true;
+    if (stop_timer_armed) {
+        restart_timer.stop_timer(event_loop);
+        stop_timer_armed = false;
+    }
+    handle_exit_status(status);
+}
+
 void bgproc_service::exec_failed(int errcode) noexcept
 {
     log(loglevel_t::ERROR, get_name(), ": execution failed: ", strerror(errcode));
@@ -411,9 +541,25 @@ bgproc_service::read_pid_file(int *exit_status) noexcept
     if (valid_pid) {
         pid_t wait_r = waitpid(pid, exit_status, WNOHANG);
         if (wait_r == -1 && errno == ECHILD) {
+            // Either not our child, or already terminated and reaped (as an orphan, before we
+            // could watch it), in which case we have the exit status:
+            const reaped_exit *rexit = services->find_reaped_exit(pid, last_start_time);
+            if (rexit != nullptr) {
+                *exit_status = rexit->status;
+                have_exit_status = true;
+                pid = -1;
+                return pid_result_t::TERMINATED;
+            }
             // We can't track this child - check process exists:
             if (kill(pid, 0) == 0 || errno != ESRCH) {
                 tracking_child = false;
+                // If it is re-parented to us, we will still see it terminate:
+                try {
+                    services->watch_orphan_pid(pid, this);
+                }
+                catch (std::bad_alloc &exc) {
+                    // we just won't be notified
+                }
                 return pid_result_t::OK;
             }
             else {
@@ -423,6 +569,7 @@ bgproc_service::read_pid_file(int *exit_status) noexcept
             }
         }
         else if (wait_r == pid) {
+            have_exit_status = true;
             pid = -1;
             return pid_result_t::TERMINATED;
         }
@@ -473,7 +620,7 @@ void process_service::bring_down() noexcept
     }
     else {
         // The process is already dead.
-        stopped();
+        complete_stop();
     }
 }
 
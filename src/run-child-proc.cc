@@ -7,13 +7,43 @@
 #include <unistd.h>
 #include <termios.h>
 
+#include <sys/resource.h>
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
 #include "service.h"
+#include "dinit-util.h"
+
+// Add a variable to the environment of the child process.
+static bool add_child_env(run_proc_params &params, char *var) noexcept
+{
+    if (params.envp == nullptr) {
+        return putenv(var) == 0;
+    }
+    params.envp[params.env_free++] = var;
+    return true;
+}
 
-void service_record::run_child_proc(const char * const *args, const char *logfile, bool on_console,
-        int wpipefd, int csfd) noexcept
+void service_record::run_child_proc(run_proc_params &params) noexcept
 {
     // Child process. Must not allocate memory (or otherwise risk throwing any exception)
-    // from here until exit().
+    // from here until exit(). With the vfork launch backend, the child also shares memory with
+    // the parent (which is suspended until we exec or exit), so must not modify any parent
+    // state other than via the params.
+
+    const char * const *args = params.args;
+    const char *logfile = params.logfile;
+    bool on_console = params.on_console;
+    int wpipefd = params.wpipefd;
+    int csfd = params.csfd;
+    int log_fd = params.log_fd;
+    int notify_fd = params.notify_fd;
+    int force_notify_fd = params.force_notify_fd;
+    int sockfd = socket_fd;
 
     // If the console already has a session leader, presumably it is us. On the other hand
     // if it has no session leader, and we don't create one, then control inputs such as
@@ -26,10 +56,15 @@ void service_record::run_child_proc(const char * const *args, const char *logfil
     sigset_t sigall_set;
     sigfillset(&sigall_set);
     sigprocmask(SIG_SETMASK, &sigall_set, &sigwait_set);
+    if (params.sigmask != nullptr) {
+        // (the parent blocked all signals before launching us)
+        sigwait_set = *params.sigmask;
+    }
     sigdelset(&sigwait_set, SIGCHLD);
     sigdelset(&sigwait_set, SIGINT);
     sigdelset(&sigwait_set, SIGTERM);
     sigdelset(&sigwait_set, SIGQUIT);
+    sigdelset(&sigwait_set, SIGHUP);
 
     constexpr int bufsz = ((CHAR_BIT * sizeof(pid_t)) / 3 + 2) + 11;
     // "LISTEN_PID=" - 11 characters; the expression above gives a conservative estimate
@@ -42,9 +77,29 @@ void service_record::run_child_proc(const char * const *args, const char *logfil
     char csenvbuf[csenvbufsz];
 
     int minfd = (socket_fd == -1) ? 3 : 4;
+    if (notify_fd != -1 && force_notify_fd >= minfd) {
+        // Also keep clear of the fd at which the notification pipe is placed:
+        minfd = force_notify_fd + 1;
+    }
+
+#ifdef __linux__
+    if (params.cgroup_fd != -1) {
+        // Join the service cgroup (writing "0" to cgroup.procs moves the writing process). Do this
+        // first, before fds are moved about (which might clobber cgroup_fd).
+        int procs_fd = openat(params.cgroup_fd, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+        if (procs_fd == -1) goto failure_out;
+        int r = write(procs_fd, "0", 1);
+        int write_errno = errno;
+        close(procs_fd);
+        if (r != 1) {
+            errno = write_errno;
+            goto failure_out;
+        }
+    }
+#endif
 
-    // Move wpipefd/csfd to another fd if necessary
-    if (wpipefd < minfd) {
+    // Move wpipefd/csfd/notify_fd to another fd if necessary
+    if (wpipefd != -1 && wpipefd < minfd) {
         wpipefd = fcntl(wpipefd, F_DUPFD_CLOEXEC, minfd);
         if (wpipefd == -1) goto failure_out;
     }
@@ -54,21 +109,41 @@ void service_record::run_child_proc(const char * const *args, const char *logfil
         if (csfd == -1) goto failure_out;
     }
 
-    if (socket_fd != -1) {
+    if (log_fd != -1 && log_fd < minfd) {
+        log_fd = fcntl(log_fd, F_DUPFD_CLOEXEC, minfd);
+        if (log_fd == -1) goto failure_out;
+    }
+
+    if (notify_fd != -1 && notify_fd < minfd) {
+        notify_fd = fcntl(notify_fd, F_DUPFD_CLOEXEC, minfd);
+        if (notify_fd == -1) goto failure_out;
+    }
 
-        if (dup2(socket_fd, 3) == -1) goto failure_out;
-        if (socket_fd != 3) {
-            close(socket_fd);
+    if (sockfd != -1 && sockfd != 3 && sockfd == force_notify_fd) {
+        sockfd = fcntl(sockfd, F_DUPFD_CLOEXEC, minfd);
+        if (sockfd == -1) goto failure_out;
+    }
+
+    if (notify_fd != -1) {
+        // (dup2 clears close-on-exec for the new descriptor)
+        if (dup2(notify_fd, force_notify_fd) == -1) goto failure_out;
+    }
+
+    if (sockfd != -1) {
+
+        if (dup2(sockfd, 3) == -1) goto failure_out;
+        if (sockfd != 3) {
+            close(sockfd);
         }
 
-        if (putenv(const_cast<char *>("LISTEN_FDS=1"))) goto failure_out;
+        if (! add_child_env(params, const_cast<char *>("LISTEN_FDS=1"))) goto failure_out;
         snprintf(nbuf, bufsz, "LISTEN_PID=%jd", static_cast<intmax_t>(getpid()));
-        if (putenv(nbuf)) goto failure_out;
+        if (! add_child_env(params, nbuf)) goto failure_out;
     }
 
     if (csfd != -1) {
         snprintf(csenvbuf, csenvbufsz, "DINIT_CS_FD=%d", csfd);
-        if (putenv(csenvbuf)) goto failure_out;
+        if (! add_child_env(params, csenvbuf)) goto failure_out;
     }
 
     if (! on_console) {
@@ -77,8 +152,13 @@ void service_record::run_child_proc(const char * const *args, const char *logfil
 
         if (open("/dev/null", O_RDONLY) == 0) {
             // stdin = 0. That's what we should have; proceed with opening
-            // stdout and stderr.
-            if (open(logfile, O_WRONLY | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR) != 1) {
+            // stdout and stderr (normally, the log file is already open).
+            if (log_fd != -1) {
+                if (dup2(log_fd, 1) != 1) {
+                    goto failure_out;
+                }
+            }
+            else if (open(logfile, O_WRONLY | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR) != 1) {
                 goto failure_out;
             }
             if (dup2(1, 2) != 2) {
@@ -118,13 +198,137 @@ void service_record::run_child_proc(const char * const *args, const char *logfil
         tcsetpgrp(0, getpgrp());
     }
 
+    // Apply resource limits, scheduling and I/O priorities, and CPU affinity:
+    for (const service_rlimits &rlimit : proc_attrs.rlimits) {
+        struct rlimit limits;
+        if (! rlimit.soft_set || ! rlimit.hard_set) {
+            if (getrlimit(rlimit.resource_id, &limits) == -1) goto failure_out;
+        }
+        if (rlimit.soft_set) limits.rlim_cur = rlimit.limits.rlim_cur;
+        if (rlimit.hard_set) limits.rlim_max = rlimit.limits.rlim_max;
+        if (setrlimit(rlimit.resource_id, &limits) == -1) goto failure_out;
+    }
+
+    if (proc_attrs.nice != INT_MIN) {
+        if (setpriority(PRIO_PROCESS, 0, proc_attrs.nice) == -1) goto failure_out;
+    }
+
+#ifdef __linux__
+    if (proc_attrs.ioprio != -1) {
+        // (IOPRIO_WHO_PROCESS = 1)
+        if (syscall(SYS_ioprio_set, 1, 0, proc_attrs.ioprio) == -1) goto failure_out;
+    }
+
+    if (proc_attrs.oom_score_adj != INT_MIN) {
+        int oom_fd = open("/proc/self/oom_score_adj", O_WRONLY | O_CLOEXEC);
+        if (oom_fd == -1) goto failure_out;
+        char oom_buf[16];
+        int len = snprintf(oom_buf, sizeof(oom_buf), "%d", proc_attrs.oom_score_adj);
+        int r = write(oom_fd, oom_buf, len);
+        int write_errno = errno;
+        close(oom_fd);
+        if (r != len) {
+            errno = write_errno;
+            goto failure_out;
+        }
+    }
+
+    if (proc_attrs.has_cpu_affinity) {
+        if (sched_setaffinity(0, sizeof(cpu_set_t), &proc_attrs.cpu_affinity) == -1) goto failure_out;
+    }
+
+    {
+        // Close any other descriptors inherited from dinit (which should all be close-on-exec,
+        // but a leak would otherwise persist for the life of the process). The status pipe is
+        // close-on-exec, but needed until then.
+        int keep_fds[7] = { 0, 1, 2 };
+        int nkeep = 3;
+        if (sockfd != -1) keep_fds[nkeep++] = 3;
+        if (notify_fd != -1) keep_fds[nkeep++] = force_notify_fd;
+        if (csfd != -1) keep_fds[nkeep++] = csfd;
+        if (wpipefd != -1) keep_fds[nkeep++] = wpipefd;
+        close_fds_except(keep_fds, nkeep);
+    }
+#endif
+
     sigprocmask(SIG_SETMASK, &sigwait_set, nullptr);
 
+#ifdef __linux__
+    if (params.envp != nullptr) {
+        execvpe(args[0], const_cast<char **>(args), const_cast<char **>(params.envp));
+    }
+    else
+#endif
     execvp(args[0], const_cast<char **>(args));
 
     // If we got here, the exec failed:
     failure_out:
     int exec_status = errno;
-    write(wpipefd, &exec_status, sizeof(int));
+    if (params.exec_errno != nullptr) {
+        *params.exec_errno = exec_status;
+    }
+    else {
+        write(wpipefd, &exec_status, sizeof(int));
+    }
     _exit(0);
 }
+
+#ifdef __linux__
+
+namespace {
+    // Stack for the child process launched via clone(). Only one child uses it at a time, since
+    // the parent is suspended until the child has exec'd (or exited). It is allocated on first
+    // use, with a guard page below.
+    constexpr size_t vfork_stack_size = 64 * 1024;
+    char *vfork_stack = nullptr;
+
+    class vfork_child_args
+    {
+        public:
+        service_record *service;
+        run_proc_params *params;
+    };
+}
+
+pid_t service_record::vfork_child_proc(run_proc_params &params) noexcept
+{
+    if (vfork_stack == nullptr) {
+        long page_size = sysconf(_SC_PAGESIZE);
+        void *stack_mem = mmap(nullptr, vfork_stack_size + page_size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+        if (stack_mem == MAP_FAILED) {
+            return -1;
+        }
+        mprotect(stack_mem, page_size, PROT_NONE);
+        vfork_stack = static_cast<char *>(stack_mem) + page_size;
+    }
+
+    // Block all signals while the child shares our memory, so that our signal handlers cannot
+    // run in the child. The child restores the original mask before exec.
+    sigset_t sigall_set;
+    sigset_t orig_set;
+    sigfillset(&sigall_set);
+    sigprocmask(SIG_SETMASK, &sigall_set, &orig_set);
+
+    *params.exec_errno = 0;
+    params.sigmask = &orig_set;
+
+    auto child_fn = [](void *arg) -> int {
+        vfork_child_args *child_args = static_cast<vfork_child_args *>(arg);
+        child_args->service->run_child_proc(*child_args->params);
+        return 0; // (not reached)
+    };
+
+    vfork_child_args child_args = { this, &params };
+    pid_t child = clone(child_fn, vfork_stack + vfork_stack_size,
+            CLONE_VM | CLONE_VFORK | SIGCHLD, &child_args);
+    int clone_errno = errno;
+
+    sigprocmask(SIG_SETMASK, &orig_set, nullptr);
+    params.sigmask = nullptr;
+
+    errno = clone_errno;
+    return child;
+}
+
+#endif
@@ -1,4 +1,5 @@
 #include <cstring>
+#include <cstdio>
 #include <cerrno>
 #include <sstream>
 #include <iterator>
@@ -20,30 +21,22 @@
 #include "dinit-socket.h"
 #include "dinit-util.h"
 
+#include "baseproc-sys.h"
+
 /*
  * service.cc - Service management.
  * See service.h for details.
  */
 
-// Find the requested service by name
-static service_record * find_service(const std::list<service_record *> & records,
-                                    const char *name) noexcept
+service_record * service_set::find_service(const std::string &name) noexcept
 {
-    using std::list;
-    list<service_record *>::const_iterator i = records.begin();
-    for ( ; i != records.end(); i++ ) {
-        if (strcmp((*i)->get_name().c_str(), name) == 0) {
-            return *i;
-        }
+    auto i = records_by_name.find(name);
+    if (i != records_by_name.end()) {
+        return i->second;
     }
     return nullptr;
 }
 
-service_record * service_set::find_service(const std::string &name) noexcept
-{
-    return ::find_service(records, name.c_str());
-}
-
 void service_set::stop_service(const std::string & name) noexcept
 {
     service_record *record = find_service(name);
@@ -63,6 +56,7 @@ void service_record::stopped() noexcept
         release_console();
     }
 
+    release_start_slot();
     force_stop = false;
 
     // If we are a soft dependency of another target, break the acquisition from that target now:
@@ -78,12 +72,13 @@ void service_record::stopped() noexcept
     bool will_restart = (desired_state == service_state_t::STARTED)
             && services->get_auto_restart();
 
-    for (auto dependency : depends_on) {
+    for (auto & dependency : depends_on) {
         // we signal dependencies in case they are waiting for us to stop:
         dependency.get_to()->dependent_stopped();
     }
 
     service_state = service_state_t::STOPPED;
+    trace_event(trace_event_t::STOPPED);
 
     if (will_restart) {
         // Desired state is "started".
@@ -110,6 +105,100 @@ void service_record::stopped() noexcept
 }
 
 
+void service_record::close_log_fd() noexcept
+{
+    if (log_fd != -1) {
+        close(log_fd);
+        log_fd = -1;
+    }
+}
+
+void service_record::reopen_log() noexcept
+{
+    if (log_type == log_type_id::LOGFILE) {
+        close_log_fd();
+    }
+}
+
+void service_record::notify_listeners(service_event_t event) noexcept
+{
+    for (service_handle *h = handles.head(); h != nullptr; h = handles.next(h)) {
+        h->listener->service_event(*h, event);
+    }
+    services->notify_event_listeners(this, event);
+}
+
+void service_record::trace_event(trace_event_t event) noexcept
+{
+    int64_t event_time = timespec_to_ns(services->get_trace().record(this, event));
+
+    // Also keep the timing of the latest start:
+    switch (event) {
+    case trace_event_t::STARTING:
+        start_begin_time = event_time;
+        start_deps_time = 0;
+        start_end_time = 0;
+        break;
+    case trace_event_t::DEPSSTARTED:
+        start_deps_time = event_time;
+        break;
+    case trace_event_t::STARTED:
+        start_end_time = event_time;
+        break;
+    default: ;
+    }
+}
+
+service_record *service_record::get_critical_dependency() noexcept
+{
+    if (start_begin_time == 0 || start_deps_time == 0) {
+        return nullptr;
+    }
+
+    // The critical dependency is the one that started last, if it started after this service
+    // began to start (and so was waited for):
+    service_record *critical = nullptr;
+    int64_t critical_time = 0;
+    for (auto & dep : depends_on) {
+        service_record *to = dep.get_to();
+        int64_t to_started = to->start_end_time;
+        if (to_started >= start_begin_time && to_started <= start_deps_time && to_started > critical_time) {
+            critical = to;
+            critical_time = to_started;
+        }
+    }
+
+    return critical;
+}
+
+void service_record::update_start_paths() noexcept
+{
+    for (auto dept : dependents) {
+        start_path_len = std::max(start_path_len, dept->get_from()->start_path_len + 1);
+    }
+
+    // Propagate to dependencies (and their dependencies, etc), using an explicit stack rather
+    // than recursion since the dependency chain may be long:
+    std::vector<service_record *> stack;
+    try {
+        stack.push_back(this);
+        while (! stack.empty()) {
+            service_record *sr = stack.back();
+            stack.pop_back();
+            for (auto & dep : sr->depends_on) {
+                service_record *to = dep.get_to();
+                if (to->start_path_len < sr->start_path_len + 1) {
+                    to->start_path_len = sr->start_path_len + 1;
+                    stack.push_back(to);
+                }
+            }
+        }
+    }
+    catch (std::bad_alloc &exc) {
+        // The path lengths are only used to prioritise starts; leave them inexact.
+    }
+}
+
 bool service_record::do_auto_restart() noexcept
 {
     if (auto_restart) {
@@ -199,6 +288,7 @@ void service_record::start(bool activate) noexcept
 
     service_state = service_state_t::STARTING;
     waiting_for_deps = true;
+    trace_event(trace_event_t::STARTING);
 
     if (start_check_dependencies()) {
         services->add_transition_queue(this);
@@ -392,6 +482,16 @@ bool service_record::open_socket() noexcept
 
 void service_record::all_deps_started(bool has_console) noexcept
 {
+    // (A smooth recovery, where we are already STARTED, does not require a start slot).
+    if (service_state == service_state_t::STARTING && needs_start_slot() && ! has_start_slot) {
+        if (! services->get_start_slot(this)) {
+            // Wait for a start slot; acquired_start_slot() will be called.
+            waiting_for_deps = true;
+            return;
+        }
+        has_start_slot = true;
+    }
+
     if (onstart_flags.starts_on_console && ! has_console) {
         waiting_for_deps = true;
         queue_for_console();
@@ -405,6 +505,8 @@ void service_record::all_deps_started(bool has_console) noexcept
         return;
     }
 
+    trace_event(trace_event_t::DEPSSTARTED);
+
     if (! open_socket()) {
         failed_to_start();
     }
@@ -430,6 +532,20 @@ void service_record::acquired_console() noexcept
     }
 }
 
+void service_record::acquired_start_slot() noexcept
+{
+    has_start_slot = true;
+    if (service_state == service_state_t::STARTING && check_deps_started()) {
+        // Continue the start via the transition queue, to avoid recursing through
+        // pull_start_slot_queue() if the start fails immediately.
+        services->add_transition_queue(this);
+    }
+    else {
+        // We got a slot but can't use it.
+        release_start_slot();
+    }
+}
+
 
 void service_record::started() noexcept
 {
@@ -438,8 +554,10 @@ void service_record::started() noexcept
         release_console();
     }
 
+    release_start_slot();
     log_service_started(get_name());
     service_state = service_state_t::STARTED;
+    trace_event(trace_event_t::STARTED);
     notify_listeners(service_event_t::STARTED);
 
     if (onstart_flags.rw_ready) {
@@ -457,6 +575,9 @@ void service_record::started() noexcept
 
     // Notify any dependents whose desired state is STARTED:
     for (auto dept : dependents) {
+        if (dept->waiting_on) {
+            services->get_trace().record(dept->get_from(), trace_event_t::DEPREADY, this);
+        }
         dept->get_from()->dependency_started();
         dept->waiting_on = false;
     }
@@ -469,8 +590,10 @@ void service_record::failed_to_start(bool depfailed) noexcept
         release_console();
     }
     
+    release_start_slot();
     log_service_failed(get_name());
     service_state = service_state_t::STOPPED;
+    trace_event(trace_event_t::FAILEDSTART);
     if (start_explicit) {
         start_explicit = false;
         release();
@@ -491,6 +614,7 @@ void service_record::failed_to_start(bool depfailed) noexcept
         case dependency_type::SOFT:
             if (dept->waiting_on) {
                 dept->waiting_on = false;
+                services->get_trace().record(dept->get_from(), trace_event_t::DEPREADY, this);
                 dept->get_from()->dependency_started();
             }
             if (dept->holding_acq) {
@@ -578,6 +702,7 @@ void service_record::do_stop() noexcept
 
     service_state = service_state_t::STOPPING;
     waiting_for_deps = true;
+    trace_event(trace_event_t::STOPPING);
     if (all_deps_stopped) {
         services->add_transition_queue(this);
     }
@@ -657,6 +782,17 @@ void service_record::release_console() noexcept
     services->pull_console_queue();
 }
 
+void service_record::release_start_slot() noexcept
+{
+    if (has_start_slot) {
+        has_start_slot = false;
+        services->release_start_slot();
+    }
+    else {
+        services->unqueue_start_slot(this);
+    }
+}
+
 bool service_record::interrupt_start() noexcept
 {
     services->unqueue_console(this);
@@ -672,3 +808,97 @@ void service_set::service_inactive(service_record *sr) noexcept
 {
     active_services--;
 }
+
+#ifdef __linux__
+service_record *service_set::find_cgroup_service(pid_t pid) noexcept
+{
+    char path[32];
+    snprintf(path, sizeof(path), "/proc/%d/cgroup", (int)pid);
+    int fd = bp_sys::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return nullptr;
+    }
+    char buf[512];
+    ssize_t r = bp_sys::read(fd, buf, sizeof(buf) - 1);
+    bp_sys::close(fd);
+    if (r <= 0) {
+        return nullptr;
+    }
+    buf[r] = 0;
+
+    // The (v2) cgroup is given by the line "0::<path>". Each service cgroup is named after the
+    // service (see base_process_service::ensure_cgroup()).
+    char *cgroup_path = (strncmp(buf, "0::", 3) == 0) ? buf : strstr(buf, "\n0::");
+    if (cgroup_path == nullptr) {
+        return nullptr;
+    }
+    cgroup_path += (*cgroup_path == '\n') ? 4 : 3;
+    char *line_end = strchr(cgroup_path, '\n');
+    if (line_end != nullptr) *line_end = 0;
+    char *name = strrchr(cgroup_path, '/');
+    if (name == nullptr || name[1] == 0) {
+        return nullptr;
+    }
+
+    try {
+        return find_service(name + 1);
+    }
+    catch (std::bad_alloc &exc) {
+        return nullptr;
+    }
+}
+#endif
+
+void service_set::child_reaped(pid_t pid, int status) noexcept
+{
+    // Determine the process group and session of the process while it is still a zombie, so that
+    // it can be attributed to a service (each service process is started in its own session and
+    // process group). A process which has left the session (via setsid()) can still be attributed
+    // to its service if it ran in the service cgroup; it is then recorded as belonging to the
+    // session of the service.
+    pid_t pgid = getpgid(pid);
+    pid_t sid = getsid(pid);
+#ifdef __linux__
+    if (! cgroup_root.empty()) {
+        service_record *sr = find_cgroup_service(pid);
+        if (sr != nullptr && sr->get_session_id() != -1) {
+            pgid = sid = sr->get_session_id();
+        }
+    }
+#endif
+
+    reaped_exits.record(pid, status, pgid, sid);
+    if (reaped_undispatched < reaped_exit_history::capacity) {
+        reaped_undispatched++;
+    }
+}
+
+void service_set::dispatch_reaped_exits() noexcept
+{
+    unsigned count = reaped_exits.size();
+    for (unsigned i = count - reaped_undispatched; i < count; i++) {
+        const reaped_exit &rexit = reaped_exits[i];
+        auto watch = orphan_pid_watches.find(rexit.pid);
+        if (watch != orphan_pid_watches.end()) {
+            service_record *sr = watch->second;
+            orphan_pid_watches.erase(watch);
+            sr->orphan_pid_exited(rexit.pid, rexit.status);
+            continue;
+        }
+
+        // (A service process run on the console may share our session, but has its own process
+        // group):
+        auto session = service_sessions.find(rexit.sid);
+        if (session == service_sessions.end()) {
+            session = service_sessions.find(rexit.pgid);
+        }
+        if (session != service_sessions.end()) {
+            service_record *sr = session->second;
+            sr->orphan_reaped();
+            log(loglevel_t::DEBUG, "Service ", sr->get_name(), ": orphaned process ", rexit.pid,
+                    " terminated (status ", rexit.status, ")");
+        }
+    }
+    reaped_undispatched = 0;
+    process_queues();
+}
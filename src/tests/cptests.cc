@@ -0,0 +1,324 @@
+#include <cassert>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstring>
+
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "service.h"
+#include "control.h"
+
+// Tests of control protocol processing.
+//
+// A control connection is created on one end of a socket pair; requests are written to the other
+// end, and processed by calling data_ready() directly (there is no real event loop). Replies are
+// then read back from the socket.
+
+// Friend interface to access control_conn_t private members.
+class control_conn_t_test
+{
+    public:
+    static bool data_ready(control_conn_t *cc)
+    {
+        return cc->data_ready();
+    }
+};
+
+// BATCHREPLY entry: 1-byte result, 4-byte handle, 1-byte state
+constexpr static uint32_t batch_entry_size = 2 + sizeof(uint32_t);
+
+// Builds a BATCH request.
+class batch_request
+{
+    public:
+    std::vector<char> pkt;
+
+    batch_request()
+    {
+        pkt.push_back(DINIT_CP_BATCH);
+        pkt.push_back(0);
+        pkt.push_back(0);
+    }
+
+    void add_handle(char op, char flags, uint32_t handle)
+    {
+        pkt.push_back(op);
+        pkt.push_back(flags);
+        const char *hp = reinterpret_cast<const char *>(&handle);
+        pkt.insert(pkt.end(), hp, hp + sizeof(handle));
+    }
+
+    void add_name(char op, char flags, const char *name)
+    {
+        uint16_t name_len = std::strlen(name);
+        pkt.push_back(op);
+        pkt.push_back(flags | DINIT_BATCH_BYNAME);
+        const char *lp = reinterpret_cast<const char *>(&name_len);
+        pkt.insert(pkt.end(), lp, lp + 2);
+        pkt.insert(pkt.end(), name, name + name_len);
+    }
+
+    // Fill in the packet length (the actual length, unless specified).
+    std::vector<char> &finish()
+    {
+        return finish(pkt.size());
+    }
+
+    std::vector<char> &finish(uint16_t pkt_len)
+    {
+        std::memcpy(pkt.data() + 1, &pkt_len, 2);
+        return pkt;
+    }
+};
+
+// A control connection, with the client end of its socket.
+class test_conn
+{
+    public:
+    int client_fd;
+    control_conn_t *cc;
+
+    test_conn(service_set *sset)
+    {
+        int sockets[2];
+        assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sockets) == 0);
+        client_fd = sockets[0];
+        cc = new control_conn_t(event_loop, sset, sockets[1]);
+    }
+
+    ~test_conn()
+    {
+        delete cc;
+        close(client_fd);
+    }
+
+    // Send a request and process it. Returns the output (all packets) sent in response.
+    std::vector<char> request(const std::vector<char> &req)
+    {
+        assert(write(client_fd, req.data(), req.size()) == (ssize_t)req.size());
+        assert(! control_conn_t_test::data_ready(cc));
+
+        std::vector<char> reply;
+        char buf[1024];
+        ssize_t r;
+        while ((r = read(client_fd, buf, sizeof(buf))) > 0) {
+            reply.insert(reply.end(), buf, buf + r);
+        }
+        return reply;
+    }
+};
+
+// Check the reply entry at index i of a BATCHREPLY packet.
+static void check_entry(const std::vector<char> &reply, int i, char result, uint32_t handle,
+        service_state_t state)
+{
+    const char *ep = reply.data() + 3 + i * batch_entry_size;
+    assert(ep[0] == result);
+    uint32_t ehandle;
+    std::memcpy(&ehandle, ep + 1, sizeof(ehandle));
+    assert(ehandle == handle);
+    assert(ep[1 + sizeof(uint32_t)] == static_cast<char>(state));
+}
+
+static uint16_t batch_reply_count(const std::vector<char> &reply)
+{
+    assert(reply.size() >= 3);
+    assert(reply[0] == DINIT_RP_BATCHREPLY);
+    uint16_t count;
+    std::memcpy(&count, reply.data() + 1, 2);
+    return count;
+}
+
+// Test 1: services given by name are loaded and operated on; a service which can't be loaded
+// is reported (DINIT_RP_NOSERVICE). The reply precedes the service events which the operations
+// trigger.
+void test1()
+{
+    service_set sset;
+
+    service_record *s1 = new (&sset) service_record(&sset, "test-service-1", service_type_t::INTERNAL, {});
+    sset.add_service(s1);
+
+    test_conn conn(&sset);
+
+    batch_request req;
+    req.add_name(DINIT_CP_STARTSERVICE, 0, "test-service-1");
+    req.add_name(DINIT_CP_STARTSERVICE, 0, "no-such-service");
+    std::vector<char> reply = conn.request(req.finish());
+
+    assert(s1->get_state() == service_state_t::STARTED);
+
+    // The reply gives the state at the time of the request:
+    assert(batch_reply_count(reply) == 2);
+    size_t reply_len = 3 + 2 * batch_entry_size;
+    assert(reply.size() > reply_len);
+    check_entry(reply, 0, DINIT_RP_ACK, 0, service_state_t::STOPPED);
+    check_entry(reply, 1, DINIT_RP_NOSERVICE, 0, service_state_t::STOPPED);
+
+    // ... followed by the event for the service start:
+    const char *ip = reply.data() + reply_len;
+    assert(reply.size() == reply_len + 3 + sizeof(uint32_t));
+    assert(ip[0] == DINIT_IP_SERVICEEVENT);
+    assert(ip[1] == 3 + sizeof(uint32_t));
+    uint32_t handle;
+    std::memcpy(&handle, ip + 2, sizeof(handle));
+    assert(handle == 0);
+    assert(ip[2 + sizeof(uint32_t)] == static_cast<char>(service_event_t::STARTED));
+}
+
+// Test 2: services given by handle; an operation already satisfied is reported
+// (DINIT_RP_ALREADYSS); an invalid handle fails the whole request (DINIT_RP_BADREQ).
+void test2()
+{
+    service_set sset;
+
+    service_record *s1 = new (&sset) service_record(&sset, "test-service-1", service_type_t::INTERNAL, {});
+    service_record *s2 = new (&sset) service_record(&sset, "test-service-2", service_type_t::INTERNAL, {});
+    sset.add_service(s1);
+    sset.add_service(s2);
+    sset.start_service(s2);
+
+    test_conn conn(&sset);
+
+    batch_request load_req;
+    load_req.add_name(DINIT_CP_LOADSERVICE, 0, "test-service-1");
+    load_req.add_name(DINIT_CP_LOADSERVICE, 0, "test-service-2");
+    std::vector<char> reply = conn.request(load_req.finish());
+    assert(batch_reply_count(reply) == 2);
+    assert(reply.size() == 3 + 2 * batch_entry_size);
+    check_entry(reply, 0, DINIT_RP_ACK, 0, service_state_t::STOPPED);
+    check_entry(reply, 1, DINIT_RP_ACK, 1, service_state_t::STARTED);
+    assert(s1->get_state() == service_state_t::STOPPED);
+
+    batch_request req;
+    req.add_handle(DINIT_CP_STARTSERVICE, DINIT_BATCH_PIN, 0);
+    req.add_handle(DINIT_CP_STARTSERVICE, 0, 1);
+    reply = conn.request(req.finish());
+    assert(batch_reply_count(reply) == 2);
+    check_entry(reply, 0, DINIT_RP_ACK, 0, service_state_t::STOPPED);
+    check_entry(reply, 1, DINIT_RP_ALREADYSS, 1, service_state_t::STARTED);
+    assert(s1->get_state() == service_state_t::STARTED);
+
+    // (pinned started):
+    s1->stop(true);
+    sset.process_queues();
+    assert(s1->get_state() == service_state_t::STARTED);
+
+    // Handle 2 has not been allocated; the valid entry preceding it must not be issued:
+    batch_request bad_req;
+    bad_req.add_handle(DINIT_CP_STOPSERVICE, 0, 1);
+    bad_req.add_handle(DINIT_CP_STOPSERVICE, 0, 2);
+    reply = conn.request(bad_req.finish());
+    assert(reply.size() == 1);
+    assert(reply[0] == DINIT_RP_BADREQ);
+    assert(s2->get_state() == service_state_t::STARTED);
+}
+
+// Test 3: packet length at or below the header size, or over the maximum, is rejected.
+void test3()
+{
+    service_set sset;
+
+    service_record *s1 = new (&sset) service_record(&sset, "test-service-1", service_type_t::INTERNAL, {});
+    sset.add_service(s1);
+
+    for (uint16_t pkt_len : { 0, 1, 3, 1025, 0xFFFF }) {
+        test_conn conn(&sset);
+        batch_request req;
+        std::vector<char> reply = conn.request(req.finish(pkt_len));
+        assert(reply.size() == 1);
+        assert(reply[0] == DINIT_RP_BADREQ);
+    }
+
+    // Length larger than the entries actually given (not yet complete) is not processed:
+    {
+        test_conn conn(&sset);
+        batch_request req;
+        req.add_name(DINIT_CP_STARTSERVICE, 0, "test-service-1");
+        std::vector<char> reply = conn.request(req.finish(req.pkt.size() + 1));
+        assert(reply.empty());
+        assert(s1->get_state() == service_state_t::STOPPED);
+    }
+}
+
+// Test 4: a truncated entry is rejected, and no entry is issued.
+void test4()
+{
+    service_set sset;
+
+    service_record *s1 = new (&sset) service_record(&sset, "test-service-1", service_type_t::INTERNAL, {});
+    sset.add_service(s1);
+
+    // Handle cut short:
+    {
+        test_conn conn(&sset);
+        batch_request req;
+        req.add_name(DINIT_CP_STARTSERVICE, 0, "test-service-1");
+        req.add_handle(DINIT_CP_STARTSERVICE, 0, 0);
+        req.pkt.resize(req.pkt.size() - 1);
+        std::vector<char> reply = conn.request(req.finish());
+        assert(reply.size() == 1);
+        assert(reply[0] == DINIT_RP_BADREQ);
+        assert(s1->get_state() == service_state_t::STOPPED);
+    }
+
+    // Name cut short:
+    {
+        test_conn conn(&sset);
+        batch_request req;
+        req.add_name(DINIT_CP_STARTSERVICE, 0, "test-service-1");
+        req.pkt.resize(req.pkt.size() - 1);
+        std::vector<char> reply = conn.request(req.finish());
+        assert(reply.size() == 1);
+        assert(reply[0] == DINIT_RP_BADREQ);
+        assert(s1->get_state() == service_state_t::STOPPED);
+    }
+
+    // Operation without flags:
+    {
+        test_conn conn(&sset);
+        batch_request req;
+        req.add_name(DINIT_CP_STARTSERVICE, 0, "test-service-1");
+        req.pkt.push_back(DINIT_CP_STARTSERVICE);
+        std::vector<char> reply = conn.request(req.finish());
+        assert(reply.size() == 1);
+        assert(reply[0] == DINIT_RP_BADREQ);
+        assert(s1->get_state() == service_state_t::STOPPED);
+    }
+}
+
+// Test 5: an entry with an unknown operation is rejected, and no entry is issued.
+void test5()
+{
+    service_set sset;
+
+    service_record *s1 = new (&sset) service_record(&sset, "test-service-1", service_type_t::INTERNAL, {});
+    sset.add_service(s1);
+
+    for (char op : { (char)DINIT_CP_QUERYVERSION, (char)DINIT_CP_BATCH, (char)127 }) {
+        test_conn conn(&sset);
+        batch_request req;
+        req.add_name(DINIT_CP_STARTSERVICE, 0, "test-service-1");
+        req.add_name(op, 0, "test-service-1");
+        std::vector<char> reply = conn.request(req.finish());
+        assert(reply.size() == 1);
+        assert(reply[0] == DINIT_RP_BADREQ);
+        assert(s1->get_state() == service_state_t::STOPPED);
+    }
+}
+
+#define RUN_TEST(name) \
+    std::cout << #name "... "; \
+    name(); \
+    std::cout << "PASSED" << std::endl;
+
+int main(int argc, char **argv)
+{
+    RUN_TEST(test1);
+    RUN_TEST(test2);
+    RUN_TEST(test3);
+    RUN_TEST(test4);
+    RUN_TEST(test5);
+}
@@ -0,0 +1 @@
+../test-includes/baseproc-sys.h
\ No newline at end of file
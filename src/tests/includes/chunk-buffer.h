@@ -0,0 +1 @@
+../../includes/chunk-buffer.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../includes/control-cmds.h
\ No newline at end of file
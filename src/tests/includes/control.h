@@ -0,0 +1 @@
+../../includes/control.h
\ No newline at end of file
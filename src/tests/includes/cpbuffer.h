@@ -0,0 +1 @@
+../../includes/cpbuffer.h
\ No newline at end of file
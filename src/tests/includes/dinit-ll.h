@@ -0,0 +1 @@
+../../includes/dinit-ll.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../includes/dinit-log.h
\ No newline at end of file
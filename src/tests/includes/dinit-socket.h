@@ -0,0 +1 @@
+../../includes/dinit-socket.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../includes/dinit-util.h
\ No newline at end of file
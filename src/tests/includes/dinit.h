@@ -0,0 +1 @@
+../test-includes/dinit.h
\ No newline at end of file
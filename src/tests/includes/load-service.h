@@ -0,0 +1 @@
+../../includes/load-service.h
\ No newline at end of file
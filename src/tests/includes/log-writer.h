@@ -0,0 +1 @@
+../../includes/log-writer.h
\ No newline at end of file
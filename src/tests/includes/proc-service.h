@@ -0,0 +1 @@
+../../includes/proc-service.h
\ No newline at end of file
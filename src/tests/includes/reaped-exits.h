@@ -0,0 +1 @@
+../../includes/reaped-exits.h
\ No newline at end of file
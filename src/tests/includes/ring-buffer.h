@@ -0,0 +1 @@
+../../includes/ring-buffer.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../includes/service-arena.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../includes/service-constants.h
\ No newline at end of file
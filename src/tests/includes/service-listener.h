@@ -0,0 +1 @@
+../../includes/service-listener.h
\ No newline at end of file
@@ -0,0 +1 @@
+../../includes/service-trace.h
\ No newline at end of file
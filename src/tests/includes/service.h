@@ -0,0 +1 @@
+../../includes/service.h
\ No newline at end of file
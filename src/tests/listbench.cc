@@ -0,0 +1,129 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "service.h"
+#include "control.h"
+
+// Control protocol benchmark: a client requests the service list (LISTSERVICES) from a control
+// connection for a set of 10k services (or the given number), and reads the reply. The
+// connection is on one end of a socket pair, driven directly (there is no real event loop).
+// Reports the mean time until the complete list is received, and the chunk buffer allocations.
+//
+// Usage: listbench [services [iterations]]
+
+using bench_clock = std::chrono::steady_clock;
+
+// Friend interface to access control_conn_t private members.
+class control_conn_t_test
+{
+    public:
+    static bool data_ready(control_conn_t *cc)
+    {
+        return cc->data_ready();
+    }
+
+    static bool send_data(control_conn_t *cc)
+    {
+        return cc->send_data();
+    }
+};
+
+// Request the service list, and read the reply until LISTDONE. Returns the number of services
+// listed, or -1 on error.
+static int list_services(control_conn_t *cc, int client_fd)
+{
+    char req = DINIT_CP_LISTSERVICES;
+    if (write(client_fd, &req, 1) != 1) return -1;
+    if (control_conn_t_test::data_ready(cc)) return -1;
+
+    std::vector<char> buf(65536);
+    size_t buf_len = 0;
+    int count = 0;
+    while (true) {
+        ssize_t r = read(client_fd, buf.data() + buf_len, buf.size() - buf_len);
+        if (r == -1) {
+            if (errno != EAGAIN) return -1;
+            // socket drained; let the connection send more
+            if (control_conn_t_test::send_data(cc)) return -1;
+            continue;
+        }
+        if (r == 0) return -1;
+        buf_len += r;
+
+        // Process complete packets:
+        size_t pos = 0;
+        while (pos < buf_len) {
+            if (buf[pos] == DINIT_RP_LISTDONE) {
+                return count;
+            }
+            if (buf[pos] != DINIT_RP_SVCINFO) return -1;
+            if (buf_len - pos < 2) break;
+            size_t pkt_len = 8 + (unsigned char)buf[pos + 1];
+            if (buf_len - pos < pkt_len) break;
+            pos += pkt_len;
+            count++;
+        }
+        buf_len -= pos;
+        std::copy(buf.begin() + pos, buf.begin() + pos + buf_len, buf.begin());
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int num_services = 10000;
+    int iterations = 20;
+    if (argc > 1) num_services = std::atoi(argv[1]);
+    if (argc > 2) iterations = std::atoi(argv[2]);
+    if (num_services <= 0 || iterations <= 0) {
+        std::cerr << "listbench: invalid arguments" << std::endl;
+        return 1;
+    }
+
+    service_set sset;
+    for (int i = 0; i < num_services; i++) {
+        sset.add_service(new (&sset) service_record(&sset, "service-" + std::to_string(i),
+                service_type_t::INTERNAL, {}));
+    }
+
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sockets) == -1) {
+        std::cerr << "listbench: can't create socket pair" << std::endl;
+        return 1;
+    }
+    control_conn_t *cc = new control_conn_t(event_loop, &sset, sockets[1]);
+
+    chunk_buffer_stats before = chunk_buffer::get_stats();
+    double total_ms = 0.0;
+    double min_ms = 0.0;
+    for (int i = 0; i < iterations; i++) {
+        auto start = bench_clock::now();
+        int listed = list_services(cc, sockets[0]);
+        double ms = std::chrono::duration<double, std::milli>(bench_clock::now() - start).count();
+        if (listed != num_services) {
+            std::cerr << "listbench: service list not received" << std::endl;
+            return 1;
+        }
+        total_ms += ms;
+        if (i == 0 || ms < min_ms) min_ms = ms;
+    }
+    const chunk_buffer_stats &after = chunk_buffer::get_stats();
+
+    std::cout << "LISTSERVICES, " << num_services << " services, " << iterations << " iterations:"
+            << std::endl;
+    std::cout << "  latency: " << (total_ms / iterations) << " ms mean, " << min_ms << " ms min"
+            << std::endl;
+    std::cout << "  chunks: " << (after.new_chunks - before.new_chunks) << " allocated, "
+            << (after.reused - before.reused) << " reused" << std::endl;
+
+    delete cc;
+    close(sockets[0]);
+    return 0;
+}
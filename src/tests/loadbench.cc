@@ -0,0 +1,144 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <chrono>
+
+#include <cstdlib>
+#include <unistd.h>
+
+#include "service.h"
+
+// Service loading and lookup benchmark: synthetic service trees of 1k, 10k and 100k services are
+// written to a temporary directory, and loaded with a dirload_service_set (from the descriptions,
+// and from a description cache); then every service is looked up by name.
+//
+// Usage: loadbench [size...]
+
+using std::string;
+using bench_clock = std::chrono::steady_clock;
+
+static double ms_since(bench_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(bench_clock::now() - start).count();
+}
+
+static string svc_name(int i)
+{
+    return "svc-" + std::to_string(i);
+}
+
+// Write a tree of n services: svc-i depends on svc-(2i+1) and waits for svc-(2i+2), so that
+// loading svc-0 loads them all.
+static void write_tree(const string &dir, int n)
+{
+    for (int i = 0; i < n; i++) {
+        std::ofstream f(dir + "/" + svc_name(i));
+        f << "type = internal\n";
+        if (2 * i + 1 < n) f << "depends-on = " << svc_name(2 * i + 1) << "\n";
+        if (2 * i + 2 < n) f << "waits-for = " << svc_name(2 * i + 2) << "\n";
+    }
+}
+
+static void remove_tree(const string &dir, int n)
+{
+    for (int i = 0; i < n; i++) {
+        unlink((dir + "/" + svc_name(i)).c_str());
+    }
+    rmdir(dir.c_str());
+}
+
+static bool load_tree(dirload_service_set &sset, int n)
+{
+    service_record *root = sset.load_service(svc_name(0).c_str());
+    return root != nullptr && sset.list_services().size() == (size_t)n;
+}
+
+static bool bench(int n)
+{
+    char dirbuf[] = "/tmp/dinit-loadbench-XXXXXX";
+    if (mkdtemp(dirbuf) == nullptr) {
+        std::cerr << "loadbench: can't create temporary directory" << std::endl;
+        return false;
+    }
+    string dir = dirbuf;
+    string cache_path = dir + ".cache";
+    write_tree(dir, n);
+
+    std::cout << n << " services:" << std::endl;
+    bool ok = true;
+
+    {
+        dirload_service_set sset(dir.c_str());
+        auto start = bench_clock::now();
+        ok = load_tree(sset, n);
+        std::cout << "  load:           " << ms_since(start) << " ms" << std::endl;
+
+        // Look up every service (in a scattered order), then names which are not present:
+        std::vector<string> names;
+        for (int i = 0; i < n; i++) {
+            names.push_back(svc_name((int)((i * 7919LL) % n)));
+        }
+        int found = 0;
+        start = bench_clock::now();
+        for (const string &name : names) {
+            if (sset.find_service(name) != nullptr) found++;
+        }
+        double lookup_ms = ms_since(start);
+        ok = ok && (found == n);
+        std::cout << "  lookup:         " << lookup_ms << " ms (" << (lookup_ms * 1000000.0 / n)
+                << " ns each)" << std::endl;
+
+        for (string &name : names) {
+            name += "-missing";
+        }
+        start = bench_clock::now();
+        for (const string &name : names) {
+            if (sset.find_service(name) != nullptr) ok = false;
+        }
+        lookup_ms = ms_since(start);
+        std::cout << "  failed lookup:  " << lookup_ms << " ms (" << (lookup_ms * 1000000.0 / n)
+                << " ns each)" << std::endl;
+
+        if (sset.write_cache(cache_path.c_str()) != n) {
+            std::cerr << "loadbench: can't write description cache" << std::endl;
+            ok = false;
+        }
+    }
+
+    if (ok) {
+        dirload_service_set sset(dir.c_str());
+        auto start = bench_clock::now();
+        ok = sset.use_cache(cache_path.c_str()) && load_tree(sset, n);
+        std::cout << "  load (cached):  " << ms_since(start) << " ms" << std::endl;
+    }
+
+    unlink(cache_path.c_str());
+    remove_tree(dir, n);
+
+    if (! ok) {
+        std::cerr << "loadbench: services were not loaded as expected" << std::endl;
+    }
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<int> sizes;
+    for (int i = 1; i < argc; i++) {
+        int n = std::atoi(argv[i]);
+        if (n <= 0) {
+            std::cerr << "loadbench: invalid size: " << argv[i] << std::endl;
+            return 1;
+        }
+        sizes.push_back(n);
+    }
+    if (sizes.empty()) {
+        sizes = { 1000, 10000, 100000 };
+    }
+
+    for (int n : sizes) {
+        if (! bench(n)) return 1;
+    }
+    return 0;
+}
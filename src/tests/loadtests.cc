@@ -0,0 +1,335 @@
+#include <cassert>
+#include <iostream>
+#include <sstream>
+#include <locale>
+#include <vector>
+#include <string>
+#include <list>
+#include <fstream>
+#include <iterator>
+
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "load-service.h"
+#include "test_parse.h"
+
+// Test 1: value tokenising: quoting, escapes, white space collapse, comments.
+void test1()
+{
+    string line = "  /bin/echo \"a  b\"  c\\ d\\#  x\"y\"z   # comment";
+    const char *i = line.data();
+    part_list parts;
+    string value = dinit_load::read_setting_value(i, line.data() + line.length(), &parts);
+
+    assert(value == "/bin/echo a  b c d# xyz");
+    assert(parts.size() == 4);
+    auto pi = parts.begin();
+    assert(value.substr(pi->first, pi->second - pi->first) == "/bin/echo"); ++pi;
+    assert(value.substr(pi->first, pi->second - pi->first) == "a  b"); ++pi;
+    assert(value.substr(pi->first, pi->second - pi->first) == "c d#"); ++pi;
+    assert(value.substr(pi->first, pi->second - pi->first) == "xyz");
+}
+
+// Test 2: whole descriptions, and errors, match the original parser.
+void test2()
+{
+    const char * const descs[] = {
+        "",
+        "\n\n",
+        "# comment only\n",
+        "type = process\ncommand = /bin/sleep 10\n",
+        "type=process\ncommand=/bin/sleep 10",
+        "command: /bin/sh -c \"echo \\\"hi\\\"\"   \n   depends-on = a\r\nwaits-for=b  # x\n",
+        "command = /bin/true \n",
+        "command = \n",
+        "command = a#b\n",
+        "command = \"unterminated\n",
+        "command = trailing\\",
+        "bad line\n",
+        "=novalue\n",
+        "options = runs-on-console starts-rwfs\t\tno-sigterm\n",
+    };
+
+    for (const char *desc : descs) {
+        assert(parse_new(desc) == parse_ref(desc));
+    }
+}
+
+// Test 3: randomly generated descriptions parse identically with both parsers.
+void test3()
+{
+    random_desc_generator gen;
+    for (int n = 0; n < 20000; n++) {
+        string text = gen.next();
+        assert(parse_new(text) == parse_ref(text));
+    }
+}
+
+// Write a service description file into the given directory.
+static void write_desc(const string &dir, const string &name, const string &contents)
+{
+    std::ofstream f(dir + "/" + name);
+    f << contents;
+}
+
+// Test 4: a very deep dependency chain loads without recursion, and each service is loaded once.
+void test4()
+{
+    char dirbuf[] = "/tmp/dinit-loadtest-XXXXXX";
+    string dir = mkdtemp(dirbuf);
+
+    const int depth = 10000;
+    for (int i = 0; i < depth; i++) {
+        string desc = "type = internal\n";
+        if (i + 1 < depth) {
+            desc += "depends-on = s" + std::to_string(i + 1) + "\n";
+            // also depend on the end of the chain, which is then already loaded or in progress:
+            desc += "waits-for = s" + std::to_string(depth - 1) + "\n";
+        }
+        write_desc(dir, "s" + std::to_string(i), desc);
+    }
+
+    {
+        dirload_service_set sset(dir.c_str());
+        service_record *s0 = sset.load_service("s0");
+        assert(s0 != nullptr);
+        assert(sset.find_service("s0") == s0);
+        assert(sset.find_service("s" + std::to_string(depth - 1)) != nullptr);
+        assert(sset.list_services().size() == (size_t)depth);
+    }
+
+    for (int i = 0; i < depth; i++) {
+        unlink((dir + "/s" + std::to_string(i)).c_str());
+    }
+    rmdir(dir.c_str());
+}
+
+// Test 5: a dependency cycle is detected, and services in the cycle are not added.
+void test5()
+{
+    char dirbuf[] = "/tmp/dinit-loadtest-XXXXXX";
+    string dir = mkdtemp(dirbuf);
+
+    write_desc(dir, "a", "type = internal\ndepends-on = b\ndepends-on = d\n");
+    write_desc(dir, "b", "type = internal\ndepends-on = c\n");
+    write_desc(dir, "c", "type = internal\nwaits-for = a\n");
+    write_desc(dir, "d", "type = internal\n");
+
+    {
+        dirload_service_set sset(dir.c_str());
+        bool got_cycle = false;
+        try {
+            sset.load_service("a");
+        }
+        catch (service_cyclic_dependency &exc) {
+            got_cycle = true;
+            assert(exc.serviceName == "a");
+        }
+        assert(got_cycle);
+        assert(sset.find_service("a") == nullptr);
+        assert(sset.find_service("b") == nullptr);
+        assert(sset.find_service("c") == nullptr);
+
+        // A service outside the cycle still loads normally:
+        assert(sset.load_service("d") != nullptr);
+    }
+
+    for (const char *n : { "a", "b", "c", "d" }) {
+        unlink((dir + "/" + n).c_str());
+    }
+    rmdir(dir.c_str());
+}
+
+// Test 6: process attribute settings (nice, rlimit-*, ioprio, oom-score-adj, cpu-affinity).
+void test6()
+{
+    char dirbuf[] = "/tmp/dinit-loadtest-XXXXXX";
+    string dir = mkdtemp(dirbuf);
+
+    string base = "type = process\ncommand = /bin/true\n";
+    write_desc(dir, "good", base + "nice = -5\nrlimit-nofile = 100:200\nrlimit-core = unlimited\n"
+            "rlimit-nofile = :300\n"
+#ifdef __linux__
+            "ioprio = best-effort:3\noom-score-adj = -500\ncpu-affinity = 0-2, 5\n"
+            "cgroup-cpu-weight = 200\nio-weight = 50\nmemory-max = 512M\n"
+#endif
+            );
+
+    const char * const bad_settings[] = {
+        "nice = 20\n", "nice = x\n", "rlimit-nofile = 1:x\n", "rlimit-stuff = 1\n",
+#ifdef __linux__
+        "ioprio = realtime\n", "ioprio = idle:1\n", "ioprio = best-effort:8\n",
+        "oom-score-adj = 1001\n", "cpu-affinity = 3-1\n", "cpu-affinity = 100000\n", "cpu-affinity = 1;2\n",
+        "cgroup-cpu-weight = 0\n", "io-weight = 10001\n", "memory-max = 1X\n",
+        "memory-max = 99999999999999999G\n",
+#endif
+    };
+    int nbad = sizeof(bad_settings) / sizeof(bad_settings[0]);
+    for (int i = 0; i < nbad; i++) {
+        write_desc(dir, "bad" + std::to_string(i), base + bad_settings[i]);
+    }
+
+    {
+        dirload_service_set sset(dir.c_str());
+        service_record *good = sset.load_service("good");
+        const process_attrs &attrs = good->get_process_attrs();
+        assert(attrs.nice == -5);
+        assert(attrs.rlimits.size() == 2);
+        assert(attrs.rlimits[0].resource_id == RLIMIT_NOFILE);
+        assert(attrs.rlimits[0].soft_set && attrs.rlimits[0].limits.rlim_cur == 100);
+        assert(attrs.rlimits[0].hard_set && attrs.rlimits[0].limits.rlim_max == 300);
+        assert(attrs.rlimits[1].resource_id == RLIMIT_CORE);
+        assert(attrs.rlimits[1].limits.rlim_cur == RLIM_INFINITY);
+        assert(attrs.rlimits[1].limits.rlim_max == RLIM_INFINITY);
+#ifdef __linux__
+        assert(attrs.ioprio == ((2 << 13) | 3));
+        assert(attrs.oom_score_adj == -500);
+        assert(attrs.has_cpu_affinity && CPU_COUNT(&attrs.cpu_affinity) == 4);
+        assert(CPU_ISSET(2, &attrs.cpu_affinity) && CPU_ISSET(5, &attrs.cpu_affinity));
+#endif
+
+        for (int i = 0; i < nbad; i++) {
+            bool got_exc = false;
+            try {
+                sset.load_service(("bad" + std::to_string(i)).c_str());
+            }
+            catch (service_description_exc &exc) {
+                got_exc = true;
+            }
+            assert(got_exc);
+        }
+    }
+
+    unlink((dir + "/good").c_str());
+    for (int i = 0; i < nbad; i++) {
+        unlink((dir + "/bad" + std::to_string(i)).c_str());
+    }
+    rmdir(dir.c_str());
+}
+
+// Test 7: the service description cache replays the same settings as parsing the description
+// file; entries are ignored once the file changes, and a damaged cache file is rejected.
+void test7()
+{
+    char dirbuf[] = "/tmp/dinit-loadtest-XXXXXX";
+    string dir = mkdtemp(dirbuf);
+    string sdir = dir + "/sd";
+    mkdir(sdir.c_str(), 0700);
+    string cache_path = dir + "/cache";
+    string bad_path = dir + "/badcache";
+
+    const string one_text = "type = process\ncommand = /bin/echo \"a  b\" c\\ d  # comment\n"
+            "restart = yes\n\n# comment line\ndepends-on = two\n";
+    const string two_text = "type = internal\n";
+    write_desc(sdir, "one", one_text);
+    write_desc(sdir, "two", two_text);
+    write_desc(sdir, "bad", "type = process\ncommand\n");  // badly formed: omitted from cache
+    // A dangling symbolic link must not cause cache writing to fail:
+    assert(symlink("/nonexistent", (sdir + "/dangling").c_str()) == 0);
+
+    {
+        dirload_service_set sset(sdir.c_str());
+        assert(sset.write_cache(cache_path.c_str()) == 2);
+    }
+
+    auto replay_entry = [](service_desc_cache &cache, const char *entry) {
+        parse_result r;
+        cache.replay(entry, [&](const string &setting, string &value, part_list &parts) {
+            r.settings.emplace_back(setting, value);
+            r.parts.push_back(parts);
+        });
+        return r;
+    };
+
+    {
+        service_desc_cache cache;
+        assert(cache.open(cache_path.c_str()));
+
+        const char *entry = cache.find("one", sdir + "/one");
+        assert(entry != nullptr);
+        parse_result r = replay_entry(cache, entry);
+        assert(r.settings.size() == 4);
+        assert(r == parse_new(one_text));
+
+        entry = cache.find("two", sdir + "/two");
+        assert(entry != nullptr);
+        assert(replay_entry(cache, entry) == parse_new(two_text));
+
+        assert(cache.find("bad", sdir + "/bad") == nullptr);
+        assert(cache.find("dangling", sdir + "/dangling") == nullptr);
+
+        // Modification time changed:
+        struct stat statbuf;
+        assert(stat((sdir + "/one").c_str(), &statbuf) == 0);
+        struct timespec times[2] = { statbuf.st_atim, statbuf.st_mtim };
+        times[1].tv_sec -= 10;
+        assert(utimensat(AT_FDCWD, (sdir + "/one").c_str(), times, 0) == 0);
+        assert(cache.find("one", sdir + "/one") == nullptr);
+
+        // Size changed (modification time as originally):
+        write_desc(sdir, "two", two_text + "restart = no\n");
+        assert(stat((sdir + "/two").c_str(), &statbuf) == 0);
+        times[0] = statbuf.st_atim;
+        times[1] = statbuf.st_mtim;
+        assert(utimensat(AT_FDCWD, (sdir + "/two").c_str(), times, 0) == 0);
+        assert(cache.find("two", sdir + "/two") == nullptr);
+    }
+
+    // A truncated cache file, or one containing garbage, is rejected:
+    std::string cache_data;
+    {
+        std::ifstream f(cache_path);
+        cache_data.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+    }
+    for (size_t len : { (size_t)4, (size_t)16, cache_data.length() / 2, cache_data.length() - 1 }) {
+        write_desc(dir, "badcache", cache_data.substr(0, len));
+        service_desc_cache cache;
+        assert(! cache.open(bad_path.c_str()));
+    }
+    {
+        string garbage = cache_data;
+        for (size_t i = 0; i < garbage.length(); i++) {
+            garbage[i] = (char)(i * 7 + 3);
+        }
+        write_desc(dir, "badcache", garbage);
+        service_desc_cache cache;
+        assert(! cache.open(bad_path.c_str()));
+    }
+    {
+        // valid header, but an entry which extends past the end of the file
+        string overlong = cache_data;
+        uint16_t name_len = 0xFFFF;
+        std::memcpy(&overlong[16], &name_len, sizeof(name_len));
+        write_desc(dir, "badcache", overlong);
+        service_desc_cache cache;
+        assert(! cache.open(bad_path.c_str()));
+    }
+
+    for (const char *name : { "one", "two", "bad", "dangling" }) {
+        unlink((sdir + "/" + name).c_str());
+    }
+    rmdir(sdir.c_str());
+    unlink(cache_path.c_str());
+    unlink(bad_path.c_str());
+    rmdir(dir.c_str());
+}
+
+#define RUN_TEST(name) \
+    std::cout << #name "... "; \
+    name(); \
+    std::cout << "PASSED" << std::endl;
+
+int main(int argc, char **argv)
+{
+    RUN_TEST(test1);
+    RUN_TEST(test2);
+    RUN_TEST(test3);
+    RUN_TEST(test4);
+    RUN_TEST(test5);
+    RUN_TEST(test6);
+    RUN_TEST(test7);
+}
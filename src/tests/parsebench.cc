@@ -0,0 +1,81 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <chrono>
+
+#include <cstdlib>
+
+#include "load-service.h"
+#include "test_parse.h"
+
+// Parse throughput benchmark: service description parsing with the buffer-based tokenizer
+// (load-service.h), compared with the original iostream-based parser.
+//
+// Usage: parsebench [iterations]
+
+using bench_clock = std::chrono::steady_clock;
+
+// Parse each text the given number of times with the given parser; report throughput.
+template <typename P>
+static void run(const char *label, const std::vector<string> &texts, int iterations, P parse)
+{
+    size_t bytes = 0;
+    size_t settings = 0;
+    auto start = bench_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        for (const string &text : texts) {
+            parse_result r = parse(text);
+            bytes += text.length();
+            settings += r.settings.size();
+        }
+    }
+    double secs = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+    std::cout << "  " << label << ": " << secs * 1000.0 << " ms, "
+            << (bytes / secs / (1024 * 1024)) << " MiB/s (" << settings << " settings)" << std::endl;
+}
+
+static void bench(const char *title, const std::vector<string> &texts, int iterations)
+{
+    std::cout << title << std::endl;
+    run("tokenizer", texts, iterations, parse_new);
+    run("iostream ", texts, iterations, parse_ref);
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = 20;
+    if (argc > 1) {
+        iterations = std::atoi(argv[1]);
+        if (iterations <= 0) {
+            std::cerr << "parsebench: iterations must be positive" << std::endl;
+            return 1;
+        }
+    }
+
+    // Random descriptions (mostly malformed; each is parsed until the first error):
+    random_desc_generator gen;
+    std::vector<string> fuzz_texts;
+    for (int i = 0; i < 10000; i++) {
+        fuzz_texts.push_back(gen.next());
+    }
+    bench("random descriptions (10000):", fuzz_texts, iterations);
+
+    // A typical, well-formed description:
+    std::vector<string> desc_texts(1000,
+            "# A typical process service\n"
+            "type = process\n"
+            "command = /usr/sbin/daemon --foreground --config \"/etc/daemon/daemon.conf\" -v\n"
+            "stop-command = /usr/sbin/daemon-ctl stop\n"
+            "depends-on = network\n"
+            "depends-on = syslog\n"
+            "waits-for = ntpd\n"
+            "logfile = /var/log/daemon.log\n"
+            "restart = true\n"
+            "smooth-recovery = yes\n"
+            "options = starts-rwfs no-sigterm\n"
+            "stop-timeout = 10\n");
+    bench("typical descriptions (1000):", desc_texts, iterations);
+
+    return 0;
+}
@@ -4,8 +4,13 @@
 #include <utility>
 #include <string>
 
+#include <cstdio>
+#include <csignal>
+#include <unistd.h>
+
 #include "service.h"
 #include "proc-service.h"
+#include "baseproc-sys.h"
 
 // Tests of process-service related functionality.
 //
@@ -25,6 +30,50 @@ class base_process_service_test
     {
         bsp->handle_exit_status(exit_status);
     }
+
+    static void ready_notified(base_process_service *bsp)
+    {
+        bsp->ready_notified();
+    }
+
+    static void set_pid(base_process_service *bsp, pid_t pid)
+    {
+        bsp->pid = pid;
+    }
+
+    // Have the service use the mock cgroup (as if it had been created by ensure_cgroup()):
+    static void use_mock_cgroup(base_process_service *bsp)
+    {
+        bsp->cgroup_fd = bp_sys::mock_cgroup::dir_fd;
+        bsp->cgroup_events_fd = bp_sys::mock_cgroup::events_fd;
+    }
+
+    // The (directly watched) process has terminated:
+    static void child_exited(base_process_service *bsp, int exit_status)
+    {
+        bsp->child_listener.status_change(event_loop, bsp->pid, exit_status);
+    }
+
+    // cgroup.events has been modified:
+    static void cgroup_events(base_process_service *bsp)
+    {
+        bsp->cgroup_watcher.fd_event(event_loop, bsp->cgroup_events_fd, dasynq::IN_EVENTS);
+    }
+
+    static void timer_expired(base_process_service *bsp)
+    {
+        bsp->timer_expired();
+    }
+
+    static bool stop_timer_armed(base_process_service *bsp)
+    {
+        return bsp->stop_timer_armed;
+    }
+
+    static bool waiting_cgroup_empty(base_process_service *bsp)
+    {
+        return bsp->waiting_cgroup_empty;
+    }
 };
 
 // Regular service start
@@ -39,7 +88,7 @@ void test1()
     command_offsets.emplace_back(0, command.length());
     std::list<prelim_dep> depends;
 
-    process_service p = process_service(&sset, "testproc", std::move(command), command_offsets, depends);
+    process_service p {&sset, "testproc", std::move(command), command_offsets, depends};
     p.start(true);
 
     base_process_service_test::exec_succeeded(&p);
@@ -59,7 +108,7 @@ void test2()
     command_offsets.emplace_back(0, command.length());
     std::list<prelim_dep> depends;
 
-    process_service p = process_service(&sset, "testproc", std::move(command), command_offsets, depends);
+    process_service p {&sset, "testproc", std::move(command), command_offsets, depends};
     p.start(true);
 
     base_process_service_test::exec_succeeded(&p);
@@ -83,22 +132,218 @@ void test3()
     command_offsets.emplace_back(0, command.length());
     std::list<prelim_dep> depends;
 
-    process_service p = process_service(&sset, "testproc", std::move(command), command_offsets, depends);
+    process_service p {&sset, "testproc", std::move(command), command_offsets, depends};
+    p.start(true);
+
+    base_process_service_test::exec_succeeded(&p);
+
+    assert(p.get_state() == service_state_t::STARTED);
+
+    p.stop(true);
+
+    assert(p.get_state() == service_state_t::STOPPING);
+
+    base_process_service_test::handle_exit(&p, 0);
+
+    assert(p.get_state() == service_state_t::STOPPED);
+}
+
+
+// Readiness notification: service remains STARTING until the process signals readiness
+void test4()
+{
+    using namespace std;
+
+    service_set sset;
+
+    string command = "test-command";
+    list<pair<unsigned,unsigned>> command_offsets;
+    command_offsets.emplace_back(0, command.length());
+    std::list<prelim_dep> depends;
+
+    process_service p {&sset, "testproc", std::move(command), command_offsets, depends};
+    p.set_notification_fd(3);
+    p.start(true);
+
+    base_process_service_test::exec_succeeded(&p);
+
+    assert(p.get_state() == service_state_t::STARTING);
+
+    base_process_service_test::ready_notified(&p);
+
+    assert(p.get_state() == service_state_t::STARTED);
+}
+
+// Readiness notification: process terminating before signalling readiness fails the start
+void test5()
+{
+    using namespace std;
+
+    service_set sset;
+
+    string command = "test-command";
+    list<pair<unsigned,unsigned>> command_offsets;
+    command_offsets.emplace_back(0, command.length());
+    std::list<prelim_dep> depends;
+
+    process_service p {&sset, "testproc", std::move(command), command_offsets, depends};
+    p.set_notification_fd(3);
     p.start(true);
 
     base_process_service_test::exec_succeeded(&p);
 
+    assert(p.get_state() == service_state_t::STARTING);
+
+    base_process_service_test::handle_exit(&p, 0);
+
+    assert(p.get_state() == service_state_t::STOPPED);
+}
+
+#ifdef __linux__
+
+// Stop, where other processes remain in the service cgroup after the main process has
+// terminated: they are killed, and the service stops once the cgroup is empty
+void test6()
+{
+    using namespace std;
+
+    service_set sset;
+    bp_sys::mock_cgroup &cgroup = bp_sys::get_mock_cgroup();
+    cgroup = bp_sys::mock_cgroup();
+
+    string command = "test-command";
+    list<pair<unsigned,unsigned>> command_offsets;
+    command_offsets.emplace_back(0, command.length());
+    std::list<prelim_dep> depends;
+
+    process_service p {&sset, "testproc", std::move(command), command_offsets, depends};
+    p.start(true);
+    base_process_service_test::exec_succeeded(&p);
+    // (signals are not actually sent, so the process can be ourself):
+    base_process_service_test::set_pid(&p, getpid());
+    base_process_service_test::use_mock_cgroup(&p);
     assert(p.get_state() == service_state_t::STARTED);
 
+    cgroup.populated = true;
     p.stop(true);
+    sset.process_queues();
+    assert(p.get_state() == service_state_t::STOPPING);
+    assert(bp_sys::get_last_signal().sig == SIGTERM);
+    assert(cgroup.kills == 0);
+
+    base_process_service_test::child_exited(&p, 0);
+    assert(p.get_state() == service_state_t::STOPPING);
+    assert(base_process_service_test::waiting_cgroup_empty(&p));
+    assert(base_process_service_test::stop_timer_armed(&p));
+    assert(cgroup.kills == 1);
 
+    // cgroup.events is modified, but the cgroup is still populated:
+    base_process_service_test::cgroup_events(&p);
     assert(p.get_state() == service_state_t::STOPPING);
 
+    cgroup.populated = false;
+    base_process_service_test::cgroup_events(&p);
+    assert(p.get_state() == service_state_t::STOPPED);
+    assert(! base_process_service_test::waiting_cgroup_empty(&p));
+    assert(! base_process_service_test::stop_timer_armed(&p));
+    assert(cgroup.files.empty());
+}
+
+// Stop timeout while waiting for the cgroup to become empty: the remaining processes are killed
+// again, and the timer is re-armed
+void test7()
+{
+    using namespace std;
+
+    service_set sset;
+    bp_sys::mock_cgroup &cgroup = bp_sys::get_mock_cgroup();
+    cgroup = bp_sys::mock_cgroup();
+
+    string command = "test-command";
+    list<pair<unsigned,unsigned>> command_offsets;
+    command_offsets.emplace_back(0, command.length());
+    std::list<prelim_dep> depends;
+
+    process_service p {&sset, "testproc", std::move(command), command_offsets, depends};
+    p.start(true);
+    base_process_service_test::exec_succeeded(&p);
+    base_process_service_test::set_pid(&p, getpid());
+    base_process_service_test::use_mock_cgroup(&p);
+
+    cgroup.populated = true;
+    p.stop(true);
+    sset.process_queues();
+    base_process_service_test::child_exited(&p, 0);
+    assert(cgroup.kills == 1);
+
+    base_process_service_test::timer_expired(&p);
+    assert(p.get_state() == service_state_t::STOPPING);
+    assert(cgroup.kills == 2);
+    assert(base_process_service_test::stop_timer_armed(&p));
+
+    // Without cgroup.kill, each process listed in cgroup.procs is signalled:
+    cgroup.kill_supported = false;
+    cgroup.procs = "4321\n";
+    base_process_service_test::timer_expired(&p);
+    assert(bp_sys::get_last_signal().pid == 4321);
+    assert(bp_sys::get_last_signal().sig == SIGKILL);
+    assert(base_process_service_test::stop_timer_armed(&p));
+
+    cgroup.populated = false;
+    base_process_service_test::cgroup_events(&p);
+    assert(p.get_state() == service_state_t::STOPPED);
+    assert(! base_process_service_test::stop_timer_armed(&p));
+    assert(cgroup.files.empty());
+}
+
+// Stop of a bgprocess which is not our child: the service stops once its cgroup is empty
+void test8()
+{
+    using namespace std;
+
+    service_set sset;
+    bp_sys::mock_cgroup &cgroup = bp_sys::get_mock_cgroup();
+    cgroup = bp_sys::mock_cgroup();
+
+    // The pid file names a process which is not our child (our parent):
+    char pid_file[] = "/tmp/dinit-proctests-XXXXXX";
+    int pid_fd = mkstemp(pid_file);
+    assert(pid_fd != -1);
+    string pid_str = std::to_string(getppid());
+    assert(write(pid_fd, pid_str.c_str(), pid_str.length()) == (ssize_t)pid_str.length());
+    ::close(pid_fd);
+
+    string command = "test-command";
+    list<pair<unsigned,unsigned>> command_offsets;
+    command_offsets.emplace_back(0, command.length());
+    std::list<prelim_dep> depends;
+
+    bgproc_service p {&sset, "testproc", std::move(command), command_offsets, depends};
+    p.set_pid_file(pid_file);
+    p.start(true);
+    base_process_service_test::exec_succeeded(&p);
+    base_process_service_test::use_mock_cgroup(&p);
+
+    // The launched process exits, having written the pid file:
     base_process_service_test::handle_exit(&p, 0);
+    unlink(pid_file);
+    assert(p.get_state() == service_state_t::STARTED);
+    assert(p.get_pid() == getppid());
+
+    cgroup.populated = true;
+    p.stop(true);
+    sset.process_queues();
+    assert(p.get_state() == service_state_t::STOPPING);
+    assert(base_process_service_test::waiting_cgroup_empty(&p));
+    assert(bp_sys::get_last_signal().sig == SIGTERM);
 
+    cgroup.populated = false;
+    base_process_service_test::cgroup_events(&p);
     assert(p.get_state() == service_state_t::STOPPED);
+    assert(p.get_pid() == -1);
 }
 
+#endif
 
 #define RUN_TEST(name) \
     std::cout << #name "... "; \
@@ -110,4 +355,11 @@ int main(int argc, char **argv)
     RUN_TEST(test1);
     RUN_TEST(test2);
     RUN_TEST(test3);
+    RUN_TEST(test4);
+    RUN_TEST(test5);
+#ifdef __linux__
+    RUN_TEST(test6);
+    RUN_TEST(test7);
+    RUN_TEST(test8);
+#endif
 }
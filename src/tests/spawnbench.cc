@@ -0,0 +1,140 @@
+#include <iostream>
+#include <vector>
+#include <chrono>
+
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+#include "service.h"
+
+// Process launch benchmark: launches a program (/bin/true by default) repeatedly via
+// run_child_proc, with the fork launch backend (the child reports exec() failure via a close-on-exec
+// status pipe, read by the parent) and, on Linux, the vfork backend (vfork_child_proc). Reports the
+// mean latency until the launch is known to have succeeded, and the overall launch rate
+// (including reaping each child).
+//
+// Usage: spawnbench [count [program]]
+
+using bench_clock = std::chrono::steady_clock;
+
+extern char **environ;
+
+// A service record through which processes are launched.
+class bench_service : public service_record
+{
+    public:
+    bench_service(service_set *set) : service_record(set, "bench", service_type_t::PROCESS, {})
+    {
+    }
+
+    // Launch via fork(), as for the fork backend; returns the child pid once exec() has succeeded,
+    // or -1.
+    pid_t launch_fork(const char * const *args)
+    {
+        int pipefd[2];
+        if (pipe2(pipefd, O_CLOEXEC) == -1) {
+            return -1;
+        }
+
+        run_proc_params params(args, "/dev/null", false);
+        params.wpipefd = pipefd[1];
+
+        pid_t child = fork();
+        if (child == 0) {
+            run_child_proc(params);
+        }
+        close(pipefd[1]);
+
+        int exec_status = 0;
+        ssize_t r;
+        while ((r = read(pipefd[0], &exec_status, sizeof(exec_status))) == -1 && errno == EINTR) { }
+        close(pipefd[0]);
+
+        if (child != -1 && r != 0) {
+            // exec failed (or the status couldn't be read)
+            waitpid(child, nullptr, 0);
+            return -1;
+        }
+        return child;
+    }
+
+#ifdef __linux__
+    // Launch via vfork_child_proc, as for the vfork backend; returns the child pid once exec()
+    // has succeeded, or -1.
+    pid_t launch_vfork(const char * const *args)
+    {
+        std::vector<const char *> child_env;
+        for (char **env_var = environ; *env_var != nullptr; ++env_var) {
+            child_env.push_back(*env_var);
+        }
+
+        run_proc_params params(args, "/dev/null", false);
+        params.env_free = child_env.size();
+        child_env.resize(child_env.size() + 4, nullptr);
+        params.envp = child_env.data();
+        int exec_errno = 0;
+        params.exec_errno = &exec_errno;
+
+        pid_t child = vfork_child_proc(params);
+        if (child != -1 && exec_errno != 0) {
+            waitpid(child, nullptr, 0);
+            return -1;
+        }
+        return child;
+    }
+#endif
+};
+
+// Launch the program count times; report mean latency and launch rate.
+template <typename L>
+static bool run(const char *label, int count, L launch)
+{
+    double latency_total = 0.0;
+    auto start = bench_clock::now();
+    for (int i = 0; i < count; i++) {
+        auto launch_start = bench_clock::now();
+        pid_t child = launch();
+        if (child == -1) {
+            std::cerr << "spawnbench: " << label << ": launch failed" << std::endl;
+            return false;
+        }
+        latency_total += std::chrono::duration<double, std::micro>(bench_clock::now() - launch_start).count();
+        waitpid(child, nullptr, 0);
+    }
+    double secs = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+    std::cout << "  " << label << ": " << (latency_total / count) << " us mean latency, "
+            << (count / secs) << " launches/s" << std::endl;
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    int count = 1000;
+    const char *program = "/bin/true";
+    if (argc > 1) {
+        count = std::atoi(argv[1]);
+        if (count <= 0) {
+            std::cerr << "spawnbench: count must be positive" << std::endl;
+            return 1;
+        }
+    }
+    if (argc > 2) {
+        program = argv[2];
+    }
+
+    const char * const args[] = { program, nullptr };
+    service_set sset;
+    bench_service svc(&sset);
+
+    std::cout << count << " launches of " << program << ":" << std::endl;
+    if (! run("fork ", count, [&]() { return svc.launch_fork(args); })) return 1;
+#ifdef __linux__
+    if (! run("vfork", count, [&]() { return svc.launch_vfork(args); })) return 1;
+#endif
+    return 0;
+}
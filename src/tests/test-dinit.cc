@@ -1,12 +1,16 @@
 #include "dasynq.h"
 #include "dinit.h"
 
+class control_conn_t;
+
 // using eventloop_t = dasynq::event_loop<dasynq::null_mutex>;
 
 eventloop_t event_loop;
 
 int active_control_conns = 0;
 
+control_conn_t *rollback_handler_conn = nullptr;
+
 /*
 These are provided in header instead:
 
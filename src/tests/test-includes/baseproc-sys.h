@@ -1,9 +1,54 @@
+#include <algorithm>
+#include <map>
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
 #include <sys/types.h>
 
 // Mock system functions for testing.
 
 namespace bp_sys {
 
+// A (single) mock cgroup. A service using it should have its directory open as dir_fd, and be
+// watching it via the inotify instance events_fd; the files within it are opened via openat().
+struct mock_cgroup
+{
+    static constexpr int dir_fd = 100;
+    static constexpr int events_fd = 101;
+
+    bool populated = false;         // reported via cgroup.events
+    bool kill_supported = true;     // whether cgroup.kill exists
+    std::string procs;              // contents of cgroup.procs
+    int kills = 0;                  // number of writes to cgroup.kill
+
+    // contents of files under /proc (such as /proc/<pid>/cgroup), which can be opened via open():
+    std::map<std::string, std::string> proc_files;
+
+    // open files (fd -> name, read position):
+    std::map<int, std::pair<std::string, size_t>> files;
+    int next_fd = 102;
+};
+
+inline mock_cgroup &get_mock_cgroup()
+{
+    static mock_cgroup cgroup;
+    return cgroup;
+}
+
+// The most recent signal sent via kill(), and its target:
+struct mock_signal
+{
+    pid_t pid = 0;
+    int sig = 0;
+};
+
+inline mock_signal &get_last_signal()
+{
+    static mock_signal last;
+    return last;
+}
+
 inline int pipe2(int pipefd[2], int flags)
 {
     abort();
@@ -16,13 +61,142 @@ inline int fcntl(int fd, int cmd, ...)
     return 0;
 }
 
+inline int open(const char *pathname, int flags, ...)
+{
+    mock_cgroup &cg = get_mock_cgroup();
+    if (strncmp(pathname, "/proc/", 6) != 0) {
+        abort();
+    }
+    if (cg.proc_files.find(pathname) == cg.proc_files.end()) {
+        errno = ENOENT;
+        return -1;
+    }
+    int fd = cg.next_fd++;
+    cg.files[fd] = std::make_pair(std::string(pathname), (size_t)0);
+    return fd;
+}
+
+inline int openat(int dirfd, const char *pathname, int flags, ...)
+{
+    mock_cgroup &cg = get_mock_cgroup();
+    if (dirfd != mock_cgroup::dir_fd) {
+        abort();
+    }
+    if (strcmp(pathname, "cgroup.kill") == 0 && ! cg.kill_supported) {
+        errno = ENOENT;
+        return -1;
+    }
+    int fd = cg.next_fd++;
+    cg.files[fd] = std::make_pair(std::string(pathname), (size_t)0);
+    return fd;
+}
+
 inline int close(int fd)
 {
-    abort();
+    mock_cgroup &cg = get_mock_cgroup();
+    if (fd == mock_cgroup::dir_fd || fd == mock_cgroup::events_fd) {
+        return 0;
+    }
+    if (cg.files.erase(fd) == 0) {
+        abort();
+    }
     return 0;
 }
 
+inline ssize_t read(int fd, void *buf, size_t count)
+{
+    mock_cgroup &cg = get_mock_cgroup();
+    if (fd == mock_cgroup::events_fd) {
+        // no inotify events are queued
+        errno = EAGAIN;
+        return -1;
+    }
+    auto i = cg.files.find(fd);
+    if (i == cg.files.end()) {
+        abort();
+    }
+
+    std::string contents;
+    if (i->second.first == "cgroup.events") {
+        contents = cg.populated ? "populated 1\nfrozen 0\n" : "populated 0\nfrozen 0\n";
+    }
+    else if (i->second.first == "cgroup.procs") {
+        contents = cg.procs;
+    }
+    else {
+        contents = cg.proc_files[i->second.first];
+    }
+
+    size_t &pos = i->second.second;
+    size_t r = std::min(count, contents.length() - std::min(pos, contents.length()));
+    memcpy(buf, contents.data() + pos, r);
+    pos += r;
+    return r;
+}
+
+inline ssize_t write(int fd, const void *buf, size_t count)
+{
+    mock_cgroup &cg = get_mock_cgroup();
+    auto i = cg.files.find(fd);
+    if (i == cg.files.end()) {
+        abort();
+    }
+    if (i->second.first == "cgroup.kill") {
+        cg.kills++;
+    }
+    return count;
+}
+
 inline int kill(pid_t pid, int sig)
+{
+    mock_signal &last = get_last_signal();
+    last.pid = pid;
+    last.sig = sig;
+    return 0;
+}
+
+inline ssize_t writev(int fd, const struct iovec *iov, int iovcnt)
+{
+    abort();
+    return 0;
+}
+
+inline int fstat(int fd, struct stat *statbuf)
+{
+    abort();
+    return 0;
+}
+
+inline int rename(const char *oldpath, const char *newpath)
+{
+    abort();
+    return 0;
+}
+
+inline int unlink(const char *pathname)
+{
+    abort();
+    return 0;
+}
+
+inline int mkdir(const char *pathname, mode_t mode)
+{
+    abort();
+    return 0;
+}
+
+inline int rmdir(const char *pathname)
+{
+    return 0;
+}
+
+inline int inotify_init1(int flags)
+{
+    abort();
+    return 0;
+}
+
+inline int inotify_add_watch(int fd, const char *pathname, uint32_t mask)
 {
     abort();
     return 0;
@@ -25,6 +25,11 @@ class eventloop_t
             return -1;
         }
 
+        void reserve_watch(eventloop_t &eloop)
+        {
+
+        }
+
         void add_reserved(eventloop_t &eloop, pid_t child, int prio = dasynq::DEFAULT_PRIORITY) noexcept
         {
 
@@ -77,6 +82,38 @@ class eventloop_t
 
     };
 
+    class bidi_fd_watcher
+    {
+        int watched_fd = -1;
+
+        public:
+        void set_watches(eventloop_t &eloop, int new_flags) noexcept
+        {
+
+        }
+
+        void add_watch(eventloop_t &eloop, int fd, int flags, int inprio = dasynq::DEFAULT_PRIORITY,
+                int outprio = dasynq::DEFAULT_PRIORITY)
+        {
+            watched_fd = fd;
+        }
+
+        int get_watched_fd() noexcept
+        {
+            return watched_fd;
+        }
+
+        void deregister(eventloop_t &eloop) noexcept
+        {
+
+        }
+    };
+
+    template <typename Derived> class bidi_fd_watcher_impl : public bidi_fd_watcher
+    {
+
+    };
+
     class timer
     {
         public:
@@ -94,6 +131,11 @@ class eventloop_t
         {
 
         }
+
+        void deregister(eventloop_t &loop) noexcept
+        {
+
+        }
     };
 
     template <typename Derived> class timer_impl : public timer
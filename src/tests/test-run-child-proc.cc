@@ -1,9 +1,16 @@
+#include <cerrno>
+
 #include "service.h"
 
 // Stub out run_child_proc function, for testing purposes.
 
-void service_record::run_child_proc(const char * const *args, const char *logfile, bool on_console,
-        int wpipefd, int csfd) noexcept
+void service_record::run_child_proc(run_proc_params &params) noexcept
 {
 
 }
+
+pid_t service_record::vfork_child_proc(run_proc_params &params) noexcept
+{
+    errno = ENOSYS;
+    return -1;
+}
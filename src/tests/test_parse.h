@@ -0,0 +1,268 @@
+#ifndef TEST_PARSE_H_INCLUDED
+#define TEST_PARSE_H_INCLUDED 1
+
+#include <sstream>
+#include <locale>
+#include <vector>
+#include <string>
+#include <list>
+#include <cstdint>
+
+#include "load-service.h"
+
+using string = std::string;
+using string_iterator = std::string::iterator;
+using part_list = std::list<std::pair<unsigned,unsigned>>;
+
+// Reference implementation: the original (std::string / iostream based) service description
+// parser, used to check that the buffer-based tokenizer in load-service.h gives the same results.
+namespace ref {
+
+class setting_exception
+{
+    public:
+    std::string info;
+
+    setting_exception(const std::string &&exc_info) : info(std::move(exc_info))
+    {
+    }
+};
+
+static string_iterator skipws(string_iterator i, string_iterator end)
+{
+    using std::locale;
+    using std::isspace;
+
+    while (i != end) {
+      if (! isspace(*i, locale::classic())) {
+        break;
+      }
+      ++i;
+    }
+    return i;
+}
+
+static string read_setting_name(string_iterator & i, string_iterator end)
+{
+    using std::locale;
+    using std::ctype;
+    using std::use_facet;
+
+    const ctype<char> & facet = use_facet<ctype<char> >(locale::classic());
+
+    string rval;
+    while (i != end && (*i == '-' || facet.is(ctype<char>::alpha, *i))) {
+        rval += *i;
+        ++i;
+    }
+    return rval;
+}
+
+static string read_setting_value(string_iterator & i, string_iterator end,
+        part_list * part_positions = nullptr)
+{
+    using std::locale;
+    using std::isspace;
+
+    i = skipws(i, end);
+
+    string rval;
+    bool new_part = true;
+    int part_start;
+
+    while (i != end) {
+        char c = *i;
+        if (c == '\"') {
+            if (new_part) {
+                part_start = rval.length();
+                new_part = false;
+            }
+            ++i;
+            while (i != end) {
+                c = *i;
+                if (c == '\"') break;
+                if (c == '\n') {
+                    throw setting_exception("Line end inside quoted string");
+                }
+                else if (c == '\\') {
+                    ++i;
+                    if (i != end) {
+                        c = *i;
+                        if (c == '\n') {
+                            throw setting_exception("Line end follows backslash escape character (`\\')");
+                        }
+                        rval += c;
+                    }
+                    else {
+                        // (the original parser stepped past the end here)
+                        break;
+                    }
+                }
+                else {
+                    rval += c;
+                }
+                ++i;
+            }
+            if (i == end) {
+                throw setting_exception("Unterminated quoted string");
+            }
+        }
+        else if (c == '\\') {
+            if (new_part) {
+                part_start = rval.length();
+                new_part = false;
+            }
+            ++i;
+            if (i != end) {
+                rval += *i;
+            }
+            else {
+                throw setting_exception("Backslash escape (`\\') not followed by character");
+            }
+        }
+        else if (isspace(c, locale::classic())) {
+            if (! new_part && part_positions != nullptr) {
+                part_positions->emplace_back(part_start, rval.length());
+                new_part = true;
+            }
+            i = skipws(i, end);
+            if (i == end) break;
+            if (*i == '#') break;
+            rval += ' ';
+            continue;
+        }
+        else if (c == '#') {
+            throw setting_exception("hashmark (`#') comment must be separated from setting value by whitespace");
+        }
+        else {
+            if (new_part) {
+                part_start = rval.length();
+                new_part = false;
+            }
+            rval += c;
+        }
+        ++i;
+    }
+
+    if (! new_part && part_positions != nullptr) {
+        part_positions->emplace_back(part_start, rval.length());
+    }
+
+    return rval;
+}
+
+template <typename T>
+static void process_service_file(const std::string &name, std::istream &service_file, T func)
+{
+    using std::ios;
+
+    string line;
+    service_file.exceptions(ios::badbit);
+
+    while (! (service_file.rdstate() & ios::eofbit)) {
+        getline(service_file, line);
+        string::iterator i = line.begin();
+        string::iterator end = line.end();
+
+        i = skipws(i, end);
+        if (i != end) {
+            if (*i == '#') {
+                continue;
+            }
+            string setting = read_setting_name(i, end);
+            i = skipws(i, end);
+            if (i == end || (*i != '=' && *i != ':')) {
+                throw service_description_exc(name, "Badly formed line.");
+            }
+            i = skipws(++i, end);
+
+            part_list parts;
+            string value = read_setting_value(i, end, &parts);
+            func(setting, value, parts);
+        }
+    }
+}
+
+} // namespace ref
+
+// The result of parsing a description: the settings (name, value, parts) and any error.
+struct parse_result
+{
+    std::vector<std::pair<string, string>> settings;
+    std::vector<part_list> parts;
+    string error;
+
+    bool operator==(const parse_result &other) const
+    {
+        return settings == other.settings && parts == other.parts && error == other.error;
+    }
+};
+
+static parse_result parse_new(const string &text)
+{
+    parse_result r;
+    try {
+        dinit_load::process_service_file("test", text.data(), text.data() + text.length(),
+                [&](const string &setting, string &value, part_list &parts) {
+            r.settings.emplace_back(setting, value);
+            r.parts.push_back(parts);
+        });
+    }
+    catch (dinit_load::setting_exception &exc) {
+        r.error = exc.get_info();
+    }
+    catch (service_description_exc &exc) {
+        r.error = exc.excDescription;
+    }
+    return r;
+}
+
+static parse_result parse_ref(const string &text)
+{
+    parse_result r;
+    std::istringstream ss(text);
+    try {
+        ref::process_service_file("test", ss,
+                [&](const string &setting, string &value, part_list &parts) {
+            r.settings.emplace_back(setting, value);
+            r.parts.push_back(parts);
+        });
+    }
+    catch (ref::setting_exception &exc) {
+        r.error = exc.info;
+    }
+    catch (service_description_exc &exc) {
+        r.error = exc.excDescription;
+    }
+    return r;
+}
+
+// Generates random (mostly malformed) service description text, for comparing the parsers.
+class random_desc_generator
+{
+    uint32_t seed;
+
+    uint32_t next_rand() noexcept
+    {
+        seed = seed * 1103515245u + 12345u;
+        return (seed >> 16) & 0x7fff;
+    }
+
+    public:
+    random_desc_generator(uint32_t seed_p = 12345) noexcept : seed(seed_p)
+    {
+    }
+
+    string next()
+    {
+        static const char alphabet[] = { 'a', 'b', '-', ' ', ' ', '\t', '\r', '\n', '"', '\\', '#', '=', ':', 'x', '\xe9' };
+        string text = (next_rand() % 2) ? "command = " : "";
+        int len = next_rand() % 40;
+        for (int j = 0; j < len; j++) {
+            text += alphabet[next_rand() % sizeof(alphabet)];
+        }
+        return text;
+    }
+};
+
+#endif
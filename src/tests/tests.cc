@@ -1,8 +1,17 @@
 #include <cassert>
 #include <iostream>
+#include <limits>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
 
 #include "service.h"
+#include "ring-buffer.h"
+#include "chunk-buffer.h"
+#include "dinit-util.h"
 #include "test_service.h"
+#include "baseproc-sys.h"
 
 constexpr static auto REG = dependency_type::REGULAR;
 constexpr static auto WAITS = dependency_type::WAITS_FOR;
@@ -14,9 +23,9 @@ void test1()
 {
     service_set sset;
 
-    service_record *s1 = new service_record(&sset, "test-service-1", service_type_t::INTERNAL, {});
-    service_record *s2 = new service_record(&sset, "test-service-2", service_type_t::INTERNAL, {{s1, REG}});
-    service_record *s3 = new service_record(&sset, "test-service-3", service_type_t::INTERNAL, {{s2, REG}});
+    service_record *s1 = new (&sset) service_record(&sset, "test-service-1", service_type_t::INTERNAL, {});
+    service_record *s2 = new (&sset) service_record(&sset, "test-service-2", service_type_t::INTERNAL, {{s1, REG}});
+    service_record *s3 = new (&sset) service_record(&sset, "test-service-3", service_type_t::INTERNAL, {{s2, REG}});
     sset.add_service(s1);
     sset.add_service(s2);
     sset.add_service(s3);
@@ -46,10 +55,10 @@ void test2()
 {
     service_set sset;
 
-    service_record *s1 = new service_record(&sset, "test-service-1", service_type_t::INTERNAL, {});
-    service_record *s2 = new service_record(&sset, "test-service-2", service_type_t::INTERNAL, {{s1, REG}});
-    service_record *s3 = new service_record(&sset, "test-service-3", service_type_t::INTERNAL, {{s2, REG}});
-    service_record *s4 = new service_record(&sset, "test-service-4", service_type_t::INTERNAL, {{s2, REG}});
+    service_record *s1 = new (&sset) service_record(&sset, "test-service-1", service_type_t::INTERNAL, {});
+    service_record *s2 = new (&sset) service_record(&sset, "test-service-2", service_type_t::INTERNAL, {{s1, REG}});
+    service_record *s3 = new (&sset) service_record(&sset, "test-service-3", service_type_t::INTERNAL, {{s2, REG}});
+    service_record *s4 = new (&sset) service_record(&sset, "test-service-4", service_type_t::INTERNAL, {{s2, REG}});
     sset.add_service(s1);
     sset.add_service(s2);
     sset.add_service(s3);
@@ -87,9 +96,9 @@ void test3()
 {
     service_set sset;
 
-    service_record *s1 = new service_record(&sset, "test-service-1", service_type_t::INTERNAL, {});
-    service_record *s2 = new service_record(&sset, "test-service-2", service_type_t::INTERNAL, {{s1, REG}});
-    service_record *s3 = new service_record(&sset, "test-service-3", service_type_t::INTERNAL, {{s2, REG}});
+    service_record *s1 = new (&sset) service_record(&sset, "test-service-1", service_type_t::INTERNAL, {});
+    service_record *s2 = new (&sset) service_record(&sset, "test-service-2", service_type_t::INTERNAL, {{s1, REG}});
+    service_record *s3 = new (&sset) service_record(&sset, "test-service-3", service_type_t::INTERNAL, {{s2, REG}});
     sset.add_service(s1);
     sset.add_service(s2);
     sset.add_service(s3);
@@ -115,9 +124,9 @@ void test4()
 {
     service_set sset;
 
-    service_record *s1 = new service_record(&sset, "test-service-1", service_type_t::INTERNAL, {});
-    service_record *s2 = new service_record(&sset, "test-service-2", service_type_t::INTERNAL, {{s1, REG}});
-    service_record *s3 = new service_record(&sset, "test-service-3", service_type_t::INTERNAL, {{s2, REG}});
+    service_record *s1 = new (&sset) service_record(&sset, "test-service-1", service_type_t::INTERNAL, {});
+    service_record *s2 = new (&sset) service_record(&sset, "test-service-2", service_type_t::INTERNAL, {{s1, REG}});
+    service_record *s3 = new (&sset) service_record(&sset, "test-service-3", service_type_t::INTERNAL, {{s2, REG}});
     s2->set_auto_restart(true);
     sset.add_service(s1);
     sset.add_service(s2);
@@ -148,9 +157,9 @@ void test5()
 {
     service_set sset;
 
-    test_service *s1 = new test_service(&sset, "test-service-1", service_type_t::INTERNAL, {});
-    test_service *s2 = new test_service(&sset, "test-service-2", service_type_t::INTERNAL, {{s1, REG}});
-    test_service *s3 = new test_service(&sset, "test-service-3", service_type_t::INTERNAL, {{s2, REG}});
+    test_service *s1 = new (&sset) test_service(&sset, "test-service-1", service_type_t::INTERNAL, {});
+    test_service *s2 = new (&sset) test_service(&sset, "test-service-2", service_type_t::INTERNAL, {{s1, REG}});
+    test_service *s3 = new (&sset) test_service(&sset, "test-service-3", service_type_t::INTERNAL, {{s2, REG}});
 
     sset.add_service(s1);
     sset.add_service(s2);
@@ -187,9 +196,9 @@ void test6()
 {
     service_set sset;
 
-    service_record *s1 = new service_record(&sset, "test-service-1", service_type_t::INTERNAL, {});
-    service_record *s2 = new service_record(&sset, "test-service-2", service_type_t::INTERNAL, {{s1, REG}});
-    service_record *s3 = new service_record(&sset, "test-service-3", service_type_t::INTERNAL, {{s2, REG}});
+    service_record *s1 = new (&sset) service_record(&sset, "test-service-1", service_type_t::INTERNAL, {});
+    service_record *s2 = new (&sset) service_record(&sset, "test-service-2", service_type_t::INTERNAL, {{s1, REG}});
+    service_record *s3 = new (&sset) service_record(&sset, "test-service-3", service_type_t::INTERNAL, {{s2, REG}});
     s2->set_auto_restart(true);
     sset.add_service(s1);
     sset.add_service(s2);
@@ -229,9 +238,9 @@ void test7()
 {
     service_set sset;
 
-    service_record *s1 = new service_record(&sset, "test-service-1", service_type_t::INTERNAL, {});
-    service_record *s2 = new service_record(&sset, "test-service-2", service_type_t::INTERNAL, {{s1, REG}});
-    service_record *s3 = new service_record(&sset, "test-service-3", service_type_t::INTERNAL, {{s2, WAITS}});
+    service_record *s1 = new (&sset) service_record(&sset, "test-service-1", service_type_t::INTERNAL, {});
+    service_record *s2 = new (&sset) service_record(&sset, "test-service-2", service_type_t::INTERNAL, {{s1, REG}});
+    service_record *s3 = new (&sset) service_record(&sset, "test-service-3", service_type_t::INTERNAL, {{s2, WAITS}});
     sset.add_service(s1);
     sset.add_service(s2);
     sset.add_service(s3);
@@ -256,8 +265,8 @@ void test8()
 {
     service_set sset;
 
-    service_record *s1 = new service_record(&sset, "test-service-1", service_type_t::INTERNAL, {});
-    service_record *s2 = new service_record(&sset, "test-service-2", service_type_t::INTERNAL, {{s1, MS}});
+    service_record *s1 = new (&sset) service_record(&sset, "test-service-1", service_type_t::INTERNAL, {});
+    service_record *s2 = new (&sset) service_record(&sset, "test-service-2", service_type_t::INTERNAL, {{s1, MS}});
     sset.add_service(s1);
     sset.add_service(s2);
 
@@ -282,8 +291,8 @@ void test9()
 {
     service_set sset;
 
-    test_service *s1 = new test_service(&sset, "test-service-1", service_type_t::INTERNAL, {});
-    test_service *s2 = new test_service(&sset, "test-service-2", service_type_t::INTERNAL, {{s1, MS}});
+    test_service *s1 = new (&sset) test_service(&sset, "test-service-1", service_type_t::INTERNAL, {});
+    test_service *s2 = new (&sset) test_service(&sset, "test-service-2", service_type_t::INTERNAL, {{s1, MS}});
     sset.add_service(s1);
     sset.add_service(s2);
 
@@ -300,6 +309,719 @@ void test9()
     assert(s2->get_state() == service_state_t::STOPPED);
 }
 
+// Test 10: services can be found by name after being added, and not after being removed
+void test10()
+{
+    service_set sset;
+
+    std::vector<service_record *> records;
+    for (int i = 0; i < 1000; i++) {
+        service_record *sr = new (&sset) service_record(&sset, "test-service-" + std::to_string(i),
+                service_type_t::INTERNAL, {});
+        sset.add_service(sr);
+        records.push_back(sr);
+    }
+
+    for (int i = 0; i < 1000; i++) {
+        assert(sset.find_service("test-service-" + std::to_string(i)) == records[i]);
+    }
+    assert(sset.find_service("test-service-1000") == nullptr);
+
+    sset.remove_service(records[10]);
+    assert(sset.find_service("test-service-10") == nullptr);
+    assert(sset.find_service("test-service-11") == records[11]);
+    assert(sset.list_services().size() == 999);
+    delete records[10];
+}
+
+// Test 11: large fan-out and fan-in. A hub service with many dependencies, and many
+// dependents; starting all dependents starts the hub and its dependencies, and stopping
+// them releases everything.
+void test11()
+{
+    service_set sset;
+
+    const int fan = 1000;
+    std::list<prelim_dep> hub_deps;
+    std::vector<service_record *> leaves;
+    for (int i = 0; i < fan; i++) {
+        service_record *sr = new (&sset) service_record(&sset, "leaf-" + std::to_string(i),
+                service_type_t::INTERNAL, {});
+        sset.add_service(sr);
+        leaves.push_back(sr);
+        hub_deps.emplace_back(sr, (i % 2) ? REG : WAITS);
+    }
+
+    service_record *hub = new (&sset) service_record(&sset, "hub", service_type_t::INTERNAL, hub_deps);
+    sset.add_service(hub);
+
+    std::vector<service_record *> tops;
+    for (int i = 0; i < fan; i++) {
+        service_record *sr = new (&sset) service_record(&sset, "top-" + std::to_string(i),
+                service_type_t::INTERNAL, {{hub, REG}});
+        sset.add_service(sr);
+        tops.push_back(sr);
+    }
+
+    for (auto top : tops) {
+        sset.start_service(top);
+    }
+
+    assert(hub->get_state() == service_state_t::STARTED);
+    for (auto leaf : leaves) {
+        assert(leaf->get_state() == service_state_t::STARTED);
+    }
+
+    for (auto top : tops) {
+        sset.stop_service(top);
+    }
+
+    assert(hub->get_state() == service_state_t::STOPPED);
+    for (auto leaf : leaves) {
+        assert(leaf->get_state() == service_state_t::STOPPED);
+    }
+}
+
+// Test 12: service state transitions are recorded in the timeline trace.
+void test12()
+{
+    service_set sset;
+
+    service_record *s1 = new (&sset) service_record(&sset, "test-service-1", service_type_t::INTERNAL, {});
+    service_record *s2 = new (&sset) service_record(&sset, "test-service-2", service_type_t::INTERNAL, {{s1, REG}});
+    sset.add_service(s1);
+    sset.add_service(s2);
+
+    sset.start_service(s2);
+    sset.stop_service(s2);
+
+    service_trace &trace = sset.get_trace();
+
+    // Find the first trace entry (after the given position) for a service and event
+    auto find_entry = [&](unsigned from, service_record *svc, trace_event_t event) -> unsigned {
+        for (unsigned i = from; i < trace.size(); i++) {
+            if (trace[i].service == svc && trace[i].event == event) return i;
+        }
+        return trace.size();
+    };
+
+    unsigned s2_starting = find_entry(0, s2, trace_event_t::STARTING);
+    unsigned s1_started = find_entry(0, s1, trace_event_t::STARTED);
+    unsigned s2_depready = find_entry(0, s2, trace_event_t::DEPREADY);
+    unsigned s2_started = find_entry(0, s2, trace_event_t::STARTED);
+    unsigned s2_stopped = find_entry(0, s2, trace_event_t::STOPPED);
+    unsigned s1_stopped = find_entry(0, s1, trace_event_t::STOPPED);
+
+    assert(s2_starting < s1_started);
+    assert(s1_started < s2_depready);
+    assert(trace[s2_depready].dependency == s1);
+    assert(s2_depready < s2_started);
+    assert(s2_started < s2_stopped);
+    assert(s2_stopped < s1_stopped);
+    assert(s1_stopped < trace.size());
+
+    // The trace is a ring buffer; once full, the oldest entries are discarded:
+    for (unsigned i = 0; i < service_trace::capacity; i++) {
+        trace.record(s1, trace_event_t::EXECUTED);
+    }
+    assert(trace.size() == service_trace::capacity);
+    assert(find_entry(0, s2, trace_event_t::STARTING) == trace.size());
+}
+
+// Test 13: the critical dependency of a service is the dependency that started last.
+void test13()
+{
+    service_set sset;
+
+    test_service *s1 = new (&sset) test_service(&sset, "test-service-1", service_type_t::INTERNAL, {});
+    test_service *s2 = new (&sset) test_service(&sset, "test-service-2", service_type_t::INTERNAL, {});
+    test_service *s3 = new (&sset) test_service(&sset, "test-service-3", service_type_t::INTERNAL,
+            {{s1, REG}, {s2, WAITS}});
+    sset.add_service(s1);
+    sset.add_service(s2);
+    sset.add_service(s3);
+
+    sset.start_service(s3);
+    assert(s3->get_state() == service_state_t::STARTING);
+    assert(s3->get_critical_dependency() == nullptr);
+
+    s2->started();
+    sset.process_queues();
+    s1->started();
+    sset.process_queues();
+    s3->started();
+    sset.process_queues();
+
+    assert(s3->get_state() == service_state_t::STARTED);
+    assert(s3->get_critical_dependency() == s1);
+    assert(s1->get_critical_dependency() == nullptr);
+    assert(s3->get_start_begin_time() <= s1->get_start_end_time());
+    assert(s1->get_start_end_time() <= s3->get_start_deps_time());
+    assert(s3->get_start_deps_time() <= s3->get_start_end_time());
+}
+
+// A service which is slow to start: bring_up() adds it to a list of services currently
+// starting, and the test completes the start later.
+class slow_start_service : public test_service
+{
+    public:
+    std::vector<slow_start_service *> &starting;
+
+    slow_start_service(service_set *set, std::string name, std::vector<slow_start_service *> &starting_p)
+            : test_service(set, name, service_type_t::PROCESS, {}), starting(starting_p)
+    {
+    }
+
+    virtual bool bring_up() noexcept override
+    {
+        starting.push_back(this);
+        return true;
+    }
+};
+
+// Test 14: the number of concurrently starting services is limited by the start slots;
+// waiting services are started as slots are freed, by either success or failure.
+void test14()
+{
+    service_set sset;
+    const int max_starts = 4;
+    sset.set_max_concurrent_starts(max_starts);
+
+    const int count = 1000;
+    std::vector<slow_start_service *> starting;
+    std::list<prelim_dep> top_deps;
+    std::vector<slow_start_service *> services;
+    for (int i = 0; i < count; i++) {
+        slow_start_service *sr = new (&sset) slow_start_service(&sset, "slow-" + std::to_string(i), starting);
+        sset.add_service(sr);
+        services.push_back(sr);
+        top_deps.emplace_back(sr, WAITS);
+    }
+
+    service_record *top = new (&sset) service_record(&sset, "top", service_type_t::INTERNAL, top_deps);
+    sset.add_service(top);
+
+    sset.start_service(top);
+    assert(top->get_state() == service_state_t::STARTING);
+    assert(starting.size() == (size_t)max_starts);
+    assert(sset.count_active_starts() == max_starts);
+
+    // Complete starts, oldest first; every third one fails:
+    int completed = 0;
+    size_t next = 0;
+    while (next < starting.size()) {
+        slow_start_service *sr = starting[next++];
+        assert(sr->get_state() == service_state_t::STARTING);
+        if (completed % 3 == 0) {
+            sr->failed_to_start();
+        }
+        else {
+            sr->started();
+        }
+        sset.process_queues();
+        completed++;
+        assert(starting.size() - next <= (size_t)max_starts);
+        assert(sset.count_active_starts() == (int)(starting.size() - next));
+    }
+
+    assert(completed == count);
+    assert(sset.count_active_starts() == 0);
+    assert(top->get_state() == service_state_t::STARTED);
+    for (int i = 0; i < count; i++) {
+        assert(services[i]->get_state() == (i % 3 == 0 ? service_state_t::STOPPED : service_state_t::STARTED));
+    }
+
+    // Services which are stopped while waiting for a slot leave the queue:
+    sset.stop_service(top);
+    starting.clear();
+    sset.start_service(top);
+    assert(starting.size() == (size_t)max_starts);
+    sset.stop_service(top);
+    for (auto sr : starting) {
+        sr->started();
+    }
+    sset.process_queues();
+    assert(sset.count_active_starts() == 0);
+    assert(starting.size() == (size_t)max_starts);
+    assert(top->get_state() == service_state_t::STOPPED);
+}
+
+// Test 15: services waiting for a start slot are started in order of start priority, and
+// then of the length of their path (via dependents) to the top-level service.
+void test15()
+{
+    service_set sset;
+    sset.set_max_concurrent_starts(1);
+
+    std::vector<slow_start_service *> starting;
+    auto slow_a = new (&sset) slow_start_service(&sset, "slow-a", starting);
+    auto slow_b = new (&sset) slow_start_service(&sset, "slow-b", starting);
+    auto slow_c = new (&sset) slow_start_service(&sset, "slow-c", starting);
+    auto slow_d = new (&sset) slow_start_service(&sset, "slow-d", starting);
+    auto slow_e = new (&sset) slow_start_service(&sset, "slow-e", starting);
+    slow_c->set_start_priority(5);
+    for (auto sr : { slow_a, slow_b, slow_c, slow_d, slow_e }) {
+        sset.add_service(sr);
+    }
+
+    service_record *mid1 = new (&sset) service_record(&sset, "mid-1", service_type_t::INTERNAL, {{slow_b, REG}});
+    sset.add_service(mid1);
+    service_record *mid2 = new (&sset) service_record(&sset, "mid-2", service_type_t::INTERNAL,
+            {{mid1, REG}, {slow_d, REG}});
+    sset.add_service(mid2);
+    service_record *top = new (&sset) service_record(&sset, "top", service_type_t::INTERNAL,
+            {{slow_e, WAITS}, {slow_a, WAITS}, {slow_c, WAITS}, {mid2, REG}});
+    sset.add_service(top);
+
+    assert(slow_a->get_start_path_len() == 1);
+    assert(slow_b->get_start_path_len() == 3);
+    assert(slow_c->get_start_path_len() == 1);
+    assert(slow_d->get_start_path_len() == 2);
+    assert(top->get_start_path_len() == 0);
+
+    sset.start_service(top);
+    assert(starting.size() == 1);
+
+    size_t next = 0;
+    while (next < starting.size()) {
+        starting[next++]->started();
+        sset.process_queues();
+    }
+    assert(top->get_state() == service_state_t::STARTED);
+    assert(starting.size() == 5);
+
+    // The first service to start takes the slot immediately; the others are queued and
+    // then started in priority order:
+    std::vector<slow_start_service *> expected_order { slow_c, slow_b, slow_d, slow_e, slow_a };
+    expected_order.erase(std::find(expected_order.begin(), expected_order.end(), starting[0]));
+    assert(std::equal(expected_order.begin(), expected_order.end(), starting.begin() + 1));
+}
+
+// Test 16: the log ring buffer keeps the most recent output, including across a resize.
+void test16()
+{
+    int pipefds[2];
+    assert(pipe(pipefds) == 0);
+
+    auto contents = [](ring_buffer &rb) {
+        std::string r(rb.get_length(), '\0');
+        rb.extract(&r[0], 0, rb.get_length());
+        return r;
+    };
+
+    ring_buffer rb;
+    rb.resize(8);
+    assert(write(pipefds[1], "abcde", 5) == 5);
+    assert(rb.fill_overwrite(pipefds[0]) == 5);
+    assert(contents(rb) == "abcde");
+
+    // Wraps around; the oldest output is discarded:
+    assert(write(pipefds[1], "fghijk", 6) == 6);
+    assert(rb.fill_overwrite(pipefds[0]) == 3);  // (up to the end of storage)
+    assert(rb.fill_overwrite(pipefds[0]) == 3);
+    assert(rb.get_length() == 8);
+    assert(contents(rb) == "defghijk");
+
+    rb.resize(4);
+    assert(contents(rb) == "hijk");
+    rb.resize(16);
+    assert(contents(rb) == "hijk");
+    assert(rb.get_contiguous_length(0) == 4);
+
+    rb.clear();
+    assert(rb.get_length() == 0);
+
+    close(pipefds[0]);
+    close(pipefds[1]);
+}
+
+#ifdef __linux__
+// Test 17: a child process closes all descriptors other than those it is to keep, both via
+// close_range() and via the /proc/self/fd scan used when close_range() is unavailable.
+void test17()
+{
+    for (bool use_scan : { false, true }) {
+        pid_t child = fork();
+        assert(child != -1);
+        if (child == 0) {
+            int fds[20];
+            for (int &fd : fds) {
+                fd = open("/dev/null", O_RDONLY);
+                if (fd == -1) _exit(1);
+            }
+            int keep[] = { fds[12], 0, 1, 2, fds[3] };
+            if (use_scan) {
+                std::sort(std::begin(keep), std::end(keep));
+                close_fds_by_scan(keep, 5);
+            }
+            else {
+                close_fds_except(keep, 5);
+            }
+            for (int i = 0; i < 20; i++) {
+                bool is_open = fcntl(fds[i], F_GETFD) != -1;
+                if (is_open != (i == 3 || i == 12)) _exit(2);
+            }
+            _exit(0);
+        }
+        int status;
+        assert(waitpid(child, &status, 0) == child);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+}
+#endif
+
+// Test 18: exits of reaped processes with no watcher are dispatched to a service watching the
+// pid, or else attributed to the service in whose session the process ran.
+class orphan_test_service : public test_service
+{
+    public:
+    pid_t exited_pid = -1;
+    int exited_status = -1;
+
+    orphan_test_service(service_set *set, std::string name)
+            : test_service(set, name, service_type_t::INTERNAL, {})
+    {
+    }
+
+    void set_pid(pid_t new_pid) noexcept
+    {
+        pid = new_pid;
+    }
+
+    virtual void orphan_pid_exited(pid_t exited_pid_p, int status) noexcept override
+    {
+        exited_pid = exited_pid_p;
+        exited_status = status;
+    }
+};
+
+void test18()
+{
+    service_set sset;
+
+    orphan_test_service *s1 = new (&sset) orphan_test_service(&sset, "test-service-1");
+    orphan_test_service *s2 = new (&sset) orphan_test_service(&sset, "test-service-2");
+    sset.add_service(s1);
+    sset.add_service(s2);
+
+    struct timespec before;
+    clock_gettime(CLOCK_MONOTONIC, &before);
+
+    // A (non-existent) process watched by s1:
+    pid_t other_pid = std::numeric_limits<pid_t>::max() - 1;
+    sset.watch_orphan_pid(other_pid, s1);
+    sset.child_reaped(other_pid, 3 << 8);
+    assert(s1->exited_pid == -1);
+    sset.dispatch_reaped_exits();
+    assert(s1->exited_pid == other_pid);
+    assert(s1->exited_status == (3 << 8));
+
+    const reaped_exit *rexit = sset.find_reaped_exit(other_pid, before);
+    assert(rexit != nullptr && rexit->status == (3 << 8));
+    struct timespec later = before;
+    later.tv_sec += 1000;
+    assert(sset.find_reaped_exit(other_pid, later) == nullptr);
+
+    // Our own process stands in for an orphan in the session of s2's (running) process:
+    s2->set_pid(getsid(0));
+    sset.set_service_session(s2, getsid(0));
+    sset.child_reaped(getpid(), 0);
+    sset.dispatch_reaped_exits();
+    assert(s2->get_orphan_count() == 1);
+    assert(s1->get_orphan_count() == 0);
+    s2->set_pid(-1);
+    sset.clear_service_session(s2);
+}
+
+// Test 24: orphans are attributed to a service when they are not in the session of the current
+// service process
+void test24()
+{
+    service_set sset;
+
+    orphan_test_service *s1 = new (&sset) orphan_test_service(&sset, "test-service-1");
+    orphan_test_service *s2 = new (&sset) orphan_test_service(&sset, "test-service-2");
+    sset.add_service(s1);
+    sset.add_service(s2);
+
+    // The service process (which started the session) has terminated:
+    sset.set_service_session(s2, getsid(0));
+    sset.child_reaped(getpid(), 0);
+    sset.dispatch_reaped_exits();
+    assert(s2->get_orphan_count() == 1);
+
+    // The service process has been re-launched (in a new session); orphans remaining from the
+    // previous session are no longer attributed:
+    pid_t new_sid = std::numeric_limits<pid_t>::max() - 2;
+    sset.set_service_session(s2, new_sid);
+    sset.child_reaped(getpid(), 0);
+    sset.dispatch_reaped_exits();
+    assert(s2->get_orphan_count() == 1);
+
+#ifdef __linux__
+    // With service cgroups, an orphan which left the session (via setsid()) is attributed to the
+    // service in whose cgroup it ran:
+    bp_sys::mock_cgroup &cgroup = bp_sys::get_mock_cgroup();
+    std::string proc_path = "/proc/" + std::to_string(getpid()) + "/cgroup";
+    cgroup.proc_files[proc_path] = "0::/dinit/test-service-1\n";
+    sset.set_service_session(s1, new_sid - 1);
+    sset.set_cgroup_root("/sys/fs/cgroup/dinit");
+    sset.child_reaped(getpid(), 0);
+    sset.dispatch_reaped_exits();
+    assert(s1->get_orphan_count() == 1);
+    assert(s2->get_orphan_count() == 1);
+
+    // (Hybrid cgroup hierarchy; not in a service cgroup):
+    cgroup.proc_files[proc_path] = "1:cpu:/\n0::/dinit\n";
+    sset.child_reaped(getpid(), 0);
+    sset.dispatch_reaped_exits();
+    assert(s1->get_orphan_count() == 1);
+
+    cgroup.proc_files[proc_path] = "1:cpu:/\n0::/dinit/test-service-2\n";
+    sset.child_reaped(getpid(), 0);
+    sset.dispatch_reaped_exits();
+    assert(s2->get_orphan_count() == 2);
+    cgroup.proc_files.erase(proc_path);
+#endif
+
+    sset.clear_service_session(s1);
+    sset.clear_service_session(s2);
+}
+
+// Records events delivered to service handles
+class test_handle_listener : public service_handle_listener
+{
+    public:
+    std::vector<std::pair<uint32_t, service_event_t>> events;
+
+    void service_event(service_handle &handle, service_event_t event) noexcept override
+    {
+        events.emplace_back(handle.id, event);
+    }
+};
+
+// Test 19: events for a service are delivered to each handle referring to it, until the handle
+// is removed.
+void test19()
+{
+    service_set sset;
+
+    service_record *s1 = new (&sset) service_record(&sset, "test-service-1", service_type_t::INTERNAL, {});
+    service_record *s2 = new (&sset) service_record(&sset, "test-service-2", service_type_t::INTERNAL, {{s1, REG}});
+    sset.add_service(s1);
+    sset.add_service(s2);
+
+    test_handle_listener listener;
+    service_handle handles[3];
+    for (uint32_t i = 0; i < 3; i++) {
+        handles[i].listener = &listener;
+        handles[i].id = i;
+    }
+    handles[0].service = s1;
+    handles[1].service = s2;
+    handles[2].service = s1;
+    s1->add_handle(&handles[0]);
+    s2->add_handle(&handles[1]);
+    s1->add_handle(&handles[2]);
+
+    sset.start_service(s2);
+    assert(s2->get_state() == service_state_t::STARTED);
+
+    using ev_t = std::pair<uint32_t, service_event_t>;
+    assert(listener.events.size() == 3);
+    assert(listener.events[0] == ev_t(0, service_event_t::STARTED));
+    assert(listener.events[1] == ev_t(2, service_event_t::STARTED));
+    assert(listener.events[2] == ev_t(1, service_event_t::STARTED));
+
+    listener.events.clear();
+    s1->remove_handle(&handles[0]);
+    sset.stop_service(s2);
+    assert(s1->get_state() == service_state_t::STOPPED);
+    assert(listener.events.size() == 2);
+    assert(listener.events[0] == ev_t(1, service_event_t::STOPPED));
+    assert(listener.events[1] == ev_t(2, service_event_t::STOPPED));
+
+    s1->remove_handle(&handles[2]);
+    s2->remove_handle(&handles[1]);
+}
+
+// Test 20: chunk_buffer contents spanning several chunks are written out in order, and the
+// buffer can be re-filled after being emptied.
+void test20()
+{
+    int pipefds[2];
+    assert(pipe(pipefds) == 0);
+    fcntl(pipefds[1], F_SETFL, O_NONBLOCK);
+
+    chunk_buffer cbuf;
+    assert(cbuf.empty());
+
+    std::vector<char> expected;
+    char pkt[250];
+    for (int i = 0; i < 100; i++) {
+        for (unsigned j = 0; j < sizeof(pkt); j++) {
+            pkt[j] = (char)(i + j);
+        }
+        cbuf.append(pkt, sizeof(pkt));
+        expected.insert(expected.end(), pkt, pkt + sizeof(pkt));
+    }
+    assert(cbuf.get_length() == expected.size());
+
+    cbuf.consume(10);
+    expected.erase(expected.begin(), expected.begin() + 10);
+
+    std::vector<char> received;
+    while (! cbuf.empty()) {
+        ssize_t r = cbuf.write_to(pipefds[1]);
+        assert(r != -1 || errno == EAGAIN);
+        char rdbuf[4096];
+        ssize_t rr;
+        while ((rr = read(pipefds[0], rdbuf, sizeof(rdbuf))) > 0) {
+            received.insert(received.end(), rdbuf, rdbuf + rr);
+            if (received.size() == expected.size() - cbuf.get_length()) break;
+        }
+    }
+    assert(received == expected);
+
+    cbuf.append("abc", 3);
+    assert(cbuf.write_to(pipefds[1]) == 3);
+    char rdbuf[3];
+    assert(read(pipefds[0], rdbuf, 3) == 3);
+    assert(std::memcmp(rdbuf, "abc", 3) == 0);
+
+    close(pipefds[0]);
+    close(pipefds[1]);
+
+    // Statistics (across all chunk buffers):
+    chunk_buffer_stats before = chunk_buffer::get_stats();
+    {
+        chunk_buffer sbuf;
+        std::vector<char> data(chunk_buffer::chunk_data_size * 6 + 1);
+        sbuf.append(data.data(), data.size());
+        const chunk_buffer_stats &stats = chunk_buffer::get_stats();
+        assert(stats.allocated == before.allocated + 7);
+        assert(stats.new_chunks == before.new_chunks + 7);
+
+        sbuf.consume(data.size());
+        assert(stats.allocated == before.allocated + 4);  // (4 kept free)
+        assert(stats.free == before.free + 4);
+
+        sbuf.append("abc", 3);
+        assert(stats.reused == before.reused + 1);
+        assert(stats.free == before.free + 3);
+        assert(stats.new_chunks == before.new_chunks + 7);
+    }
+    assert(chunk_buffer::get_stats().allocated == before.allocated);
+    assert(chunk_buffer::get_stats().free == before.free);
+}
+
+// Records events for all services
+class test_event_listener : public service_listener
+{
+    public:
+    std::vector<std::pair<service_record *, service_event_t>> events;
+
+    void service_event(service_record *service, service_event_t event) noexcept override
+    {
+        events.emplace_back(service, event);
+    }
+};
+
+// Test 21: a listener for all services receives events for each service, until removed.
+void test21()
+{
+    service_set sset;
+
+    service_record *s1 = new (&sset) service_record(&sset, "test-service-1", service_type_t::INTERNAL, {});
+    service_record *s2 = new (&sset) service_record(&sset, "test-service-2", service_type_t::INTERNAL, {{s1, REG}});
+    sset.add_service(s1);
+    sset.add_service(s2);
+
+    test_event_listener listener;
+    sset.add_event_listener(&listener);
+
+    sset.start_service(s2);
+
+    using ev_t = std::pair<service_record *, service_event_t>;
+    assert(listener.events.size() == 2);
+    assert(listener.events[0] == ev_t(s1, service_event_t::STARTED));
+    assert(listener.events[1] == ev_t(s2, service_event_t::STARTED));
+
+    sset.remove_event_listener(&listener);
+    sset.stop_service(s2);
+    assert(s1->get_state() == service_state_t::STOPPED);
+    assert(listener.events.size() == 2);
+}
+
+// Console queue position is reported for services waiting to start on the console
+void test22()
+{
+    service_set sset;
+
+    onstart_flags_t flags;
+    flags.starts_on_console = true;
+
+    service_record *s1 = new (&sset) service_record(&sset, "test-service-1", service_type_t::INTERNAL, {});
+    service_record *s2 = new (&sset) service_record(&sset, "test-service-2", service_type_t::INTERNAL, {});
+    service_record *s3 = new (&sset) service_record(&sset, "test-service-3", service_type_t::INTERNAL, {});
+    s1->set_flags(flags);
+    s2->set_flags(flags);
+    s3->set_flags(flags);
+    sset.add_service(s1);
+    sset.add_service(s2);
+    sset.add_service(s3);
+
+    sset.start_service(s1);
+    sset.start_service(s2);
+    sset.start_service(s3);
+
+    assert(s1->get_state() == service_state_t::STARTING);
+    assert(sset.get_console_queue_position(s1) == 1);
+    assert(sset.get_console_queue_position(s2) == 2);
+    assert(sset.get_console_queue_position(s3) == 3);
+
+    sset.unqueue_console(s2);
+    assert(sset.get_console_queue_position(s2) == 0);
+    assert(sset.get_console_queue_position(s1) == 1);
+    assert(sset.get_console_queue_position(s3) == 2);
+
+    sset.unqueue_console(s1);
+    sset.unqueue_console(s3);
+    assert(sset.get_console_queue_position(s3) == 0);
+}
+
+// Service records and their dependency lists are allocated from the service set's arena, and
+// storage is re-used after records are deleted
+void test23()
+{
+    service_set sset;
+    const service_arena_stats &stats = sset.get_arena().get_stats();
+    assert(stats.in_use == 0);
+
+    service_record *s1 = new (&sset) service_record(&sset, "test-service-1", service_type_t::INTERNAL, {});
+    assert(stats.slabs == 1);
+    assert(stats.in_use == 1);
+    service_record *s2 = new (&sset) service_record(&sset, "test-service-2", service_type_t::INTERNAL,
+            {{s1, REG}});
+    // s2 record, its dependency list, and s1's dependents list:
+    assert(stats.in_use == 4);
+    sset.add_service(s1);
+    sset.add_service(s2);
+
+    sset.remove_service(s2);
+    s2->unlink_dependencies();
+    delete s2;
+    // (s1's dependents list keeps its storage)
+    assert(stats.in_use == 2);
+    assert(stats.free == 2);
+
+    service_record *s3 = new (&sset) service_record(&sset, "test-service-3", service_type_t::INTERNAL, {});
+    assert(stats.in_use == 3);
+    assert(stats.free == 1);
+    assert(stats.slabs == 1);
+    sset.add_service(s3);
+}
+
 #define RUN_TEST(name) \
     std::cout << #name "... "; \
     name(); \
@@ -316,4 +1038,21 @@ int main(int argc, char **argv)
     RUN_TEST(test7);
     RUN_TEST(test8);
     RUN_TEST(test9);
+    RUN_TEST(test10);
+    RUN_TEST(test11);
+    RUN_TEST(test12);
+    RUN_TEST(test13);
+    RUN_TEST(test14);
+    RUN_TEST(test15);
+    RUN_TEST(test16);
+    RUN_TEST(test18);
+    RUN_TEST(test19);
+    RUN_TEST(test20);
+    RUN_TEST(test21);
+    RUN_TEST(test22);
+    RUN_TEST(test23);
+    RUN_TEST(test24);
+#ifdef __linux__
+    RUN_TEST(test17);
+#endif
 }